@@ -0,0 +1,170 @@
+// keycast_capturebench: screen capture throughput per backend.
+//
+// Grabs the screen back to back with each ScreenCapture backend and reports
+// frames/s, wall time per frame and CPU time per frame, as JSON. CPU is this
+// process's user plus system time; the X server's share of the copy is not
+// included. Meant to run on a fixed-size virtual display:
+//
+//   xvfb-run -s "-screen 0 1920x1080x24" keycast_capturebench [--min-time <ms>] [--output <file>] [--text]
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScreen>
+#include <QSysInfo>
+#include <QTextStream>
+
+#include <sys/resource.h>
+
+#include "screencapture.h"
+
+namespace {
+
+struct Result {
+    QString backend;
+    bool available = false;
+    qint64 frames = 0;
+    double framesPerSecond = 0;
+    double wallUsPerFrame = 0;
+    double cpuUsPerFrame = 0;
+};
+
+qint64 cpuTimeUs()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<qint64>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+Result run(const QString& name, ScreenCapture::Backend backend, int minTimeMs)
+{
+    Result result;
+    result.backend = name;
+
+    ScreenCapture capture;
+    capture.setBackend(backend);
+
+    // Frames are dropped right away, as if the encoder kept up
+    qint64 frames = 0;
+    QObject::connect(&capture, &ScreenCapture::frameCaptured, [&frames](const QImage&) { ++frames; });
+
+    // Warm up; also tells whether the backend works here at all
+    for (int i = 0; i < 5; ++i) {
+        capture.captureFrame();
+    }
+    if (frames == 0 || (backend != ScreenCapture::Backend::Auto && capture.activeBackend() != backend)) {
+        return result;
+    }
+
+    frames = 0;
+    qint64 cpuStart = cpuTimeUs();
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < minTimeMs) {
+        capture.captureFrame();
+    }
+    qint64 elapsedUs = timer.nsecsElapsed() / 1000;
+    qint64 cpuUs = cpuTimeUs() - cpuStart;
+
+    result.available = frames > 0;
+    result.frames = frames;
+    if (frames > 0) {
+        result.framesPerSecond = frames * 1000000.0 / elapsedUs;
+        result.wallUsPerFrame = double(elapsedUs) / frames;
+        result.cpuUsPerFrame = double(cpuUs) / frames;
+    }
+    return result;
+}
+
+QJsonDocument toJson(const QVector<Result>& results)
+{
+    QJsonArray entries;
+    for (const Result& result : results) {
+        QJsonObject entry;
+        entry["backend"] = result.backend;
+        entry["available"] = result.available;
+        entry["frames"] = result.frames;
+        entry["framesPerSecond"] = result.available ? QJsonValue(result.framesPerSecond) : QJsonValue();
+        entry["wallUsPerFrame"] = result.available ? QJsonValue(result.wallUsPerFrame) : QJsonValue();
+        entry["cpuUsPerFrame"] = result.available ? QJsonValue(result.cpuUsPerFrame) : QJsonValue();
+        entries.append(entry);
+    }
+
+    QScreen* screen = QGuiApplication::primaryScreen();
+    QJsonObject root;
+    root["suite"] = "keycast_capture";
+    root["platform"] = QGuiApplication::platformName();
+    root["screen"] = screen ? QString("%1x%2").arg(screen->size().width()).arg(screen->size().height()) : QString();
+    root["qtVersion"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = entries;
+    return QJsonDocument(root);
+}
+
+void printText(const QVector<Result>& results)
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4\n")
+               .arg("backend", -12)
+               .arg("frames/s", 10)
+               .arg("wall us/frame", 14)
+               .arg("cpu us/frame", 14);
+    for (const Result& result : results) {
+        if (!result.available) {
+            out << QString("%1 %2\n").arg(result.backend, -12).arg("unavailable", 10);
+            continue;
+        }
+        out << QString("%1 %2 %3 %4\n")
+                   .arg(result.backend, -12)
+                   .arg(result.framesPerSecond, 10, 'f', 1)
+                   .arg(result.wallUsPerFrame, 14, 'f', 0)
+                   .arg(result.cpuUsPerFrame, 14, 'f', 0);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("keycast_capturebench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KeyCast screen capture benchmarks");
+    parser.addHelpOption();
+    QCommandLineOption minTimeOption("min-time", "Measured time per backend in ms.", "ms", "3000");
+    QCommandLineOption outputOption("output", "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption textOption("text", "Print a table instead of JSON.");
+    parser.addOptions({ minTimeOption, outputOption, textOption });
+    parser.process(app);
+
+    int minTimeMs = qMax(1, parser.value(minTimeOption).toInt());
+    QVector<Result> results;
+    results.append(run("qt", ScreenCapture::Backend::QtGrab, minTimeMs));
+    results.append(run("xshm", ScreenCapture::Backend::XShm, minTimeMs));
+
+    if (parser.isSet(textOption)) {
+        printText(results);
+        return 0;
+    }
+
+    QByteArray json = toJson(results).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+// keycast_deltabench: full JPEG frames against tile deltas.
+//
+// Replays synthetic desktop workloads and encodes every frame both ways,
+// the way FrameEncoder does for clients: "full" is one ScreenFrame per
+// frame, "tiles" is a ScreenRegionUpdate against the frame before (or a
+// ScreenFrame when most of it changed). Reports wire bytes and encode time
+// per frame, tile comparison included, as JSON:
+//
+//   keycast_deltabench [--frames <n>] [--quality <q>] [--output <file>] [--text]
+//
+// Workloads, on a 1920x1080 desktop:
+//   idle      nothing changes but a blinking caret
+//   typing    one character per frame in an editor pane
+//   scrolling an 800x600 document pane scrolls by one line per frame
+
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFont>
+#include <QFontMetrics>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QSysInfo>
+#include <QTextStream>
+
+#include <functional>
+
+#include "frameencoder.h"
+#include "protocol.h"
+
+namespace {
+
+const QSize SCREEN_SIZE(1920, 1080);
+
+struct Result {
+    QString workload;
+    QString mode;
+    int frames = 0;
+    int keyframes = 0; // ScreenFrame packets among them
+    double bytesPerFrame = 0;
+    double encodeUsPerFrame = 0;
+};
+
+// Draws frame n of a workload into image
+using Workload = std::function<void(QImage& image, int n)>;
+
+QString textLine(int n)
+{
+    static const char* const words[] = { "frame", "encoder", "tile", "delta", "server", "client", "packet",
+                                         "region", "capture", "window", "screen", "queue" };
+    QString line = QString("%1  ").arg(n, 4);
+    for (int i = 0; i < 8; ++i) {
+        line += words[(n * 7 + i * 3) % 12];
+        line += ' ';
+    }
+    return line;
+}
+
+void drawDesktop(QPainter& painter)
+{
+    // Panel, window chrome and some flat areas, as JPEG sees a desktop
+    painter.fillRect(QRect(QPoint(0, 0), SCREEN_SIZE), QColor(58, 110, 165));
+    painter.fillRect(0, 0, SCREEN_SIZE.width(), 32, QColor(40, 40, 40));
+    painter.fillRect(200, 120, 1000, 760, QColor(245, 245, 245));
+    painter.fillRect(200, 120, 1000, 28, QColor(210, 210, 210));
+    painter.fillRect(1260, 200, 560, 640, QColor(255, 255, 255));
+    painter.setPen(Qt::black);
+    for (int i = 0; i < 30; ++i) {
+        painter.drawText(1280, 230 + i * 20, textLine(i + 1000));
+    }
+}
+
+QFont editorFont()
+{
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    font.setPixelSize(14);
+    return font;
+}
+
+Workload idleWorkload()
+{
+    return [](QImage& image, int n) {
+        QPainter painter(&image);
+        drawDesktop(painter);
+        if ((n / 15) % 2 == 0) {
+            painter.fillRect(230, 170, 2, 16, Qt::black);
+        }
+    };
+}
+
+Workload typingWorkload()
+{
+    return [](QImage& image, int n) {
+        QPainter painter(&image);
+        drawDesktop(painter);
+        painter.setFont(editorFont());
+        painter.setPen(Qt::black);
+
+        // n characters typed so far, 100 to a line
+        const QString text = QString(textLine(0).repeated(1 + n / 40)).left(n);
+        QFontMetrics metrics(painter.font());
+        int lines = (text.size() + 99) / 100;
+        for (int i = 0; i < lines; ++i) {
+            painter.drawText(220, 180 + i * 18, text.mid(i * 100, 100));
+        }
+        int caretX = 220 + metrics.horizontalAdvance(text.mid((text.size() / 100) * 100));
+        painter.fillRect(caretX, 168 + (text.size() / 100) * 18, 2, 16, Qt::black);
+    };
+}
+
+Workload scrollingWorkload()
+{
+    return [](QImage& image, int n) {
+        QPainter painter(&image);
+        drawDesktop(painter);
+        painter.setFont(editorFont());
+        painter.setPen(Qt::black);
+
+        const QRect pane(300, 200, 800, 600);
+        painter.fillRect(pane, Qt::white);
+        painter.setClipRect(pane);
+        for (int i = 0; i < pane.height() / 18 + 1; ++i) {
+            painter.drawText(pane.left() + 10, pane.top() + 14 + i * 18, textLine(n + i));
+        }
+    };
+}
+
+Result run(const QString& workload, const Workload& draw, bool tiles, int frames, int quality)
+{
+    Result result;
+    result.workload = workload;
+    result.mode = tiles ? "tiles" : "full";
+    result.frames = frames;
+
+    QImage previous;
+    qint64 bytes = 0;
+    qint64 encodeNs = 0;
+    QElapsedTimer timer;
+
+    for (int n = 0; n < frames; ++n) {
+        QImage image(SCREEN_SIZE, QImage::Format_RGB32);
+        draw(image, n);
+
+        timer.start();
+        QByteArray packet = tiles ? FrameEncoder::encodeDelta(image, previous, QVector<QRect>(), n + 1, n, quality)
+                                  : FrameEncoder::encodeFrame(image, n + 1, quality);
+        encodeNs += timer.nsecsElapsed();
+
+        Protocol::PacketHeader header;
+        if (Protocol::parsePacketHeader(packet, header) && header.type == Protocol::MessageType::ScreenFrame) {
+            result.keyframes++;
+        }
+        bytes += packet.size();
+        previous = image;
+    }
+
+    result.bytesPerFrame = double(bytes) / frames;
+    result.encodeUsPerFrame = encodeNs / 1000.0 / frames;
+    return result;
+}
+
+QJsonDocument toJson(const QVector<Result>& results, int quality)
+{
+    QJsonArray entries;
+    for (const Result& result : results) {
+        QJsonObject entry;
+        entry["workload"] = result.workload;
+        entry["mode"] = result.mode;
+        entry["frames"] = result.frames;
+        entry["keyframes"] = result.keyframes;
+        entry["bytesPerFrame"] = result.bytesPerFrame;
+        entry["encodeUsPerFrame"] = result.encodeUsPerFrame;
+        entries.append(entry);
+    }
+
+    QJsonObject root;
+    root["suite"] = "keycast_frames";
+    root["screen"] = QString("%1x%2").arg(SCREEN_SIZE.width()).arg(SCREEN_SIZE.height());
+    root["quality"] = quality;
+    root["qtVersion"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = entries;
+    return QJsonDocument(root);
+}
+
+void printText(const QVector<Result>& results)
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5\n")
+               .arg("workload", -10)
+               .arg("mode", -6)
+               .arg("keyframes", 10)
+               .arg("bytes/frame", 12)
+               .arg("encode us/frame", 16);
+    for (const Result& result : results) {
+        out << QString("%1 %2 %3 %4 %5\n")
+                   .arg(result.workload, -10)
+                   .arg(result.mode, -6)
+                   .arg(result.keyframes, 10)
+                   .arg(result.bytesPerFrame, 12, 'f', 0)
+                   .arg(result.encodeUsPerFrame, 16, 'f', 0);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    // Fonts without a display
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("keycast_deltabench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KeyCast full frame and tile delta benchmarks");
+    parser.addHelpOption();
+    QCommandLineOption framesOption("frames", "Frames per workload.", "n", "120");
+    QCommandLineOption qualityOption("quality", "JPEG quality.", "q", "70");
+    QCommandLineOption outputOption("output", "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption textOption("text", "Print a table instead of JSON.");
+    parser.addOptions({ framesOption, qualityOption, outputOption, textOption });
+    parser.process(app);
+
+    int frames = qMax(2, parser.value(framesOption).toInt());
+    int quality = qBound(10, parser.value(qualityOption).toInt(), 100);
+
+    const QVector<QPair<QString, Workload>> workloads = {
+        { "idle", idleWorkload() },
+        { "typing", typingWorkload() },
+        { "scrolling", scrollingWorkload() },
+    };
+    QVector<Result> results;
+    for (const auto& workload : workloads) {
+        results.append(run(workload.first, workload.second, false, frames, quality));
+        results.append(run(workload.first, workload.second, true, frames, quality));
+    }
+
+    if (parser.isSet(textOption)) {
+        printText(results);
+        return 0;
+    }
+
+    QByteArray json = toJson(results, quality).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
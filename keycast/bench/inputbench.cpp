@@ -0,0 +1,344 @@
+// keycast_inputbench: input latency over TCP against the datagram channel.
+//
+// Sends a steady stream of mouse moves over loopback, once through a TCP
+// connection as InputBatch packets and once through a DTLS session of the
+// datagram input channel, at each of a few loss ratios. Reports p50, p99
+// and max send-to-delivery latency and the share of events delivered, as
+// JSON:
+//
+//   keycast_inputbench [--events <n>] [--interval <ms>] [--loss <r,r,...>]
+//                      [--rto <ms>] [--output <file>] [--text]
+//
+// Datagrams are dropped by InputDatagramServer::setSimulatedLoss(). TCP
+// segments can't be dropped from user space, so TCP loss is modelled on
+// the receiving side: a lost segment arrives one retransmission timeout
+// (--rto, Linux's minimum by default) late, and every event behind it
+// waits for it. For kernel numbers on both, run with --loss 0 under
+// "tc qdisc add dev lo root netem loss <n>%".
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QSysInfo>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+
+#include "datagraminput.h"
+#include "protocol.h"
+#include "receivebuffer.h"
+
+namespace {
+
+constexpr ClientHandle BENCH_CLIENT = 1;
+constexpr int SETUP_TIMEOUT_MS = 5000;
+constexpr int DRAIN_MS = 500; // for events still under way after the last send
+
+struct Config {
+    int events = 2000;
+    int intervalMs = 5;
+    int rtoMs = 200;
+};
+
+struct Result {
+    QString channel;
+    double loss = 0;
+    int sent = 0;
+    int delivered = 0;
+    double p50Ms = 0;
+    double p99Ms = 0;
+    double maxMs = 0;
+};
+
+// Send times by event index, which travels in the event's x
+class Recorder
+{
+public:
+    explicit Recorder(int events)
+        : m_sentNs(events, -1)
+        , m_latencyNs(events, -1)
+    {
+        m_clock.start();
+    }
+
+    qint64 now() const { return m_clock.nsecsElapsed(); }
+    void sent(int index) { m_sentNs[index] = now(); }
+    void delivered(int index, qint64 atNs)
+    {
+        if (index < 0 || index >= m_sentNs.size() || m_sentNs[index] < 0 || m_latencyNs[index] >= 0) return;
+        m_latencyNs[index] = atNs - m_sentNs[index];
+    }
+
+    Result result(const QString& channel, double loss) const
+    {
+        Result result;
+        result.channel = channel;
+        result.loss = loss;
+        QVector<qint64> latencies;
+        for (int i = 0; i < m_sentNs.size(); ++i) {
+            if (m_sentNs[i] >= 0) result.sent++;
+            if (m_latencyNs[i] >= 0) latencies.append(m_latencyNs[i]);
+        }
+        result.delivered = latencies.size();
+        if (latencies.isEmpty()) return result;
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) {
+            return latencies[qMin(latencies.size() - 1, qsizetype(p * latencies.size()))] / 1e6;
+        };
+        result.p50Ms = percentile(0.50);
+        result.p99Ms = percentile(0.99);
+        result.maxMs = latencies.last() / 1e6;
+        return result;
+    }
+
+private:
+    QElapsedTimer m_clock;
+    QVector<qint64> m_sentNs;
+    QVector<qint64> m_latencyNs;
+};
+
+Protocol::InputEvent moveEvent(int index)
+{
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::MouseMove;
+    event.x = index;
+    event.y = 0;
+    return event;
+}
+
+// Runs the event loop until done() or the timeout; false on timeout
+template <typename F>
+bool waitFor(F done, int timeoutMs)
+{
+    // Wakes the loop up to check even while nothing arrives
+    QTimer tick;
+    tick.start(10);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.elapsed() > timeoutMs) return false;
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    return true;
+}
+
+// Sends config.events events, one per interval, through send(index)
+template <typename F>
+void pace(const Config& config, Recorder& recorder, F send)
+{
+    int next = 0;
+    QTimer timer;
+    timer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&timer, &QTimer::timeout, [&]() {
+        if (next >= config.events) return;
+        recorder.sent(next);
+        send(next);
+        ++next;
+    });
+    timer.start(config.intervalMs);
+    waitFor([&]() { return next >= config.events; }, config.events * config.intervalMs * 4 + SETUP_TIMEOUT_MS);
+    timer.stop();
+
+    QElapsedTimer drain;
+    drain.start();
+    waitFor([&]() { return drain.elapsed() >= DRAIN_MS + config.rtoMs; }, DRAIN_MS + config.rtoMs + 100);
+}
+
+bool runDatagram(const Config& config, double loss, Result& result)
+{
+    InputDatagramServer server;
+    if (!server.listen(0)) return false;
+    server.setSimulatedLoss(loss);
+
+    QByteArray identity;
+    QByteArray key;
+    server.openSession(BENCH_CLIENT, identity, key);
+
+    Recorder recorder(config.events);
+    InputDatagramClient client;
+    QObject::connect(&client, &InputDatagramClient::inputEventReceived,
+                     [&recorder](const Protocol::InputEvent& event) {
+                         recorder.delivered(event.x, recorder.now());
+                     });
+    client.open(QHostAddress::LocalHost, server.port(), identity, key);
+
+    // Active once the handshake is done and the first keepalive is in
+    if (!waitFor([&]() { return server.isActive(BENCH_CLIENT); }, SETUP_TIMEOUT_MS)) return false;
+
+    pace(config, recorder, [&server](int index) {
+        server.sendInputEvent(BENCH_CLIENT, moveEvent(index));
+    });
+    result = recorder.result("datagram", loss);
+    return true;
+}
+
+bool runTcp(const Config& config, double loss, Result& result)
+{
+    QTcpServer listener;
+    if (!listener.listen(QHostAddress::LocalHost, 0)) return false;
+
+    QTcpSocket sender;
+    sender.connectToHost(QHostAddress::LocalHost, listener.serverPort());
+    QTcpSocket* receiver = nullptr;
+    bool ready = waitFor([&]() {
+        if (!receiver && listener.hasPendingConnections()) {
+            receiver = listener.nextPendingConnection();
+        }
+        return receiver && sender.state() == QAbstractSocket::ConnectedState;
+    }, SETUP_TIMEOUT_MS);
+    if (!ready) return false;
+    sender.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+    // A lost segment arrives an RTO late, and holds up the ones behind it
+    Recorder recorder(config.events);
+    ReceiveBuffer buffer;
+    QVector<Protocol::InputEvent> events;
+    qint64 blockedUntilNs = 0;
+    qint64 rtoNs = qint64(config.rtoMs) * 1000000;
+    QObject::connect(receiver, &QTcpSocket::readyRead, [&]() {
+        buffer.readFrom(receiver);
+        qint64 arrivedNs = recorder.now();
+        Protocol::PacketView packet;
+        while (Protocol::nextPacket(buffer.data(), buffer.size(), packet) == Protocol::FrameStatus::Complete) {
+            events.clear();
+            if (Protocol::parseInputBatchPacket(packet, events)) {
+                for (const Protocol::InputEvent& event : events) {
+                    qint64 deliveredNs = qMax(arrivedNs, blockedUntilNs);
+                    if (loss > 0 && QRandomGenerator::global()->generateDouble() < loss) {
+                        deliveredNs = qMax(arrivedNs + rtoNs, blockedUntilNs);
+                    }
+                    blockedUntilNs = deliveredNs;
+                    recorder.delivered(event.x, deliveredNs);
+                }
+            }
+            buffer.consume(Protocol::PACKET_HEADER_SIZE + packet.payloadSize);
+        }
+    });
+
+    // One packet per event, as an unbatched client would get them
+    pace(config, recorder, [&sender](int index) {
+        sender.write(Protocol::createInputBatchPacket({ moveEvent(index) }));
+    });
+    result = recorder.result("tcp", loss);
+    return true;
+}
+
+QJsonDocument toJson(const QVector<Result>& results, const Config& config)
+{
+    QJsonArray entries;
+    for (const Result& result : results) {
+        QJsonObject entry;
+        entry["channel"] = result.channel;
+        entry["loss"] = result.loss;
+        entry["sent"] = result.sent;
+        entry["delivered"] = result.delivered;
+        entry["p50Ms"] = result.p50Ms;
+        entry["p99Ms"] = result.p99Ms;
+        entry["maxMs"] = result.maxMs;
+        entries.append(entry);
+    }
+
+    QJsonObject root;
+    root["suite"] = "keycast_input";
+    root["events"] = config.events;
+    root["intervalMs"] = config.intervalMs;
+    root["tcpRtoMs"] = config.rtoMs;
+    root["qtVersion"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = entries;
+    return QJsonDocument(root);
+}
+
+void printText(const QVector<Result>& results)
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5 %6\n")
+               .arg("channel", -9)
+               .arg("loss", 6)
+               .arg("delivered", 10)
+               .arg("p50 ms", 8)
+               .arg("p99 ms", 8)
+               .arg("max ms", 8);
+    for (const Result& result : results) {
+        out << QString("%1 %2 %3 %4 %5 %6\n")
+                   .arg(result.channel, -9)
+                   .arg(result.loss, 6, 'f', 3)
+                   .arg(QString("%1/%2").arg(result.delivered).arg(result.sent), 10)
+                   .arg(result.p50Ms, 8, 'f', 2)
+                   .arg(result.p99Ms, 8, 'f', 2)
+                   .arg(result.maxMs, 8, 'f', 2);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("keycast_inputbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KeyCast input latency over TCP and the datagram channel");
+    parser.addHelpOption();
+    QCommandLineOption eventsOption("events", "Events per run.", "n", "2000");
+    QCommandLineOption intervalOption("interval", "Milliseconds between events.", "ms", "5");
+    QCommandLineOption lossOption("loss", "Comma-separated loss ratios.", "ratios", "0,0.01,0.05,0.1");
+    QCommandLineOption rtoOption("rto", "Retransmission timeout of modelled TCP loss.", "ms", "200");
+    QCommandLineOption outputOption("output", "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption textOption("text", "Print a table instead of JSON.");
+    parser.addOptions({ eventsOption, intervalOption, lossOption, rtoOption, outputOption, textOption });
+    parser.process(app);
+
+    Config config;
+    config.events = qMax(1, parser.value(eventsOption).toInt());
+    config.intervalMs = qMax(1, parser.value(intervalOption).toInt());
+    config.rtoMs = qMax(0, parser.value(rtoOption).toInt());
+
+    QVector<Result> results;
+    const QStringList ratios = parser.value(lossOption).split(',', Qt::SkipEmptyParts);
+    for (const QString& ratio : ratios) {
+        double loss = qBound(0.0, ratio.toDouble(), 1.0);
+        Result result;
+        if (!runTcp(config, loss, result)) {
+            QTextStream(stderr) << "TCP loopback connection failed\n";
+            return 1;
+        }
+        results.append(result);
+        if (!runDatagram(config, loss, result)) {
+            QTextStream(stderr) << "DTLS session did not come up (Qt built without DTLS?)\n";
+            return 1;
+        }
+        results.append(result);
+    }
+
+    if (parser.isSet(textOption)) {
+        printText(results);
+        return 0;
+    }
+
+    QByteArray json = toJson(results, config).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
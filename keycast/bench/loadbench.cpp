@@ -0,0 +1,528 @@
+// keycast_loadbench: keycastd under many TLS clients, per network backend.
+//
+// Starts keycastd once per backend and opens --clients TLS connections to
+// it all at once, timing how long until every one is authenticated (the
+// connection storm). Then each client sends a LatencyProbe every
+// --interval ms for --duration seconds. Reports, as JSON, the server's CPU
+// use, context switches and syscalls per second over that steady phase,
+// along with the storm's wall and CPU time and the probe round trips:
+//
+//   keycast_loadbench [--server <keycastd>] [--backends <b,b,...>] [--clients <n>]
+//                     [--interval <ms>] [--duration <s>] [--io-threads <n>]
+//                     [--port <port>] [--output <file>] [--text]
+//
+// Syscalls are counted by "perf stat -e raw_syscalls:sys_enter" on the
+// server process, and are -1 without perf or permission to trace it. The
+// clients share one thread of this process; pin it away from keycastd
+// (taskset) for clean numbers, and raise "ulimit -n" past 1000 clients.
+// Linux only: the server is measured through /proc.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSslSocket>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "messages.h"
+#include "protocol.h"
+#include "receivebuffer.h"
+
+namespace {
+
+constexpr int START_TIMEOUT_MS = 10000;
+constexpr int STORM_TIMEOUT_MS = 60000;
+constexpr int STOP_TIMEOUT_MS = 5000;
+constexpr qsizetype CLIENT_BUFFER_SIZE = 4096; // probes and pings only
+const char* const PASSWORD = "keycast-loadbench";
+
+struct Config {
+    QString serverPath;
+    QStringList backends;
+    int clients = 500;
+    int intervalMs = 100;
+    int durationSec = 10;
+    int ioThreads = 0;
+    quint16 port = 45700;
+};
+
+struct Result {
+    QString backend;
+    bool available = false;
+    int authenticated = 0;
+    int refused = 0; // ServerFull or any other AuthResponse but Success
+    int failed = 0;  // connection or TLS errors
+    qint64 stormMs = 0;
+    double stormCpuMs = 0;
+    double cpuPercent = 0; // of one core
+    double syscallsPerSec = -1;
+    double contextSwitchesPerSec = 0;
+    double probesPerSec = 0;
+    double rttP50Ms = 0;
+    double rttP99Ms = 0;
+};
+
+// Runs the event loop until done() or the timeout; false on timeout
+template <typename F>
+bool waitFor(F done, int timeoutMs)
+{
+    // Wakes the loop up to check even while nothing arrives
+    QTimer tick;
+    tick.start(10);
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.elapsed() > timeoutMs) return false;
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+    }
+    return true;
+}
+
+// Counters of another process, from /proc
+struct ProcessSample {
+    qint64 cpuUs = 0;
+    qint64 contextSwitches = 0;
+};
+
+ProcessSample sampleProcess(qint64 pid)
+{
+    ProcessSample sample;
+
+    // Fields after the command name, which may hold spaces; utime and
+    // stime are the 14th and 15th of the whole line
+    QFile stat(QString("/proc/%1/stat").arg(pid));
+    if (stat.open(QIODevice::ReadOnly)) {
+        QByteArray line = stat.readAll();
+        const QList<QByteArray> fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() > 12) {
+            qint64 ticks = fields[11].toLongLong() + fields[12].toLongLong();
+            sample.cpuUs = ticks * 1000000 / sysconf(_SC_CLK_TCK);
+        }
+    }
+
+    // Per thread; the I/O threads are where the backends differ
+    QDir tasks(QString("/proc/%1/task").arg(pid));
+    const QStringList threads = tasks.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const QString& thread : threads) {
+        QFile status(tasks.filePath(thread + "/status"));
+        if (!status.open(QIODevice::ReadOnly)) continue;
+        const QList<QByteArray> lines = status.readAll().split('\n');
+        for (const QByteArray& line : lines) {
+            if (line.startsWith("voluntary_ctxt_switches:") || line.startsWith("nonvoluntary_ctxt_switches:")) {
+                sample.contextSwitches += line.mid(line.indexOf(':') + 1).trimmed().toLongLong();
+            }
+        }
+    }
+    return sample;
+}
+
+// Syscalls of pid over the next seconds, counted by perf
+void startSyscallCount(QProcess& perf, qint64 pid, int seconds)
+{
+    perf.start("perf", { "stat", "-x", ",", "-e", "raw_syscalls:sys_enter", "-p", QString::number(pid),
+                         "--", "sleep", QString::number(seconds) });
+}
+
+// -1 if perf is missing or not allowed to count
+qint64 finishSyscallCount(QProcess& perf)
+{
+    if (!perf.waitForFinished(STOP_TIMEOUT_MS) || perf.exitCode() != 0) return -1;
+
+    // "<count>,,raw_syscalls:sys_enter,..." on stderr
+    const QList<QByteArray> lines = perf.readAllStandardError().split('\n');
+    for (const QByteArray& line : lines) {
+        if (!line.contains("raw_syscalls:sys_enter")) continue;
+        bool ok = false;
+        qint64 count = line.left(line.indexOf(',')).toLongLong(&ok);
+        return ok ? count : -1;
+    }
+    return -1;
+}
+
+// The clients, all on this thread
+class Swarm
+{
+public:
+    Swarm(int clients, quint16 port)
+        : m_port(port)
+    {
+        m_clock.start();
+        m_clients.resize(clients);
+    }
+
+    ~Swarm()
+    {
+        for (LoadClient& client : m_clients) {
+            if (client.socket) {
+                client.socket->abort();
+                delete client.socket;
+            }
+        }
+    }
+
+    int authenticated() const { return m_authenticated; }
+    int refused() const { return m_refused; }
+    int failed() const { return m_failed; }
+    bool settled() const { return m_authenticated + m_refused + m_failed == m_clients.size(); }
+
+    // Every client at once, as after a server restart
+    void connectAll()
+    {
+        for (int i = 0; i < m_clients.size(); ++i) {
+            LoadClient& client = m_clients[i];
+            client.socket = new QSslSocket;
+            client.socket->setPeerVerifyMode(QSslSocket::VerifyNone); // self-signed
+            QObject::connect(client.socket, &QSslSocket::encrypted, [this, i]() { onEncrypted(i); });
+            QObject::connect(client.socket, &QSslSocket::readyRead, [this, i]() { onReadyRead(i); });
+            QObject::connect(client.socket, &QSslSocket::errorOccurred, [this, i]() { onError(i); });
+            QObject::connect(client.socket, &QSslSocket::sslErrors, [this, i]() {
+                m_clients[i].socket->ignoreSslErrors();
+            });
+            client.socket->connectToHostEncrypted("127.0.0.1", m_port);
+        }
+    }
+
+    void sendProbes()
+    {
+        Protocol::LatencyProbeMessage probe;
+        probe.sentUs = static_cast<quint64>(m_clock.nsecsElapsed() / 1000);
+        QByteArray packet = Protocol::encode(probe);
+        for (LoadClient& client : m_clients) {
+            if (client.state == State::Authenticated) {
+                client.socket->write(packet);
+            }
+        }
+    }
+
+    // Round trips of the probes answered since the last call, in µs
+    QVector<qint64> takeRoundTrips()
+    {
+        QVector<qint64> roundTrips;
+        roundTrips.swap(m_roundTrips);
+        return roundTrips;
+    }
+
+private:
+    enum class State { Connecting, Authenticating, Authenticated, Refused, Failed };
+
+    struct LoadClient {
+        QSslSocket* socket = nullptr;
+        ReceiveBuffer buffer{CLIENT_BUFFER_SIZE};
+        State state = State::Connecting;
+    };
+
+    void onEncrypted(int index)
+    {
+        LoadClient& client = m_clients[index];
+        Protocol::PeerCapabilities caps;
+        caps.flags |= Protocol::CapLatencyProbe;
+        client.socket->write(Protocol::createAuthPacket(PASSWORD, QString("load %1").arg(index), caps));
+        client.state = State::Authenticating;
+    }
+
+    void onReadyRead(int index)
+    {
+        LoadClient& client = m_clients[index];
+        client.buffer.readFrom(client.socket);
+
+        Protocol::PacketView packet;
+        while (Protocol::nextPacket(client.buffer.data(), client.buffer.size(), packet) == Protocol::FrameStatus::Complete) {
+            handlePacket(client, packet);
+            client.buffer.consume(Protocol::PACKET_HEADER_SIZE + packet.payloadSize);
+        }
+    }
+
+    void handlePacket(LoadClient& client, const Protocol::PacketView& packet)
+    {
+        switch (packet.header.type) {
+        case Protocol::MessageType::AuthResponse: {
+            Protocol::AuthResponseMessage response;
+            if (client.state != State::Authenticating || !Protocol::decode(packet, response)) return;
+            if (response.result == Protocol::AuthResult::Success) {
+                client.state = State::Authenticated;
+                ++m_authenticated;
+            } else {
+                client.state = State::Refused;
+                ++m_refused;
+            }
+            break;
+        }
+        case Protocol::MessageType::Ping:
+            client.socket->write(Protocol::encode(Protocol::PongMessage()));
+            break;
+        case Protocol::MessageType::LatencyProbe: {
+            // The server's own probes, answered like a real client would
+            Protocol::LatencyProbeMessage probe;
+            if (Protocol::decode(packet, probe)) {
+                client.socket->write(Protocol::encode(Protocol::LatencyReplyMessage{probe.sentUs}));
+            }
+            break;
+        }
+        case Protocol::MessageType::LatencyReply: {
+            Protocol::LatencyReplyMessage reply;
+            if (Protocol::decode(packet, reply)) {
+                m_roundTrips.append(m_clock.nsecsElapsed() / 1000 - static_cast<qint64>(reply.sentUs));
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void onError(int index)
+    {
+        LoadClient& client = m_clients[index];
+        if (client.state == State::Connecting || client.state == State::Authenticating) {
+            client.state = State::Failed;
+            ++m_failed;
+        }
+    }
+
+    quint16 m_port;
+    QElapsedTimer m_clock; // probe timestamps
+    QVector<LoadClient> m_clients;
+    QVector<qint64> m_roundTrips;
+    int m_authenticated = 0;
+    int m_refused = 0;
+    int m_failed = 0;
+};
+
+void stopServer(QProcess& server)
+{
+    server.terminate();
+    if (!server.waitForFinished(STOP_TIMEOUT_MS)) {
+        server.kill();
+        server.waitForFinished(STOP_TIMEOUT_MS);
+    }
+}
+
+// false if keycastd didn't come up with this backend
+bool startServer(QProcess& server, const Config& config, const QString& backend, const QString& configFile)
+{
+    QStringList arguments = { "--config", configFile, "--backend", backend, "--port", QString::number(config.port),
+                              "--password", PASSWORD, "--no-discovery" };
+    if (config.ioThreads > 0) {
+        arguments << "--io-threads" << QString::number(config.ioThreads);
+    }
+    server.setProcessChannelMode(QProcess::MergedChannels);
+    server.start(config.serverPath, arguments);
+
+    // keycastd logs this once it listens; it falls back to the qt backend
+    // with a warning rather than fail
+    QByteArray output;
+    bool listening = waitFor([&]() {
+        output += server.readAll();
+        return output.contains("Listening on port") || server.state() == QProcess::NotRunning;
+    }, START_TIMEOUT_MS);
+    return listening && output.contains("Listening on port") && !output.contains("using the qt backend");
+}
+
+Result run(const Config& config, const QString& backend, const QString& configFile)
+{
+    Result result;
+    result.backend = backend;
+
+    QProcess server;
+    if (!startServer(server, config, backend, configFile)) {
+        stopServer(server);
+        return result;
+    }
+    result.available = true;
+    qint64 pid = server.processId();
+
+    // The storm: handshakes and Auth for every client at once
+    Swarm swarm(config.clients, config.port);
+    ProcessSample before = sampleProcess(pid);
+    QElapsedTimer storm;
+    storm.start();
+    swarm.connectAll();
+    waitFor([&swarm]() { return swarm.settled(); }, STORM_TIMEOUT_MS);
+    result.stormMs = storm.elapsed();
+    result.stormCpuMs = (sampleProcess(pid).cpuUs - before.cpuUs) / 1000.0;
+    result.authenticated = swarm.authenticated();
+    result.refused = swarm.refused();
+    result.failed = swarm.failed();
+
+    // Steady load: a probe from every client each interval
+    QTimer probes;
+    QObject::connect(&probes, &QTimer::timeout, [&swarm]() { swarm.sendProbes(); });
+    swarm.takeRoundTrips();
+    QProcess perf;
+    startSyscallCount(perf, pid, config.durationSec);
+    before = sampleProcess(pid);
+    QElapsedTimer steady;
+    steady.start();
+    probes.start(config.intervalMs);
+    waitFor([&]() { return steady.elapsed() >= config.durationSec * 1000; }, config.durationSec * 1000 + 100);
+    probes.stop();
+    ProcessSample after = sampleProcess(pid);
+    double elapsedSec = steady.nsecsElapsed() / 1e9;
+    qint64 syscalls = finishSyscallCount(perf);
+
+    result.cpuPercent = 100.0 * (after.cpuUs - before.cpuUs) / (elapsedSec * 1e6);
+    result.contextSwitchesPerSec = (after.contextSwitches - before.contextSwitches) / elapsedSec;
+    if (syscalls >= 0) {
+        result.syscallsPerSec = syscalls / double(config.durationSec);
+    }
+
+    QVector<qint64> roundTrips = swarm.takeRoundTrips();
+    result.probesPerSec = roundTrips.size() / elapsedSec;
+    if (!roundTrips.isEmpty()) {
+        std::sort(roundTrips.begin(), roundTrips.end());
+        auto percentile = [&roundTrips](double p) {
+            return roundTrips[qMin(roundTrips.size() - 1, qsizetype(p * roundTrips.size()))] / 1000.0;
+        };
+        result.rttP50Ms = percentile(0.50);
+        result.rttP99Ms = percentile(0.99);
+    }
+
+    stopServer(server);
+    return result;
+}
+
+QJsonDocument toJson(const QVector<Result>& results, const Config& config)
+{
+    QJsonArray entries;
+    for (const Result& result : results) {
+        QJsonObject entry;
+        entry["backend"] = result.backend;
+        entry["available"] = result.available;
+        if (result.available) {
+            entry["authenticated"] = result.authenticated;
+            entry["refused"] = result.refused;
+            entry["failed"] = result.failed;
+            entry["stormMs"] = result.stormMs;
+            entry["stormCpuMs"] = result.stormCpuMs;
+            entry["cpuPercent"] = result.cpuPercent;
+            entry["syscallsPerSec"] = result.syscallsPerSec;
+            entry["contextSwitchesPerSec"] = result.contextSwitchesPerSec;
+            entry["probesPerSec"] = result.probesPerSec;
+            entry["rttP50Ms"] = result.rttP50Ms;
+            entry["rttP99Ms"] = result.rttP99Ms;
+        }
+        entries.append(entry);
+    }
+
+    QJsonObject root;
+    root["suite"] = "keycast_load";
+    root["clients"] = config.clients;
+    root["intervalMs"] = config.intervalMs;
+    root["durationSec"] = config.durationSec;
+    root["ioThreads"] = config.ioThreads;
+    root["qtVersion"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = entries;
+    return QJsonDocument(root);
+}
+
+void printText(const QVector<Result>& results)
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+               .arg("backend", -9)
+               .arg("clients", 9)
+               .arg("storm ms", 9)
+               .arg("cpu %", 7)
+               .arg("syscalls/s", 11)
+               .arg("ctxsw/s", 9)
+               .arg("p50 ms", 8)
+               .arg("p99 ms", 8);
+    for (const Result& result : results) {
+        if (!result.available) {
+            out << QString("%1 not available\n").arg(result.backend, -9);
+            continue;
+        }
+        out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+                   .arg(result.backend, -9)
+                   .arg(result.authenticated, 9)
+                   .arg(result.stormMs, 9)
+                   .arg(result.cpuPercent, 7, 'f', 1)
+                   .arg(result.syscallsPerSec, 11, 'f', 0)
+                   .arg(result.contextSwitchesPerSec, 9, 'f', 0)
+                   .arg(result.rttP50Ms, 8, 'f', 2)
+                   .arg(result.rttP99Ms, 8, 'f', 2);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("keycast_loadbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("keycastd CPU and syscalls under many TLS clients, per network backend");
+    parser.addHelpOption();
+    QCommandLineOption serverOption("server", "keycastd to run, by default the one next to this program.", "path");
+    QCommandLineOption backendsOption("backends", "Comma-separated network backends.", "backends", "qt,io_uring");
+    QCommandLineOption clientsOption("clients", "Clients connecting at once.", "n", "500");
+    QCommandLineOption intervalOption("interval", "Milliseconds between each client's probes.", "ms", "100");
+    QCommandLineOption durationOption("duration", "Seconds of steady load per backend.", "s", "10");
+    QCommandLineOption ioThreadsOption("io-threads", "keycastd I/O threads, 0 for its default.", "n", "0");
+    QCommandLineOption portOption("port", "Port for keycastd to listen on.", "port", "45700");
+    QCommandLineOption outputOption("output", "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption textOption("text", "Print a table instead of JSON.");
+    parser.addOptions({ serverOption, backendsOption, clientsOption, intervalOption, durationOption, ioThreadsOption,
+                        portOption, outputOption, textOption });
+    parser.process(app);
+
+    Config config;
+    config.serverPath = parser.isSet(serverOption) ? parser.value(serverOption)
+                                                   : QCoreApplication::applicationDirPath() + "/keycastd";
+    config.backends = parser.value(backendsOption).split(',', Qt::SkipEmptyParts);
+    config.clients = qMax(1, parser.value(clientsOption).toInt());
+    config.intervalMs = qMax(1, parser.value(intervalOption).toInt());
+    config.durationSec = qMax(1, parser.value(durationOption).toInt());
+    config.ioThreads = qMax(0, parser.value(ioThreadsOption).toInt());
+    config.port = static_cast<quint16>(parser.value(portOption).toUInt());
+
+    if (!QFile::exists(config.serverPath)) {
+        QTextStream(stderr) << "No keycastd at " << config.serverPath << " (see --server)\n";
+        return 1;
+    }
+
+    // Default settings rather than the user's, which may limit clients
+    QTemporaryDir settingsDir;
+    QString configFile = settingsDir.filePath("keycast.ini");
+
+    QVector<Result> results;
+    for (const QString& backend : config.backends) {
+        results.append(run(config, backend, configFile));
+    }
+
+    if (parser.isSet(textOption)) {
+        printText(results);
+        return 0;
+    }
+
+    QByteArray json = toJson(results, config).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,595 @@
+// keycast_bench: wire protocol microbenchmarks.
+//
+// Every message type is encoded and decoded at realistic payload sizes. Each
+// case reports ns/op, wire bytes/op and heap allocations (count and bytes)
+// per op, written as JSON so results can be compared between releases:
+//
+//   keycast_bench [--filter <substring>] [--min-time <ms>] [--output <file>] [--text]
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QSysInfo>
+#include <QTextStream>
+
+#include <atomic>
+#include <cstdlib>
+
+#include "protocol.h"
+#include "messages.h"
+#include "channels.h"
+#include "receivebuffer.h"
+
+// Allocation counting. glibc lets the executable interpose malloc and friends
+// and forward to the real allocator; elsewhere allocation columns are null.
+#if defined(__GLIBC__)
+#define KEYCAST_COUNT_ALLOCATIONS 1
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+static std::atomic<bool> s_counting{false};
+static std::atomic<quint64> s_allocations{0};
+static std::atomic<quint64> s_allocatedBytes{0};
+
+static inline void countAllocation(size_t size)
+{
+    if (s_counting.load(std::memory_order_relaxed)) {
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+        s_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+extern "C" {
+void* malloc(size_t size)
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+}
+#else
+#define KEYCAST_COUNT_ALLOCATIONS 0
+#endif
+
+namespace {
+
+// Keeps the compiler from optimizing the measured work away
+template<class T>
+inline void keep(const T& value)
+{
+#if defined(_MSC_VER)
+    static volatile const void* sink;
+    sink = &value;
+#else
+    asm volatile("" : : "g"(&value) : "memory");
+#endif
+}
+
+struct Result {
+    QString name;
+    qint64 iterations = 0;
+    double nsPerOp = 0;
+    double wireBytesPerOp = 0;
+    double allocationsPerOp = -1;
+    double allocatedBytesPerOp = -1;
+};
+
+class Bench
+{
+public:
+    Bench(const QString& filter, int minTimeMs)
+        : m_filter(filter), m_minTimeNs(qint64(minTimeMs) * 1000000)
+    {
+    }
+
+    // op performs one operation and returns the wire bytes it produced or
+    // consumed
+    template<class Op>
+    void run(const QString& name, Op op)
+    {
+        if (!m_filter.isEmpty() && !name.contains(m_filter, Qt::CaseInsensitive)) return;
+
+        // Warm up caches and any lazily allocated state
+        for (int i = 0; i < 100; ++i) {
+            keep(op());
+        }
+
+        // Double the batch until one takes at least the minimum time
+        qint64 iterations = 1000;
+        for (;;) {
+            QElapsedTimer timer;
+            qint64 wireBytes = 0;
+#if KEYCAST_COUNT_ALLOCATIONS
+            s_allocations = 0;
+            s_allocatedBytes = 0;
+            s_counting = true;
+#endif
+            timer.start();
+            for (qint64 i = 0; i < iterations; ++i) {
+                wireBytes += op();
+            }
+            qint64 elapsed = timer.nsecsElapsed();
+#if KEYCAST_COUNT_ALLOCATIONS
+            s_counting = false;
+#endif
+
+            if (elapsed >= m_minTimeNs || iterations >= (qint64(1) << 30)) {
+                Result result;
+                result.name = name;
+                result.iterations = iterations;
+                result.nsPerOp = double(elapsed) / iterations;
+                result.wireBytesPerOp = double(wireBytes) / iterations;
+#if KEYCAST_COUNT_ALLOCATIONS
+                result.allocationsPerOp = double(s_allocations.load()) / iterations;
+                result.allocatedBytesPerOp = double(s_allocatedBytes.load()) / iterations;
+#endif
+                m_results.append(result);
+                return;
+            }
+            iterations *= 2;
+        }
+    }
+
+    const QVector<Result>& results() const { return m_results; }
+
+private:
+    QString m_filter;
+    qint64 m_minTimeNs;
+    QVector<Result> m_results;
+};
+
+QByteArray randomBytes(qsizetype size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    QRandomGenerator generator(42);
+    for (qsizetype i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(generator.bounded(256));
+    }
+    return data;
+}
+
+Protocol::PacketView frame(const QByteArray& packet)
+{
+    Protocol::PacketView view;
+    Protocol::nextPacket(packet.constData(), packet.size(), view, 0xFFFFFFFFu);
+    return view;
+}
+
+// Typical command output: a few KB of mostly repetitive text
+QString commandOutput(int lines)
+{
+    QString output;
+    for (int i = 0; i < lines; ++i) {
+        output += QString("drwxr-xr-x  2 user user 4096 Jan %1 12:00 directory-%2\n").arg(i % 28 + 1).arg(i);
+    }
+    return output;
+}
+
+QVector<Protocol::InputEvent> inputEvents(int count)
+{
+    QVector<Protocol::InputEvent> events;
+    for (int i = 0; i < count; ++i) {
+        Protocol::InputEvent event;
+        event.kind = i % 8 == 0 ? Protocol::InputEventKind::Key : Protocol::InputEventKind::MouseMove;
+        event.x = 960 + i;
+        event.y = 540 - i;
+        event.code = 0x41 + i % 26;
+        event.pressed = i % 2 == 0;
+        event.timeOffsetUs = 800;
+        events.append(event);
+    }
+    return events;
+}
+
+// Handler for the dispatch benchmark
+struct CountingHandler {
+    qint64 handled = 0;
+    void handleMessage(const Protocol::MouseMoveMessage& message) { handled += message.x; }
+    void handleMessage(const Protocol::KeyEventMessage& message) { handled += message.vkCode; }
+    void handleMessage(const Protocol::PingMessage&) { ++handled; }
+};
+
+void runInputBenchmarks(Bench& bench)
+{
+    using Protocol::InputWireFormat;
+    const InputWireFormat formats[] = { InputWireFormat::Fixed, InputWireFormat::Legacy };
+
+    for (InputWireFormat format : formats) {
+        const QString suffix = format == InputWireFormat::Fixed ? "fixed" : "legacy";
+        char buffer[Protocol::MAX_INPUT_PACKET_SIZE];
+
+        bench.run("KeyEvent/encode/" + suffix, [&] {
+            return qint64(Protocol::writeKeyEventPacket(buffer, 0x41, true, format));
+        });
+        bench.run("KeyEvent/encodeQByteArray/" + suffix, [&] {
+            QByteArray packet = Protocol::createKeyEventPacket(0x41, true, format);
+            return qint64(packet.size());
+        });
+        bench.run("MouseEvent/encode/" + suffix, [&] {
+            return qint64(Protocol::writeMouseEventPacket(buffer, 960, 540, 1, true, format));
+        });
+        bench.run("MouseMove/encode/" + suffix, [&] {
+            return qint64(Protocol::writeMouseMovePacket(buffer, 960, 540, format));
+        });
+        bench.run("MouseMove/encodeQByteArray/" + suffix, [&] {
+            QByteArray packet = Protocol::createMouseMovePacket(960, 540, format);
+            return qint64(packet.size());
+        });
+
+        QByteArray keyPacket = Protocol::createKeyEventPacket(0x41, true, format);
+        QByteArray mouseEventPacket = Protocol::createMouseEventPacket(960, 540, 1, true, format);
+        QByteArray mouseMovePacket = Protocol::createMouseMovePacket(960, 540, format);
+        Protocol::PacketView keyView = frame(keyPacket);
+        Protocol::PacketView mouseEventView = frame(mouseEventPacket);
+        Protocol::PacketView mouseMoveView = frame(mouseMovePacket);
+
+        bench.run("KeyEvent/decode/" + suffix, [&] {
+            int vkCode;
+            bool pressed;
+            Protocol::parseKeyEventPacket(keyView, vkCode, pressed);
+            keep(vkCode);
+            return qint64(keyPacket.size());
+        });
+        bench.run("MouseEvent/decode/" + suffix, [&] {
+            int x, y, button;
+            bool pressed;
+            Protocol::parseMouseEventPacket(mouseEventView, x, y, button, pressed);
+            keep(x);
+            return qint64(mouseEventPacket.size());
+        });
+        bench.run("MouseMove/decode/" + suffix, [&] {
+            int x, y;
+            Protocol::parseMouseMovePacket(mouseMoveView, x, y);
+            keep(x);
+            return qint64(mouseMovePacket.size());
+        });
+    }
+
+    // A batch as flushed after a fast mouse sweep
+    const QVector<Protocol::InputEvent> events = inputEvents(32);
+    QByteArray batchPacket;
+    bench.run("InputBatch/encode/32", [&] {
+        Protocol::writeInputBatchPacket(batchPacket, events);
+        return qint64(batchPacket.size());
+    });
+
+    QByteArray batch = Protocol::createInputBatchPacket(events);
+    Protocol::PacketView batchView = frame(batch);
+    QVector<Protocol::InputEvent> decoded;
+    decoded.reserve(events.size());
+    bench.run("InputBatch/decode/32", [&] {
+        decoded.clear();
+        Protocol::parseInputBatchPacket(batchView, decoded);
+        return qint64(batch.size());
+    });
+
+    char datagram[Protocol::MAX_INPUT_DATAGRAM_SIZE];
+    bench.run("InputDatagram/encode/8", [&] {
+        return qint64(Protocol::writeInputDatagram(datagram, 1, events.constData(),
+                                                   Protocol::MAX_INPUT_DATAGRAM_EVENTS));
+    });
+
+    int datagramSize = Protocol::writeInputDatagram(datagram, 1, events.constData(),
+                                                    Protocol::MAX_INPUT_DATAGRAM_EVENTS);
+    QByteArray datagramBytes(datagram, datagramSize);
+    bench.run("InputDatagram/decode/8", [&] {
+        quint32 sequence;
+        decoded.clear();
+        Protocol::parseInputDatagram(datagramBytes, sequence, decoded);
+        return qint64(datagramBytes.size());
+    });
+}
+
+void runControlBenchmarks(Bench& bench)
+{
+    Protocol::PeerCapabilities caps;
+    caps.flags = Protocol::SUPPORTED_CAPABILITIES;
+
+    bench.run("Auth/encode", [&] {
+        QByteArray packet = Protocol::createAuthPacket("correct horse battery", "WORKSTATION-07", caps);
+        return qint64(packet.size());
+    });
+    QByteArray auth = Protocol::createAuthPacket("correct horse battery", "WORKSTATION-07", caps);
+    Protocol::PacketView authView = frame(auth);
+    bench.run("Auth/decode", [&] {
+        Protocol::AuthMessage message;
+        Protocol::decode(authView, message);
+        return qint64(auth.size());
+    });
+
+    bench.run("AuthResponse/encode", [&] {
+        QByteArray packet = Protocol::createAuthResponsePacket(Protocol::AuthResult::Success, "MEDIA-PC", caps);
+        return qint64(packet.size());
+    });
+    QByteArray authResponse = Protocol::createAuthResponsePacket(Protocol::AuthResult::Success, "MEDIA-PC", caps);
+    Protocol::PacketView authResponseView = frame(authResponse);
+    bench.run("AuthResponse/decode", [&] {
+        Protocol::AuthResponseMessage message;
+        Protocol::decode(authResponseView, message);
+        return qint64(authResponse.size());
+    });
+
+    bench.run("Ping/encode", [&] {
+        QByteArray packet = Protocol::encode(Protocol::PingMessage());
+        return qint64(packet.size());
+    });
+
+    Protocol::ClientInfoMessage clientInfo{ "5f0c2a9e-1b7d-4d0a-9f3e-6a1c2b3d4e5f", "WORKSTATION-07" };
+    bench.run("ClientInfo/encode", [&] {
+        QByteArray packet = Protocol::encode(clientInfo);
+        return qint64(packet.size());
+    });
+    QByteArray clientInfoPacket = Protocol::encode(clientInfo);
+    Protocol::PacketView clientInfoView = frame(clientInfoPacket);
+    bench.run("ClientInfo/decode", [&] {
+        Protocol::ClientInfoMessage message;
+        Protocol::decode(clientInfoView, message);
+        return qint64(clientInfoPacket.size());
+    });
+
+    Protocol::ExecuteCommandMessage command{ "ls -la /home/user/projects", "shell" };
+    bench.run("ExecuteCommand/encode", [&] {
+        QByteArray packet = Protocol::encode(command);
+        return qint64(packet.size());
+    });
+    QByteArray commandPacket = Protocol::encode(command);
+    Protocol::PacketView commandView = frame(commandPacket);
+    bench.run("ExecuteCommand/decode", [&] {
+        Protocol::ExecuteCommandMessage message;
+        Protocol::decode(commandView, message);
+        return qint64(commandPacket.size());
+    });
+
+    bench.run("ScreenShareRequest/encode", [&] {
+        QByteArray packet = Protocol::createScreenShareRequestPacket(true);
+        return qint64(packet.size());
+    });
+
+    bench.run("ScreenFrameAck/encode", [&] {
+        QByteArray packet = Protocol::encode(Protocol::ScreenFrameAckMessage{ 1234 });
+        return qint64(packet.size());
+    });
+    QByteArray ack = Protocol::encode(Protocol::ScreenFrameAckMessage{ 1234 });
+    Protocol::PacketView ackView = frame(ack);
+    bench.run("ScreenFrameAck/decode", [&] {
+        Protocol::ScreenFrameAckMessage message;
+        Protocol::decode(ackView, message);
+        keep(message.frameId);
+        return qint64(ack.size());
+    });
+
+    Protocol::InputChannelSetupMessage setup{ 45679, randomBytes(16), randomBytes(32) };
+    bench.run("InputChannelSetup/encode", [&] {
+        QByteArray packet = Protocol::encode(setup);
+        return qint64(packet.size());
+    });
+}
+
+void runBulkBenchmarks(Bench& bench)
+{
+    // Command output, 100 lines, with and without compression
+    const QString output = commandOutput(100);
+    const bool compression[] = { false, true };
+    for (bool compressed : compression) {
+        const QString suffix = compressed ? "zlib" : "plain";
+        bench.run("CommandOutput/encode/" + suffix, [&] {
+            QByteArray packet = Protocol::createCommandOutputPacket(output, compressed);
+            return qint64(packet.size());
+        });
+        QByteArray packet = Protocol::createCommandOutputPacket(output, compressed);
+        Protocol::PacketView view = frame(packet);
+        bench.run("CommandOutput/decode/" + suffix, [&] {
+            QString decoded;
+            Protocol::parseCommandOutputPacket(view, decoded, compressed);
+            return qint64(packet.size());
+        });
+    }
+
+    // JPEG frames: a mostly static desktop and a busy 1080p screen
+    const qsizetype frameSizes[] = { 60 * 1024, 400 * 1024 };
+    for (qsizetype size : frameSizes) {
+        const QString suffix = QString("%1k").arg(size / 1024);
+        const QByteArray image = randomBytes(size);
+        bench.run("ScreenFrame/encode/" + suffix, [&] {
+            QByteArray packet = Protocol::createScreenFramePacket(image, 1920, 1080, 42);
+            return qint64(packet.size());
+        });
+        QByteArray packet = Protocol::createScreenFramePacket(image, 1920, 1080, 42);
+        Protocol::PacketView view = frame(packet);
+        bench.run("ScreenFrame/decode/" + suffix, [&] {
+            Protocol::ScreenFrameMessage message;
+            Protocol::decode(view, message);
+            return qint64(packet.size());
+        });
+    }
+
+    // Clipboard: a line of text and a screenshot
+    const qsizetype clipboardSizes[] = { 256, 1024 * 1024 };
+    for (qsizetype size : clipboardSizes) {
+        const QString suffix = QString("%1b").arg(size);
+        const QByteArray data = randomBytes(size);
+        bench.run("ClipboardData/encode/" + suffix, [&] {
+            QByteArray packet = Protocol::createClipboardDataPacket("image/png", data);
+            return qint64(packet.size());
+        });
+        QByteArray packet = Protocol::createClipboardDataPacket("image/png", data);
+        Protocol::PacketView view = frame(packet);
+        bench.run("ClipboardData/decode/" + suffix, [&] {
+            Protocol::ClipboardDataMessage message;
+            Protocol::decode(view, message);
+            return qint64(packet.size());
+        });
+    }
+
+    // One streamed chunk
+    const QByteArray chunk = randomBytes(Protocol::STREAM_CHUNK_SIZE);
+    bench.run("StreamData/encode/64k", [&] {
+        QByteArray packet(Protocol::STREAM_DATA_HEADER_SIZE + chunk.size(), Qt::Uninitialized);
+        Protocol::writeStreamDataHeader(packet.data(), 1, static_cast<quint32>(chunk.size()));
+        memcpy(packet.data() + Protocol::STREAM_DATA_HEADER_SIZE, chunk.constData(), chunk.size());
+        return qint64(packet.size());
+    });
+}
+
+void runFramingBenchmarks(Bench& bench)
+{
+    // Receive path: a socket read holding 64 mouse moves, framed and
+    // dispatched in place
+    QByteArray stream;
+    for (int i = 0; i < 64; ++i) {
+        stream += Protocol::createMouseMovePacket(i, i, Protocol::InputWireFormat::Fixed);
+    }
+
+    CountingHandler handler;
+    using Messages = Protocol::MessageList<Protocol::MouseMoveMessage, Protocol::KeyEventMessage,
+                                           Protocol::PingMessage>;
+    bench.run("Receive/frameAndDispatch/64", [&] {
+        const char* data = stream.constData();
+        qsizetype remaining = stream.size();
+        Protocol::PacketView packet;
+        while (Protocol::nextPacket(data, remaining, packet) == Protocol::FrameStatus::Complete) {
+            Protocol::Dispatcher<CountingHandler, Messages>::dispatch(handler, packet);
+            qsizetype size = Protocol::PACKET_HEADER_SIZE + packet.payloadSize;
+            data += size;
+            remaining -= size;
+        }
+        return qint64(stream.size());
+    });
+    keep(handler.handled);
+
+    // A 400 KB frame cut into fragments and reassembled
+    QByteArray framePacket = Protocol::createScreenFramePacket(randomBytes(400 * 1024), 1920, 1080, 7);
+    QVector<QByteArray> fragments;
+    for (qsizetype offset = 0; offset < framePacket.size(); offset += Protocol::DEFAULT_FRAGMENT_SIZE) {
+        qsizetype size = qMin<qsizetype>(Protocol::DEFAULT_FRAGMENT_SIZE, framePacket.size() - offset);
+        QByteArray fragment(Protocol::FRAGMENT_HEADER_SIZE, Qt::Uninitialized);
+        Protocol::writeFragmentHeader(fragment.data(), Protocol::Channel::Frames,
+                                      offset + size == framePacket.size(), static_cast<quint32>(size));
+        fragment.append(framePacket.constData() + offset, size);
+        fragments.append(fragment);
+    }
+
+    FragmentAssembler assembler;
+    bench.run("Fragment/reassemble/400k", [&] {
+        qint64 bytes = 0;
+        Protocol::PacketView message;
+        for (const QByteArray& fragment : fragments) {
+            assembler.append(frame(fragment), message);
+            bytes += fragment.size();
+        }
+        return bytes;
+    });
+}
+
+QJsonDocument toJson(const QVector<Result>& results)
+{
+    QJsonArray entries;
+    for (const Result& result : results) {
+        QJsonObject entry;
+        entry["name"] = result.name;
+        entry["iterations"] = result.iterations;
+        entry["nsPerOp"] = result.nsPerOp;
+        entry["wireBytesPerOp"] = result.wireBytesPerOp;
+        entry["allocationsPerOp"] = result.allocationsPerOp < 0 ? QJsonValue() : QJsonValue(result.allocationsPerOp);
+        entry["allocatedBytesPerOp"] =
+            result.allocatedBytesPerOp < 0 ? QJsonValue() : QJsonValue(result.allocatedBytesPerOp);
+        entries.append(entry);
+    }
+
+    QJsonObject root;
+    root["suite"] = "keycast_protocol";
+    root["protocolVersion"] = Protocol::PROTOCOL_VERSION_MAX;
+    root["qtVersion"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = entries;
+    return QJsonDocument(root);
+}
+
+void printText(const QVector<Result>& results)
+{
+    QTextStream out(stdout);
+    out << QString("%1 %2 %3 %4 %5\n")
+               .arg("benchmark", -36)
+               .arg("ns/op", 12)
+               .arg("bytes/op", 12)
+               .arg("allocs/op", 10)
+               .arg("alloc B/op", 12);
+    for (const Result& result : results) {
+        out << QString("%1 %2 %3 %4 %5\n")
+                   .arg(result.name, -36)
+                   .arg(result.nsPerOp, 12, 'f', 1)
+                   .arg(result.wireBytesPerOp, 12, 'f', 0)
+                   .arg(result.allocationsPerOp, 10, 'f', 2)
+                   .arg(result.allocatedBytesPerOp, 12, 'f', 0);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("keycast_bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KeyCast wire protocol microbenchmarks");
+    parser.addHelpOption();
+    QCommandLineOption filterOption("filter", "Only run benchmarks whose name contains <substring>.", "substring");
+    QCommandLineOption minTimeOption("min-time", "Minimum measured time per benchmark in ms.", "ms", "200");
+    QCommandLineOption outputOption("output", "Write JSON results to <file> instead of stdout.", "file");
+    QCommandLineOption textOption("text", "Print a table instead of JSON.");
+    parser.addOptions({ filterOption, minTimeOption, outputOption, textOption });
+    parser.process(app);
+
+    Bench bench(parser.value(filterOption), qMax(1, parser.value(minTimeOption).toInt()));
+    runInputBenchmarks(bench);
+    runControlBenchmarks(bench);
+    runBulkBenchmarks(bench);
+    runFramingBenchmarks(bench);
+
+    if (parser.isSet(textOption)) {
+        printText(bench.results());
+        return 0;
+    }
+
+    QByteArray json = toJson(bench.results()).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            QTextStream(stderr) << "Cannot write " << file.fileName() << ": " << file.errorString() << "\n";
+            return 1;
+        }
+        file.write(json);
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
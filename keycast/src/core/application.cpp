@@ -4,6 +4,7 @@
 #include "systemtray.h"
 #include "server.h"
 #include "client.h"
+#include "relay.h"
 #include "discovery.h"
 #include "inputcapture.h"
 #include "inputinjector.h"
@@ -29,6 +30,7 @@ Application::~Application()
     delete m_shortcutManager;
     delete m_inputInjector;
     delete m_inputCapture;
+    delete m_relay; // uses the client and server
     delete m_discovery;
     delete m_client;
     delete m_server;
@@ -47,6 +49,7 @@ void Application::initializeComponents()
     m_server = new Server(this);
     m_client = new Client(this);
     m_discovery = new Discovery(this);
+    m_relay = new Relay(m_client, m_server, this);
 
     // Create input components
     m_inputCapture = new InputCapture(this);
@@ -91,12 +94,27 @@ void Application::setupConnections()
         }
     });
 
+    connect(m_inputCapture, &InputCapture::mouseMove, this, [this](int x, int y) {
+        if (m_broadcasting && m_server->isRunning() && Settings::instance()->broadcastMouse()) {
+            m_server->broadcastMouseMove(x, y);
+        }
+    });
+
     // Client receives input and injects it
     connect(m_client, &Client::keyEventReceived, m_inputInjector, &InputInjector::injectKeyEvent);
     connect(m_client, &Client::mouseEventReceived, m_inputInjector, &InputInjector::injectMouseEvent);
+    connect(m_client, &Client::mouseMoveReceived, m_inputInjector, &InputInjector::injectMouseMove);
     connect(m_client, &Client::executeCommandReceived, this, [this](const QString& command, const QString& type) {
         m_shortcutManager->executeCommand(command, type);
     });
+
+    // Shortcuts aimed at clients go out through the server
+    connect(m_shortcutManager, &ShortcutManager::remoteCommandRequested, this,
+            [this](const QString& target, const QString& command, const QString& type) {
+        if (m_server->isRunning()) {
+            m_server->sendCommand(target, command, type);
+        }
+    });
 }
 
 void Application::loadSettings()
@@ -116,6 +134,11 @@ void Application::loadSettings()
     // Load shortcuts
     m_shortcutManager->loadShortcuts();
 
+    // Pass upstream traffic on to our own clients
+    if (settings->relayMode()) {
+        m_relay->start();
+    }
+
     // Show main window unless start minimized
     // Always use showNormal() to ensure window is visible and not minimized
     if (!settings->startMinimized()) {
@@ -131,6 +154,8 @@ void Application::loadSettings()
 void Application::startServer()
 {
     Settings* settings = Settings::instance();
+    m_server->setIoThreads(settings->ioThreads());
+    m_server->setBackend(settings->networkBackend());
     m_server->start(settings->serverPort(), settings->serverPassword());
 }
 
@@ -12,6 +12,7 @@ class Discovery;
 class InputCapture;
 class InputInjector;
 class ShortcutManager;
+class Relay;
 
 class Application : public QApplication
 {
@@ -31,6 +32,7 @@ public:
     InputCapture* inputCapture() const { return m_inputCapture; }
     InputInjector* inputInjector() const { return m_inputInjector; }
     ShortcutManager* shortcutManager() const { return m_shortcutManager; }
+    Relay* relay() const { return m_relay; }
 
     bool isBroadcasting() const { return m_broadcasting; }
 
@@ -68,6 +70,7 @@ private:
     InputCapture* m_inputCapture = nullptr;
     InputInjector* m_inputInjector = nullptr;
     ShortcutManager* m_shortcutManager = nullptr;
+    Relay* m_relay = nullptr;
 
     bool m_broadcasting = false;
 };
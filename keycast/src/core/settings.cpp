@@ -1,8 +1,10 @@
 #include "settings.h"
+#include "protocol.h"
 #include <QStandardPaths>
 #include <QDir>
 
 Settings* Settings::m_instance = nullptr;
+QString Settings::m_configFile;
 
 Settings* Settings::instance()
 {
@@ -12,9 +14,17 @@ Settings* Settings::instance()
     return m_instance;
 }
 
+void Settings::setConfigFile(const QString& path)
+{
+    m_configFile = path;
+}
+
 Settings::Settings(QObject* parent)
     : QObject(parent)
-    , m_settings(QSettings::IniFormat, QSettings::UserScope, "KeyCast", "KeyCast")
+    , m_settings(m_configFile.isEmpty()
+                     ? QSettings(QSettings::IniFormat, QSettings::UserScope, "KeyCast", "KeyCast").fileName()
+                     : m_configFile,
+                 QSettings::IniFormat)
 {
 }
 
@@ -140,6 +150,215 @@ void Settings::setEnableDiscovery(bool enabled)
     emit settingsChanged();
 }
 
+bool Settings::legacyInputEncoding() const
+{
+    return m_settings.value("network/legacyInputEncoding", false).toBool();
+}
+
+void Settings::setLegacyInputEncoding(bool enabled)
+{
+    m_settings.setValue("network/legacyInputEncoding", enabled);
+    emit settingsChanged();
+}
+
+int Settings::inputBatchInterval() const
+{
+    return m_settings.value("network/inputBatchInterval", 0).toInt();
+}
+
+void Settings::setInputBatchInterval(int msecs)
+{
+    m_settings.setValue("network/inputBatchInterval", msecs);
+    emit settingsChanged();
+}
+
+bool Settings::datagramInput() const
+{
+    return m_settings.value("network/datagramInput", true).toBool();
+}
+
+void Settings::setDatagramInput(bool enabled)
+{
+    m_settings.setValue("network/datagramInput", enabled);
+    emit settingsChanged();
+}
+
+quint32 Settings::maxMessageSize() const
+{
+    return m_settings.value("network/maxMessageSize", Protocol::DEFAULT_MAX_MESSAGE_SIZE).toUInt();
+}
+
+void Settings::setMaxMessageSize(quint32 bytes)
+{
+    m_settings.setValue("network/maxMessageSize", bytes);
+    emit settingsChanged();
+}
+
+qint64 Settings::frameQueueBudget() const
+{
+    return m_settings.value("network/frameQueueBudget", 1024 * 1024).toLongLong();
+}
+
+void Settings::setFrameQueueBudget(qint64 bytes)
+{
+    m_settings.setValue("network/frameQueueBudget", bytes);
+    emit settingsChanged();
+}
+
+int Settings::frameWindow() const
+{
+    return m_settings.value("network/frameWindow", 2).toInt();
+}
+
+void Settings::setFrameWindow(int frames)
+{
+    m_settings.setValue("network/frameWindow", frames);
+    emit settingsChanged();
+}
+
+int Settings::ioThreads() const
+{
+    return m_settings.value("network/ioThreads", 0).toInt();
+}
+
+void Settings::setIoThreads(int threads)
+{
+    m_settings.setValue("network/ioThreads", threads);
+    emit settingsChanged();
+}
+
+QString Settings::networkBackend() const
+{
+    return m_settings.value("network/backend", "qt").toString();
+}
+
+void Settings::setNetworkBackend(const QString& backend)
+{
+    m_settings.setValue("network/backend", backend);
+    emit settingsChanged();
+}
+
+bool Settings::reusePort() const
+{
+    return m_settings.value("network/reusePort", true).toBool();
+}
+
+void Settings::setReusePort(bool enabled)
+{
+    m_settings.setValue("network/reusePort", enabled);
+    emit settingsChanged();
+}
+
+int Settings::maxHandshakes() const
+{
+    return m_settings.value("network/maxHandshakes", 64).toInt();
+}
+
+void Settings::setMaxHandshakes(int connections)
+{
+    m_settings.setValue("network/maxHandshakes", connections);
+    emit settingsChanged();
+}
+
+int Settings::maxClients() const
+{
+    return m_settings.value("network/maxClients", 0).toInt();
+}
+
+void Settings::setMaxClients(int clients)
+{
+    m_settings.setValue("network/maxClients", clients);
+    emit settingsChanged();
+}
+
+bool Settings::relayMode() const
+{
+    return m_settings.value("network/relay", false).toBool();
+}
+
+void Settings::setRelayMode(bool enabled)
+{
+    m_settings.setValue("network/relay", enabled);
+    emit settingsChanged();
+}
+
+bool Settings::damageTracking() const
+{
+    return m_settings.value("network/damageTracking", true).toBool();
+}
+
+void Settings::setDamageTracking(bool enabled)
+{
+    m_settings.setValue("network/damageTracking", enabled);
+    emit settingsChanged();
+}
+
+bool Settings::frameDeltas() const
+{
+    return m_settings.value("network/frameDeltas", true).toBool();
+}
+
+void Settings::setFrameDeltas(bool enabled)
+{
+    m_settings.setValue("network/frameDeltas", enabled);
+    emit settingsChanged();
+}
+
+bool Settings::cursorUpdates() const
+{
+    return m_settings.value("network/cursorUpdates", true).toBool();
+}
+
+void Settings::setCursorUpdates(bool enabled)
+{
+    m_settings.setValue("network/cursorUpdates", enabled);
+    emit settingsChanged();
+}
+
+int Settings::maxFrameRate() const
+{
+    return m_settings.value("network/maxFrameRate", 30).toInt();
+}
+
+void Settings::setMaxFrameRate(int fps)
+{
+    m_settings.setValue("network/maxFrameRate", fps);
+    emit settingsChanged();
+}
+
+int Settings::frameQuality() const
+{
+    return m_settings.value("network/frameQuality", 70).toInt();
+}
+
+void Settings::setFrameQuality(int quality)
+{
+    m_settings.setValue("network/frameQuality", quality);
+    emit settingsChanged();
+}
+
+bool Settings::adaptiveStream() const
+{
+    return m_settings.value("network/adaptiveStream", true).toBool();
+}
+
+void Settings::setAdaptiveStream(bool enabled)
+{
+    m_settings.setValue("network/adaptiveStream", enabled);
+    emit settingsChanged();
+}
+
+int Settings::latencyBudget() const
+{
+    return m_settings.value("network/latencyBudget", 150).toInt();
+}
+
+void Settings::setLatencyBudget(int msecs)
+{
+    m_settings.setValue("network/latencyBudget", msecs);
+    emit settingsChanged();
+}
+
 // Mode settings
 bool Settings::serverModeEnabled() const
 {
@@ -261,6 +480,31 @@ void Settings::removeServer(int index)
     }
 }
 
+// Client groups
+QHash<QString, QStringList> Settings::clientTags() const
+{
+    QHash<QString, QStringList> tags;
+    m_settings.beginGroup("clientTags");
+    const QStringList names = m_settings.childKeys();
+    for (const QString& name : names) {
+        tags.insert(name, m_settings.value(name).toStringList());
+    }
+    m_settings.endGroup();
+    return tags;
+}
+
+void Settings::setClientTags(const QString& clientName, const QStringList& tags)
+{
+    m_settings.beginGroup("clientTags");
+    if (tags.isEmpty()) {
+        m_settings.remove(clientName);
+    } else {
+        m_settings.setValue(clientName, tags);
+    }
+    m_settings.endGroup();
+    emit settingsChanged();
+}
+
 // Broadcast settings
 bool Settings::broadcastKeyboard() const
 {
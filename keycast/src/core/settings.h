@@ -7,13 +7,15 @@
 #include <QByteArray>
 #include <QList>
 #include <QVariant>
+#include <QHash>
+#include <QStringList>
 
 struct ShortcutAction {
     QString name;
     QString keySequence;
     QString actionType;  // "binary" or "terminal"
     QString command;
-    QString targetClients;  // comma-separated client IDs or "all"
+    QString targetClients;  // "local", "all", or comma-separated client IDs and @group names
 };
 
 struct ServerInfo {
@@ -30,6 +32,10 @@ class Settings : public QObject
 public:
     static Settings* instance();
 
+    // Read and write this INI file instead of the per-user one; only
+    // takes effect before the first instance() call
+    static void setConfigFile(const QString& path);
+
     // Window settings
     QByteArray windowGeometry() const;
     void setWindowGeometry(const QByteArray& geometry);
@@ -57,6 +63,57 @@ public:
     void setAutoStartServer(bool enabled);
     bool enableDiscovery() const;
     void setEnableDiscovery(bool enabled);
+    // Don't offer fixed-layout input; every peer then gets the version 1 layout
+    bool legacyInputEncoding() const;
+    void setLegacyInputEncoding(bool enabled);
+    int inputBatchInterval() const;
+    void setInputBatchInterval(int msecs);
+    bool datagramInput() const;
+    void setDatagramInput(bool enabled);
+    quint32 maxMessageSize() const;
+    void setMaxMessageSize(quint32 bytes);
+    qint64 frameQueueBudget() const;
+    void setFrameQueueBudget(qint64 bytes);
+    int frameWindow() const;
+    void setFrameWindow(int frames);
+    int ioThreads() const;
+    void setIoThreads(int threads);
+    // "qt", or "io_uring" where built with it (Linux)
+    QString networkBackend() const;
+    void setNetworkBackend(const QString& backend);
+    // Accept on every I/O thread through SO_REUSEPORT where supported
+    bool reusePort() const;
+    void setReusePort(bool enabled);
+    // Connections in TLS handshake or Auth at once, 0 = unlimited
+    int maxHandshakes() const;
+    void setMaxHandshakes(int connections);
+    // Authenticated clients; more are told ServerFull. 0 = unlimited
+    int maxClients() const;
+    void setMaxClients(int clients);
+    // Pass what the client receives on to this server's clients
+    bool relayMode() const;
+    void setRelayMode(bool enabled);
+    // Skip screen share ticks on which nothing changed (Linux, XDamage)
+    bool damageTracking() const;
+    void setDamageTracking(bool enabled);
+    // Send viewers only the screen tiles that changed (CapFrameTiles)
+    bool frameDeltas() const;
+    void setFrameDeltas(bool enabled);
+    // Send the pointer apart from frames, at input rate (CapCursor)
+    bool cursorUpdates() const;
+    void setCursorUpdates(bool enabled);
+    // Screen share frame rate and JPEG quality; the most the adaptive
+    // stream goes up to, or what is sent when it is off
+    int maxFrameRate() const;
+    void setMaxFrameRate(int fps);
+    int frameQuality() const;
+    void setFrameQuality(int quality);
+    // Lower frame rate, quality and scale to keep frames within the latency
+    // budget of the slowest viewer
+    bool adaptiveStream() const;
+    void setAdaptiveStream(bool enabled);
+    int latencyBudget() const;
+    void setLatencyBudget(int msecs);
 
     // Mode settings
     bool serverModeEnabled() const;
@@ -76,6 +133,10 @@ public:
     void addServer(const ServerInfo& server);
     void removeServer(int index);
 
+    // Client tags by client name; a client joins the group of each tag
+    QHash<QString, QStringList> clientTags() const;
+    void setClientTags(const QString& clientName, const QStringList& tags);
+
     // Broadcast settings
     bool broadcastKeyboard() const;
     void setBroadcastKeyboard(bool enabled);
@@ -98,6 +159,7 @@ private:
     ~Settings() = default;
 
     static Settings* m_instance;
+    static QString m_configFile;
     mutable QSettings m_settings;
 };
 
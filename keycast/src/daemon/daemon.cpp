@@ -0,0 +1,241 @@
+#include "daemon.h"
+#include "settings.h"
+#include "server.h"
+#include "discovery.h"
+#include "inputcapture.h"
+#include "client.h"
+#include "relay.h"
+
+#include <QFile>
+#include <QDebug>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+Daemon::Daemon(const DaemonOptions& options, QObject* parent)
+    : QObject(parent)
+    , m_options(options)
+    , m_server(new Server(this))
+    , m_discovery(new Discovery(this))
+    , m_inputCapture(new InputCapture(this))
+    , m_statsTimer(new QTimer(this))
+{
+    connect(m_server, &Server::error, this, [](const QString& message) {
+        qCritical().noquote() << message;
+    });
+    connect(m_server, &Server::clientAuthenticated, this, [](const QString& clientId, const QString& clientName) {
+        qInfo().noquote() << QString("Client %1 (%2) connected").arg(clientName, clientId);
+    });
+    connect(m_server, &Server::clientDisconnected, this, [](const QString& clientId) {
+        qInfo().noquote() << QString("Client %1 disconnected").arg(clientId);
+    });
+    connect(m_discovery, &Discovery::error, this, [](const QString& message) {
+        qWarning().noquote() << message;
+    });
+
+    // Local input to clients, as Application does while broadcasting
+    connect(m_inputCapture, &InputCapture::keyEvent, m_server, &Server::broadcastKeyEvent);
+    connect(m_inputCapture, &InputCapture::mouseEvent, this, [this](int x, int y, int button, bool pressed) {
+        if (Settings::instance()->broadcastMouse()) {
+            m_server->broadcastMouseEvent(x, y, button, pressed);
+        }
+    });
+    connect(m_inputCapture, &InputCapture::mouseMove, this, [this](int x, int y) {
+        if (Settings::instance()->broadcastMouse()) {
+            m_server->broadcastMouseMove(x, y);
+        }
+    });
+
+    connect(m_statsTimer, &QTimer::timeout, this, &Daemon::onStatsTimer);
+    if (m_options.statsInterval > 0) {
+        connect(m_server, &Server::frameSent, this, &Daemon::onFrameSent);
+    }
+
+    if (!m_options.upstreamAddress.isEmpty()) {
+        m_upstream = new Client(this);
+        m_relay = new Relay(m_upstream, m_server, this);
+
+        connect(m_upstream, &Client::authenticated, this, [](const QString& serverName) {
+            qInfo().noquote() << QString("Relaying %1").arg(serverName);
+        });
+        connect(m_upstream, &Client::authenticationFailed, this, [](const QString& reason) {
+            qCritical().noquote() << QString("Upstream refused: %1").arg(reason);
+        });
+        connect(m_upstream, &Client::error, this, [](const QString& message) {
+            qWarning().noquote() << QString("Upstream: %1").arg(message);
+        });
+    }
+}
+
+Daemon::~Daemon()
+{
+    stop();
+}
+
+bool Daemon::start()
+{
+    m_server->setIoThreads(m_options.ioThreads);
+    m_server->setBackend(m_options.backend);
+    m_server->setInputTarget(m_options.inputTarget);
+    m_server->setScreenShareTarget(m_options.screenShareTarget);
+    m_server->start(m_options.port, m_options.password);
+    if (!m_server->isRunning()) return false;
+
+    if (m_options.discovery) {
+        Settings* settings = Settings::instance();
+        m_discovery->start(settings->discoveryPort());
+        m_discovery->startBroadcasting(settings->computerName(), m_options.port);
+    }
+
+    if (m_options.broadcast) {
+        m_inputCapture->start();
+    }
+
+    // Capture only runs while some client wants frames
+    if (m_options.screenShare) {
+        m_server->startScreenShare();
+    }
+
+    if (m_relay) {
+        m_relay->start();
+        m_upstream->connectToServer(m_options.upstreamAddress, m_options.upstreamPort, m_options.upstreamPassword);
+    }
+
+    if (m_options.statsInterval > 0) {
+        m_statsTimer->start(m_options.statsInterval * 1000);
+        m_statsClock.start();
+        m_statsCpuUs = cpuTimeUs();
+    }
+    return true;
+}
+
+void Daemon::stop()
+{
+    m_statsTimer->stop();
+    if (m_relay) {
+        m_relay->stop();
+        m_upstream->disconnect();
+    }
+    m_inputCapture->stop();
+    m_discovery->stop();
+    m_server->stop();
+}
+
+void Daemon::onStatsTimer()
+{
+    QString upstream;
+    if (m_upstream && m_upstream->pathLatencyUs() >= 0) {
+        upstream = QString(", %1 hops from the source, %2 ms")
+            .arg(m_upstream->hops())
+            .arg(m_upstream->pathLatencyUs() / 1000.0, 0, 'f', 1);
+    }
+
+    // Slowest hop below this node
+    qint64 slowestUs = -1;
+    const QStringList clients = m_server->clientIds();
+    for (const QString& clientId : clients) {
+        slowestUs = qMax(slowestUs, m_server->clientRoundTripUs(clientId) / 2);
+    }
+    QString downstream;
+    if (slowestUs >= 0) {
+        downstream = QString(", slowest client %1 ms").arg(slowestUs / 1000.0, 0, 'f', 1);
+    }
+
+    // Share of one core since the last report, to compare backends by
+    QString cpu;
+    qint64 cpuUs = cpuTimeUs();
+    qint64 elapsedUs = m_statsClock.restart() * 1000;
+    if (cpuUs >= 0 && elapsedUs > 0) {
+        cpu = QString(", CPU %1%").arg(100.0 * (cpuUs - m_statsCpuUs) / elapsedUs, 0, 'f', 1);
+    }
+    m_statsCpuUs = cpuUs;
+
+    qInfo().noquote() << QString("%1 clients%2%3, resident memory %4%5")
+        .arg(m_server->clientCount())
+        .arg(upstream, downstream)
+        .arg(formatBytes(residentMemory()), cpu);
+
+    if (m_statsFrames > 0) {
+        // Where a frame's time goes, to tell capture, encoder and sockets apart
+        auto stage = [this](const char* name, qint64 sumUs, qint64 maxUs) {
+            return QString("%1 %2/%3").arg(name)
+                .arg(sumUs / 1000.0 / m_statsFrames, 0, 'f', 1)
+                .arg(maxUs / 1000.0, 0, 'f', 1);
+        };
+        qInfo().noquote() << QString("%1 frames, mean/max ms: %2, %3, %4, %5, %6")
+            .arg(m_statsFrames)
+            .arg(stage("capture", m_statsFrameSum.captureUs, m_statsFrameMax.captureUs),
+                 stage("queue", m_statsFrameSum.queueUs, m_statsFrameMax.queueUs),
+                 stage("encode", m_statsFrameSum.encodeUs, m_statsFrameMax.encodeUs),
+                 stage("deliver", m_statsFrameSum.deliverUs, m_statsFrameMax.deliverUs),
+                 stage("send", m_statsFrameSum.sendUs, m_statsFrameMax.sendUs));
+        m_statsFrames = 0;
+        m_statsFrameSum = FrameTiming();
+        m_statsFrameMax = FrameTiming();
+    }
+}
+
+void Daemon::onFrameSent(const FrameTiming& timing)
+{
+    auto add = [](qint64 us, qint64& sum, qint64& max) {
+        sum += us;
+        max = qMax(max, us);
+    };
+    add(timing.captureUs, m_statsFrameSum.captureUs, m_statsFrameMax.captureUs);
+    add(timing.queueUs, m_statsFrameSum.queueUs, m_statsFrameMax.queueUs);
+    add(timing.encodeUs, m_statsFrameSum.encodeUs, m_statsFrameMax.encodeUs);
+    add(timing.deliverUs, m_statsFrameSum.deliverUs, m_statsFrameMax.deliverUs);
+    add(timing.sendUs, m_statsFrameSum.sendUs, m_statsFrameMax.sendUs);
+    ++m_statsFrames;
+}
+
+qint64 Daemon::residentMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
+
+    // "VmRSS:	    1234 kB"
+    const QList<QByteArray> lines = status.readAll().split('\n');
+    for (const QByteArray& line : lines) {
+        if (line.startsWith("VmRSS:")) {
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+    return -1;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return -1;
+    return static_cast<qint64>(counters.WorkingSetSize);
+#else
+    return -1;
+#endif
+}
+
+qint64 Daemon::cpuTimeUs()
+{
+#if defined(Q_OS_WIN)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return -1;
+    auto ticks = [](const FILETIME& time) {
+        return (static_cast<qint64>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) / 10; // 100 ns units
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return (static_cast<qint64>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+QString Daemon::formatBytes(qint64 bytes)
+{
+    if (bytes < 0) return "unknown";
+    if (bytes < 1024 * 1024) return QString("%1 KiB").arg(bytes / 1024);
+    return QString("%1 MiB").arg(bytes / (1024.0 * 1024.0), 0, 'f', 1);
+}
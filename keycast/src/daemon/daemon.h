@@ -0,0 +1,74 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "frameencoder.h"
+
+class Server;
+class Discovery;
+class InputCapture;
+class Client;
+class Relay;
+
+struct DaemonOptions {
+    int port = 45679;
+    QString password;
+    int ioThreads = 0;        // 0 = pick from the number of cores
+    QString backend = "qt";   // or "io_uring"
+    bool discovery = true;    // announce the server on the local network
+    bool broadcast = false;   // capture local input and send it to clients
+    bool screenShare = false; // needs a QGuiApplication
+    int statsInterval = 0;    // seconds between memory, CPU and frame timing reports, 0 = never
+    QString inputTarget = "all";  // "all" or @group names
+    QString screenShareTarget = "all";
+    // Relay mode: pass on what this upstream server sends, if set
+    QString upstreamAddress;
+    int upstreamPort = 45679;
+    QString upstreamPassword;
+};
+
+// Headless server: the networking and capture parts of Application,
+// without any windows or tray icon
+class Daemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Daemon(const DaemonOptions& options, QObject* parent = nullptr);
+    ~Daemon();
+
+    // false if the server could not listen
+    bool start();
+    void stop();
+
+    // Resident set size of this process in bytes, -1 where unsupported
+    static qint64 residentMemory();
+    // User plus system CPU time of this process, -1 where unsupported
+    static qint64 cpuTimeUs();
+    static QString formatBytes(qint64 bytes);
+
+private slots:
+    void onStatsTimer();
+    void onFrameSent(const FrameTiming& timing);
+
+private:
+    DaemonOptions m_options;
+    Server* m_server;
+    Discovery* m_discovery;
+    InputCapture* m_inputCapture;
+    Client* m_upstream = nullptr;
+    Relay* m_relay = nullptr;
+    QTimer* m_statsTimer;
+    QElapsedTimer m_statsClock; // since the last report
+    qint64 m_statsCpuUs = 0;
+    // Frames sent since the last report: per-stage sums and maxima
+    int m_statsFrames = 0;
+    FrameTiming m_statsFrameSum;
+    FrameTiming m_statsFrameMax;
+};
+
+#endif // DAEMON_H
@@ -0,0 +1,102 @@
+#include "daemon.h"
+#include "settings.h"
+
+#include <QCoreApplication>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QDebug>
+
+int main(int argc, char *argv[])
+{
+    QElapsedTimer startup;
+    startup.start();
+
+    // Screen capture needs a QGuiApplication; input-only broadcast gets by
+    // with QtCore. This has to be known before the parser can run.
+    bool screenShare = false;
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--screen-share") == 0) {
+            screenShare = true;
+        }
+    }
+
+    QScopedPointer<QCoreApplication> app(screenShare ? new QGuiApplication(argc, argv)
+                                                     : new QCoreApplication(argc, argv));
+    // Same name as the GUI, so both find the same certificate
+    QCoreApplication::setApplicationName("KeyCast");
+    QCoreApplication::setApplicationVersion("1.0.0");
+    QCoreApplication::setOrganizationName("KeyCast");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("KeyCast headless server");
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption configOption("config", "Read settings from <file> instead of the user's KeyCast settings.",
+                                    "file");
+    QCommandLineOption portOption(QStringList{"p", "port"}, "Listen on <port>.", "port");
+    QCommandLineOption passwordOption("password", "Require <password> from clients.", "password");
+    QCommandLineOption ioThreadsOption("io-threads", "Serve clients on <n> I/O threads, 0 for automatic.", "n");
+    QCommandLineOption backendOption("backend", "Serve sockets through <backend>: qt or io_uring.", "backend");
+    QCommandLineOption noDiscoveryOption("no-discovery", "Don't announce the server on the local network.");
+    QCommandLineOption broadcastOption("broadcast", "Capture local input and broadcast it to clients.");
+    QCommandLineOption screenShareOption("screen-share", "Share the screen with clients that ask for it.");
+    QCommandLineOption inputTargetOption("input-target",
+                                         "Send input to <targets>: all, or comma-separated @group names.",
+                                         "targets", "all");
+    QCommandLineOption screenTargetOption("screen-target",
+                                          "Share the screen with <targets>: all, or comma-separated @group names.",
+                                          "targets", "all");
+    QCommandLineOption relayOption("relay", "Relay the server at <host[:port]> to this server's clients.",
+                                   "host[:port]");
+    QCommandLineOption upstreamPasswordOption("upstream-password", "Password for the relayed server.",
+                                              "password");
+    QCommandLineOption statsOption("stats-interval", "Report memory, CPU use and frame timings every <seconds>.", "seconds", "0");
+    parser.addOptions({configOption, portOption, passwordOption, ioThreadsOption, backendOption, noDiscoveryOption,
+                       broadcastOption, screenShareOption, inputTargetOption, screenTargetOption, relayOption, upstreamPasswordOption, statsOption});
+    parser.process(*app);
+
+    // Flags override the config file
+    if (parser.isSet(configOption)) {
+        Settings::setConfigFile(parser.value(configOption));
+    }
+    Settings* settings = Settings::instance();
+
+    DaemonOptions options;
+    options.port = parser.isSet(portOption) ? parser.value(portOption).toInt() : settings->serverPort();
+    options.password = parser.isSet(passwordOption) ? parser.value(passwordOption) : settings->serverPassword();
+    options.ioThreads = parser.isSet(ioThreadsOption) ? parser.value(ioThreadsOption).toInt() : settings->ioThreads();
+    options.backend = parser.isSet(backendOption) ? parser.value(backendOption) : settings->networkBackend();
+    options.discovery = settings->enableDiscovery() && !parser.isSet(noDiscoveryOption);
+    options.broadcast = parser.isSet(broadcastOption);
+    options.screenShare = screenShare;
+    options.statsInterval = parser.value(statsOption).toInt();
+    options.inputTarget = parser.value(inputTargetOption);
+    options.screenShareTarget = parser.value(screenTargetOption);
+    if (parser.isSet(relayOption)) {
+        QString upstream = parser.value(relayOption);
+        int colon = upstream.lastIndexOf(':');
+        if (colon > 0) {
+            options.upstreamAddress = upstream.left(colon);
+            options.upstreamPort = upstream.mid(colon + 1).toInt();
+        } else {
+            options.upstreamAddress = upstream;
+            options.upstreamPort = options.port;
+        }
+        options.upstreamPassword = parser.value(upstreamPasswordOption);
+    }
+
+    Daemon daemon(options);
+    if (!daemon.start()) {
+        return 1;
+    }
+
+    qInfo().noquote() << QString("Listening on port %1, started in %2 ms, resident memory %3")
+        .arg(options.port)
+        .arg(startup.elapsed())
+        .arg(Daemon::formatBytes(Daemon::residentMemory()));
+
+    return app->exec();
+}
@@ -0,0 +1,224 @@
+#include "frameencoder.h"
+#include "protocol.h"
+#include "tilediff.h"
+
+#include <QBuffer>
+#include <QThread>
+
+namespace {
+
+// Dirty rectangle lists, where empty means the whole frame
+void mergeDirtyRects(QVector<QRect>& into, const QVector<QRect>& from)
+{
+    if (into.isEmpty() || from.isEmpty()) {
+        into.clear();
+    } else {
+        into += from;
+    }
+}
+
+} // namespace
+
+FrameEncoder::FrameEncoder(QObject* parent)
+    : QObject(parent)
+    , m_pool(new QThreadPool(this))
+{
+    // Leave cores for capture, the event loop and the rest of the system
+    m_pool->setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+}
+
+FrameEncoder::~FrameEncoder()
+{
+    clear();
+}
+
+void FrameEncoder::setMaxThreads(int threads)
+{
+    m_pool->setMaxThreadCount(qMax(1, threads));
+}
+
+void FrameEncoder::setQuality(int quality)
+{
+    m_quality = qBound(10, quality, 100);
+}
+
+void FrameEncoder::encode(const QImage& image, quint32 frameId, const QString& clientId, qint64 captureUs,
+                          Outputs outputs, const QVector<QRect>& dirtyRects)
+{
+    if (image.isNull()) return;
+
+    Job job;
+    job.image = image;
+    job.frameId = frameId;
+    job.clientId = clientId;
+    job.outputs = clientId.isEmpty() ? outputs : Outputs(Keyframe);
+    job.dirtyRects = dirtyRects;
+    job.timing.frameId = frameId;
+    job.timing.captureUs = captureUs;
+    job.queued.start();
+
+    if (job.clientId.isEmpty() && m_hasCarried) {
+        mergeDirtyRects(job.dirtyRects, m_carriedRects);
+        m_carriedRects.clear();
+        m_hasCarried = false;
+    }
+
+    if (m_running < m_pool->maxThreadCount()) {
+        startJob(job);
+        return;
+    }
+
+    // All threads busy; a frame already waiting is stale now. What changed
+    // in it still has to reach the clients, with the next frame for all of
+    // them: this one, or a later one if this is for a single client.
+    if (m_hasWaiting && m_waiting.clientId.isEmpty()) {
+        if (job.clientId.isEmpty()) {
+            mergeDirtyRects(job.dirtyRects, m_waiting.dirtyRects);
+        } else if (m_hasCarried) {
+            mergeDirtyRects(m_carriedRects, m_waiting.dirtyRects);
+        } else {
+            m_carriedRects = m_waiting.dirtyRects;
+            m_hasCarried = true;
+        }
+    }
+    m_waiting = job;
+    m_hasWaiting = true;
+}
+
+void FrameEncoder::clear()
+{
+    m_hasWaiting = false;
+    m_waiting = Job();
+    m_pool->waitForDone();
+    m_previous = QImage();
+    m_previousFrameId = 0;
+    m_carriedRects.clear();
+    m_hasCarried = false;
+}
+
+QByteArray FrameEncoder::encodeFrame(const QImage& image, quint32 frameId, int quality, qsizetype sizeHint)
+{
+    // Encode straight into the packet behind a reserved header
+    QByteArray packet = Protocol::beginScreenFramePacket(image.width(), image.height(), frameId, sizeHint);
+    QBuffer buffer(&packet);
+    buffer.open(QIODevice::WriteOnly | QIODevice::Append);
+    image.save(&buffer, "JPEG", quality);
+    buffer.close();
+
+    Protocol::finishScreenFramePacket(packet);
+    return packet;
+}
+
+QByteArray FrameEncoder::encodeDelta(const QImage& image, const QImage& previous, const QVector<QRect>& dirtyRects,
+                                     quint32 frameId, quint32 baseFrameId, int quality)
+{
+    if (!TileDiff::comparable(previous, image)) {
+        return encodeFrame(image, frameId, quality);
+    }
+
+    const QVector<QRect> regions = TileDiff::changedRegions(previous, image, dirtyRects);
+    qint64 changedArea = 0;
+    for (const QRect& region : regions) {
+        changedArea += qint64(region.width()) * region.height();
+    }
+    // Past this, one JPEG of everything is smaller than many of the parts
+    if (changedArea * 100 > qint64(image.width()) * image.height() * MAX_DELTA_AREA_PERCENT) {
+        return encodeFrame(image, frameId, quality);
+    }
+
+    QByteArray packet = Protocol::beginScreenRegionUpdatePacket(image.width(), image.height(), frameId, baseFrameId);
+    QBuffer buffer(&packet);
+    buffer.open(QIODevice::WriteOnly | QIODevice::Append);
+
+    const char placeholder[Protocol::SCREEN_REGION_HEADER_SIZE] = {};
+    for (const QRect& region : regions) {
+        qsizetype headerOffset = packet.size();
+        buffer.write(placeholder, sizeof(placeholder));
+
+        // A view of the region, not a copy
+        QImage part(image.constBits() + region.y() * image.bytesPerLine() + region.x() * 4,
+                    region.width(), region.height(), image.bytesPerLine(), image.format());
+        part.save(&buffer, "JPEG", quality);
+
+        quint32 dataSize = static_cast<quint32>(packet.size() - headerOffset - Protocol::SCREEN_REGION_HEADER_SIZE);
+        Protocol::writeScreenRegionHeader(packet.data() + headerOffset, region.x(), region.y(),
+                                          region.width(), region.height(), dataSize);
+    }
+    buffer.close();
+
+    Protocol::finishScreenRegionUpdatePacket(packet, regions.size());
+    return packet;
+}
+
+void FrameEncoder::startJob(Job job)
+{
+    quint64 sequence = m_nextSequence++;
+    m_running++;
+
+    job.timing.queueUs = job.queued.nsecsElapsed() / 1000;
+
+    // Chained in start order, which is also delivery order
+    if (job.clientId.isEmpty()) {
+        job.previous = m_previous;
+        job.previousFrameId = m_previousFrameId;
+        m_previous = job.image;
+        m_previousFrameId = job.frameId;
+    }
+
+    // Sized from the previous frame so the buffer rarely has to grow
+    qsizetype sizeHint = m_lastEncodedSize + m_lastEncodedSize / 4;
+    int quality = m_quality;
+
+    m_pool->start([this, job, sequence, sizeHint, quality]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        Result result;
+        if (job.outputs.testFlag(Delta)) {
+            result.frame.delta = encodeDelta(job.image, job.previous, job.dirtyRects, job.frameId,
+                                             job.previousFrameId, quality);
+        }
+        if (job.outputs.testFlag(Keyframe)) {
+            // The delta may already be one
+            Protocol::PacketHeader header;
+            bool deltaIsKeyframe = Protocol::parsePacketHeader(result.frame.delta, header) &&
+                                   header.type == Protocol::MessageType::ScreenFrame;
+            result.frame.keyframe = deltaIsKeyframe ? result.frame.delta
+                                                    : encodeFrame(job.image, job.frameId, quality, sizeHint);
+        }
+        result.clientId = job.clientId;
+        result.timing = job.timing;
+        result.timing.encodeUs = timer.nsecsElapsed() / 1000;
+        result.finished.start();
+
+        // Queued back to the encoder's thread; dropped if it is gone
+        QMetaObject::invokeMethod(this, [this, sequence, result]() {
+            jobFinished(sequence, result);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void FrameEncoder::jobFinished(quint64 sequence, Result result)
+{
+    m_running--;
+    m_finished.insert(sequence, result);
+
+    // A thread is free again
+    if (m_hasWaiting) {
+        m_hasWaiting = false;
+        startJob(m_waiting);
+        m_waiting = Job();
+    }
+
+    // Deliver in submission order
+    while (!m_finished.isEmpty() && m_finished.firstKey() == m_nextDelivery) {
+        Result next = m_finished.take(m_nextDelivery);
+        m_nextDelivery++;
+
+        if (!next.frame.keyframe.isEmpty()) {
+            m_lastEncodedSize = next.frame.keyframe.size() - Protocol::SCREEN_FRAME_HEADER_SIZE;
+        }
+        next.timing.deliverUs = next.finished.nsecsElapsed() / 1000;
+        emit frameEncoded(next.frame, next.clientId, next.timing);
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef FRAMEENCODER_H
+#define FRAMEENCODER_H
+
+#include <QObject>
+#include <QImage>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMetaType>
+#include <QRect>
+#include <QThreadPool>
+#include <QVector>
+
+// Time one frame spent in each stage of the screen sharing pipeline, in µs
+struct FrameTiming {
+    quint32 frameId = 0;
+    qint64 captureUs = 0; // grabbing and scaling the screen
+    qint64 queueUs = 0;   // waiting for a free encoder thread
+    qint64 encodeUs = 0;  // JPEG encoding into the packet
+    qint64 deliverUs = 0; // encoded until the event loop picked it up
+    qint64 sendUs = 0;    // handing the packet to the clients' send queues
+};
+Q_DECLARE_METATYPE(FrameTiming)
+
+// What one frame was encoded into; either packet may be empty
+struct EncodedFrame {
+    QByteArray keyframe; // ScreenFrame: the whole frame
+    // ScreenRegionUpdate against the previous frame for every client, or
+    // a ScreenFrame when there was nothing to compare with or most of the
+    // screen changed
+    QByteArray delta;
+};
+Q_DECLARE_METATYPE(EncodedFrame)
+
+// Encodes screen frames into ScreenFrame packets on worker threads, so the
+// event loop only ever hands finished buffers to sockets.
+//
+// At most maxThreads() frames are encoded at once; one more may wait for a
+// thread, and a newer frame replaces it rather than queuing behind it.
+// Encoded frames are delivered in submission order.
+//
+// Frames for every client form a chain: each one's delta holds the tiles
+// that differ from the frame started before it, whatever was asked of
+// that one. A frame replaced while waiting is not part of the chain; its
+// dirty rectangles carry over to the next frame for every client.
+class FrameEncoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Output {
+        Keyframe = 0x1,
+        Delta = 0x2
+    };
+    Q_DECLARE_FLAGS(Outputs, Output)
+
+    // Share of the frame that may change before a delta becomes a keyframe
+    static constexpr int MAX_DELTA_AREA_PERCENT = 50;
+
+    explicit FrameEncoder(QObject* parent = nullptr);
+    ~FrameEncoder();
+
+    int maxThreads() const { return m_pool->maxThreadCount(); }
+    void setMaxThreads(int threads);
+
+    int quality() const { return m_quality; }
+    void setQuality(int quality);
+
+    // Frames submitted but not yet delivered
+    int pendingFrames() const { return m_running + m_finished.size() + (m_hasWaiting ? 1 : 0); }
+
+    // clientId is passed through to frameEncoded(); empty means every client.
+    // captureUs is the time the capture stage took, for the frame's timing.
+    // Deltas are only made for every client's frames; dirtyRects says where
+    // to look for changes, empty meaning everywhere.
+    void encode(const QImage& image, quint32 frameId, const QString& clientId = QString(), qint64 captureUs = 0,
+                Outputs outputs = Keyframe, const QVector<QRect>& dirtyRects = QVector<QRect>());
+
+    // Drop the waiting frame, wait for running encodes to finish and start
+    // a new chain
+    void clear();
+
+    // Encodes synchronously; sizeHint pre-sizes the packet
+    static QByteArray encodeFrame(const QImage& image, quint32 frameId, int quality, qsizetype sizeHint = 0);
+    // ScreenRegionUpdate with the tiles of image that differ from previous,
+    // or a ScreenFrame (see EncodedFrame::delta)
+    static QByteArray encodeDelta(const QImage& image, const QImage& previous, const QVector<QRect>& dirtyRects,
+                                  quint32 frameId, quint32 baseFrameId, int quality);
+
+signals:
+    void frameEncoded(const EncodedFrame& frame, const QString& clientId, const FrameTiming& timing);
+
+private:
+    struct Job {
+        QImage image;
+        quint32 frameId = 0;
+        QString clientId;
+        Outputs outputs = Keyframe;
+        QVector<QRect> dirtyRects;
+        QImage previous; // the frame before in the chain
+        quint32 previousFrameId = 0;
+        FrameTiming timing;
+        QElapsedTimer queued;
+    };
+
+    struct Result {
+        EncodedFrame frame;
+        QString clientId;
+        FrameTiming timing;
+        QElapsedTimer finished;
+    };
+
+    void startJob(Job job);
+    void jobFinished(quint64 sequence, Result result);
+
+    QThreadPool* m_pool;
+    int m_quality = 70;
+    int m_running = 0;
+
+    Job m_waiting;
+    bool m_hasWaiting = false;
+
+    quint64 m_nextSequence = 0;  // assigned when a job starts
+    quint64 m_nextDelivery = 0;  // next sequence to emit
+    QMap<quint64, Result> m_finished; // done but waiting for an earlier frame
+
+    QImage m_previous; // last frame of the chain started
+    quint32 m_previousFrameId = 0;
+    // Of every-client frames replaced by a single client's, for the next
+    // every-client frame
+    QVector<QRect> m_carriedRects;
+    bool m_hasCarried = false;
+
+    qsizetype m_lastEncodedSize = 0;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FrameEncoder::Outputs)
+
+#endif // FRAMEENCODER_H
@@ -4,6 +4,31 @@
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QResizeEvent>
+#include <QPainterPath>
+
+// Stand-in for pointers whose shape the remote end can't tell
+static QImage defaultCursor()
+{
+    QImage image(12, 19, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainterPath arrow;
+    arrow.moveTo(0.5, 0.5);
+    arrow.lineTo(0.5, 16.5);
+    arrow.lineTo(4.5, 12.5);
+    arrow.lineTo(7.5, 18.5);
+    arrow.lineTo(9.5, 17.5);
+    arrow.lineTo(6.5, 11.5);
+    arrow.lineTo(11.5, 11.5);
+    arrow.closeSubpath();
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(Qt::white);
+    painter.setBrush(Qt::black);
+    painter.drawPath(arrow);
+    return image;
+}
 
 RemoteDesktopWidget::RemoteDesktopWidget(QWidget* parent)
     : QWidget(parent)
@@ -17,6 +42,8 @@ RemoteDesktopWidget::RemoteDesktopWidget(QWidget* parent)
     QPalette pal = palette();
     pal.setColor(QPalette::Window, QColor(30, 30, 30));
     setPalette(pal);
+
+    m_cursorShape = defaultCursor();
 }
 
 void RemoteDesktopWidget::setConnected(bool connected)
@@ -54,9 +81,47 @@ void RemoteDesktopWidget::clear()
     m_frame = QImage();
     m_scaledFrame = QImage();
     m_remoteSize = QSize();
+    m_cursorVisible = false;
     update();
 }
 
+void RemoteDesktopWidget::setCursorShape(const QImage& shape, const QPoint& hotspot)
+{
+    if (m_cursorVisible) {
+        update(cursorRect().toAlignedRect());
+    }
+
+    m_cursorShape = shape.isNull() ? defaultCursor() : shape;
+    m_cursorHotspot = shape.isNull() ? QPoint() : hotspot;
+
+    if (m_cursorVisible) {
+        update(cursorRect().toAlignedRect());
+    }
+}
+
+void RemoteDesktopWidget::setCursorPosition(const QPoint& position, bool visible)
+{
+    if (position == m_cursorPosition && visible == m_cursorVisible) return;
+
+    // Only the pixels under the old and new pointer are repainted
+    if (m_cursorVisible) {
+        update(cursorRect().toAlignedRect());
+    }
+    m_cursorPosition = position;
+    m_cursorVisible = visible;
+    if (m_cursorVisible) {
+        update(cursorRect().toAlignedRect());
+    }
+}
+
+QRectF RemoteDesktopWidget::cursorRect() const
+{
+    if (m_displayRect.isEmpty()) return QRectF();
+
+    QPointF topLeft = QPointF(m_displayRect.topLeft()) + QPointF(m_cursorPosition - m_cursorHotspot) * m_scale;
+    return QRectF(topLeft, QSizeF(m_cursorShape.size()) * m_scale);
+}
+
 void RemoteDesktopWidget::updateScaledFrame()
 {
     if (m_frame.isNull()) {
@@ -146,6 +211,14 @@ void RemoteDesktopWidget::paintEvent(QPaintEvent* event)
     // Draw the frame
     painter.drawImage(m_displayRect.topLeft(), m_scaledFrame);
 
+    // and the pointer over it, which frames leave out
+    if (m_cursorVisible) {
+        painter.save();
+        painter.setClipRect(m_displayRect);
+        painter.drawImage(cursorRect(), m_cursorShape);
+        painter.restore();
+    }
+
     // Draw border if focused
     if (m_hasFocus && m_controlEnabled) {
         painter.setPen(QPen(QColor(0, 120, 215), 2));
@@ -27,6 +27,10 @@ public slots:
     void setConnected(bool connected);
     void updateFrame(const QImage& frame);
     void clear();
+    // The remote pointer, drawn over the frame at its own pace, so it moves
+    // without waiting for a new frame. Null shape draws a plain arrow.
+    void setCursorShape(const QImage& shape, const QPoint& hotspot);
+    void setCursorPosition(const QPoint& position, bool visible);
 
 signals:
     void keyPressed(int key, Qt::KeyboardModifiers modifiers);
@@ -53,11 +57,18 @@ protected:
 private:
     QPoint mapToRemote(const QPoint& localPos) const;
     void updateScaledFrame();
+    // Where the remote pointer is drawn, in widget coordinates
+    QRectF cursorRect() const;
 
     QImage m_frame;
     QImage m_scaledFrame;
     QSize m_remoteSize;
 
+    QImage m_cursorShape;
+    QPoint m_cursorHotspot;
+    QPoint m_cursorPosition; // remote pixels
+    bool m_cursorVisible = false;
+
     bool m_connected = false;
     bool m_controlEnabled = true;
     bool m_scaleToFit = true;
@@ -23,14 +23,23 @@ RemoteDesktopWindow::RemoteDesktopWindow(Client* client, QWidget* parent)
 
     // Status bar
     m_statusLabel = new QLabel("Disconnected");
+    m_bitrateLabel = new QLabel("0 kbit/s");
+    // Shown once the server says what it sends at
+    m_qualityLabel = new QLabel;
+    m_qualityLabel->hide();
     m_fpsLabel = new QLabel("0 FPS");
     statusBar()->addWidget(m_statusLabel);
+    statusBar()->addPermanentWidget(m_bitrateLabel);
+    statusBar()->addPermanentWidget(m_qualityLabel);
     statusBar()->addPermanentWidget(m_fpsLabel);
 
     // Connect to client signals
     connect(m_client, &Client::connected, this, &RemoteDesktopWindow::onConnected);
     connect(m_client, &Client::disconnected, this, &RemoteDesktopWindow::onDisconnected);
     connect(m_client, &Client::screenFrameReceived, this, &RemoteDesktopWindow::onScreenFrame);
+    connect(m_client, &Client::screenShareParamsChanged, this, &RemoteDesktopWindow::onScreenShareParams);
+    connect(m_client, &Client::cursorShapeChanged, m_desktopWidget, &RemoteDesktopWidget::setCursorShape);
+    connect(m_client, &Client::cursorMoved, m_desktopWidget, &RemoteDesktopWidget::setCursorPosition);
 
     // Connect input signals from widget
     connect(m_desktopWidget, &RemoteDesktopWidget::keyPressed, this, &RemoteDesktopWindow::onKeyPressed);
@@ -81,6 +90,7 @@ void RemoteDesktopWindow::startViewing()
     m_viewing = true;
     m_frameCount = 0;
     m_lastFpsTime = QDateTime::currentMSecsSinceEpoch();
+    m_lastFrameBytes = m_client->frameBytesReceived();
 
     if (m_client->isAuthenticated()) {
         m_client->requestScreenShare(true);
@@ -123,6 +133,7 @@ void RemoteDesktopWindow::onDisconnected()
 {
     m_desktopWidget->setConnected(false);
     m_desktopWidget->clear();
+    m_qualityLabel->hide();
     updateStatusBar();
 }
 
@@ -134,17 +145,35 @@ void RemoteDesktopWindow::onScreenFrame(const QImage& frame, quint32 frameId)
 
     m_desktopWidget->updateFrame(frame);
 
-    // Calculate FPS
+    // Calculate FPS and bitrate
     m_frameCount++;
     qint64 now = QDateTime::currentMSecsSinceEpoch();
     if (now - m_lastFpsTime >= 1000) {
         int fps = m_frameCount * 1000 / (now - m_lastFpsTime);
         m_fpsLabel->setText(QString("%1 FPS").arg(fps));
+
+        quint64 bytes = m_client->frameBytesReceived();
+        double kbits = (bytes - m_lastFrameBytes) * 8.0 / (now - m_lastFpsTime);
+        m_bitrateLabel->setText(kbits >= 1000 ? QString("%1 Mbit/s").arg(kbits / 1000, 0, 'f', 1)
+                                              : QString("%1 kbit/s").arg(qRound(kbits)));
+        m_lastFrameBytes = bytes;
+
         m_frameCount = 0;
         m_lastFpsTime = now;
     }
 }
 
+void RemoteDesktopWindow::onScreenShareParams(int frameRate, int quality, int scalePercent)
+{
+    QString text = QString("Quality %1").arg(quality);
+    if (scalePercent < 100) {
+        text += QString(", %1% size").arg(scalePercent);
+    }
+    m_qualityLabel->setText(text);
+    m_qualityLabel->setToolTip(QString("The server sends up to %1 FPS").arg(frameRate));
+    m_qualityLabel->show();
+}
+
 void RemoteDesktopWindow::onToggleControl()
 {
     bool enabled = m_controlAction->isChecked();
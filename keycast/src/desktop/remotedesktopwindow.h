@@ -28,6 +28,7 @@ private slots:
     void onConnected();
     void onDisconnected();
     void onScreenFrame(const QImage& frame, quint32 frameId);
+    void onScreenShareParams(int frameRate, int quality, int scalePercent);
     void onToggleControl();
     void onToggleScaling();
     void onFullscreen();
@@ -55,11 +56,14 @@ private:
     QAction* m_fullscreenAction;
 
     QLabel* m_statusLabel;
+    QLabel* m_bitrateLabel;
+    QLabel* m_qualityLabel;
     QLabel* m_fpsLabel;
 
     bool m_viewing = false;
     int m_frameCount = 0;
     qint64 m_lastFpsTime = 0;
+    quint64 m_lastFrameBytes = 0;
 };
 
 #endif // REMOTEDESKTOPWINDOW_H
@@ -2,21 +2,62 @@
 #include <QGuiApplication>
 #include <QScreen>
 #include <QPixmap>
+#include <QCursor>
 
 #ifdef Q_OS_WIN
 #include <windows.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#include "x11shmcapture.h"
+#include "x11damagetracker.h"
+#include "x11cursortracker.h"
+#endif
+
 ScreenCapture::ScreenCapture(QObject* parent)
     : QObject(parent)
     , m_captureTimer(new QTimer(this))
+    , m_cursorTimer(new QTimer(this))
 {
     connect(m_captureTimer, &QTimer::timeout, this, &ScreenCapture::captureFrame);
+    connect(m_cursorTimer, &QTimer::timeout, this, &ScreenCapture::pollCursor);
 }
 
 ScreenCapture::~ScreenCapture()
 {
     stop();
+#ifdef Q_OS_LINUX
+    delete m_shmCapture;
+    delete m_damageTracker;
+    delete m_cursorTracker;
+#endif
+}
+
+void ScreenCapture::setBackend(Backend backend)
+{
+    m_backend = backend;
+    m_shmUnavailable = false;
+}
+
+void ScreenCapture::setDamageTracking(bool enabled)
+{
+    m_damageTracking = enabled;
+    m_damageUnavailable = false;
+    m_fullFrame = true;
+}
+
+void ScreenCapture::setCursorTracking(bool enabled)
+{
+    m_cursorTracking = enabled;
+    m_cursorUnavailable = false;
+    m_cursorReported = false;
+
+    if (!m_capturing) return;
+    if (enabled) {
+        m_cursorTimer->start(CURSOR_INTERVAL_MS);
+    } else {
+        m_cursorTimer->stop();
+    }
 }
 
 void ScreenCapture::setFrameRate(int fps)
@@ -35,6 +76,18 @@ void ScreenCapture::setQuality(int quality)
 void ScreenCapture::setCaptureSize(const QSize& size)
 {
     m_captureSize = size;
+    m_fullFrame = true;
+    m_cursorReported = false;
+}
+
+void ScreenCapture::setScalePercent(int percent)
+{
+    percent = qBound(10, percent, 100);
+    if (percent == m_scalePercent) return;
+
+    m_scalePercent = percent;
+    m_fullFrame = true;
+    m_cursorReported = false;
 }
 
 void ScreenCapture::setScreenIndex(int index)
@@ -42,12 +95,27 @@ void ScreenCapture::setScreenIndex(int index)
     QList<QScreen*> screens = QGuiApplication::screens();
     if (index >= 0 && index < screens.size()) {
         m_screenIndex = index;
+        m_fullFrame = true;
+        m_cursorReported = false;
     }
 }
 
 void ScreenCapture::setCaptureRegion(const QRect& region)
 {
     m_captureRegion = region;
+    m_fullFrame = true;
+    m_cursorReported = false;
+}
+
+void ScreenCapture::setPaused(bool paused)
+{
+    if (m_paused == paused) return;
+
+    m_paused = paused;
+    if (!m_paused && m_capturing && m_missedFrame &&
+        (!m_lastCapture.isValid() || m_lastCapture.elapsed() >= m_captureTimer->interval())) {
+        captureFrame();
+    }
 }
 
 void ScreenCapture::start()
@@ -55,7 +123,14 @@ void ScreenCapture::start()
     if (m_capturing) return;
 
     m_capturing = true;
+    m_fullFrame = true;
     m_captureTimer->start(1000 / m_frameRate);
+
+    // Not paused along with capture: moving the pointer costs no frame
+    m_cursorReported = false;
+    if (m_cursorTracking) {
+        m_cursorTimer->start(CURSOR_INTERVAL_MS);
+    }
 }
 
 void ScreenCapture::stop()
@@ -63,35 +138,130 @@ void ScreenCapture::stop()
     if (!m_capturing) return;
 
     m_capturing = false;
+    m_missedFrame = false;
     m_captureTimer->stop();
+    m_cursorTimer->stop();
+
+#ifdef Q_OS_LINUX
+    // Shared memory segments are a few MB each; give them back while idle
+    if (m_shmCapture) {
+        m_shmCapture->close();
+    }
+    if (m_damageTracker) {
+        m_damageTracker->close();
+    }
+    if (m_cursorTracker) {
+        m_cursorTracker->close();
+    }
+    m_damage.clear();
+#endif
 }
 
 void ScreenCapture::captureFrame()
 {
+    if (m_paused) {
+        m_missedFrame = true;
+        return;
+    }
+
+    m_missedFrame = false;
+    ++m_captureTicks;
+
+    // An idle screen costs neither a grab nor an encode
+    QRect area = captureArea();
+    if (!collectDamage(area)) return;
+
+    m_lastCapture.start();
+
     QImage frame = captureScreen();
     if (!frame.isNull()) {
-        if (!m_captureSize.isEmpty()) {
-            frame = scaleImage(frame);
+        frame = scaleImage(frame);
+        QVector<QRect> dirty = dirtyRects(area, frame.size());
+        // Damage stays pending until a frame actually carries it
+        m_damage.clear();
+        m_fullFrame = false;
+
+        m_lastCaptureUs = m_lastCapture.nsecsElapsed() / 1000;
+        ++m_capturedFrames;
+        emit frameCaptured(frame, dirty);
+    }
+}
+
+void ScreenCapture::pollCursor()
+{
+    QRect area = captureArea();
+    if (area.isEmpty()) return;
+
+    QPoint position;
+    bool onScreen = true;
+    bool shapeChanged = !m_cursorReported;
+    QImage shape;
+    QPoint hotspot;
+#ifdef Q_OS_LINUX
+    if (X11CursorTracker* tracker = cursorTracker()) {
+        onScreen = tracker->position(position);
+        if (tracker->takeShapeChange() || shapeChanged) {
+            shape = tracker->shape(hotspot);
+            shapeChanged = true;
+        }
+    } else {
+        position = QCursor::pos();
+    }
+#else
+    position = QCursor::pos();
+#endif
+
+    bool visible = onScreen && area.contains(position);
+    if (!shapeChanged && !visible && !m_cursorVisible) return;
+
+    QSize size = frameSize(area);
+    double scaleX = double(size.width()) / area.width();
+    double scaleY = double(size.height()) / area.height();
+    QPoint framePosition(int((position.x() - area.x()) * scaleX), int((position.y() - area.y()) * scaleY));
+
+    if (shapeChanged) {
+        // Scaled with the frame, so it covers what it covers on screen
+        if (!shape.isNull() && size != area.size()) {
+            shape = shape.scaled(qMax(1, qRound(shape.width() * scaleX)), qMax(1, qRound(shape.height() * scaleY)),
+                                 Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            hotspot = QPoint(qRound(hotspot.x() * scaleX), qRound(hotspot.y() * scaleY));
         }
-        emit frameCaptured(frame);
+        emit cursorShapeChanged(shape, hotspot);
+    } else if (framePosition == m_cursorPosition && visible == m_cursorVisible) {
+        return;
     }
+
+    m_cursorPosition = framePosition;
+    m_cursorVisible = visible;
+    m_cursorReported = true;
+    emit cursorMoved(framePosition, visible);
 }
 
-QImage ScreenCapture::captureScreen()
+QScreen* ScreenCapture::targetScreen() const
 {
     QList<QScreen*> screens = QGuiApplication::screens();
-    if (screens.isEmpty()) {
-        emit error("No screens available");
-        return QImage();
+    if (m_screenIndex >= 0 && m_screenIndex < screens.size()) {
+        return screens[m_screenIndex];
     }
+    return QGuiApplication::primaryScreen();
+}
 
-    QScreen* screen = nullptr;
-    if (m_screenIndex >= 0 && m_screenIndex < screens.size()) {
-        screen = screens[m_screenIndex];
-    } else {
-        screen = QGuiApplication::primaryScreen();
+QRect ScreenCapture::captureArea() const
+{
+    if (m_captureRegion.isValid()) return m_captureRegion;
+
+    QScreen* screen = targetScreen();
+    return screen ? screen->geometry() : QRect();
+}
+
+QImage ScreenCapture::captureScreen()
+{
+    if (QGuiApplication::screens().isEmpty()) {
+        emit error("No screens available");
+        return QImage();
     }
 
+    QScreen* screen = targetScreen();
     if (!screen) {
         emit error("Failed to get screen");
         return QImage();
@@ -148,17 +318,182 @@ QImage ScreenCapture::captureScreen()
 
     return image;
 #else
-    // Use Qt for other platforms
     QRect grabRect = m_captureRegion.isValid() ? m_captureRegion : screen->geometry();
+
+#ifdef Q_OS_LINUX
+    // Null when every buffer is still being encoded: that frame is skipped
+    if (X11ShmCapture* shm = shmCapture(screen)) {
+        m_activeBackend = Backend::XShm;
+        return shm->grab(grabRect);
+    }
+#endif
+
+    // Qt on other platforms, and where XShm can't be used
+    m_activeBackend = Backend::QtGrab;
     QPixmap pixmap = screen->grabWindow(0, grabRect.x(), grabRect.y(),
                                          grabRect.width(), grabRect.height());
     return pixmap.toImage();
 #endif
 }
 
+X11ShmCapture* ScreenCapture::shmCapture(QScreen* screen)
+{
+#ifdef Q_OS_LINUX
+    // X pixels are Qt's only without scaling, and only xcb means X at all
+    if (m_backend == Backend::QtGrab || m_shmUnavailable ||
+        QGuiApplication::platformName() != "xcb" || screen->devicePixelRatio() != 1.0) {
+        return nullptr;
+    }
+
+    if (!m_shmCapture) {
+        m_shmCapture = new X11ShmCapture;
+    }
+    if (!m_shmCapture->isOpen() && !m_shmCapture->open()) {
+        m_shmUnavailable = true;
+        if (m_backend == Backend::XShm) {
+            emit error("MIT-SHM capture is not available, using Qt");
+        }
+        return nullptr;
+    }
+    return m_shmCapture;
+#else
+    Q_UNUSED(screen)
+    return nullptr;
+#endif
+}
+
+X11DamageTracker* ScreenCapture::damageTracker()
+{
+#ifdef Q_OS_LINUX
+    // Damage is in X pixels, which are Qt's only without scaling
+    QScreen* screen = targetScreen();
+    if (!m_damageTracking || m_damageUnavailable || !screen ||
+        QGuiApplication::platformName() != "xcb" || screen->devicePixelRatio() != 1.0) {
+        return nullptr;
+    }
+
+    if (!m_damageTracker) {
+        m_damageTracker = new X11DamageTracker;
+    }
+    if (!m_damageTracker->isOpen()) {
+        if (!m_damageTracker->open()) {
+            m_damageUnavailable = true;
+            emit error("XDamage is not available, capturing every frame");
+            return nullptr;
+        }
+        // Changes before the tracker existed are unknown
+        m_fullFrame = true;
+    }
+    return m_damageTracker;
+#else
+    return nullptr;
+#endif
+}
+
+X11CursorTracker* ScreenCapture::cursorTracker()
+{
+#ifdef Q_OS_LINUX
+    // Root window coordinates are Qt's only without scaling
+    QScreen* screen = targetScreen();
+    if (m_cursorUnavailable || !screen ||
+        QGuiApplication::platformName() != "xcb" || screen->devicePixelRatio() != 1.0) {
+        return nullptr;
+    }
+
+    if (!m_cursorTracker) {
+        m_cursorTracker = new X11CursorTracker;
+    }
+    if (!m_cursorTracker->isOpen() && !m_cursorTracker->open()) {
+        m_cursorUnavailable = true;
+        emit error("XFixes cursor shapes are not available, showing a default pointer");
+        return nullptr;
+    }
+    return m_cursorTracker;
+#else
+    return nullptr;
+#endif
+}
+
+bool ScreenCapture::collectDamage(const QRect& area)
+{
+#ifdef Q_OS_LINUX
+    X11DamageTracker* tracker = damageTracker();
+    if (!tracker) {
+        m_fullFrame = true;
+        return true;
+    }
+
+    m_damage += tracker->takeDamage();
+    if (m_fullFrame) return true;
+
+    for (const QRect& rect : m_damage) {
+        if (rect.intersects(area)) return true;
+    }
+    // Only changes elsewhere on the screen
+    m_damage.clear();
+    return false;
+#else
+    Q_UNUSED(area)
+    m_fullFrame = true;
+    return true;
+#endif
+}
+
+QVector<QRect> ScreenCapture::dirtyRects(const QRect& area, const QSize& frameSize) const
+{
+    QVector<QRect> rects;
+    if (m_fullFrame || area.isEmpty()) return rects;
+
+    double scaleX = double(frameSize.width()) / area.width();
+    double scaleY = double(frameSize.height()) / area.height();
+    QRect frameRect(QPoint(0, 0), frameSize);
+    QRect bounds;
+
+    for (const QRect& damaged : m_damage) {
+        QRect rect = damaged.intersected(area).translated(-area.topLeft());
+        if (rect.isEmpty()) continue;
+
+        // Grown to whole pixels so scaled edges are covered
+        rect = QRectF(rect.x() * scaleX, rect.y() * scaleY, rect.width() * scaleX, rect.height() * scaleY)
+                   .toAlignedRect()
+                   .intersected(frameRect);
+        if (rect.isEmpty()) continue;
+        rects.append(rect);
+        bounds |= rect;
+    }
+
+    if (rects.isEmpty()) {
+        // Empty after all (scaled away): the whole frame is the safe answer
+        return rects;
+    }
+
+    // Too many to track one by one: their bounding box, a single region
+    // for the encoder to compare and send
+    if (rects.size() > MAX_DIRTY_RECTS) {
+        rects = { bounds };
+    }
+    return rects;
+}
+
+QSize ScreenCapture::frameSize(const QRect& area) const
+{
+    return scaledSize(area.size());
+}
+
+QSize ScreenCapture::scaledSize(const QSize& size) const
+{
+    QSize scaled = m_captureSize.isEmpty() ? size : size.scaled(m_captureSize, Qt::KeepAspectRatio);
+    if (m_scalePercent < 100) {
+        scaled = QSize(qMax(1, scaled.width() * m_scalePercent / 100), qMax(1, scaled.height() * m_scalePercent / 100));
+    }
+    return scaled;
+}
+
 QImage ScreenCapture::scaleImage(const QImage& image)
 {
-    if (image.isNull() || m_captureSize.isEmpty()) return image;
+    if (image.isNull()) return image;
 
-    return image.scaled(m_captureSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    QSize size = scaledSize(image.size());
+    if (size == image.size()) return image;
+    return image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 }
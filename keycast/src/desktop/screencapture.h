@@ -5,16 +5,61 @@
 #include <QImage>
 #include <QTimer>
 #include <QScreen>
+#include <QElapsedTimer>
+#include <QVector>
+
+class X11ShmCapture;
+class X11DamageTracker;
+class X11CursorTracker;
 
 class ScreenCapture : public QObject
 {
     Q_OBJECT
 
 public:
+    // How frames are grabbed on Linux; elsewhere there is only one way.
+    // Auto takes XShm where the display supports it.
+    enum class Backend {
+        Auto,
+        QtGrab, // QScreen::grabWindow
+        XShm,   // MIT-SHM shared memory images
+    };
+
     explicit ScreenCapture(QObject* parent = nullptr);
     ~ScreenCapture();
 
+    Backend backend() const { return m_backend; }
+    void setBackend(Backend backend);
+    // What grabbed the last frame; falls back to QtGrab without XShm
+    Backend activeBackend() const { return m_activeBackend; }
+
+    // Linux: follow screen changes through XDamage, skip ticks on which
+    // nothing in the capture area changed and report what did change with
+    // each frame. Without XDamage every tick is a whole frame, as before.
+    bool damageTracking() const { return m_damageTracking; }
+    void setDamageTracking(bool enabled);
+    // The next tick captures even if nothing changed, and reports the
+    // whole frame as dirty: for a new viewer, or after one lost a frame
+    void requestFullFrame() { m_fullFrame = true; }
+    static constexpr int MAX_DIRTY_RECTS = 64; // more are merged into their bounds
+
+    // Report the pointer apart from the frames, which never show it: its
+    // position whenever it moves, polled at input rate rather than the
+    // frame rate, and its shape when that changes. Shapes come from XFixes
+    // on Linux; elsewhere only the position is known.
+    bool cursorTracking() const { return m_cursorTracking; }
+    void setCursorTracking(bool enabled);
+    static constexpr int CURSOR_INTERVAL_MS = 16;
+
     bool isCapturing() const { return m_capturing; }
+
+    // While paused the timer keeps running but nothing is grabbed; a tick
+    // missed while paused is made up as soon as capture resumes
+    bool isPaused() const { return m_paused; }
+    void setPaused(bool paused);
+
+    // Time the last frame took to grab and scale, in µs
+    qint64 lastCaptureUs() const { return m_lastCaptureUs; }
     int frameRate() const { return m_frameRate; }
     void setFrameRate(int fps);
 
@@ -23,6 +68,15 @@ public:
 
     QSize captureSize() const { return m_captureSize; }
     void setCaptureSize(const QSize& size);
+    // Percent of the capture size frames are scaled to, for the stream to
+    // trade resolution for bandwidth
+    int scalePercent() const { return m_scalePercent; }
+    void setScalePercent(int percent);
+
+    // Ticks on which capture was not paused, and frames those produced;
+    // fewer frames than ticks means damage tracking found nothing new
+    quint64 captureTicks() const { return m_captureTicks; }
+    quint64 capturedFrames() const { return m_capturedFrames; }
 
     int screenIndex() const { return m_screenIndex; }
     void setScreenIndex(int index);
@@ -36,21 +90,68 @@ public slots:
     void captureFrame();
 
 signals:
-    void frameCaptured(const QImage& frame);
+    // dirtyRects are in frame pixels; empty means the whole frame
+    void frameCaptured(const QImage& frame, const QVector<QRect>& dirtyRects);
+    // In frame pixels, always followed by cursorMoved. A null shape means
+    // the viewer's default pointer.
+    void cursorShapeChanged(const QImage& shape, const QPoint& hotspot);
+    // In frame pixels; visible is false outside the captured area
+    void cursorMoved(const QPoint& position, bool visible);
     void error(const QString& message);
 
 private:
+    QScreen* targetScreen() const;
+    // Root window area the frame shows; null without a screen
+    QRect captureArea() const;
     QImage captureScreen();
     QImage scaleImage(const QImage& image);
+    // Size of a frame of the given size after scaling
+    QSize scaledSize(const QSize& size) const;
+    // XShm grabber if the backend and display allow, opened on first use
+    X11ShmCapture* shmCapture(QScreen* screen);
+    X11DamageTracker* damageTracker();
+    // false if damage tracking is on and nothing in area changed
+    bool collectDamage(const QRect& area);
+    QVector<QRect> dirtyRects(const QRect& area, const QSize& frameSize) const;
+    // Size of the frames captured from area, after scaling
+    QSize frameSize(const QRect& area) const;
+    void pollCursor();
+    X11CursorTracker* cursorTracker();
 
     QTimer* m_captureTimer;
+    QElapsedTimer m_lastCapture;
+    qint64 m_lastCaptureUs = 0;
     bool m_capturing = false;
+    bool m_paused = false;
+    bool m_missedFrame = false;
+    quint64 m_captureTicks = 0;
+    quint64 m_capturedFrames = 0;
 
     int m_frameRate = 15;       // FPS
     int m_quality = 70;         // JPEG quality
     QSize m_captureSize;        // Output size (empty = original)
+    int m_scalePercent = 100;   // of the output size
     int m_screenIndex = 0;      // Which screen to capture
     QRect m_captureRegion;      // Region to capture (empty = full screen)
+
+    Backend m_backend = Backend::Auto;
+    Backend m_activeBackend = Backend::QtGrab;
+    X11ShmCapture* m_shmCapture = nullptr;
+    bool m_shmUnavailable = false; // tried once, not supported here
+
+    bool m_damageTracking = false;
+    X11DamageTracker* m_damageTracker = nullptr;
+    bool m_damageUnavailable = false;
+    bool m_fullFrame = true;  // next frame goes out whole
+    QVector<QRect> m_damage;  // root window rectangles not sent yet
+
+    bool m_cursorTracking = false;
+    QTimer* m_cursorTimer;
+    X11CursorTracker* m_cursorTracker = nullptr;
+    bool m_cursorUnavailable = false;
+    bool m_cursorReported = false; // shape and position sent at the current scale
+    QPoint m_cursorPosition;
+    bool m_cursorVisible = false;
 };
 
 #endif // SCREENCAPTURE_H
@@ -0,0 +1,145 @@
+#include "tilediff.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KEYCAST_TILEDIFF_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define KEYCAST_TILEDIFF_NEON
+#endif
+
+namespace TileDiff {
+
+static bool rowDiffers(const uchar* a, const uchar* b, int bytes)
+{
+    int i = 0;
+
+#if defined(KEYCAST_TILEDIFF_SSE2)
+    // OR of XORs, tested once per row: a full tile row is 16 loads per side
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 64 <= bytes; i += 64) {
+        __m128i x0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        __m128i x1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 16)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 16)));
+        __m128i x2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 32)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 32)));
+        __m128i x3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 48)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i + 48)));
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3)));
+    }
+    for (; i + 16 <= bytes; i += 16) {
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i))));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return true;
+#elif defined(KEYCAST_TILEDIFF_NEON)
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (; i + 64 <= bytes; i += 64) {
+        uint8x16_t x0 = veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        uint8x16_t x1 = veorq_u8(vld1q_u8(a + i + 16), vld1q_u8(b + i + 16));
+        uint8x16_t x2 = veorq_u8(vld1q_u8(a + i + 32), vld1q_u8(b + i + 32));
+        uint8x16_t x3 = veorq_u8(vld1q_u8(a + i + 48), vld1q_u8(b + i + 48));
+        acc = vorrq_u8(acc, vorrq_u8(vorrq_u8(x0, x1), vorrq_u8(x2, x3)));
+    }
+    for (; i + 16 <= bytes; i += 16) {
+        acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    uint64x2_t lanes = vreinterpretq_u64_u8(acc);
+    if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0) return true;
+#endif
+
+    // The last pixels of a tile cut off by the frame edge
+    return i < bytes && memcmp(a + i, b + i, bytes - i) != 0;
+}
+
+bool differs(const uchar* a, qsizetype strideA, const uchar* b, qsizetype strideB, int bytes, int rows)
+{
+    for (int row = 0; row < rows; ++row) {
+        if (rowDiffers(a + row * strideA, b + row * strideB, bytes)) return true;
+    }
+    return false;
+}
+
+bool comparable(const QImage& previous, const QImage& current)
+{
+    return !previous.isNull() && !current.isNull() && previous.size() == current.size() &&
+           previous.format() == current.format() && current.depth() == 32;
+}
+
+QVector<QRect> changedRegions(const QImage& previous, const QImage& current, const QVector<QRect>& dirtyRects)
+{
+    const int width = current.width();
+    const int height = current.height();
+    const int columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // Tiles worth comparing at all
+    QVector<char> candidates(columns * rows, dirtyRects.isEmpty() ? 1 : 0);
+    const QRect frameRect(0, 0, width, height);
+    for (const QRect& dirty : dirtyRects) {
+        QRect rect = dirty.intersected(frameRect);
+        if (rect.isEmpty()) continue;
+        for (int row = rect.top() / TILE_SIZE; row <= rect.bottom() / TILE_SIZE; ++row) {
+            for (int column = rect.left() / TILE_SIZE; column <= rect.right() / TILE_SIZE; ++column) {
+                candidates[row * columns + column] = 1;
+            }
+        }
+    }
+
+    const uchar* previousBits = previous.constBits();
+    const uchar* currentBits = current.constBits();
+    const qsizetype previousStride = previous.bytesPerLine();
+    const qsizetype currentStride = current.bytesPerLine();
+
+    auto changed = [&](int row, int column) {
+        if (!candidates[row * columns + column]) return false;
+        const int x = column * TILE_SIZE;
+        const int y = row * TILE_SIZE;
+        return differs(previousBits + y * previousStride + x * 4, previousStride,
+                       currentBits + y * currentStride + x * 4, currentStride,
+                       qMin(TILE_SIZE, width - x) * 4, qMin(TILE_SIZE, height - y));
+    };
+
+    QVector<QRect> regions;
+    QVector<int> above;  // regions ending on the previous tile row
+    QVector<int> ending; // regions ending on this one
+    for (int row = 0; row < rows; ++row) {
+        const int y = row * TILE_SIZE;
+        ending.clear();
+
+        for (int column = 0; column < columns; ++column) {
+            if (!changed(row, column)) continue;
+
+            // Run of changed tiles; the tile that ends it is unchanged
+            const int first = column;
+            while (column + 1 < columns && changed(row, column + 1)) {
+                ++column;
+            }
+            QRect run(first * TILE_SIZE, y, qMin((column + 1) * TILE_SIZE, width) - first * TILE_SIZE,
+                      qMin(TILE_SIZE, height - y));
+            ++column;
+
+            int index = -1;
+            for (int candidate : above) {
+                QRect& region = regions[candidate];
+                if (region.left() == run.left() && region.width() == run.width()) {
+                    region.setBottom(run.bottom());
+                    index = candidate;
+                    break;
+                }
+            }
+            if (index < 0) {
+                index = regions.size();
+                regions.append(run);
+            }
+            ending.append(index);
+        }
+        above.swap(ending);
+    }
+    return regions;
+}
+
+} // namespace TileDiff
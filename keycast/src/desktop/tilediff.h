@@ -0,0 +1,30 @@
+#ifndef TILEDIFF_H
+#define TILEDIFF_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+// Finds what changed between two screen frames, tile by tile. Tiles are
+// compared with SSE2 on x86 and NEON on ARM, a plain memcmp elsewhere; a
+// changed tile usually gives itself away in its first rows.
+namespace TileDiff {
+
+constexpr int TILE_SIZE = 64;
+
+// Whether any of rows rows of bytes bytes differ
+bool differs(const uchar* a, qsizetype strideA, const uchar* b, qsizetype strideB, int bytes, int rows);
+
+// Whether the frames can be compared at all: same size, same 32-bit format
+bool comparable(const QImage& previous, const QImage& current);
+
+// Changed tiles of current, merged into rectangles: runs along a tile row,
+// then runs spanning the same columns in consecutive rows. Only tiles that
+// touch dirtyRects are compared; an empty list compares every tile. The
+// frames must be comparable().
+QVector<QRect> changedRegions(const QImage& previous, const QImage& current,
+                              const QVector<QRect>& dirtyRects = QVector<QRect>());
+
+} // namespace TileDiff
+
+#endif // TILEDIFF_H
@@ -0,0 +1,106 @@
+#include "x11cursortracker.h"
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xfixes.h>
+
+X11CursorTracker::X11CursorTracker()
+{
+}
+
+X11CursorTracker::~X11CursorTracker()
+{
+    close();
+}
+
+bool X11CursorTracker::open()
+{
+    if (m_display) return true;
+
+    m_display = XOpenDisplay(nullptr);
+    if (!m_display) return false;
+
+    int errorBase = 0;
+    int major = 0;
+    int minor = 0;
+    // Cursor images and notifications came with XFixes 2
+    bool usable = XFixesQueryExtension(m_display, &m_eventBase, &errorBase) &&
+                  XFixesQueryVersion(m_display, &major, &minor) && major >= 2;
+    if (!usable) {
+        XCloseDisplay(m_display);
+        m_display = nullptr;
+        return false;
+    }
+
+    m_root = DefaultRootWindow(m_display);
+    XFixesSelectCursorInput(m_display, m_root, XFixesDisplayCursorNotifyMask);
+    m_shapeChanged = true;
+    return true;
+}
+
+void X11CursorTracker::close()
+{
+    if (!m_display) return;
+
+    XCloseDisplay(m_display);
+    m_display = nullptr;
+    m_root = 0;
+}
+
+bool X11CursorTracker::position(QPoint& position)
+{
+    if (!m_display) return false;
+
+    Window root;
+    Window child;
+    int rootX = 0;
+    int rootY = 0;
+    int windowX = 0;
+    int windowY = 0;
+    unsigned int mask = 0;
+    if (!XQueryPointer(m_display, m_root, &root, &child, &rootX, &rootY, &windowX, &windowY, &mask)) {
+        return false;
+    }
+    position = QPoint(rootX, rootY);
+    return true;
+}
+
+bool X11CursorTracker::takeShapeChange()
+{
+    if (!m_display) return false;
+
+    // Notifications only say the shape changed; it is fetched on demand
+    while (XPending(m_display) > 0) {
+        XEvent event;
+        XNextEvent(m_display, &event);
+        if (event.type == m_eventBase + XFixesCursorNotify) {
+            m_shapeChanged = true;
+        }
+    }
+
+    bool changed = m_shapeChanged;
+    m_shapeChanged = false;
+    return changed;
+}
+
+QImage X11CursorTracker::shape(QPoint& hotspot)
+{
+    if (!m_display) return QImage();
+
+    XFixesCursorImage* cursor = XFixesGetCursorImage(m_display);
+    if (!cursor) return QImage();
+
+    // One pixel per unsigned long, which is 64 bits wide on LP64
+    QImage image(cursor->width, cursor->height, QImage::Format_ARGB32_Premultiplied);
+    if (!image.isNull()) {
+        const unsigned long* pixels = cursor->pixels;
+        for (int y = 0; y < image.height(); ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < image.width(); ++x) {
+                line[x] = static_cast<QRgb>(*pixels++);
+            }
+        }
+    }
+    hotspot = QPoint(cursor->xhot, cursor->yhot);
+    XFree(cursor);
+    return image;
+}
@@ -0,0 +1,37 @@
+#ifndef X11CURSORTRACKER_H
+#define X11CURSORTRACKER_H
+
+#include <QImage>
+#include <QPoint>
+
+typedef struct _XDisplay Display;
+
+// The pointer on the root window, through XFixes. Position is one round
+// trip; the shape is only fetched after XFixes reports it changed.
+class X11CursorTracker
+{
+public:
+    X11CursorTracker();
+    ~X11CursorTracker();
+
+    // false if there is no display, or it lacks XFixes cursor support
+    bool open();
+    void close();
+    bool isOpen() const { return m_display != nullptr; }
+
+    // Root window coordinates; false if the pointer is on another screen
+    bool position(QPoint& position);
+
+    // Whether the shape changed since the previous call or open()
+    bool takeShapeChange();
+    // Current shape, premultiplied ARGB; null if it can't be read
+    QImage shape(QPoint& hotspot);
+
+private:
+    Display* m_display = nullptr;
+    unsigned long m_root = 0;
+    int m_eventBase = 0;
+    bool m_shapeChanged = true;
+};
+
+#endif // X11CURSORTRACKER_H
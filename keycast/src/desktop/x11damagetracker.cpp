@@ -0,0 +1,80 @@
+#include "x11damagetracker.h"
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+
+X11DamageTracker::X11DamageTracker()
+{
+}
+
+X11DamageTracker::~X11DamageTracker()
+{
+    close();
+}
+
+bool X11DamageTracker::open()
+{
+    if (m_display) return true;
+
+    m_display = XOpenDisplay(nullptr);
+    if (!m_display) return false;
+
+    int eventBase = 0;
+    int errorBase = 0;
+    int major = 0;
+    int minor = 0;
+    // Both extensions must be told the client's version before use
+    bool usable = XDamageQueryExtension(m_display, &eventBase, &errorBase) &&
+                  XDamageQueryVersion(m_display, &major, &minor) &&
+                  XFixesQueryExtension(m_display, &eventBase, &errorBase) &&
+                  XFixesQueryVersion(m_display, &major, &minor);
+    if (!usable) {
+        XCloseDisplay(m_display);
+        m_display = nullptr;
+        return false;
+    }
+
+    // NonEmpty: one event when damage first appears, none while it grows.
+    // The events are only drained; the region is what counts.
+    m_damage = XDamageCreate(m_display, DefaultRootWindow(m_display), XDamageReportNonEmpty);
+    m_parts = XFixesCreateRegion(m_display, nullptr, 0);
+    return true;
+}
+
+void X11DamageTracker::close()
+{
+    if (!m_display) return;
+
+    XDamageDestroy(m_display, m_damage);
+    XFixesDestroyRegion(m_display, m_parts);
+    XCloseDisplay(m_display);
+    m_display = nullptr;
+    m_damage = 0;
+    m_parts = 0;
+}
+
+QVector<QRect> X11DamageTracker::takeDamage()
+{
+    QVector<QRect> rects;
+    if (!m_display) return rects;
+
+    while (XPending(m_display) > 0) {
+        XEvent event;
+        XNextEvent(m_display, &event);
+    }
+
+    // Moves the accumulated damage into m_parts and clears it
+    XDamageSubtract(m_display, m_damage, None, m_parts);
+
+    int count = 0;
+    XRectangle* parts = XFixesFetchRegion(m_display, m_parts, &count);
+    rects.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        rects.append(QRect(parts[i].x, parts[i].y, parts[i].width, parts[i].height));
+    }
+    if (parts) {
+        XFree(parts);
+    }
+    return rects;
+}
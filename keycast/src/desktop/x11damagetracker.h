@@ -0,0 +1,32 @@
+#ifndef X11DAMAGETRACKER_H
+#define X11DAMAGETRACKER_H
+
+#include <QRect>
+#include <QVector>
+
+typedef struct _XDisplay Display;
+
+// Areas of the root window that changed, from the XDamage extension. The
+// X server accumulates damage between calls; takeDamage() collects it and
+// starts over, one round trip no matter how much was drawn meanwhile.
+class X11DamageTracker
+{
+public:
+    X11DamageTracker();
+    ~X11DamageTracker();
+
+    // false if there is no display, or it lacks XDamage or XFixes
+    bool open();
+    void close();
+    bool isOpen() const { return m_display != nullptr; }
+
+    // Root window rectangles changed since the previous call or open()
+    QVector<QRect> takeDamage();
+
+private:
+    Display* m_display = nullptr;
+    unsigned long m_damage = 0; // Damage
+    unsigned long m_parts = 0;  // XserverRegion the damage is moved into
+};
+
+#endif // X11DAMAGETRACKER_H
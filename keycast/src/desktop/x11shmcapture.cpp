@@ -0,0 +1,199 @@
+#include "x11shmcapture.h"
+
+#include <atomic>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+struct X11ShmCapture::Buffer {
+    enum State { Free, InUse, Orphaned };
+
+    XShmSegmentInfo segment = {};
+    XImage* image = nullptr;
+    // InUse while a QImage refers to the segment; Orphaned once the capture
+    // let go of it, leaving the last QImage to detach the memory
+    std::atomic<int> state{Free};
+};
+
+// XShmAttach fails asynchronously, e.g. on a remote display; Xlib's
+// default handler would exit the process
+static bool s_attachFailed = false;
+
+static int onAttachError(Display*, XErrorEvent*)
+{
+    s_attachFailed = true;
+    return 0;
+}
+
+X11ShmCapture::X11ShmCapture()
+{
+}
+
+X11ShmCapture::~X11ShmCapture()
+{
+    close();
+}
+
+bool X11ShmCapture::open()
+{
+    if (m_display) return true;
+
+    m_display = XOpenDisplay(nullptr);
+    if (!m_display) return false;
+
+    int screen = DefaultScreen(m_display);
+    Visual* visual = DefaultVisual(m_display, screen);
+    int depth = DefaultDepth(m_display, screen);
+
+    // Pixels must already be what QImage::Format_RGB32 expects
+    bool usable = XShmQueryExtension(m_display) &&
+                  (depth == 24 || depth == 32) &&
+                  visual->red_mask == 0xff0000 && visual->green_mask == 0xff00 && visual->blue_mask == 0xff &&
+                  ImageByteOrder(m_display) == LSBFirst && Q_BYTE_ORDER == Q_LITTLE_ENDIAN;
+    if (!usable) {
+        XCloseDisplay(m_display);
+        m_display = nullptr;
+        return false;
+    }
+
+    m_root = RootWindow(m_display, screen);
+    m_visual = visual;
+    m_depth = depth;
+    m_rootRect = QRect(0, 0, DisplayWidth(m_display, screen), DisplayHeight(m_display, screen));
+
+    // One buffer up front proves attaching works on this display
+    Buffer* probe = createBuffer(QSize(1, 1));
+    if (!probe) {
+        XCloseDisplay(m_display);
+        m_display = nullptr;
+        return false;
+    }
+    destroyBuffer(probe);
+    return true;
+}
+
+void X11ShmCapture::close()
+{
+    if (!m_display) return;
+
+    for (Buffer* buffer : m_buffers) {
+        destroyBuffer(buffer);
+    }
+    m_buffers.clear();
+    m_bufferSize = QSize();
+
+    XCloseDisplay(m_display);
+    m_display = nullptr;
+}
+
+X11ShmCapture::Buffer* X11ShmCapture::createBuffer(const QSize& size)
+{
+    Buffer* buffer = new Buffer;
+    buffer->image = XShmCreateImage(m_display, static_cast<Visual*>(m_visual), m_depth, ZPixmap, nullptr,
+                                    &buffer->segment, size.width(), size.height());
+    if (!buffer->image || buffer->image->bits_per_pixel != 32) {
+        if (buffer->image) XDestroyImage(buffer->image);
+        delete buffer;
+        return nullptr;
+    }
+
+    buffer->segment.shmid = shmget(IPC_PRIVATE, buffer->image->bytes_per_line * buffer->image->height,
+                                   IPC_CREAT | 0600);
+    if (buffer->segment.shmid < 0) {
+        XDestroyImage(buffer->image);
+        delete buffer;
+        return nullptr;
+    }
+    buffer->segment.shmaddr = buffer->image->data = static_cast<char*>(shmat(buffer->segment.shmid, nullptr, 0));
+    buffer->segment.readOnly = False;
+
+    s_attachFailed = false;
+    XErrorHandler previous = XSetErrorHandler(onAttachError);
+    bool attached = buffer->segment.shmaddr != reinterpret_cast<char*>(-1) &&
+                    XShmAttach(m_display, &buffer->segment);
+    XSync(m_display, False);
+    XSetErrorHandler(previous);
+
+    // Freed by the kernel once both sides have detached
+    shmctl(buffer->segment.shmid, IPC_RMID, nullptr);
+
+    if (!attached || s_attachFailed) {
+        if (buffer->segment.shmaddr != reinterpret_cast<char*>(-1)) {
+            shmdt(buffer->segment.shmaddr);
+        }
+        XDestroyImage(buffer->image);
+        delete buffer;
+        return nullptr;
+    }
+    return buffer;
+}
+
+void X11ShmCapture::destroyBuffer(Buffer* buffer)
+{
+    XShmDetach(m_display, &buffer->segment);
+    XSync(m_display, False);
+    XDestroyImage(buffer->image); // the structure only; the data is the segment
+    buffer->image = nullptr;
+
+    int expected = Buffer::InUse;
+    if (buffer->state.compare_exchange_strong(expected, Buffer::Orphaned)) {
+        return; // the last QImage detaches and deletes it
+    }
+    shmdt(buffer->segment.shmaddr);
+    delete buffer;
+}
+
+void X11ShmCapture::releaseImage(void* info)
+{
+    Buffer* buffer = static_cast<Buffer*>(info);
+
+    int expected = Buffer::InUse;
+    if (!buffer->state.compare_exchange_strong(expected, Buffer::Free)) {
+        // The capture was closed or resized meanwhile
+        shmdt(buffer->segment.shmaddr);
+        delete buffer;
+    }
+}
+
+QImage X11ShmCapture::grab(const QRect& area)
+{
+    if (!m_display) return QImage();
+
+    QRect rect = area.intersected(m_rootRect);
+    if (rect.isEmpty()) return QImage();
+
+    if (rect.size() != m_bufferSize) {
+        for (Buffer* buffer : m_buffers) {
+            destroyBuffer(buffer);
+        }
+        m_buffers.clear();
+        m_bufferSize = rect.size();
+    }
+
+    Buffer* buffer = nullptr;
+    for (Buffer* candidate : m_buffers) {
+        if (candidate->state.load() == Buffer::Free) {
+            buffer = candidate;
+            break;
+        }
+    }
+    if (!buffer) {
+        // Downstream is behind; skipping a frame beats queuing another
+        if (m_buffers.size() >= MAX_BUFFERS) return QImage();
+        buffer = createBuffer(m_bufferSize);
+        if (!buffer) return QImage();
+        m_buffers.append(buffer);
+    }
+
+    if (!XShmGetImage(m_display, m_root, buffer->image, rect.x(), rect.y(), AllPlanes)) {
+        return QImage();
+    }
+
+    // Read-only data: anyone writing to the frame gets a copy of their own
+    buffer->state.store(Buffer::InUse);
+    return QImage(reinterpret_cast<const uchar*>(buffer->image->data), rect.width(), rect.height(),
+                  buffer->image->bytes_per_line, QImage::Format_RGB32, &X11ShmCapture::releaseImage, buffer);
+}
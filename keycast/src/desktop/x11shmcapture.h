@@ -0,0 +1,54 @@
+#ifndef X11SHMCAPTURE_H
+#define X11SHMCAPTURE_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+typedef struct _XDisplay Display;
+
+// Screen grabs through the MIT-SHM extension. The X server copies pixels
+// straight into a shared memory segment and the QImage handed out points
+// at it: no XGetImage round trip and no format conversion. Segments are
+// reused from frame to frame; one stays reserved while any QImage made
+// from it is alive, so frames still being encoded are never overwritten.
+//
+// Needs a local display with MIT-SHM and a 32-bit TrueColor root window.
+class X11ShmCapture
+{
+public:
+    // Frames alive at once before grab() gives up: encoder threads, the one
+    // waiting and the previous frame deltas are made against, with room
+    // to spare
+    static constexpr int MAX_BUFFERS = 8;
+
+    X11ShmCapture();
+    ~X11ShmCapture();
+
+    // false if there is no display, or it can't do shared memory grabs
+    bool open();
+    void close();
+    bool isOpen() const { return m_display != nullptr; }
+
+    // Area of the root window in X pixels, clipped to the screen. Null if
+    // the grab failed or every buffer is still in use downstream.
+    QImage grab(const QRect& area);
+
+private:
+    struct Buffer;
+
+    Buffer* createBuffer(const QSize& size);
+    void destroyBuffer(Buffer* buffer);
+    // Called by QImage when the last copy of a frame goes away, from any thread
+    static void releaseImage(void* info);
+
+    Display* m_display = nullptr;
+    unsigned long m_root = 0;
+    void* m_visual = nullptr; // Visual*
+    int m_depth = 0;
+    QRect m_rootRect;
+    QSize m_bufferSize;
+    QVector<Buffer*> m_buffers;
+};
+
+#endif // X11SHMCAPTURE_H
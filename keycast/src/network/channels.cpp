@@ -0,0 +1,296 @@
+#include "channels.h"
+
+ChannelScheduler::ChannelScheduler()
+{
+    Queue& frames = m_queues[static_cast<int>(Protocol::Channel::Frames)];
+    frames.limit = DEFAULT_FRAME_QUEUE_LIMIT;
+    frames.replaceOnOverflow = true;
+}
+
+qsizetype ChannelScheduler::channelLimit(Protocol::Channel channel) const
+{
+    return m_queues[static_cast<int>(channel)].limit;
+}
+
+void ChannelScheduler::setChannelLimit(Protocol::Channel channel, qsizetype bytes)
+{
+    m_queues[static_cast<int>(channel)].limit = qMax<qsizetype>(0, bytes);
+}
+
+bool ChannelScheduler::replacesOnOverflow(Protocol::Channel channel) const
+{
+    return m_queues[static_cast<int>(channel)].replaceOnOverflow;
+}
+
+void ChannelScheduler::setReplaceOnOverflow(Protocol::Channel channel, bool replace)
+{
+    m_queues[static_cast<int>(channel)].replaceOnOverflow = replace;
+}
+
+bool ChannelScheduler::send(const QByteArray& packet)
+{
+    if (packet.size() < Protocol::PACKET_HEADER_SIZE) return false;
+
+    int channel = static_cast<int>(Protocol::channelFor(static_cast<Protocol::MessageType>(packet.at(6))));
+
+    if (canWriteDirect(channel, packet.size())) {
+        m_device->write(packet);
+        return true;
+    }
+
+    if (!admit(channel, packet.size())) return false;
+
+    // Implicitly shared, queuing does not copy the packet
+    Queue& queue = m_queues[channel];
+    queue.packets.enqueue(packet);
+    queue.bytes += packet.size();
+
+    flush();
+    return true;
+}
+
+bool ChannelScheduler::send(const char* data, qint64 size)
+{
+    if (size < Protocol::PACKET_HEADER_SIZE) return false;
+
+    int channel = static_cast<int>(Protocol::channelFor(static_cast<Protocol::MessageType>(data[6])));
+
+    if (canWriteDirect(channel, size)) {
+        m_device->write(data, size);
+        return true;
+    }
+
+    if (!admit(channel, size)) return false;
+
+    Queue& queue = m_queues[channel];
+    queue.packets.enqueue(QByteArray(data, size));
+    queue.bytes += size;
+
+    flush();
+    return true;
+}
+
+void ChannelScheduler::flush()
+{
+    while (canWrite()) {
+        int channel = nextChannel();
+        if (channel < 0) return;
+        writeNext(channel);
+    }
+}
+
+qsizetype ChannelScheduler::queuedBytes(Protocol::Channel channel) const
+{
+    return m_queues[static_cast<int>(channel)].bytes;
+}
+
+qsizetype ChannelScheduler::queuedBytes() const
+{
+    qsizetype total = 0;
+    for (const Queue& queue : m_queues) {
+        total += queue.bytes;
+    }
+    return total;
+}
+
+ChannelScheduler::ChannelStats ChannelScheduler::stats(Protocol::Channel channel) const
+{
+    const Queue& queue = m_queues[static_cast<int>(channel)];
+
+    ChannelStats stats;
+    stats.queuedPackets = queue.packets.size();
+    stats.queuedBytes = queue.bytes;
+    stats.droppedPackets = queue.droppedPackets;
+    stats.droppedBytes = queue.droppedBytes;
+    return stats;
+}
+
+void ChannelScheduler::clear()
+{
+    for (Queue& queue : m_queues) {
+        queue.packets.clear();
+        queue.offset = 0;
+        queue.bytes = 0;
+    }
+}
+
+bool ChannelScheduler::canWrite() const
+{
+    return m_device && m_device->isOpen() && m_device->bytesToWrite() < m_highWaterMark;
+}
+
+bool ChannelScheduler::canWriteDirect(int channel, qint64 size) const
+{
+    if (!canWrite()) return false;
+    if (m_fragmentSize > 0 && size > m_fragmentSize) return false;
+
+    // Never overtake queued packets of the same or a higher priority
+    for (int i = 0; i <= channel; ++i) {
+        if (!m_queues[i].packets.isEmpty()) return false;
+    }
+    return true;
+}
+
+bool ChannelScheduler::admit(int channel, qint64 size)
+{
+    Queue& queue = m_queues[channel];
+
+    // An empty channel always takes one packet, however large
+    if (queue.limit == 0 || queue.bytes == 0 || queue.bytes + size <= queue.limit) return true;
+
+    if (queue.replaceOnOverflow) {
+        dropQueued(queue);
+        return true;
+    }
+
+    queue.droppedPackets++;
+    queue.droppedBytes += size;
+    return false;
+}
+
+void ChannelScheduler::dropQueued(Queue& queue)
+{
+    // A partly written head packet has to be finished
+    int keep = queue.offset > 0 ? 1 : 0;
+    while (queue.packets.size() > keep) {
+        qsizetype size = queue.packets.last().size();
+        queue.packets.removeLast();
+        queue.bytes -= size;
+        queue.droppedPackets++;
+        queue.droppedBytes += size;
+    }
+}
+
+int ChannelScheduler::nextChannel()
+{
+    const int control = static_cast<int>(Protocol::Channel::Control);
+    const int input = static_cast<int>(Protocol::Channel::Input);
+    const int frames = static_cast<int>(Protocol::Channel::Frames);
+    const int bulk = static_cast<int>(Protocol::Channel::Bulk);
+
+    if (!m_queues[control].packets.isEmpty()) return control;
+    if (!m_queues[input].packets.isEmpty()) return input;
+
+    // Frames and bulk data take turns so neither starves the other
+    int first = m_lastSharedChannel == frames ? bulk : frames;
+    int second = first == frames ? bulk : frames;
+    if (!m_queues[first].packets.isEmpty()) {
+        m_lastSharedChannel = first;
+        return first;
+    }
+    if (!m_queues[second].packets.isEmpty()) {
+        m_lastSharedChannel = second;
+        return second;
+    }
+    return -1;
+}
+
+void ChannelScheduler::writeNext(int channel)
+{
+    Queue& queue = m_queues[channel];
+    const QByteArray& packet = queue.packets.head();
+    qsizetype remaining = packet.size() - queue.offset;
+    qsizetype written;
+
+    if (queue.offset == 0 && (m_fragmentSize == 0 || remaining <= m_fragmentSize)) {
+        // Small packets never pay for a fragment header
+        m_device->write(packet);
+        written = remaining;
+    } else {
+        // A packet already in flight keeps being fragmented even if the
+        // fragment size was changed in the meantime
+        int sliceSize = m_fragmentSize > 0 ? m_fragmentSize : Protocol::DEFAULT_FRAGMENT_SIZE;
+        written = qMin<qsizetype>(remaining, sliceSize);
+
+        char header[Protocol::FRAGMENT_HEADER_SIZE];
+        Protocol::writeFragmentHeader(header, static_cast<Protocol::Channel>(channel), written == remaining,
+                                      static_cast<quint32>(written));
+        m_device->write(header, Protocol::FRAGMENT_HEADER_SIZE);
+        m_device->write(packet.constData() + queue.offset, written);
+    }
+
+    queue.offset += written;
+    queue.bytes -= written;
+    if (queue.offset == packet.size()) {
+        queue.packets.dequeue();
+        queue.offset = 0;
+    }
+}
+
+bool FragmentAssembler::append(const Protocol::PacketView& fragment, Protocol::PacketView& message)
+{
+    Protocol::Channel channel;
+    bool last;
+    const char* chunk;
+    qsizetype chunkSize;
+    if (!Protocol::parseFragmentPacket(fragment, channel, last, chunk, chunkSize)) return false;
+
+    int index = static_cast<int>(channel);
+    QByteArray& partial = m_partial[index];
+
+    // The previous message is no longer referenced; don't keep a huge one
+    if (m_complete.capacity() > RETAINED_CAPACITY) {
+        m_complete = QByteArray();
+    }
+
+    if (!m_discarding[index]) {
+        // The first slice carries the original header; size the buffer once
+        Protocol::PacketHeader header;
+        if (partial.isEmpty() && Protocol::parsePacketHeader(chunk, chunkSize, header)) {
+            qsizetype total = Protocol::PACKET_HEADER_SIZE + static_cast<qsizetype>(header.payloadSize);
+            if (total <= m_maxMessageSize) {
+                partial.reserve(total);
+            }
+        }
+
+        if (partial.size() + chunkSize > m_maxMessageSize) {
+            partial.resize(0);
+            m_discarding[index] = true;
+        } else {
+            partial.append(chunk, chunkSize);
+        }
+    }
+
+    if (!last) return false;
+
+    if (m_discarding[index]) {
+        m_discarding[index] = false;
+        return false;
+    }
+
+    // Keep both buffers' capacity for the next message, up to a limit
+    m_complete.swap(partial);
+    if (partial.capacity() > RETAINED_CAPACITY) {
+        partial = QByteArray();
+    } else {
+        partial.resize(0);
+    }
+
+    if (Protocol::nextPacket(m_complete.constData(), m_complete.size(), message,
+                             static_cast<quint32>(m_maxMessageSize)) != Protocol::FrameStatus::Complete) {
+        return false;
+    }
+
+    // Exactly one packet of this channel, and no nesting
+    return Protocol::PACKET_HEADER_SIZE + message.payloadSize == m_complete.size() &&
+           message.header.type != Protocol::MessageType::Fragment &&
+           Protocol::channelFor(message.header.type) == channel;
+}
+
+qsizetype FragmentAssembler::memoryUsage() const
+{
+    qsizetype total = m_complete.capacity();
+    for (const QByteArray& partial : m_partial) {
+        total += partial.capacity();
+    }
+    return total;
+}
+
+void FragmentAssembler::clear()
+{
+    for (int i = 0; i < Protocol::CHANNEL_COUNT; ++i) {
+        m_partial[i].clear();
+        m_discarding[i] = false;
+    }
+    m_complete.clear();
+}
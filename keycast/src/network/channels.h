@@ -0,0 +1,139 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QQueue>
+
+#include "protocol.h"
+
+// Per-connection send scheduler.
+//
+// Outgoing packets are queued per logical channel and handed to the socket
+// only while its write buffer is below a small high-water mark, so there is
+// never more than a fragment's worth of frame data ahead of a new key press.
+// Control and input are always drained first; frames and bulk data share the
+// rest in turn. When the peer supports Fragment messages, large packets go out
+// in bounded slices and channels interleave between them. Otherwise packets
+// are still sent whole, but in priority order.
+//
+// The frames channel is the only one allowed to lose data: once its byte
+// budget is used up, frames still waiting are replaced by the newest one, so
+// a slow viewer gets fewer but current frames instead of an ever-growing
+// backlog. Control, input and bulk packets are never dropped.
+class ChannelScheduler
+{
+public:
+    static constexpr qint64 DEFAULT_HIGH_WATER_MARK = 64 * 1024;
+    static constexpr qsizetype DEFAULT_FRAME_QUEUE_LIMIT = 1024 * 1024;
+
+    ChannelScheduler();
+
+    void setDevice(QIODevice* device) { m_device = device; }
+
+    // Largest slice sent per Fragment packet; 0 sends every packet whole
+    int fragmentSize() const { return m_fragmentSize; }
+    void setFragmentSize(int bytes) { m_fragmentSize = qMax(0, bytes); }
+
+    // Unsent bytes above which the channel refuses new packets; 0 is unbounded.
+    // Only frames are bounded by default.
+    qsizetype channelLimit(Protocol::Channel channel) const;
+    void setChannelLimit(Protocol::Channel channel, qsizetype bytes);
+
+    // Whether a packet over the limit replaces the channel's queued packets
+    // (the one being written excepted) instead of being refused. Only for
+    // channels whose newest message supersedes the older ones; set for frames.
+    bool replacesOnOverflow(Protocol::Channel channel) const;
+    void setReplaceOnOverflow(Protocol::Channel channel, bool replace);
+
+    qint64 highWaterMark() const { return m_highWaterMark; }
+    void setHighWaterMark(qint64 bytes) { m_highWaterMark = bytes; }
+
+    // Queue a complete packet on its message type's channel and write out as
+    // much as the device will take. Returns false if the channel was over its
+    // limit and the packet was refused.
+    bool send(const QByteArray& packet);
+    // Written straight through when nothing of equal or higher priority is
+    // waiting; copied only if it has to be queued
+    bool send(const char* data, qint64 size);
+
+    // Hand queued data to the device; call again from bytesWritten()
+    void flush();
+
+    struct ChannelStats {
+        int queuedPackets = 0;
+        qsizetype queuedBytes = 0;
+        quint64 droppedPackets = 0; // refused or replaced
+        quint64 droppedBytes = 0;
+    };
+
+    qsizetype queuedBytes(Protocol::Channel channel) const;
+    qsizetype queuedBytes() const;
+    ChannelStats stats(Protocol::Channel channel) const;
+
+    // Drops everything queued; drop counters are kept
+    void clear();
+
+private:
+    struct Queue {
+        QQueue<QByteArray> packets;
+        qsizetype offset = 0; // bytes of the head packet already written
+        qsizetype bytes = 0;  // unsent bytes in the queue
+        qsizetype limit = 0;
+        bool replaceOnOverflow = false;
+        quint64 droppedPackets = 0;
+        quint64 droppedBytes = 0;
+    };
+
+    bool canWrite() const;
+    bool canWriteDirect(int channel, qint64 size) const;
+    bool admit(int channel, qint64 size);
+    void dropQueued(Queue& queue);
+    int nextChannel();
+    void writeNext(int channel);
+
+    Queue m_queues[Protocol::CHANNEL_COUNT];
+    QIODevice* m_device = nullptr;
+    int m_fragmentSize = 0;
+    qint64 m_highWaterMark = DEFAULT_HIGH_WATER_MARK;
+    int m_lastSharedChannel = static_cast<int>(Protocol::Channel::Bulk);
+};
+
+// Per-connection reassembly of Fragment messages, one partial packet per
+// channel. Storage is reused across messages unless it grew past
+// RETAINED_CAPACITY.
+class FragmentAssembler
+{
+public:
+    static constexpr qsizetype RETAINED_CAPACITY = 1024 * 1024;
+
+    qsizetype maxMessageSize() const { return m_maxMessageSize; }
+    void setMaxMessageSize(qsizetype bytes) { m_maxMessageSize = bytes; }
+
+    // Add one Fragment packet. Returns true when it completed a message;
+    // message then views the reassembled packet until the next call.
+    // Oversized or malformed messages are dropped.
+    bool append(const Protocol::PacketView& fragment, Protocol::PacketView& message);
+
+    // Bytes allocated for partial and completed messages
+    qsizetype memoryUsage() const;
+    void clear();
+
+private:
+    QByteArray m_partial[Protocol::CHANNEL_COUNT];
+    bool m_discarding[Protocol::CHANNEL_COUNT] = {};
+    QByteArray m_complete;
+    qsizetype m_maxMessageSize = Protocol::DEFAULT_MAX_MESSAGE_SIZE;
+};
+
+// Memory held by one connection's buffers, for monitoring
+struct ConnectionMemory {
+    qsizetype socketBuffers = 0; // unread and unwritten bytes inside the socket
+    qsizetype receiveBuffer = 0; // allocated receive buffer
+    qsizetype sendQueue = 0;     // packets waiting in the channel scheduler
+    qsizetype reassembly = 0;    // partially received fragmented messages
+
+    qsizetype total() const { return socketBuffers + receiveBuffer + sendQueue + reassembly; }
+};
+
+#endif // CHANNELS_H
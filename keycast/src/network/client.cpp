@@ -1,24 +1,40 @@
 #include "client.h"
 #include "protocol.h"
+#include "messages.h"
 #include "settings.h"
 #include "sslconfig.h"
+#include "datagraminput.h"
 
 #include <QBuffer>
+#include <QPainter>
+#include <QRandomGenerator>
 
 Client::Client(QObject* parent)
     : QObject(parent)
     , m_socket(new QSslSocket(this))
     , m_reconnectTimer(new QTimer(this))
+    , m_probeTimer(new QTimer(this))
+    , m_datagramInput(new InputDatagramClient(this))
 {
+    m_scheduler.setDevice(m_socket);
+    m_clock.start();
+
     connect(m_socket, &QSslSocket::connected, this, &Client::onConnected);
     connect(m_socket, &QSslSocket::disconnected, this, &Client::onDisconnected);
     connect(m_socket, &QSslSocket::encrypted, this, &Client::onEncrypted);
     connect(m_socket, QOverload<const QList<QSslError>&>::of(&QSslSocket::sslErrors),
             this, &Client::onSslErrors);
     connect(m_socket, &QSslSocket::readyRead, this, &Client::onReadyRead);
+    connect(m_socket, &QSslSocket::bytesWritten, this, &Client::onBytesWritten);
     connect(m_socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::errorOccurred),
             this, &Client::onError);
     connect(m_reconnectTimer, &QTimer::timeout, this, &Client::onReconnectTimer);
+    connect(m_probeTimer, &QTimer::timeout, this, &Client::onProbeTimer);
+    connect(m_datagramInput, &InputDatagramClient::inputEventReceived, this,
+            [this](const Protocol::InputEvent& event) {
+        forwardInputEvent(event);
+        replayInputEvent(event);
+    });
 }
 
 Client::~Client()
@@ -54,7 +70,7 @@ void Client::disconnect()
     if (m_socket->state() != QAbstractSocket::UnconnectedState) {
         // Send disconnect packet
         if (m_authenticated) {
-            QByteArray packet = Protocol::createDisconnectPacket();
+            QByteArray packet = Protocol::encode(Protocol::DisconnectMessage());
             m_socket->write(packet);
             m_socket->flush();
         }
@@ -65,6 +81,19 @@ void Client::disconnect()
     m_authenticated = false;
     m_sslEstablished = false;
     m_buffer.clear();
+    m_scheduler.clear();
+    m_scheduler.setFragmentSize(0);
+    m_fragments.clear();
+    m_streams.clear();
+    m_datagramInput->close();
+    resetLatency();
+    m_watching = false;
+    m_frame = QImage();
+    m_haveFrame = false;
+    m_keyframeRequested = false;
+    m_cursorShapes.clear();
+    m_cursorShapeOrder.clear();
+    m_cursorShapeKnown = false;
 }
 
 void Client::onConnected()
@@ -100,8 +129,14 @@ void Client::onSslErrors(const QList<QSslError>& errors)
 void Client::sendAuthentication()
 {
     QString clientName = Settings::instance()->computerName();
-    QByteArray authPacket = Protocol::createAuthPacket(m_password, clientName);
-    m_socket->write(authPacket);
+
+    Protocol::PeerCapabilities caps;
+    caps.flags = Protocol::SUPPORTED_CAPABILITIES;
+    caps.maxMessageSize = m_maxMessageSize = Settings::instance()->maxMessageSize();
+    m_fragments.setMaxMessageSize(m_maxMessageSize);
+
+    QByteArray authPacket = Protocol::createAuthPacket(m_password, clientName, caps);
+    m_scheduler.send(authPacket);
 }
 
 void Client::onDisconnected()
@@ -109,169 +144,486 @@ void Client::onDisconnected()
     m_connected = false;
     m_authenticated = false;
     m_sslEstablished = false;
+    m_capabilities = Protocol::PeerCapabilities();
     m_buffer.clear();
+    m_scheduler.clear();
+    m_scheduler.setFragmentSize(0);
+    m_fragments.clear();
+    m_streams.clear();
+    m_datagramInput->close();
+    resetLatency();
+    m_watching = false;
+    m_frame = QImage();
+    m_haveFrame = false;
+    m_keyframeRequested = false;
+    m_cursorShapes.clear();
+    m_cursorShapeOrder.clear();
+    m_cursorShapeKnown = false;
 
     emit disconnected();
 
-    // Auto-reconnect if enabled
+    // Auto-reconnect if enabled. Spread over [delay, 2 * delay) so clients
+    // dropped together don't all come back at the same moment.
     if (m_autoReconnect && m_reconnectAttempts < MAX_RECONNECT_ATTEMPTS) {
-        m_reconnectTimer->start(5000); // Retry in 5 seconds
+        int delay = m_retryAfterMs > 0 ? m_retryAfterMs : RECONNECT_INTERVAL_MS;
+        m_retryAfterMs = 0;
+        m_reconnectTimer->start(delay + QRandomGenerator::global()->bounded(delay));
     }
 }
 
 void Client::onReadyRead()
 {
-    m_buffer.append(m_socket->readAll());
+    m_buffer.readFrom(m_socket);
     processData();
 }
 
+void Client::onBytesWritten()
+{
+    m_scheduler.flush();
+}
+
 void Client::processData()
 {
-    while (m_buffer.size() >= 11) { // Minimum header size
-        Protocol::PacketHeader header;
-        if (!Protocol::parsePacketHeader(m_buffer, header)) {
-            // Invalid packet, clear buffer
+    Protocol::PacketView packet;
+    for (;;) {
+        // Only AuthResponse is expected until authenticated
+        quint32 limit = m_authenticated ? m_maxMessageSize : Protocol::PRE_AUTH_MAX_MESSAGE_SIZE;
+        Protocol::FrameStatus status = Protocol::nextPacket(m_buffer.data(), m_buffer.size(), packet, limit);
+
+        if (status == Protocol::FrameStatus::Invalid) {
+            // Garbage or an oversized message, the stream can't be resynchronized
             m_buffer.clear();
+            m_socket->disconnectFromHost();
             return;
         }
 
-        int totalSize = 11 + header.payloadSize;
-        if (m_buffer.size() < totalSize) {
-            // Wait for more data
+        if (status == Protocol::FrameStatus::Incomplete) {
+            // Make room for the whole packet so the rest arrives contiguously
+            if (m_buffer.size() >= Protocol::PACKET_HEADER_SIZE) {
+                qsizetype totalSize = Protocol::PACKET_HEADER_SIZE + static_cast<qsizetype>(packet.header.payloadSize);
+                m_buffer.reserve(totalSize - m_buffer.size());
+            }
             return;
         }
 
-        // Extract complete packet
-        QByteArray packet = m_buffer.left(totalSize);
-        m_buffer.remove(0, totalSize);
-
         handlePacket(packet);
+        m_buffer.consume(Protocol::PACKET_HEADER_SIZE + packet.payloadSize);
     }
 }
 
-void Client::handlePacket(const QByteArray& packet)
-{
-    Protocol::PacketHeader header;
-    if (!Protocol::parsePacketHeader(packet, header)) return;
-
-    switch (header.type) {
-    case Protocol::MessageType::AuthResponse: {
-        Protocol::AuthResult result;
-        QString serverName;
-        if (Protocol::parseAuthResponsePacket(packet, result, serverName)) {
-            if (result == Protocol::AuthResult::Success) {
-                m_authenticated = true;
-                m_serverName = serverName;
-                m_autoReconnect = true;
-                emit authenticated(serverName);
-            } else {
-                QString reason;
-                switch (result) {
-                case Protocol::AuthResult::InvalidPassword:
-                    reason = "Invalid password";
-                    break;
-                case Protocol::AuthResult::ServerFull:
-                    reason = "Server is full";
-                    break;
-                case Protocol::AuthResult::VersionMismatch:
-                    reason = "Protocol version mismatch";
-                    break;
-                default:
-                    reason = "Unknown error";
-                }
-                m_autoReconnect = false;
-                emit authenticationFailed(reason);
-            }
+void Client::handlePacket(const Protocol::PacketView& packet)
+{
+    bool frame = packet.header.type == Protocol::MessageType::ScreenFrame ||
+                 packet.header.type == Protocol::MessageType::ScreenRegionUpdate;
+    if (frame) {
+        m_frameBytesReceived += Protocol::PACKET_HEADER_SIZE + packet.payloadSize;
+    }
+
+    // A relay passes frames on still encoded
+    if (m_relaying && frame) {
+        relayScreenFrame(packet);
+        return;
+    }
+    // and the cursor, whose shapes the relay server caches for its clients
+    if (m_relaying && (packet.header.type == Protocol::MessageType::CursorPosition ||
+                       packet.header.type == Protocol::MessageType::CursorShape)) {
+        if (m_authenticated) {
+            emit cursorPacketReceived(Protocol::copyPacket(packet));
         }
-        break;
+        return;
+    }
+    // and the stream settings, which are upstream's
+    if (m_relaying && packet.header.type == Protocol::MessageType::ScreenShareParams) {
+        if (m_authenticated) {
+            emit screenShareParamsPacketReceived(Protocol::copyPacket(packet));
+        }
+        return;
     }
 
-    case Protocol::MessageType::KeyEvent: {
-        if (!m_authenticated) return;
+    Protocol::Dispatcher<Client, HandledMessages>::dispatch(*this, packet);
+}
 
-        int vkCode;
-        bool pressed;
-        if (Protocol::parseKeyEventPacket(packet, vkCode, pressed)) {
-            emit keyEventReceived(vkCode, pressed);
+void Client::handleMessage(const Protocol::AuthResponseMessage& message)
+{
+    if (message.result == Protocol::AuthResult::Success) {
+        m_authenticated = true;
+        m_serverName = message.serverName;
+        // Older servers answer without capabilities; never assume
+        // more than we offered
+        m_capabilities.flags = message.caps.flags & Protocol::SUPPORTED_CAPABILITIES;
+        m_capabilities.maxMessageSize = message.caps.maxMessageSize;
+        if (m_capabilities.has(Protocol::CapFragments)) {
+            m_scheduler.setFragmentSize(Protocol::DEFAULT_FRAGMENT_SIZE);
         }
-        break;
+        m_autoReconnect = true;
+        if (m_capabilities.has(Protocol::CapLatencyProbe)) {
+            m_probeTimer->start(Protocol::LATENCY_PROBE_INTERVAL_MS);
+            onProbeTimer();
+        }
+        emit authenticated(message.serverName);
+    } else {
+        QString reason;
+        switch (message.result) {
+        case Protocol::AuthResult::InvalidPassword:
+            reason = "Invalid password";
+            break;
+        case Protocol::AuthResult::ServerFull:
+            // Not a refusal; try again when the server suggests
+            reason = "Server is full";
+            m_autoReconnect = true;
+            m_retryAfterMs = message.retryAfterMs > 0 ? static_cast<int>(qMin<quint32>(message.retryAfterMs, 600000))
+                                                      : RECONNECT_INTERVAL_MS;
+            emit authenticationFailed(reason);
+            return;
+        case Protocol::AuthResult::VersionMismatch:
+            reason = "Protocol version mismatch";
+            break;
+        default:
+            reason = "Unknown error";
+        }
+        m_autoReconnect = false;
+        emit authenticationFailed(reason);
     }
+}
 
-    case Protocol::MessageType::MouseEvent: {
-        if (!m_authenticated) return;
+void Client::handleMessage(const Protocol::KeyEventMessage& message)
+{
+    if (!m_authenticated) return;
+
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::Key;
+    event.code = message.vkCode;
+    event.pressed = message.pressed;
+    forwardInputEvent(event);
+    emit keyEventReceived(message.vkCode, message.pressed);
+}
 
-        int x, y, button;
-        bool pressed;
-        if (Protocol::parseMouseEventPacket(packet, x, y, button, pressed)) {
-            emit mouseEventReceived(x, y, button, pressed);
-        }
-        break;
+void Client::handleMessage(const Protocol::MouseEventMessage& message)
+{
+    if (!m_authenticated) return;
+
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::MouseButton;
+    event.x = message.x;
+    event.y = message.y;
+    event.code = message.button;
+    event.pressed = message.pressed;
+    forwardInputEvent(event);
+    emit mouseEventReceived(message.x, message.y, message.button, message.pressed);
+}
+
+void Client::handleMessage(const Protocol::MouseMoveMessage& message)
+{
+    if (!m_authenticated) return;
+
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::MouseMove;
+    event.x = message.x;
+    event.y = message.y;
+    forwardInputEvent(event);
+    emit mouseMoveReceived(message.x, message.y);
+}
+
+void Client::handleMessage(const Protocol::InputBatchMessage& message)
+{
+    if (!m_authenticated) return;
+
+    if (m_relaying) {
+        emit inputBatchPacketReceived(Protocol::copyPacket(message.packet));
     }
+    replayInputBatch(message.packet);
+}
 
-    case Protocol::MessageType::MouseMove: {
-        if (!m_authenticated) return;
+void Client::handleMessage(const Protocol::InputChannelSetupMessage& message)
+{
+    if (!m_authenticated || !m_capabilities.has(Protocol::CapDatagramInput)) return;
+    if (message.identity.isEmpty() || message.key.isEmpty()) return;
 
-        int x, y;
-        if (Protocol::parseMouseMovePacket(packet, x, y)) {
-            emit mouseMoveReceived(x, y);
-        }
-        break;
+    // Input keeps arriving over TCP until the DTLS session is up
+    m_datagramInput->open(m_socket->peerAddress(), message.port, message.identity, message.key);
+}
+
+void Client::handleMessage(const Protocol::ExecuteCommandMessage& message)
+{
+    if (!m_authenticated) return;
+    emit executeCommandReceived(message.command, message.commandType);
+}
+
+void Client::handleMessage(const Protocol::ScreenFrameMessage& message)
+{
+    if (!m_authenticated) return;
+
+    QImage image;
+    if (image.loadFromData(message.imageData, "JPEG")) {
+        // Deltas are drawn into it
+        m_frame = image.convertToFormat(QImage::Format_RGB32);
+        m_frameId = message.frameId;
+        m_haveFrame = true;
+        m_keyframeRequested = false;
+
+        emit screenFrameReceived(m_frame, message.frameId);
+        // Auto-ack
+        sendScreenFrameAck(message.frameId);
     }
+}
 
-    case Protocol::MessageType::ExecuteCommand: {
-        if (!m_authenticated) return;
+void Client::handleMessage(const Protocol::ScreenRegionUpdateMessage& message)
+{
+    if (!m_authenticated) return;
 
-        QString command, type;
-        if (Protocol::parseExecuteCommandPacket(packet, command, type)) {
-            emit executeCommandReceived(command, type);
-        }
-        break;
+    // Acknowledged even when useless, the server counts it against the window
+    if (!followsFrame(message.baseFrameId) || m_frame.size() != QSize(message.width, message.height)) {
+        requestKeyframe();
+        sendScreenFrameAck(message.frameId);
+        return;
     }
 
-    case Protocol::MessageType::ScreenFrame: {
-        if (!m_authenticated) return;
-
-        QByteArray imageData;
-        int width, height;
-        quint32 frameId;
-        if (Protocol::parseScreenFramePacket(packet, imageData, width, height, frameId)) {
-            QImage image;
-            if (image.loadFromData(imageData, "JPEG")) {
-                emit screenFrameReceived(image, frameId);
-                // Auto-ack
-                sendScreenFrameAck(frameId);
-            }
+    QPainter painter(&m_frame);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    QImage part;
+    for (const Protocol::ScreenRegion& region : message.regions) {
+        if (!part.loadFromData(region.imageData, "JPEG") || part.size() != QSize(region.width, region.height)) {
+            // Half patched; only a keyframe fixes that
+            m_haveFrame = false;
+            requestKeyframe();
+            sendScreenFrameAck(message.frameId);
+            return;
         }
-        break;
+        painter.drawImage(region.x, region.y, part);
+    }
+    painter.end();
+
+    m_frameId = message.frameId;
+    emit screenFrameReceived(m_frame, message.frameId);
+    sendScreenFrameAck(message.frameId);
+}
+
+void Client::handleMessage(const Protocol::CursorPositionMessage& message)
+{
+    if (!m_authenticated) return;
+
+    if (!m_cursorShapeKnown || message.shapeId != m_cursorShapeId) {
+        // Unknown ids, 0 included, get the default pointer
+        CursorShape shape = m_cursorShapes.value(message.shapeId);
+        m_cursorShapeId = message.shapeId;
+        m_cursorShapeKnown = true;
+        emit cursorShapeChanged(shape.image, shape.hotspot);
+    }
+    emit cursorMoved(QPoint(message.x, message.y), message.visible);
+}
+
+void Client::handleMessage(const Protocol::CursorShapeMessage& message)
+{
+    if (!m_authenticated) return;
+
+    // Kept even if it doesn't decode, so the cache stays in step with the
+    // server's idea of it
+    CursorShape shape;
+    shape.image.loadFromData(message.image, "PNG");
+    shape.hotspot = QPoint(message.hotspotX, message.hotspotY);
+
+    if (m_cursorShapes.contains(message.shapeId)) {
+        m_cursorShapeOrder.removeOne(message.shapeId);
+    }
+    m_cursorShapes.insert(message.shapeId, shape);
+    m_cursorShapeOrder.enqueue(message.shapeId);
+    while (m_cursorShapeOrder.size() > Protocol::CURSOR_SHAPE_CACHE_SIZE) {
+        m_cursorShapes.remove(m_cursorShapeOrder.dequeue());
+    }
+}
+
+void Client::handleMessage(const Protocol::ScreenShareParamsMessage& message)
+{
+    if (!m_authenticated) return;
+
+    emit screenShareParamsChanged(message.frameRate, message.quality, message.scalePercent);
+}
+
+bool Client::followsFrame(quint32 baseFrameId)
+{
+    // A delta before it was replaced in the server's send queue, or this is
+    // the first frame after joining
+    if (!m_haveFrame || baseFrameId != m_frameId) {
+        requestKeyframe();
+        return false;
     }
+    return true;
+}
+
+void Client::handleMessage(const Protocol::ClipboardDataMessage& message)
+{
+    if (!m_authenticated) return;
+    emit clipboardReceived(message.mimeType, message.data);
+}
+
+void Client::handleMessage(const Protocol::StreamBeginMessage& message)
+{
+    if (!m_authenticated) return;
+
+    if (m_streams.begin(message.streamId, message.kind, message.mimeType, message.totalSize)) {
+        emit streamStarted(message.streamId, message.kind, message.mimeType, message.totalSize);
+    }
+}
+
+void Client::handleMessage(const Protocol::StreamDataMessage& message)
+{
+    if (!m_authenticated) return;
+
+    if (m_streams.accept(message.streamId, message.data.size())) {
+        // Owning copy of one chunk, the receive buffer is reused
+        emit streamDataReceived(message.streamId, QByteArray(message.data.constData(), message.data.size()));
+    }
+}
+
+void Client::handleMessage(const Protocol::StreamEndMessage& message)
+{
+    if (!m_authenticated) return;
+
+    StreamReceiver::Stream stream;
+    if (m_streams.finish(message.streamId, stream)) {
+        emit streamFinished(message.streamId, message.complete && stream.received == stream.totalSize);
+    }
+}
+
+void Client::handleMessage(const Protocol::FragmentMessage& message)
+{
+    if (!m_authenticated) return;
+
+    Protocol::PacketView reassembled;
+    if (m_fragments.append(message.packet, reassembled)) {
+        handlePacket(reassembled);
+    }
+}
+
+void Client::handleMessage(const Protocol::PingMessage& message)
+{
+    Q_UNUSED(message)
+    m_scheduler.send(Protocol::encode(Protocol::PongMessage()));
+}
+
+void Client::handleMessage(const Protocol::LatencyProbeMessage& message)
+{
+    if (!m_authenticated) return;
+    m_scheduler.send(Protocol::encode(Protocol::LatencyReplyMessage{message.sentUs}));
+
+    // The server's own distance from the source, if it relays
+    m_upstreamHops = message.hops;
+    m_upstreamPathUs = message.pathLatencyUs;
+}
+
+void Client::handleMessage(const Protocol::LatencyReplyMessage& message)
+{
+    if (!m_authenticated) return;
+
+    qint64 sample = m_clock.nsecsElapsed() / 1000 - static_cast<qint64>(message.sentUs);
+    if (sample < 0) return; // not one of ours
+
+    m_roundTripUs = Protocol::smoothRoundTrip(m_roundTripUs, sample);
+    emit latencyChanged();
+}
+
+void Client::onProbeTimer()
+{
+    if (!m_authenticated || !m_connected) return;
+
+    Protocol::LatencyProbeMessage probe;
+    probe.sentUs = static_cast<quint64>(m_clock.nsecsElapsed() / 1000);
+    m_scheduler.send(Protocol::encode(probe));
+}
+
+qint64 Client::pathLatencyUs() const
+{
+    if (m_roundTripUs < 0) return -1;
+    return m_upstreamPathUs + m_roundTripUs / 2;
+}
 
-    case Protocol::MessageType::ClipboardData: {
-        if (!m_authenticated) return;
+void Client::resetLatency()
+{
+    m_probeTimer->stop();
+    m_roundTripUs = -1;
+    m_upstreamHops = 0;
+    m_upstreamPathUs = 0;
+}
 
-        QString mimeType;
-        QByteArray clipData;
-        if (Protocol::parseClipboardDataPacket(packet, mimeType, clipData)) {
-            emit clipboardReceived(mimeType, clipData);
+void Client::relayScreenFrame(const Protocol::PacketView& packet)
+{
+    if (!m_authenticated) return;
+
+    // Only the frame headers are read, the images stay encoded
+    quint32 frameId = 0;
+    if (packet.header.type == Protocol::MessageType::ScreenFrame) {
+        Protocol::ScreenFrameMessage message;
+        if (!Protocol::decode(packet, message)) return;
+        frameId = message.frameId;
+        m_haveFrame = true;
+        m_keyframeRequested = false;
+    } else {
+        Protocol::ScreenRegionUpdateMessage message;
+        if (!Protocol::decode(packet, message)) return;
+        frameId = message.frameId;
+        // Clients below could not apply it either
+        if (!followsFrame(message.baseFrameId)) {
+            sendScreenFrameAck(frameId);
+            return;
         }
-        break;
     }
+    m_frameId = frameId;
 
-    case Protocol::MessageType::Ping: {
-        QByteArray pong = Protocol::createPongPacket();
-        m_socket->write(pong);
-        break;
+    emit screenFramePacketReceived(Protocol::copyPacket(packet), frameId);
+    // Flow control below this point is the relay server's
+    sendScreenFrameAck(frameId);
+}
+
+void Client::forwardInputEvent(const Protocol::InputEvent& event)
+{
+    if (m_relaying) {
+        emit inputEventReceived(event);
     }
+}
 
-    case Protocol::MessageType::Disconnect:
-        m_autoReconnect = false;
-        m_socket->disconnectFromHost();
-        break;
+void Client::handleMessage(const Protocol::DisconnectMessage& message)
+{
+    Q_UNUSED(message)
+    m_autoReconnect = false;
+    m_socket->disconnectFromHost();
+}
+
+void Client::replayInputBatch(const Protocol::PacketView& packet)
+{
+    m_batchEvents.clear();
+    if (!Protocol::parseInputBatchPacket(packet, m_batchEvents)) return;
 
-    default:
+    // Replay in the order the events were captured
+    for (const Protocol::InputEvent& event : m_batchEvents) {
+        replayInputEvent(event);
+    }
+}
+
+void Client::replayInputEvent(const Protocol::InputEvent& event)
+{
+    switch (event.kind) {
+    case Protocol::InputEventKind::Key:
+        emit keyEventReceived(event.code, event.pressed);
+        break;
+    case Protocol::InputEventKind::MouseButton:
+        emit mouseEventReceived(event.x, event.y, event.code, event.pressed);
+        break;
+    case Protocol::InputEventKind::MouseMove:
+        emit mouseMoveReceived(event.x, event.y);
         break;
     }
 }
 
+ConnectionMemory Client::memoryUsage() const
+{
+    ConnectionMemory usage;
+    usage.socketBuffers = m_socket->bytesAvailable() + m_socket->bytesToWrite();
+    usage.receiveBuffer = m_buffer.capacity();
+    usage.sendQueue = m_scheduler.queuedBytes();
+    usage.reassembly = m_fragments.memoryUsage();
+    return usage;
+}
+
 void Client::onError(QAbstractSocket::SocketError socketError)
 {
     Q_UNUSED(socketError)
@@ -300,8 +652,8 @@ void Client::sendCommandOutput(const QString& output)
 {
     if (!m_authenticated || !m_connected) return;
 
-    QByteArray packet = Protocol::createCommandOutputPacket(output);
-    m_socket->write(packet);
+    QByteArray packet = Protocol::createCommandOutputPacket(output, m_capabilities.has(Protocol::CapCompression));
+    m_scheduler.send(packet);
 }
 
 void Client::requestScreenShare(bool start)
@@ -309,13 +661,24 @@ void Client::requestScreenShare(bool start)
     if (!m_authenticated || !m_connected) return;
 
     QByteArray packet = Protocol::createScreenShareRequestPacket(start);
-    m_socket->write(packet);
+    m_scheduler.send(packet);
+    m_watching = start;
+    m_keyframeRequested = false;
+}
+
+void Client::requestKeyframe()
+{
+    // Asking to watch again restarts from a keyframe; once is enough
+    if (!m_watching || m_keyframeRequested) return;
+
+    requestScreenShare(true);
+    m_keyframeRequested = true;
 }
 
 void Client::sendScreenFrameAck(quint32 frameId)
 {
     if (!m_authenticated || !m_connected) return;
 
-    QByteArray packet = Protocol::createScreenFrameAckPacket(frameId);
-    m_socket->write(packet);
+    QByteArray packet = Protocol::encode(Protocol::ScreenFrameAckMessage{frameId});
+    m_scheduler.send(packet);
 }
@@ -4,7 +4,18 @@
 #include <QObject>
 #include <QSslSocket>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QImage>
+#include <QHash>
+#include <QQueue>
+
+#include "protocol.h"
+#include "messages.h"
+#include "receivebuffer.h"
+#include "channels.h"
+#include "streams.h"
+
+class InputDatagramClient;
 
 class Client : public QObject
 {
@@ -22,12 +33,37 @@ public:
     bool useSsl() const { return m_useSsl; }
     void setUseSsl(bool use) { m_useSsl = use; }
 
+    // Features agreed with the server during authentication
+    Protocol::PeerCapabilities capabilities() const { return m_capabilities; }
+
+    // Buffers currently held for the connection
+    ConnectionMemory memoryUsage() const;
+
+    // Smoothed round trip to the server, -1 until measured
+    qint64 roundTripUs() const { return m_roundTripUs; }
+    // Hops from the source server to this client (1 without relays) and
+    // the one-way latency over all of them, -1 until measured
+    int hops() const { return m_upstreamHops + 1; }
+    qint64 pathLatencyUs() const;
+
+    // While relaying, input and encoded frames are also handed out as they
+    // arrived (the *PacketReceived and inputEventReceived signals). Frames
+    // are then neither decoded nor shown, and are acknowledged on arrival.
+    bool isRelaying() const { return m_relaying; }
+    void setRelaying(bool relaying) { m_relaying = relaying; }
+
+    // Screen frame bytes received since the client was created, relayed
+    // ones included
+    quint64 frameBytesReceived() const { return m_frameBytesReceived; }
+
 public slots:
     void connectToServer(const QString& address, int port, const QString& password);
     void disconnect();
 
     void sendCommandOutput(const QString& output);
     void requestScreenShare(bool start);
+    // While watching: have the server send a whole frame next, once
+    void requestKeyframe();
     void sendScreenFrameAck(quint32 frameId);
 
 signals:
@@ -41,9 +77,31 @@ signals:
     void mouseEventReceived(int x, int y, int button, bool pressed);
     void mouseMoveReceived(int x, int y);
     void executeCommandReceived(const QString& command, const QString& type);
+    // Keyframes and deltas alike arrive as the whole, updated frame
     void screenFrameReceived(const QImage& frame, quint32 frameId);
+    // The shared screen's pointer (CapCursor), in frame pixels. The shape is
+    // only signalled when it changes; null means a default pointer.
+    void cursorShapeChanged(const QImage& shape, const QPoint& hotspot);
+    void cursorMoved(const QPoint& position, bool visible);
+    // Frame rate, quality and scale the server currently sends at (CapStreamParams)
+    void screenShareParamsChanged(int frameRate, int quality, int scalePercent);
     void clipboardReceived(const QString& mimeType, const QByteArray& data);
 
+    // Relaying only
+    void inputEventReceived(const Protocol::InputEvent& event);
+    void inputBatchPacketReceived(const QByteArray& packet);
+    void screenFramePacketReceived(const QByteArray& packet, quint32 frameId);
+    void cursorPacketReceived(const QByteArray& packet);
+    void screenShareParamsPacketReceived(const QByteArray& packet);
+
+    void latencyChanged();
+
+    // Payloads too large for one message arrive as a stream of chunks, each
+    // passed on as it is received; kind says what the payload is for
+    void streamStarted(quint32 streamId, const QString& kind, const QString& mimeType, quint64 totalSize);
+    void streamDataReceived(quint32 streamId, const QByteArray& chunk);
+    void streamFinished(quint32 streamId, bool complete);
+
     void error(const QString& message);
     void reconnecting(int attempt, int maxAttempts);
 
@@ -53,32 +111,124 @@ private slots:
     void onEncrypted();
     void onSslErrors(const QList<QSslError>& errors);
     void onReadyRead();
+    void onBytesWritten();
     void onError(QAbstractSocket::SocketError socketError);
     void onReconnectTimer();
+    void onProbeTimer();
+    void replayInputEvent(const Protocol::InputEvent& event);
 
 private:
     void processData();
-    void handlePacket(const QByteArray& packet);
+    void handlePacket(const Protocol::PacketView& packet);
+
+    // Messages a server may send; anything else is ignored
+    using HandledMessages = Protocol::MessageList<
+        Protocol::AuthResponseMessage,
+        Protocol::KeyEventMessage,
+        Protocol::MouseEventMessage,
+        Protocol::MouseMoveMessage,
+        Protocol::InputBatchMessage,
+        Protocol::InputChannelSetupMessage,
+        Protocol::ExecuteCommandMessage,
+        Protocol::ScreenFrameMessage,
+        Protocol::ScreenRegionUpdateMessage,
+        Protocol::CursorPositionMessage,
+        Protocol::CursorShapeMessage,
+        Protocol::ScreenShareParamsMessage,
+        Protocol::ClipboardDataMessage,
+        Protocol::StreamBeginMessage,
+        Protocol::StreamDataMessage,
+        Protocol::StreamEndMessage,
+        Protocol::FragmentMessage,
+        Protocol::PingMessage,
+        Protocol::LatencyProbeMessage,
+        Protocol::LatencyReplyMessage,
+        Protocol::DisconnectMessage>;
+    friend class Protocol::Dispatcher<Client, HandledMessages>;
+
+    void handleMessage(const Protocol::AuthResponseMessage& message);
+    void handleMessage(const Protocol::KeyEventMessage& message);
+    void handleMessage(const Protocol::MouseEventMessage& message);
+    void handleMessage(const Protocol::MouseMoveMessage& message);
+    void handleMessage(const Protocol::InputBatchMessage& message);
+    void handleMessage(const Protocol::InputChannelSetupMessage& message);
+    void handleMessage(const Protocol::ExecuteCommandMessage& message);
+    void handleMessage(const Protocol::ScreenFrameMessage& message);
+    void handleMessage(const Protocol::ScreenRegionUpdateMessage& message);
+    void handleMessage(const Protocol::CursorPositionMessage& message);
+    void handleMessage(const Protocol::CursorShapeMessage& message);
+    void handleMessage(const Protocol::ScreenShareParamsMessage& message);
+    void handleMessage(const Protocol::ClipboardDataMessage& message);
+    void handleMessage(const Protocol::StreamBeginMessage& message);
+    void handleMessage(const Protocol::StreamDataMessage& message);
+    void handleMessage(const Protocol::StreamEndMessage& message);
+    void handleMessage(const Protocol::FragmentMessage& message);
+    void handleMessage(const Protocol::PingMessage& message);
+    void handleMessage(const Protocol::LatencyProbeMessage& message);
+    void handleMessage(const Protocol::LatencyReplyMessage& message);
+    void handleMessage(const Protocol::DisconnectMessage& message);
+    void replayInputBatch(const Protocol::PacketView& packet);
+    void relayScreenFrame(const Protocol::PacketView& packet);
+    // Whether a delta applies to the frame we have; asks for a keyframe if not
+    bool followsFrame(quint32 baseFrameId);
+    void forwardInputEvent(const Protocol::InputEvent& event);
+    void resetLatency();
     void sendAuthentication();
 
     QSslSocket* m_socket;
     QTimer* m_reconnectTimer;
+    QTimer* m_probeTimer;
+    InputDatagramClient* m_datagramInput;
 
     bool m_connected = false;
     bool m_authenticated = false;
     bool m_useSsl = true;
     bool m_sslEstablished = false;
+    bool m_relaying = false;
+    bool m_watching = false; // screen share requested
+
+    // Last frame received, which the next delta applies to. Not kept while
+    // relaying, only its id.
+    QImage m_frame;
+    quint32 m_frameId = 0;
+    bool m_haveFrame = false;
+    bool m_keyframeRequested = false;
+    quint64 m_frameBytesReceived = 0;
+
+    // Cursor shapes by id, the last CURSOR_SHAPE_CACHE_SIZE received; the
+    // server knows which those are and never sends them again
+    struct CursorShape {
+        QImage image;
+        QPoint hotspot;
+    };
+    QHash<quint64, CursorShape> m_cursorShapes;
+    QQueue<quint64> m_cursorShapeOrder; // oldest first
+    quint64 m_cursorShapeId = 0;        // last signalled
+    bool m_cursorShapeKnown = false;    // cursorShapeChanged sent on this connection
 
     QString m_serverAddress;
     int m_serverPort = 45679;
     QString m_password;
     QString m_serverName;
+    Protocol::PeerCapabilities m_capabilities;
+    quint32 m_maxMessageSize = Protocol::DEFAULT_MAX_MESSAGE_SIZE; // advertised in Auth
+
+    ReceiveBuffer m_buffer;
+    ChannelScheduler m_scheduler;
+    FragmentAssembler m_fragments;
+    StreamReceiver m_streams;
+    QVector<Protocol::InputEvent> m_batchEvents;
 
-    QByteArray m_buffer;
+    QElapsedTimer m_clock; // probe timestamps
+    qint64 m_roundTripUs = -1;
+    int m_upstreamHops = 0;        // relays above the server we are connected to
+    qint64 m_upstreamPathUs = 0;   // latency from the source to that server
 
     bool m_autoReconnect = true;
     int m_reconnectAttempts = 0;
+    int m_retryAfterMs = 0; // ServerFull hint for the next reconnect
     static const int MAX_RECONNECT_ATTEMPTS = 5;
+    static const int RECONNECT_INTERVAL_MS = 5000;
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,107 @@
+#include "clientgroups.h"
+
+void ClientGroups::setShardCount(int shards)
+{
+    m_shards = shards;
+    m_clientNames.clear();
+    for (Group& group : m_groups) {
+        group.members = QVector<ClientSet>(shards);
+    }
+}
+
+QStringList ClientGroups::groups() const
+{
+    QStringList names;
+    for (const Group& group : m_groups) {
+        names.append(group.name);
+    }
+    names.sort();
+    return names;
+}
+
+int ClientGroups::group(const QString& name)
+{
+    QString key = name.trimmed();
+    if (key.isEmpty()) return -1;
+
+    auto it = m_groupIds.constFind(key);
+    if (it != m_groupIds.constEnd()) return it.value();
+
+    Group group;
+    group.name = key;
+    group.members = QVector<ClientSet>(m_shards);
+    m_groups.append(group);
+    m_groupIds.insert(key, m_groups.size() - 1);
+    return m_groups.size() - 1;
+}
+
+QStringList ClientGroups::tags(const QString& clientName) const
+{
+    return m_tags.value(clientName);
+}
+
+void ClientGroups::setTags(const QString& clientName, const QStringList& tags)
+{
+    QStringList cleaned;
+    for (const QString& tag : tags) {
+        QString trimmed = tag.trimmed();
+        if (!trimmed.isEmpty() && !cleaned.contains(trimmed)) {
+            cleaned.append(trimmed);
+        }
+    }
+
+    if (cleaned.isEmpty()) {
+        m_tags.remove(clientName);
+    } else {
+        m_tags.insert(clientName, cleaned);
+    }
+
+    // Regroup connected clients of that name
+    for (auto it = m_clientNames.constBegin(); it != m_clientNames.constEnd(); ++it) {
+        if (it.value() == clientName) {
+            leaveAll(it.key());
+            join(it.key(), cleaned);
+        }
+    }
+}
+
+void ClientGroups::addClient(ClientHandle handle, const QString& clientName)
+{
+    m_clientNames.insert(handle, clientName);
+    join(handle, m_tags.value(clientName));
+}
+
+void ClientGroups::removeClient(ClientHandle handle)
+{
+    if (m_clientNames.remove(handle)) {
+        leaveAll(handle);
+    }
+}
+
+const ClientSet& ClientGroups::members(int group, int shard) const
+{
+    if (group < 0 || group >= m_groups.size() || shard < 0 || shard >= m_groups[group].members.size()) {
+        return m_empty;
+    }
+    return m_groups[group].members[shard];
+}
+
+void ClientGroups::join(ClientHandle handle, const QStringList& tags)
+{
+    int shard = ClientHandles::shard(handle);
+    if (shard >= m_shards) return;
+
+    for (const QString& tag : tags) {
+        m_groups[group(tag)].members[shard].set(ClientHandles::slot(handle));
+    }
+}
+
+void ClientGroups::leaveAll(ClientHandle handle)
+{
+    int shard = ClientHandles::shard(handle);
+    if (shard >= m_shards) return;
+
+    for (Group& group : m_groups) {
+        group.members[shard].reset(ClientHandles::slot(handle));
+    }
+}
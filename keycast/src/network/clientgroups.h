@@ -0,0 +1,59 @@
+#ifndef CLIENTGROUPS_H
+#define CLIENTGROUPS_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+
+#include "clienttable.h"
+
+// A parsed recipient list: everyone, or a mix of groups and single clients.
+// Parsed once, so routing never looks at strings per message.
+struct ClientTarget {
+    bool all = false;
+    QVector<int> groups;           // ClientGroups ids
+    QVector<ClientHandle> clients;
+};
+
+// Named groups of clients. A client is in the groups named by its tags;
+// tags are kept by client name, so they outlive reconnects. Each group keeps
+// a membership bitset per I/O shard, updated as clients come and go, which
+// makes sending to a group a word-wise AND.
+class ClientGroups
+{
+public:
+    // Forgets all members
+    void setShardCount(int shards);
+
+    QStringList groups() const;
+    // Id of the named group, created if needed; -1 for an empty name
+    int group(const QString& name);
+
+    QStringList tags(const QString& clientName) const;
+    void setTags(const QString& clientName, const QStringList& tags);
+
+    void addClient(ClientHandle handle, const QString& clientName);
+    void removeClient(ClientHandle handle);
+
+    // Members of a group on one shard
+    const ClientSet& members(int group, int shard) const;
+
+private:
+    void join(ClientHandle handle, const QStringList& tags);
+    void leaveAll(ClientHandle handle);
+
+    struct Group {
+        QString name;
+        QVector<ClientSet> members; // per shard
+    };
+
+    QVector<Group> m_groups;
+    QHash<QString, int> m_groupIds;
+    QHash<QString, QStringList> m_tags;         // client name -> tags
+    QHash<ClientHandle, QString> m_clientNames; // connected clients
+    int m_shards = 0;
+    ClientSet m_empty;
+};
+
+#endif // CLIENTGROUPS_H
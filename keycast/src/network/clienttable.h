@@ -0,0 +1,277 @@
+#ifndef CLIENTTABLE_H
+#define CLIENTTABLE_H
+
+#include <QVector>
+#include <QtGlobal>
+#include <QtAlgorithms>
+
+// Connections are addressed by a 32-bit handle: the table slot in the low
+// 16 bits, the I/O shard in the next 8 and a generation in the top 8. The
+// generation changes whenever a slot is reused, so a handle kept past the
+// end of its connection (in a queued call, say) matches nothing. 0 is never
+// a valid handle. A ClientSet carries no generations: a table whose slots
+// are named by sets from another thread retires slots instead of removing
+// them, and releases them once no set in flight can name them.
+using ClientHandle = quint32;
+
+namespace ClientHandles {
+
+constexpr int MAX_SLOTS = 1 << 16;
+constexpr int MAX_SHARDS = 1 << 8;
+
+constexpr int slot(ClientHandle handle) { return static_cast<int>(handle & 0xFFFF); }
+constexpr int shard(ClientHandle handle) { return static_cast<int>((handle >> 16) & 0xFF); }
+constexpr quint8 generation(ClientHandle handle) { return static_cast<quint8>(handle >> 24); }
+
+constexpr ClientHandle make(int shard, int slot, quint8 generation)
+{
+    return (static_cast<ClientHandle>(generation) << 24) | (static_cast<ClientHandle>(shard & 0xFF) << 16) |
+           static_cast<ClientHandle>(slot & 0xFFFF);
+}
+
+} // namespace ClientHandles
+
+// A set of table slots, one bit each
+class ClientSet
+{
+public:
+    bool test(int slot) const
+    {
+        int word = slot >> 6;
+        return word < m_words.size() && (m_words[word] & bit(slot));
+    }
+
+    void set(int slot)
+    {
+        int word = slot >> 6;
+        if (word >= m_words.size()) {
+            m_words.resize(word + 1);
+        }
+        m_words[word] |= bit(slot);
+    }
+
+    void reset(int slot)
+    {
+        int word = slot >> 6;
+        if (word < m_words.size()) {
+            m_words[word] &= ~bit(slot);
+        }
+    }
+
+    void clear() { m_words.clear(); }
+
+    bool isEmpty() const
+    {
+        for (quint64 word : m_words) {
+            if (word) return false;
+        }
+        return true;
+    }
+
+    int count() const
+    {
+        int total = 0;
+        for (quint64 word : m_words) {
+            total += qPopulationCount(word);
+        }
+        return total;
+    }
+
+    // Slots in both sets
+    ClientSet operator&(const ClientSet& other) const
+    {
+        ClientSet result;
+        int words = qMin(m_words.size(), other.m_words.size());
+        result.m_words.resize(words);
+        for (int i = 0; i < words; ++i) {
+            result.m_words[i] = m_words[i] & other.m_words[i];
+        }
+        return result;
+    }
+
+    // Adds the other set's slots
+    ClientSet& operator|=(const ClientSet& other)
+    {
+        if (other.m_words.size() > m_words.size()) {
+            m_words.resize(other.m_words.size());
+        }
+        for (int i = 0; i < other.m_words.size(); ++i) {
+            m_words[i] |= other.m_words[i];
+        }
+        return *this;
+    }
+
+    // Slots in this set but not the other
+    ClientSet operator-(const ClientSet& other) const
+    {
+        ClientSet result = *this;
+        int words = qMin(m_words.size(), other.m_words.size());
+        for (int i = 0; i < words; ++i) {
+            result.m_words[i] &= ~other.m_words[i];
+        }
+        return result;
+    }
+
+    // Calls f(slot) for every slot in the set, in ascending order
+    template <typename F>
+    void forEach(F f) const
+    {
+        for (int i = 0; i < m_words.size(); ++i) {
+            quint64 word = m_words[i];
+            while (word) {
+                f((i << 6) + static_cast<int>(qCountTrailingZeroBits(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+private:
+    static constexpr quint64 bit(int slot) { return quint64(1) << (slot & 63); }
+
+    QVector<quint64> m_words;
+};
+
+// Per-connection state in one contiguous array, addressed by handle. Freed
+// slots are reused first, which keeps the array as dense as the peak
+// connection count allows.
+template <typename T>
+class ClientTable
+{
+public:
+    // Claim a slot for a new connection on the given shard; 0 when full
+    ClientHandle allocate(int shard)
+    {
+        int slot;
+        if (!m_free.isEmpty()) {
+            slot = m_free.takeLast();
+        } else if (m_items.size() < ClientHandles::MAX_SLOTS) {
+            slot = m_items.size();
+            m_items.resize(slot + 1);
+            m_handles.resize(slot + 1);
+            m_generations.resize(slot + 1);
+        } else {
+            return 0;
+        }
+
+        // Generation 0 is skipped so no handle is ever 0
+        quint8 generation = m_generations[slot] + 1;
+        if (generation == 0) generation = 1;
+        m_generations[slot] = generation;
+
+        ClientHandle handle = ClientHandles::make(shard, slot, generation);
+        occupy(slot, handle);
+        m_items[slot] = T();
+        return handle;
+    }
+
+    // Store a connection under a handle allocated by another table
+    T& insert(ClientHandle handle, const T& value)
+    {
+        int slot = ClientHandles::slot(handle);
+        if (slot >= m_items.size()) {
+            m_items.resize(slot + 1);
+            m_handles.resize(slot + 1);
+            m_generations.resize(slot + 1);
+        }
+        m_generations[slot] = ClientHandles::generation(handle);
+        m_free.removeOne(slot);
+        occupy(slot, handle);
+        m_items[slot] = value;
+        return m_items[slot];
+    }
+
+    void remove(ClientHandle handle)
+    {
+        if (retire(handle)) {
+            m_free.append(ClientHandles::slot(handle));
+        }
+    }
+
+    // Like remove(), but the slot is not reused until release()
+    bool retire(ClientHandle handle)
+    {
+        if (!contains(handle)) return false;
+
+        int slot = ClientHandles::slot(handle);
+        m_items[slot] = T(); // releases the connection's buffers now
+        m_handles[slot] = 0;
+        m_used.reset(slot);
+        m_size--;
+        return true;
+    }
+
+    // Makes the slot of a retired handle available again
+    void release(ClientHandle handle)
+    {
+        int slot = ClientHandles::slot(handle);
+        if (slot < m_handles.size() && !m_handles[slot] && m_generations[slot] == ClientHandles::generation(handle) &&
+            !m_free.contains(slot)) {
+            m_free.append(slot);
+        }
+    }
+
+    void clear()
+    {
+        m_items.clear();
+        m_handles.clear();
+        m_generations.clear();
+        m_free.clear();
+        m_used.clear();
+        m_size = 0;
+    }
+
+    bool contains(ClientHandle handle) const
+    {
+        int slot = ClientHandles::slot(handle);
+        return handle && slot < m_handles.size() && m_handles[slot] == handle;
+    }
+
+    T* find(ClientHandle handle) { return contains(handle) ? &m_items[ClientHandles::slot(handle)] : nullptr; }
+    const T* find(ClientHandle handle) const
+    {
+        return contains(handle) ? &m_items[ClientHandles::slot(handle)] : nullptr;
+    }
+
+    // Slot must be in use
+    T& at(int slot) { return m_items[slot]; }
+    const T& at(int slot) const { return m_items[slot]; }
+    ClientHandle handleAt(int slot) const { return m_handles[slot]; }
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+
+    // Slots in use
+    const ClientSet& occupied() const { return m_used; }
+
+    // Calls f(handle, item) for every connection, in slot order
+    template <typename F>
+    void forEach(F f)
+    {
+        m_used.forEach([&](int slot) { f(m_handles[slot], m_items[slot]); });
+    }
+
+    template <typename F>
+    void forEach(F f) const
+    {
+        m_used.forEach([&](int slot) { f(m_handles[slot], m_items[slot]); });
+    }
+
+private:
+    void occupy(int slot, ClientHandle handle)
+    {
+        if (!m_handles[slot]) {
+            m_size++;
+        }
+        m_handles[slot] = handle;
+        m_used.set(slot);
+    }
+
+    QVector<T> m_items;
+    QVector<ClientHandle> m_handles;   // 0 for free slots
+    QVector<quint8> m_generations;     // last generation handed out per slot
+    QVector<int> m_free;
+    ClientSet m_used;
+    int m_size = 0;
+};
+
+#endif // CLIENTTABLE_H
@@ -0,0 +1,457 @@
+#include "datagraminput.h"
+
+#include <QNetworkDatagram>
+#include <QRandomGenerator>
+#include <QSslSocket>
+
+namespace {
+
+constexpr int SESSION_KEY_SIZE = 32;
+constexpr int SESSION_IDENTITY_SIZE = 16;
+constexpr int KEEPALIVE_TIMEOUT_MS = 3000;
+
+// The newest datagram is repeated this many times after input goes idle, so
+// losing the last one (typically a key release) is covered as well
+constexpr int TAIL_REPEATS = 2;
+constexpr int TAIL_REPEAT_INTERVAL_MS = 20;
+
+QByteArray randomBytes(int size)
+{
+    QByteArray bytes(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        bytes[i] = static_cast<char>(QRandomGenerator::system()->generate());
+    }
+    return bytes;
+}
+
+QSslConfiguration pskConfiguration()
+{
+    // Both ends authenticate with the pre-shared key, no certificates
+    QSslConfiguration configuration = QSslConfiguration::defaultDtlsConfiguration();
+    configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+    return configuration;
+}
+
+} // namespace
+
+InputDatagramServer::InputDatagramServer(QObject* parent)
+    : QObject(parent)
+    , m_socket(new QUdpSocket(this))
+    , m_verifier(new QDtlsClientVerifier(this))
+    , m_repeatTimer(new QTimer(this))
+    , m_configuration(pskConfiguration())
+{
+    m_repeatTimer->setSingleShot(true);
+    m_repeatTimer->setTimerType(Qt::PreciseTimer);
+
+    connect(m_socket, &QUdpSocket::readyRead, this, &InputDatagramServer::onReadyRead);
+    connect(m_repeatTimer, &QTimer::timeout, this, &InputDatagramServer::onRepeatTimer);
+}
+
+InputDatagramServer::~InputDatagramServer()
+{
+    close();
+}
+
+bool InputDatagramServer::listen(quint16 port)
+{
+    close();
+
+    if (!m_socket->bind(QHostAddress::Any, port)) {
+        return false;
+    }
+
+    m_port = m_socket->localPort(); // port 0 picks one
+    return true;
+}
+
+void InputDatagramServer::close()
+{
+    const QList<ClientHandle> clients = m_sessions.keys();
+    for (ClientHandle client : clients) {
+        closeSession(client);
+    }
+
+    // Handshakes that never got as far as a session
+    const QList<QDtls*> peers = m_peers.values();
+    for (QDtls* dtls : peers) {
+        removePeer(dtls);
+    }
+
+    m_repeatTimer->stop();
+    m_socket->close();
+    m_port = 0;
+}
+
+bool InputDatagramServer::isListening() const
+{
+    return m_socket->state() == QAbstractSocket::BoundState;
+}
+
+void InputDatagramServer::openSession(ClientHandle client, QByteArray& identity, QByteArray& key)
+{
+    closeSession(client);
+
+    Session session;
+    session.identity = randomBytes(SESSION_IDENTITY_SIZE).toHex();
+    session.key = randomBytes(SESSION_KEY_SIZE);
+
+    identity = session.identity;
+    key = session.key;
+
+    m_identities.insert(session.identity, client);
+    m_sessions.insert(client, session);
+}
+
+void InputDatagramServer::closeSession(ClientHandle client)
+{
+    if (!m_sessions.contains(client)) return;
+
+    Session session = m_sessions.take(client);
+    m_identities.remove(session.identity);
+
+    if (session.dtls) {
+        if (session.dtls->isConnectionEncrypted()) {
+            session.dtls->shutdown(m_socket);
+        }
+        removePeer(session.dtls);
+    }
+}
+
+bool InputDatagramServer::isActive(ClientHandle client) const
+{
+    auto it = m_sessions.constFind(client);
+    return it != m_sessions.constEnd() && isActive(it.value());
+}
+
+bool InputDatagramServer::isActive(const Session& session)
+{
+    return session.dtls && session.dtls->isConnectionEncrypted() &&
+           session.lastHeard.isValid() && !session.lastHeard.hasExpired(KEEPALIVE_TIMEOUT_MS);
+}
+
+bool InputDatagramServer::sendInputEvent(ClientHandle client, const Protocol::InputEvent& event)
+{
+    auto it = m_sessions.find(client);
+    if (it == m_sessions.end() || !isActive(it.value())) return false;
+
+    Session& session = it.value();
+
+    // Slide the redundancy window: oldest event out, newest in
+    if (session.historySize == Protocol::MAX_INPUT_DATAGRAM_EVENTS) {
+        for (int i = 1; i < session.historySize; ++i) {
+            session.history[i - 1] = session.history[i];
+        }
+        session.historySize--;
+    }
+    session.history[session.historySize] = event;
+    session.history[session.historySize].timeOffsetUs = 0;
+    session.historySize++;
+    session.nextSequence++;
+
+    sendHistory(session);
+
+    session.repeatsLeft = TAIL_REPEATS;
+    if (!m_repeatTimer->isActive()) {
+        m_repeatTimer->start(TAIL_REPEAT_INTERVAL_MS);
+    }
+    return true;
+}
+
+void InputDatagramServer::sendHistory(Session& session)
+{
+    if (m_simulatedLoss > 0.0 && QRandomGenerator::global()->generateDouble() < m_simulatedLoss) {
+        return;
+    }
+
+    char datagram[Protocol::MAX_INPUT_DATAGRAM_SIZE];
+    quint32 firstSequence = session.nextSequence - static_cast<quint32>(session.historySize);
+    int size = Protocol::writeInputDatagram(datagram, firstSequence, session.history, session.historySize);
+
+    session.dtls->writeDatagramEncrypted(m_socket, QByteArray::fromRawData(datagram, size));
+}
+
+void InputDatagramServer::onRepeatTimer()
+{
+    bool pending = false;
+    for (Session& session : m_sessions) {
+        if (session.repeatsLeft <= 0) continue;
+
+        if (isActive(session)) {
+            sendHistory(session);
+            session.repeatsLeft--;
+        } else {
+            session.repeatsLeft = 0;
+        }
+        pending = pending || session.repeatsLeft > 0;
+    }
+
+    if (pending) {
+        m_repeatTimer->start(TAIL_REPEAT_INTERVAL_MS);
+    }
+}
+
+void InputDatagramServer::onReadyRead()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = m_socket->receiveDatagram();
+        if (!datagram.isValid()) continue;
+
+        QDtls* dtls = m_peers.value(peerKey(datagram.senderAddress(), datagram.senderPort()));
+        if (!dtls) {
+            handleNewPeer(datagram.senderAddress(), datagram.senderPort(), datagram.data());
+            continue;
+        }
+
+        if (!dtls->isConnectionEncrypted()) {
+            dtls->doHandshake(m_socket, datagram.data());
+            if (dtls->isConnectionEncrypted()) {
+                handshakeComplete(dtls);
+            } else if (dtls->dtlsError() != QDtlsError::NoError) {
+                removePeer(dtls);
+            }
+            continue;
+        }
+
+        // Clients only send keepalives; their content does not matter
+        dtls->decryptDatagram(m_socket, datagram.data());
+        if (dtls->dtlsError() == QDtlsError::RemoteClosedConnectionError) {
+            ClientHandle client = m_dtlsOwners.value(dtls);
+            if (m_sessions.contains(client) && m_sessions[client].dtls == dtls) {
+                m_sessions[client].dtls = nullptr;
+            }
+            removePeer(dtls);
+            continue;
+        }
+
+        ClientHandle client = m_dtlsOwners.value(dtls);
+        if (m_sessions.contains(client)) {
+            m_sessions[client].lastHeard.start();
+        }
+    }
+}
+
+void InputDatagramServer::handleNewPeer(const QHostAddress& address, quint16 port, const QByteArray& datagram)
+{
+    // Nobody to talk to, and no unbounded growth from stray handshakes
+    if (m_sessions.isEmpty() || m_peers.size() >= m_sessions.size() * 2) return;
+
+    // Stateless cookie exchange first, so spoofed sources cost us nothing
+    if (!m_verifier->verifyClient(m_socket, datagram, address, port)) return;
+
+    QDtls* dtls = new QDtls(QSslSocket::SslServerMode, this);
+    dtls->setDtlsConfiguration(m_configuration);
+    dtls->setPeer(address, port);
+
+    connect(dtls, &QDtls::pskRequired, this, &InputDatagramServer::onPskRequired);
+    connect(dtls, &QDtls::handshakeTimeout, this, &InputDatagramServer::onHandshakeTimeout);
+
+    m_peers.insert(peerKey(address, port), dtls);
+
+    if (!dtls->doHandshake(m_socket, m_verifier->verifiedHello())) {
+        removePeer(dtls);
+    }
+}
+
+void InputDatagramServer::onPskRequired(QSslPreSharedKeyAuthenticator* authenticator)
+{
+    QDtls* dtls = qobject_cast<QDtls*>(sender());
+    if (!dtls) return;
+
+    // Unknown identities get no key and fail the handshake
+    ClientHandle client = m_identities.value(authenticator->identity());
+    if (!client || !m_sessions.contains(client)) return;
+
+    m_dtlsOwners.insert(dtls, client);
+    authenticator->setPreSharedKey(m_sessions[client].key);
+}
+
+void InputDatagramServer::onHandshakeTimeout()
+{
+    QDtls* dtls = qobject_cast<QDtls*>(sender());
+    if (!dtls) return;
+
+    if (!dtls->handleTimeout(m_socket)) {
+        removePeer(dtls);
+    }
+}
+
+void InputDatagramServer::handshakeComplete(QDtls* dtls)
+{
+    ClientHandle client = m_dtlsOwners.value(dtls);
+    if (!m_sessions.contains(client)) {
+        removePeer(dtls);
+        return;
+    }
+
+    // A client that rebinds its UDP socket replaces its earlier connection
+    Session& session = m_sessions[client];
+    if (session.dtls && session.dtls != dtls) {
+        removePeer(session.dtls);
+    }
+    session.dtls = dtls;
+    session.lastHeard.start();
+}
+
+void InputDatagramServer::removePeer(QDtls* dtls)
+{
+    m_peers.remove(peerKey(dtls->peerAddress(), dtls->peerPort()));
+    m_dtlsOwners.remove(dtls);
+    dtls->deleteLater();
+}
+
+QString InputDatagramServer::peerKey(const QHostAddress& address, quint16 port)
+{
+    return QString("%1:%2").arg(address.toString()).arg(port);
+}
+
+InputDatagramClient::InputDatagramClient(QObject* parent)
+    : QObject(parent)
+    , m_socket(new QUdpSocket(this))
+    , m_keepaliveTimer(new QTimer(this))
+    , m_gapTimer(new QTimer(this))
+{
+    m_gapTimer->setSingleShot(true);
+    m_gapTimer->setTimerType(Qt::PreciseTimer);
+
+    connect(m_socket, &QUdpSocket::readyRead, this, &InputDatagramClient::onReadyRead);
+    connect(m_keepaliveTimer, &QTimer::timeout, this, &InputDatagramClient::onKeepaliveTimer);
+    connect(m_gapTimer, &QTimer::timeout, this, &InputDatagramClient::onGapTimer);
+}
+
+InputDatagramClient::~InputDatagramClient()
+{
+    close();
+}
+
+void InputDatagramClient::open(const QHostAddress& address, quint16 port,
+                               const QByteArray& identity, const QByteArray& key)
+{
+    close();
+
+    if (!m_socket->bind()) return;
+
+    m_identity = identity;
+    m_key = key;
+    m_nextSequence = 1;
+
+    m_dtls = new QDtls(QSslSocket::SslClientMode, this);
+    m_dtls->setDtlsConfiguration(pskConfiguration());
+    m_dtls->setPeer(address, port);
+
+    connect(m_dtls, &QDtls::pskRequired, this, &InputDatagramClient::onPskRequired);
+    connect(m_dtls, &QDtls::handshakeTimeout, this, &InputDatagramClient::onHandshakeTimeout);
+
+    if (!m_dtls->doHandshake(m_socket)) {
+        close();
+    }
+}
+
+void InputDatagramClient::close()
+{
+    m_keepaliveTimer->stop();
+    m_gapTimer->stop();
+
+    if (m_dtls) {
+        if (m_dtls->isConnectionEncrypted()) {
+            m_dtls->shutdown(m_socket);
+        }
+        m_dtls->deleteLater();
+        m_dtls = nullptr;
+    }
+
+    m_socket->close();
+    m_pending.clear();
+    m_key.clear();
+}
+
+bool InputDatagramClient::isEncrypted() const
+{
+    return m_dtls && m_dtls->isConnectionEncrypted();
+}
+
+void InputDatagramClient::onPskRequired(QSslPreSharedKeyAuthenticator* authenticator)
+{
+    authenticator->setIdentity(m_identity);
+    authenticator->setPreSharedKey(m_key);
+}
+
+void InputDatagramClient::onHandshakeTimeout()
+{
+    if (m_dtls && !m_dtls->handleTimeout(m_socket)) {
+        close();
+    }
+}
+
+void InputDatagramClient::onKeepaliveTimer()
+{
+    if (!isEncrypted()) return;
+
+    char datagram[Protocol::MAX_INPUT_DATAGRAM_SIZE];
+    int size = Protocol::writeInputDatagram(datagram, 0, nullptr, 0);
+    m_dtls->writeDatagramEncrypted(m_socket, QByteArray::fromRawData(datagram, size));
+}
+
+void InputDatagramClient::onReadyRead()
+{
+    while (m_socket->hasPendingDatagrams()) {
+        QNetworkDatagram datagram = m_socket->receiveDatagram();
+        if (!datagram.isValid() || !m_dtls) continue;
+
+        if (!m_dtls->isConnectionEncrypted()) {
+            m_dtls->doHandshake(m_socket, datagram.data());
+            if (m_dtls->isConnectionEncrypted()) {
+                // First keepalive tells the server the path works
+                onKeepaliveTimer();
+                m_keepaliveTimer->start(KEEPALIVE_INTERVAL_MS);
+            } else if (m_dtls->dtlsError() != QDtlsError::NoError) {
+                close();
+                return;
+            }
+            continue;
+        }
+
+        QByteArray plain = m_dtls->decryptDatagram(m_socket, datagram.data());
+        if (m_dtls->dtlsError() == QDtlsError::RemoteClosedConnectionError) {
+            close();
+            return;
+        }
+
+        quint32 firstSequence;
+        m_events.clear();
+        if (plain.isEmpty() || !Protocol::parseInputDatagram(plain, firstSequence, m_events)) continue;
+
+        for (int i = 0; i < m_events.size(); ++i) {
+            quint32 sequence = firstSequence + static_cast<quint32>(i);
+            if (sequence >= m_nextSequence) {
+                m_pending.insert(sequence, m_events[i]);
+            }
+        }
+
+        deliverPending();
+    }
+}
+
+void InputDatagramClient::deliverPending()
+{
+    while (!m_pending.isEmpty() && m_pending.firstKey() == m_nextSequence) {
+        Protocol::InputEvent event = m_pending.take(m_nextSequence);
+        m_nextSequence++;
+        emit inputEventReceived(event);
+    }
+
+    if (m_pending.isEmpty()) {
+        m_gapTimer->stop();
+    } else if (!m_gapTimer->isActive()) {
+        m_gapTimer->start(GAP_TIMEOUT_MS);
+    }
+}
+
+void InputDatagramClient::onGapTimer()
+{
+    if (m_pending.isEmpty()) return;
+
+    // Every datagram that could have carried the missing events is lost
+    m_nextSequence = m_pending.firstKey();
+    deliverPending();
+}
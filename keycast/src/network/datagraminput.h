@@ -0,0 +1,139 @@
+#ifndef DATAGRAMINPUT_H
+#define DATAGRAMINPUT_H
+
+#include <QObject>
+#include <QUdpSocket>
+#include <QDtls>
+#include <QSslConfiguration>
+#include <QSslPreSharedKeyAuthenticator>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QHash>
+#include <QMap>
+#include <QVector>
+
+#include "protocol.h"
+#include "clienttable.h"
+
+// Server side of the datagram input channel.
+//
+// One UDP socket serves every client. A client that negotiated
+// CapDatagramInput gets a session identity and pre-shared key over its TLS
+// connection, then completes a DTLS handshake with them. From then on input
+// events are sent to it as datagrams, each repeating the last few events, so
+// a lost datagram never stalls the ones behind it the way a lost TCP segment
+// does. A session that stops sending keepalives is treated as gone and the
+// caller falls back to TCP.
+class InputDatagramServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit InputDatagramServer(QObject* parent = nullptr);
+    ~InputDatagramServer();
+
+    bool listen(quint16 port);
+    void close();
+    bool isListening() const;
+    quint16 port() const { return m_port; }
+
+    // Create a session for an authenticated client; identity and key are sent
+    // to it in InputChannelSetup
+    void openSession(ClientHandle client, QByteArray& identity, QByteArray& key);
+    void closeSession(ClientHandle client);
+
+    // Handshake complete and the client has been heard from recently
+    bool isActive(ClientHandle client) const;
+
+    // Returns false when the session is not active and the event was not sent
+    bool sendInputEvent(ClientHandle client, const Protocol::InputEvent& event);
+
+    // Fraction of outgoing datagrams dropped on purpose, for measuring
+    // latency under loss on a loopback link (keycast_inputbench)
+    double simulatedLoss() const { return m_simulatedLoss; }
+    void setSimulatedLoss(double ratio) { m_simulatedLoss = qBound(0.0, ratio, 1.0); }
+
+private slots:
+    void onReadyRead();
+    void onHandshakeTimeout();
+    void onPskRequired(QSslPreSharedKeyAuthenticator* authenticator);
+    void onRepeatTimer();
+
+private:
+    struct Session {
+        QByteArray identity;
+        QByteArray key;
+        QDtls* dtls = nullptr;
+        QElapsedTimer lastHeard;
+        quint32 nextSequence = 1;
+        Protocol::InputEvent history[Protocol::MAX_INPUT_DATAGRAM_EVENTS];
+        int historySize = 0;
+        int repeatsLeft = 0;
+    };
+
+    void handleNewPeer(const QHostAddress& address, quint16 port, const QByteArray& datagram);
+    void handshakeComplete(QDtls* dtls);
+    void removePeer(QDtls* dtls);
+    void sendHistory(Session& session);
+    static bool isActive(const Session& session);
+    static QString peerKey(const QHostAddress& address, quint16 port);
+
+    QUdpSocket* m_socket;
+    QDtlsClientVerifier* m_verifier;
+    QTimer* m_repeatTimer;
+    QSslConfiguration m_configuration;
+
+    QHash<ClientHandle, Session> m_sessions;      // by client
+    QHash<QByteArray, ClientHandle> m_identities; // session identity -> client
+    QHash<QString, QDtls*> m_peers;               // "address:port" -> DTLS connection
+    QHash<QDtls*, ClientHandle> m_dtlsOwners;     // DTLS connection -> client
+
+    quint16 m_port = 0;
+    double m_simulatedLoss = 0.0;
+};
+
+// Client side of the datagram input channel. Delivers events in sequence
+// order; redundant copies are dropped, and a gap that no later datagram fills
+// within GAP_TIMEOUT_MS is skipped.
+class InputDatagramClient : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int KEEPALIVE_INTERVAL_MS = 1000;
+    static constexpr int GAP_TIMEOUT_MS = 50;
+
+    explicit InputDatagramClient(QObject* parent = nullptr);
+    ~InputDatagramClient();
+
+    void open(const QHostAddress& address, quint16 port, const QByteArray& identity, const QByteArray& key);
+    void close();
+    bool isOpen() const { return m_dtls != nullptr; }
+    bool isEncrypted() const;
+
+signals:
+    void inputEventReceived(const Protocol::InputEvent& event);
+
+private slots:
+    void onReadyRead();
+    void onHandshakeTimeout();
+    void onPskRequired(QSslPreSharedKeyAuthenticator* authenticator);
+    void onKeepaliveTimer();
+    void onGapTimer();
+
+private:
+    void deliverPending();
+
+    QUdpSocket* m_socket;
+    QDtls* m_dtls = nullptr;
+    QTimer* m_keepaliveTimer;
+    QTimer* m_gapTimer;
+
+    QByteArray m_identity;
+    QByteArray m_key;
+    quint32 m_nextSequence = 1;
+    QMap<quint32, Protocol::InputEvent> m_pending;
+    QVector<Protocol::InputEvent> m_events;
+};
+
+#endif // DATAGRAMINPUT_H
@@ -0,0 +1,72 @@
+#include "messages.h"
+
+#include <cstring>
+
+namespace Protocol {
+
+static constexpr quint32 NULL_LENGTH = 0xFFFFFFFF;
+
+char* FieldCodec<QString>::write(char* p, const QString& value)
+{
+    if (value.isNull()) {
+        qToBigEndian<quint32>(NULL_LENGTH, p);
+        return p + 4;
+    }
+
+    qsizetype bytes = value.size() * 2;
+    qToBigEndian<quint32>(static_cast<quint32>(bytes), p);
+    qToBigEndian<quint16>(value.utf16(), value.size(), p + 4);
+    return p + 4 + bytes;
+}
+
+bool FieldCodec<QString>::read(const char*& p, const char* end, QString& value)
+{
+    if (end - p < 4) return false;
+    quint32 bytes = qFromBigEndian<quint32>(p);
+    p += 4;
+
+    if (bytes == NULL_LENGTH) {
+        value = QString();
+        return true;
+    }
+    if ((bytes & 1) || static_cast<qsizetype>(bytes) > end - p) return false;
+
+    value.resize(bytes / 2);
+    qFromBigEndian<quint16>(p, bytes / 2, value.data());
+    p += bytes;
+    return true;
+}
+
+char* FieldCodec<QByteArray>::write(char* p, const QByteArray& value)
+{
+    if (value.isNull()) {
+        qToBigEndian<quint32>(NULL_LENGTH, p);
+        return p + 4;
+    }
+
+    qToBigEndian<quint32>(static_cast<quint32>(value.size()), p);
+    if (!value.isEmpty()) {
+        memcpy(p + 4, value.constData(), value.size());
+    }
+    return p + 4 + value.size();
+}
+
+bool FieldCodec<QByteArray>::read(const char*& p, const char* end, QByteArray& value)
+{
+    if (end - p < 4) return false;
+    quint32 bytes = qFromBigEndian<quint32>(p);
+    p += 4;
+
+    if (bytes == NULL_LENGTH) {
+        value = QByteArray();
+        return true;
+    }
+    if (static_cast<qsizetype>(bytes) > end - p) return false;
+
+    // Owning copy, the receive buffer is reused after the handler returns
+    value = QByteArray(p, bytes);
+    p += bytes;
+    return true;
+}
+
+} // namespace Protocol
@@ -0,0 +1,541 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtEndian>
+
+#include <array>
+#include <type_traits>
+
+#include "protocol.h"
+
+namespace Protocol {
+
+// Compile-time message registry.
+//
+// Every message is a plain struct with its type id. Messages made of simple
+// fields list them in a MessageFields specialization, and encode()/decode()
+// are generated from that list: sizes are summed at compile time, the packet
+// is written with one allocation and read with direct loads. Messages with a
+// hand-tuned layout (input, frames, batches) provide a static decode() that
+// wraps their parse function instead. Dispatcher turns a list of messages into
+// a 256-entry jump table of typed handlers.
+
+// Per-type field codecs. Big-endian, and strings and byte arrays carry the
+// same quint32 length prefix QDataStream writes (0xFFFFFFFF for null), so the
+// wire format is the one these messages always had.
+// size is the encoded size of fixed-size types and 0 for length-prefixed ones.
+template<class T, class = void>
+struct FieldCodec;
+
+template<class T>
+struct FieldCodec<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static constexpr int size = sizeof(T);
+    static constexpr int minSize = sizeof(T);
+
+    static qsizetype encodedSize(T) { return size; }
+
+    static char* write(char* p, T value)
+    {
+        qToBigEndian<T>(value, p);
+        return p + size;
+    }
+
+    static bool read(const char*& p, const char* end, T& value)
+    {
+        if (end - p < size) return false;
+        value = qFromBigEndian<T>(p);
+        p += size;
+        return true;
+    }
+};
+
+template<>
+struct FieldCodec<bool> {
+    static constexpr int size = 1;
+    static constexpr int minSize = 1;
+
+    static qsizetype encodedSize(bool) { return size; }
+
+    static char* write(char* p, bool value)
+    {
+        *p = value ? 1 : 0;
+        return p + 1;
+    }
+
+    static bool read(const char*& p, const char* end, bool& value)
+    {
+        if (p >= end) return false;
+        value = *p++ != 0;
+        return true;
+    }
+};
+
+template<>
+struct FieldCodec<QString> {
+    static constexpr int size = 0;
+    static constexpr int minSize = 4;
+
+    static qsizetype encodedSize(const QString& value) { return 4 + (value.isNull() ? 0 : value.size() * 2); }
+    static char* write(char* p, const QString& value);
+    static bool read(const char*& p, const char* end, QString& value);
+};
+
+template<>
+struct FieldCodec<QByteArray> {
+    static constexpr int size = 0;
+    static constexpr int minSize = 4;
+
+    static qsizetype encodedSize(const QByteArray& value) { return 4 + value.size(); }
+    static char* write(char* p, const QByteArray& value);
+    static bool read(const char*& p, const char* end, QByteArray& value);
+};
+
+template<class>
+struct MemberPointer;
+
+template<class C, class T>
+struct MemberPointer<T C::*> {
+    using Class = C;
+    using Type = T;
+};
+
+template<auto Member>
+using FieldType = typename MemberPointer<decltype(Member)>::Type;
+
+// Ordered field list of a message, as pointers to its members
+template<auto... Members>
+struct FieldList {
+    static constexpr bool generated = true;
+    static constexpr bool isFixedSize = ((FieldCodec<FieldType<Members>>::size > 0) && ...);
+    static constexpr int minPayloadSize = (0 + ... + FieldCodec<FieldType<Members>>::minSize);
+
+    template<class M>
+    static constexpr bool belongsTo = (std::is_same_v<typename MemberPointer<decltype(Members)>::Class, M> && ...);
+
+    template<class M>
+    static qsizetype payloadSize([[maybe_unused]] const M& message)
+    {
+        if constexpr (isFixedSize) {
+            return minPayloadSize;
+        } else {
+            return (qsizetype(0) + ... + FieldCodec<FieldType<Members>>::encodedSize(message.*Members));
+        }
+    }
+
+    template<class M>
+    static char* write(char* p, [[maybe_unused]] const M& message)
+    {
+        ((p = FieldCodec<FieldType<Members>>::write(p, message.*Members)), ...);
+        return p;
+    }
+
+    template<class M>
+    static bool read([[maybe_unused]] const char* p, [[maybe_unused]] const char* end,
+                     [[maybe_unused]] M& message)
+    {
+        return (FieldCodec<FieldType<Members>>::read(p, end, message.*Members) && ...);
+    }
+};
+
+// Specialized for every message with generated encode/decode
+template<class M>
+struct MessageFields {
+    static constexpr bool generated = false;
+};
+
+template<class M>
+QByteArray encode(const M& message)
+{
+    using Fields = MessageFields<M>;
+    static_assert(Fields::generated, "message has no field list");
+    static_assert(Fields::template belongsTo<M>, "field list refers to another message");
+
+    qsizetype payloadSize = Fields::payloadSize(message);
+    QByteArray packet(PACKET_HEADER_SIZE + payloadSize, Qt::Uninitialized);
+    writePacketHeader(packet.data(), M::type, PROTOCOL_VERSION, static_cast<quint32>(payloadSize));
+    Fields::write(packet.data() + PACKET_HEADER_SIZE, message);
+    return packet;
+}
+
+// Trailing bytes are ignored so newer peers can extend a message
+template<class M>
+bool decode(const PacketView& packet, M& message)
+{
+    if constexpr (MessageFields<M>::generated) {
+        if (packet.payloadSize < MessageFields<M>::minPayloadSize) return false;
+        return MessageFields<M>::read(packet.payload, packet.payload + packet.payloadSize, message);
+    } else {
+        return M::decode(packet, message);
+    }
+}
+
+// Messages with generated codecs
+
+template<MessageType Type>
+struct EmptyMessage {
+    static constexpr MessageType type = Type;
+};
+
+template<MessageType Type>
+struct MessageFields<EmptyMessage<Type>> : FieldList<> {};
+
+using PingMessage = EmptyMessage<MessageType::Ping>;
+using PongMessage = EmptyMessage<MessageType::Pong>;
+using DisconnectMessage = EmptyMessage<MessageType::Disconnect>;
+using ClipboardRequestMessage = EmptyMessage<MessageType::ClipboardRequest>;
+
+struct ExecuteCommandMessage {
+    static constexpr MessageType type = MessageType::ExecuteCommand;
+    QString command;
+    QString commandType;
+};
+
+template<>
+struct MessageFields<ExecuteCommandMessage>
+    : FieldList<&ExecuteCommandMessage::command, &ExecuteCommandMessage::commandType> {};
+
+struct ClientInfoMessage {
+    static constexpr MessageType type = MessageType::ClientInfo;
+    QString clientId;
+    QString clientName;
+};
+
+template<>
+struct MessageFields<ClientInfoMessage>
+    : FieldList<&ClientInfoMessage::clientId, &ClientInfoMessage::clientName> {};
+
+struct InputChannelSetupMessage {
+    static constexpr MessageType type = MessageType::InputChannelSetup;
+    quint16 port = 0;
+    QByteArray identity;
+    QByteArray key;
+};
+
+template<>
+struct MessageFields<InputChannelSetupMessage>
+    : FieldList<&InputChannelSetupMessage::port, &InputChannelSetupMessage::identity,
+                &InputChannelSetupMessage::key> {};
+
+// ScreenShareRequest/Start/Stop share one layout
+template<MessageType Type>
+struct ScreenShareMessage {
+    static constexpr MessageType type = Type;
+    bool start = false;
+};
+
+template<MessageType Type>
+struct MessageFields<ScreenShareMessage<Type>> : FieldList<&ScreenShareMessage<Type>::start> {};
+
+using ScreenShareRequestMessage = ScreenShareMessage<MessageType::ScreenShareRequest>;
+using ScreenShareStartMessage = ScreenShareMessage<MessageType::ScreenShareStart>;
+using ScreenShareStopMessage = ScreenShareMessage<MessageType::ScreenShareStop>;
+
+struct ScreenFrameAckMessage {
+    static constexpr MessageType type = MessageType::ScreenFrameAck;
+    quint32 frameId = 0;
+};
+
+template<>
+struct MessageFields<ScreenFrameAckMessage> : FieldList<&ScreenFrameAckMessage::frameId> {};
+
+// Round-trip timing (CapLatencyProbe). Either end may probe; the peer echoes
+// sentUs back unchanged. A server also says how far it is from the source:
+// hops and pathLatencyUs are 0 on the originating server and grow at each
+// relay, so a client learns the latency of every hop above it.
+struct LatencyProbeMessage {
+    static constexpr MessageType type = MessageType::LatencyProbe;
+    quint64 sentUs = 0;        // sender's clock
+    quint8 hops = 0;           // relays between the sender and the source
+    quint32 pathLatencyUs = 0; // one-way latency from the source to the sender
+};
+
+template<>
+struct MessageFields<LatencyProbeMessage>
+    : FieldList<&LatencyProbeMessage::sentUs, &LatencyProbeMessage::hops, &LatencyProbeMessage::pathLatencyUs> {};
+
+struct LatencyReplyMessage {
+    static constexpr MessageType type = MessageType::LatencyReply;
+    quint64 sentUs = 0; // from the probe
+};
+
+template<>
+struct MessageFields<LatencyReplyMessage> : FieldList<&LatencyReplyMessage::sentUs> {};
+
+struct StreamBeginMessage {
+    static constexpr MessageType type = MessageType::StreamBegin;
+    quint32 streamId = 0;
+    QString kind;     // what the payload is for, e.g. "clipboard"
+    QString mimeType;
+    quint64 totalSize = 0;
+};
+
+template<>
+struct MessageFields<StreamBeginMessage>
+    : FieldList<&StreamBeginMessage::streamId, &StreamBeginMessage::kind, &StreamBeginMessage::mimeType,
+                &StreamBeginMessage::totalSize> {};
+
+struct StreamEndMessage {
+    static constexpr MessageType type = MessageType::StreamEnd;
+    quint32 streamId = 0;
+    bool complete = false; // false if the sender gave up before totalSize
+};
+
+template<>
+struct MessageFields<StreamEndMessage> : FieldList<&StreamEndMessage::streamId, &StreamEndMessage::complete> {};
+
+// Position in frame pixels; shapeId names a CursorShape sent before
+struct CursorPositionMessage {
+    static constexpr MessageType type = MessageType::CursorPosition;
+    qint32 x = 0;
+    qint32 y = 0;
+    quint64 shapeId = 0;
+    bool visible = false; // false while the pointer is outside the shared area
+};
+
+template<>
+struct MessageFields<CursorPositionMessage>
+    : FieldList<&CursorPositionMessage::x, &CursorPositionMessage::y, &CursorPositionMessage::shapeId,
+                &CursorPositionMessage::visible> {};
+
+struct CursorShapeMessage {
+    static constexpr MessageType type = MessageType::CursorShape;
+    quint64 shapeId = 0;
+    qint16 hotspotX = 0;
+    qint16 hotspotY = 0;
+    QByteArray image; // PNG, in frame pixels
+};
+
+template<>
+struct MessageFields<CursorShapeMessage>
+    : FieldList<&CursorShapeMessage::shapeId, &CursorShapeMessage::hotspotX, &CursorShapeMessage::hotspotY,
+                &CursorShapeMessage::image> {};
+
+// What the server currently sends (CapStreamParams), on every change and
+// to viewers as they join; informational, frames describe themselves
+struct ScreenShareParamsMessage {
+    static constexpr MessageType type = MessageType::ScreenShareParams;
+    quint8 frameRate = 0;     // most frames per second, fewer while the screen is idle
+    quint8 quality = 0;       // JPEG quality
+    quint8 scalePercent = 0;  // of the capture size
+};
+
+template<>
+struct MessageFields<ScreenShareParamsMessage>
+    : FieldList<&ScreenShareParamsMessage::frameRate, &ScreenShareParamsMessage::quality,
+                &ScreenShareParamsMessage::scalePercent> {};
+
+static_assert(MessageFields<PingMessage>::isFixedSize && MessageFields<PingMessage>::minPayloadSize == 0);
+static_assert(MessageFields<ScreenShareStartMessage>::isFixedSize &&
+              MessageFields<ScreenShareStartMessage>::minPayloadSize == 1);
+static_assert(MessageFields<ScreenFrameAckMessage>::isFixedSize &&
+              MessageFields<ScreenFrameAckMessage>::minPayloadSize == 4);
+static_assert(MessageFields<LatencyProbeMessage>::isFixedSize &&
+              MessageFields<LatencyProbeMessage>::minPayloadSize == 13);
+static_assert(MessageFields<StreamEndMessage>::isFixedSize &&
+              MessageFields<StreamEndMessage>::minPayloadSize == 5);
+static_assert(MessageFields<CursorPositionMessage>::isFixedSize &&
+              MessageFields<CursorPositionMessage>::minPayloadSize == 17);
+static_assert(MessageFields<ScreenShareParamsMessage>::isFixedSize &&
+              MessageFields<ScreenShareParamsMessage>::minPayloadSize == 3);
+static_assert(!MessageFields<InputChannelSetupMessage>::isFixedSize &&
+              MessageFields<InputChannelSetupMessage>::minPayloadSize == 2 + 4 + 4);
+
+// Messages with hand-written layouts
+
+struct AuthMessage {
+    static constexpr MessageType type = MessageType::Auth;
+    QString password;
+    QString clientName;
+    PeerCapabilities caps;
+
+    static bool decode(const PacketView& packet, AuthMessage& message)
+    {
+        return parseAuthPacket(packet, message.password, message.clientName, message.caps);
+    }
+};
+
+struct AuthResponseMessage {
+    static constexpr MessageType type = MessageType::AuthResponse;
+    AuthResult result = AuthResult::Success;
+    QString serverName;
+    PeerCapabilities caps;
+    quint32 retryAfterMs = 0; // ServerFull: when to try again, 0 if unsaid
+
+    static bool decode(const PacketView& packet, AuthResponseMessage& message)
+    {
+        return parseAuthResponsePacket(packet, message.result, message.serverName, message.caps,
+                                       message.retryAfterMs);
+    }
+};
+
+struct KeyEventMessage {
+    static constexpr MessageType type = MessageType::KeyEvent;
+    int vkCode = 0;
+    bool pressed = false;
+
+    static bool decode(const PacketView& packet, KeyEventMessage& message)
+    {
+        return parseKeyEventPacket(packet, message.vkCode, message.pressed);
+    }
+};
+
+struct MouseEventMessage {
+    static constexpr MessageType type = MessageType::MouseEvent;
+    int x = 0;
+    int y = 0;
+    int button = 0;
+    bool pressed = false;
+
+    static bool decode(const PacketView& packet, MouseEventMessage& message)
+    {
+        return parseMouseEventPacket(packet, message.x, message.y, message.button, message.pressed);
+    }
+};
+
+struct MouseMoveMessage {
+    static constexpr MessageType type = MessageType::MouseMove;
+    int x = 0;
+    int y = 0;
+
+    static bool decode(const PacketView& packet, MouseMoveMessage& message)
+    {
+        return parseMouseMovePacket(packet, message.x, message.y);
+    }
+};
+
+// imageData is a view into the receive buffer, valid during the handler only
+struct ScreenFrameMessage {
+    static constexpr MessageType type = MessageType::ScreenFrame;
+    QByteArray imageData;
+    int width = 0;
+    int height = 0;
+    quint32 frameId = 0;
+
+    static bool decode(const PacketView& packet, ScreenFrameMessage& message)
+    {
+        return parseScreenFramePacket(packet, message.imageData, message.width, message.height, message.frameId);
+    }
+};
+
+// Region data are views into the receive buffer, valid during the handler only
+struct ScreenRegionUpdateMessage {
+    static constexpr MessageType type = MessageType::ScreenRegionUpdate;
+    int width = 0;
+    int height = 0;
+    quint32 frameId = 0;
+    quint32 baseFrameId = 0;
+    QVector<ScreenRegion> regions;
+
+    static bool decode(const PacketView& packet, ScreenRegionUpdateMessage& message)
+    {
+        return parseScreenRegionUpdatePacket(packet, message.width, message.height, message.frameId,
+                                             message.baseFrameId, message.regions);
+    }
+};
+
+struct ClipboardDataMessage {
+    static constexpr MessageType type = MessageType::ClipboardData;
+    QString mimeType;
+    QByteArray data;
+
+    static bool decode(const PacketView& packet, ClipboardDataMessage& message)
+    {
+        return parseClipboardDataPacket(packet, message.mimeType, message.data);
+    }
+};
+
+// data is a view into the receive buffer, valid during the handler only
+struct StreamDataMessage {
+    static constexpr MessageType type = MessageType::StreamData;
+    quint32 streamId = 0;
+    QByteArray data;
+
+    static bool decode(const PacketView& packet, StreamDataMessage& message)
+    {
+        const char* data;
+        qsizetype dataSize;
+        if (!parseStreamDataPacket(packet, message.streamId, data, dataSize)) return false;
+        message.data = QByteArray::fromRawData(data, dataSize);
+        return true;
+    }
+};
+
+// Handed to the handler undecoded, for messages whose decoding depends on
+// connection state (compression, reassembly) or reuses the handler's buffers
+template<MessageType Type>
+struct RawMessage {
+    static constexpr MessageType type = Type;
+    PacketView packet;
+
+    static bool decode(const PacketView& view, RawMessage& message)
+    {
+        message.packet = view;
+        return true;
+    }
+};
+
+using InputBatchMessage = RawMessage<MessageType::InputBatch>;
+using CommandOutputMessage = RawMessage<MessageType::CommandOutput>;
+using FragmentMessage = RawMessage<MessageType::Fragment>;
+
+template<class... Messages>
+struct MessageList {};
+
+// Jump table from message type to typed handlers, built at compile time.
+// For each message M in the list the handler provides
+//   void handleMessage(Args&... args, const M& message)
+// Dispatching is one table load and an indirect call; the handler may be a
+// friend of the Dispatcher rather than exposing its handlers.
+template<class Handler, class List, class... Args>
+class Dispatcher;
+
+template<class Handler, class... Messages, class... Args>
+class Dispatcher<Handler, MessageList<Messages...>, Args...>
+{
+public:
+    // Returns false for types without a handler and payloads that fail to decode
+    static bool dispatch(Handler& handler, const PacketView& packet, Args&... args)
+    {
+        Entry entry = s_table[static_cast<quint8>(packet.header.type)];
+        return entry && entry(handler, packet, args...);
+    }
+
+private:
+    using Entry = bool (*)(Handler&, const PacketView&, Args&...);
+
+    template<class M>
+    static bool invoke(Handler& handler, const PacketView& packet, Args&... args)
+    {
+        M message;
+        if (!decode(packet, message)) return false;
+        handler.handleMessage(args..., message);
+        return true;
+    }
+
+    static constexpr bool hasUniqueTypes()
+    {
+        const quint8 types[] = { static_cast<quint8>(Messages::type)... };
+        for (std::size_t i = 0; i < sizeof...(Messages); ++i) {
+            for (std::size_t j = i + 1; j < sizeof...(Messages); ++j) {
+                if (types[i] == types[j]) return false;
+            }
+        }
+        return true;
+    }
+    static_assert(sizeof...(Messages) > 0 && hasUniqueTypes(), "each message type needs exactly one handler");
+
+    static constexpr std::array<Entry, 256> makeTable()
+    {
+        std::array<Entry, 256> table{};
+        ((table[static_cast<quint8>(Messages::type)] = &invoke<Messages>), ...);
+        return table;
+    }
+
+    static constexpr std::array<Entry, 256> s_table = makeTable();
+};
+
+} // namespace Protocol
+
+#endif // MESSAGES_H
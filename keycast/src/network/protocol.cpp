@@ -1,119 +1,381 @@
 #include "protocol.h"
+#include "messages.h"
 #include <QBuffer>
+#include <cstring>
 
 namespace Protocol {
 
+void writePacketHeader(char* out, MessageType type, quint16 version, quint32 payloadSize)
+{
+    qToBigEndian<quint32>(PACKET_MAGIC, out);
+    qToBigEndian<quint16>(version, out + 4);
+    out[6] = static_cast<char>(type);
+    qToBigEndian<quint32>(payloadSize, out + 7);
+}
+
 static QByteArray createPacket(MessageType type, const QByteArray& payload)
 {
-    QByteArray packet;
-    QDataStream stream(&packet, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
+    // Single allocation: header is written in place, payload copied once
+    QByteArray packet(PACKET_HEADER_SIZE + payload.size(), Qt::Uninitialized);
+    writePacketHeader(packet.data(), type, PROTOCOL_VERSION, static_cast<quint32>(payload.size()));
+    if (!payload.isEmpty()) {
+        memcpy(packet.data() + PACKET_HEADER_SIZE, payload.constData(), payload.size());
+    }
+    return packet;
+}
 
-    // Write header
-    stream << static_cast<quint32>(0x4B435354); // Magic "KCST"
-    stream << PROTOCOL_VERSION;
-    stream << static_cast<quint8>(type);
-    stream << static_cast<quint32>(payload.size());
+// Locate a fixed-size input payload inside a packet.
+// Sets fixed to true when the packet uses the version 2 little-endian layout.
+static const char* inputPayload(const PacketView& packet, int fixedSize, int legacySize, bool& fixed)
+{
+    fixed = packet.header.version == PROTOCOL_VERSION_FIXED_INPUT;
+    int needed = fixed ? fixedSize : legacySize;
+    if (packet.payloadSize < needed) return nullptr;
 
-    // Append payload
-    packet.append(payload);
+    return packet.payload;
+}
 
-    return packet;
+Channel channelFor(MessageType type)
+{
+    switch (type) {
+    case MessageType::KeyEvent:
+    case MessageType::MouseEvent:
+    case MessageType::MouseMove:
+    case MessageType::InputBatch:
+    case MessageType::CursorPosition:
+    case MessageType::CursorShape:
+        return Channel::Input;
+    case MessageType::ScreenFrame:
+    case MessageType::ScreenRegionUpdate:
+        return Channel::Frames;
+    case MessageType::CommandOutput:
+    case MessageType::ClipboardData:
+    case MessageType::StreamBegin:
+    case MessageType::StreamData:
+    case MessageType::StreamEnd:
+        return Channel::Bulk;
+    default:
+        return Channel::Control;
+    }
 }
 
-static QByteArray extractPayload(const QByteArray& packet)
+QByteArray copyPacket(const PacketView& packet)
 {
-    // Skip header (4 + 2 + 1 + 4 = 11 bytes)
-    if (packet.size() < 11) return QByteArray();
-    return packet.mid(11);
+    QByteArray copy(PACKET_HEADER_SIZE + packet.payloadSize, Qt::Uninitialized);
+    writePacketHeader(copy.data(), packet.header.type, packet.header.version,
+                      static_cast<quint32>(packet.payloadSize));
+    memcpy(copy.data() + PACKET_HEADER_SIZE, packet.payload, packet.payloadSize);
+    return copy;
 }
 
-QByteArray createAuthPacket(const QString& password, const QString& clientName)
+void writeFragmentHeader(char* out, Channel channel, bool last, quint32 chunkSize)
+{
+    writePacketHeader(out, MessageType::Fragment, PROTOCOL_VERSION, chunkSize + 2);
+    out[PACKET_HEADER_SIZE] = static_cast<char>(channel);
+    out[PACKET_HEADER_SIZE + 1] = static_cast<char>(last ? FRAGMENT_LAST : 0);
+}
+
+void writeStreamDataHeader(char* out, quint32 streamId, quint32 dataSize)
+{
+    writePacketHeader(out, MessageType::StreamData, PROTOCOL_VERSION, dataSize + 4);
+    qToBigEndian<quint32>(streamId, out + PACKET_HEADER_SIZE);
+}
+
+QByteArray createAuthPacket(const QString& password, const QString& clientName, const PeerCapabilities& caps)
 {
     QByteArray payload;
     QDataStream stream(&payload, QIODevice::WriteOnly);
     stream.setByteOrder(QDataStream::BigEndian);
     stream << password << clientName;
+    // Older servers stop reading after clientName and ignore these
+    stream << caps.flags << caps.maxMessageSize;
     return createPacket(MessageType::Auth, payload);
 }
 
-QByteArray createAuthResponsePacket(AuthResult result, const QString& serverName)
+QByteArray createAuthResponsePacket(AuthResult result, const QString& serverName, const PeerCapabilities& caps,
+                                    quint32 retryAfterMs)
 {
     QByteArray payload;
     QDataStream stream(&payload, QIODevice::WriteOnly);
     stream.setByteOrder(QDataStream::BigEndian);
     stream << static_cast<quint8>(result) << serverName;
+    stream << caps.flags << caps.maxMessageSize;
+    if (retryAfterMs > 0) {
+        stream << retryAfterMs;
+    }
     return createPacket(MessageType::AuthResponse, payload);
 }
 
-QByteArray createKeyEventPacket(int vkCode, bool pressed)
+// Reads the optional capability trailer of Auth/AuthResponse
+static void readCapabilities(QDataStream& stream, PeerCapabilities& caps)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << static_cast<qint32>(vkCode) << pressed;
-    return createPacket(MessageType::KeyEvent, payload);
+    caps = PeerCapabilities();
+    if (stream.atEnd()) return;
+
+    quint32 flags, maxMessageSize;
+    stream >> flags >> maxMessageSize;
+    if (stream.status() != QDataStream::Ok) {
+        stream.resetStatus();
+        return;
+    }
+
+    caps.flags = flags;
+    caps.maxMessageSize = maxMessageSize;
 }
 
-QByteArray createMouseEventPacket(int x, int y, int button, bool pressed)
+int writeKeyEventPacket(char* out, int vkCode, bool pressed, InputWireFormat format)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << static_cast<qint32>(x) << static_cast<qint32>(y)
-           << static_cast<qint32>(button) << pressed;
-    return createPacket(MessageType::MouseEvent, payload);
+    char* p = out + PACKET_HEADER_SIZE;
+    if (format == InputWireFormat::Fixed) {
+        qToLittleEndian<qint32>(vkCode, p);
+    } else {
+        qToBigEndian<qint32>(vkCode, p);
+    }
+    p[4] = pressed ? 1 : 0;
+
+    writePacketHeader(out, MessageType::KeyEvent, static_cast<quint16>(format), KEY_EVENT_FIXED_PAYLOAD);
+    return PACKET_HEADER_SIZE + KEY_EVENT_FIXED_PAYLOAD;
 }
 
-QByteArray createMouseMovePacket(int x, int y)
+int writeMouseEventPacket(char* out, int x, int y, int button, bool pressed, InputWireFormat format)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << static_cast<qint32>(x) << static_cast<qint32>(y);
-    return createPacket(MessageType::MouseMove, payload);
+    char* p = out + PACKET_HEADER_SIZE;
+    int payloadSize;
+    if (format == InputWireFormat::Fixed) {
+        qToLittleEndian<qint32>(x, p);
+        qToLittleEndian<qint32>(y, p + 4);
+        p[8] = static_cast<char>(button);
+        p[9] = pressed ? 1 : 0;
+        payloadSize = MOUSE_EVENT_FIXED_PAYLOAD;
+    } else {
+        qToBigEndian<qint32>(x, p);
+        qToBigEndian<qint32>(y, p + 4);
+        qToBigEndian<qint32>(button, p + 8);
+        p[12] = pressed ? 1 : 0;
+        payloadSize = MOUSE_EVENT_LEGACY_PAYLOAD;
+    }
+
+    writePacketHeader(out, MessageType::MouseEvent, static_cast<quint16>(format), payloadSize);
+    return PACKET_HEADER_SIZE + payloadSize;
 }
 
-QByteArray createExecuteCommandPacket(const QString& command, const QString& type)
+int writeMouseMovePacket(char* out, int x, int y, InputWireFormat format)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << command << type;
-    return createPacket(MessageType::ExecuteCommand, payload);
+    char* p = out + PACKET_HEADER_SIZE;
+    if (format == InputWireFormat::Fixed) {
+        qToLittleEndian<qint32>(x, p);
+        qToLittleEndian<qint32>(y, p + 4);
+    } else {
+        qToBigEndian<qint32>(x, p);
+        qToBigEndian<qint32>(y, p + 4);
+    }
+
+    writePacketHeader(out, MessageType::MouseMove, static_cast<quint16>(format), MOUSE_MOVE_FIXED_PAYLOAD);
+    return PACKET_HEADER_SIZE + MOUSE_MOVE_FIXED_PAYLOAD;
 }
 
-QByteArray createCommandOutputPacket(const QString& output)
+static char* writeVarint(char* p, quint32 value)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << output;
-    return createPacket(MessageType::CommandOutput, payload);
+    while (value >= 0x80) {
+        *p++ = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<char>(value);
+    return p;
 }
 
-QByteArray createPingPacket()
+static bool readVarint(const char*& p, const char* end, quint32& value)
 {
-    return createPacket(MessageType::Ping, QByteArray());
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p >= end) return false;
+        quint8 byte = static_cast<quint8>(*p++);
+        value |= static_cast<quint32>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
 }
 
-QByteArray createPongPacket()
+static quint32 zigzag(qint32 value)
 {
-    return createPacket(MessageType::Pong, QByteArray());
+    return (static_cast<quint32>(value) << 1) ^ static_cast<quint32>(value >> 31);
 }
 
-QByteArray createClientInfoPacket(const QString& clientId, const QString& clientName)
+static qint32 unzigzag(quint32 value)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << clientId << clientName;
-    return createPacket(MessageType::ClientInfo, payload);
+    return static_cast<qint32>(value >> 1) ^ -static_cast<qint32>(value & 1);
+}
+
+// Count followed by the events of an InputBatch payload; shared with
+// input datagrams. Returns the end of the written data.
+static char* writeBatchEvents(char* p, const InputEvent* events, int count)
+{
+    qToLittleEndian<quint16>(static_cast<quint16>(count), p);
+    p += 2;
+
+    qint32 lastX = 0;
+    qint32 lastY = 0;
+    for (int i = 0; i < count; ++i) {
+        const InputEvent& event = events[i];
+
+        *p++ = static_cast<char>(static_cast<quint8>(event.kind) | (event.pressed ? 0x80 : 0));
+        p = writeVarint(p, event.timeOffsetUs);
+
+        if (event.kind == InputEventKind::Key) {
+            p = writeVarint(p, static_cast<quint32>(event.code));
+            continue;
+        }
+
+        // Wrapping arithmetic: any pair of coordinates has a delta, even
+        // one that overflows qint32
+        p = writeVarint(p, zigzag(static_cast<qint32>(static_cast<quint32>(event.x) - static_cast<quint32>(lastX))));
+        p = writeVarint(p, zigzag(static_cast<qint32>(static_cast<quint32>(event.y) - static_cast<quint32>(lastY))));
+        lastX = event.x;
+        lastY = event.y;
+
+        if (event.kind == InputEventKind::MouseButton) {
+            *p++ = static_cast<char>(event.code);
+        }
+    }
+
+    return p;
+}
+
+static bool readBatchEvents(const char* p, const char* end, QVector<InputEvent>& events)
+{
+    if (end - p < 2) return false;
+
+    int count = qFromLittleEndian<quint16>(p);
+    p += 2;
+
+    qint32 lastX = 0;
+    qint32 lastY = 0;
+    for (int i = 0; i < count; ++i) {
+        if (p >= end) return false;
+
+        InputEvent event;
+        quint8 kind = static_cast<quint8>(*p++);
+        event.kind = static_cast<InputEventKind>(kind & 0x7F);
+        event.pressed = (kind & 0x80) != 0;
+
+        if (!readVarint(p, end, event.timeOffsetUs)) return false;
+
+        quint32 value;
+        switch (event.kind) {
+        case InputEventKind::Key:
+            if (!readVarint(p, end, value)) return false;
+            event.code = static_cast<qint32>(value);
+            break;
+
+        case InputEventKind::MouseButton:
+        case InputEventKind::MouseMove:
+            if (!readVarint(p, end, value)) return false;
+            event.x = static_cast<qint32>(static_cast<quint32>(lastX) + static_cast<quint32>(unzigzag(value)));
+            if (!readVarint(p, end, value)) return false;
+            event.y = static_cast<qint32>(static_cast<quint32>(lastY) + static_cast<quint32>(unzigzag(value)));
+            lastX = event.x;
+            lastY = event.y;
+
+            if (event.kind == InputEventKind::MouseButton) {
+                if (p >= end) return false;
+                event.code = static_cast<quint8>(*p++);
+            }
+            break;
+
+        default:
+            return false;
+        }
+
+        events.append(event);
+    }
+
+    return true;
+}
+
+void writeInputBatchPacket(QByteArray& packet, const QVector<InputEvent>& events)
+{
+    int count = qMin(static_cast<int>(events.size()), MAX_INPUT_BATCH_EVENTS);
+
+    // resize() keeps the existing capacity, so a reused buffer never reallocates
+    packet.resize(PACKET_HEADER_SIZE + 2 + count * MAX_INPUT_BATCH_EVENT_SIZE);
+    char* start = packet.data();
+    char* p = writeBatchEvents(start + PACKET_HEADER_SIZE, events.constData(), count);
+
+    qsizetype size = p - start;
+    writePacketHeader(start, MessageType::InputBatch, PROTOCOL_VERSION, static_cast<quint32>(size - PACKET_HEADER_SIZE));
+    packet.resize(size);
+}
+
+QByteArray createInputBatchPacket(const QVector<InputEvent>& events)
+{
+    QByteArray packet;
+    writeInputBatchPacket(packet, events);
+    return packet;
 }
 
-QByteArray createDisconnectPacket()
+bool parseInputBatchPacket(const PacketView& packet, QVector<InputEvent>& events)
 {
-    return createPacket(MessageType::Disconnect, QByteArray());
+    return readBatchEvents(packet.payload, packet.payload + packet.payloadSize, events);
+}
+
+int writeInputDatagram(char* out, quint32 firstSequence, const InputEvent* events, int count)
+{
+    count = qBound(0, count, MAX_INPUT_DATAGRAM_EVENTS);
+    qToLittleEndian<quint32>(firstSequence, out);
+    char* p = writeBatchEvents(out + 4, events, count);
+    return static_cast<int>(p - out);
+}
+
+bool parseInputDatagram(const QByteArray& datagram, quint32& firstSequence, QVector<InputEvent>& events)
+{
+    if (datagram.size() < 4) return false;
+
+    const char* p = datagram.constData();
+    firstSequence = qFromLittleEndian<quint32>(p);
+    return readBatchEvents(p + 4, p + datagram.size(), events);
+}
+
+int writeInputEventPacket(char* out, const InputEvent& event, InputWireFormat format)
+{
+    switch (event.kind) {
+    case InputEventKind::Key:
+        return writeKeyEventPacket(out, event.code, event.pressed, format);
+    case InputEventKind::MouseButton:
+        return writeMouseEventPacket(out, event.x, event.y, event.code, event.pressed, format);
+    case InputEventKind::MouseMove:
+        return writeMouseMovePacket(out, event.x, event.y, format);
+    }
+    return 0;
+}
+
+QByteArray createKeyEventPacket(int vkCode, bool pressed, InputWireFormat format)
+{
+    char buf[MAX_INPUT_PACKET_SIZE];
+    int size = writeKeyEventPacket(buf, vkCode, pressed, format);
+    return QByteArray(buf, size);
+}
+
+QByteArray createMouseEventPacket(int x, int y, int button, bool pressed, InputWireFormat format)
+{
+    char buf[MAX_INPUT_PACKET_SIZE];
+    int size = writeMouseEventPacket(buf, x, y, button, pressed, format);
+    return QByteArray(buf, size);
+}
+
+QByteArray createMouseMovePacket(int x, int y, InputWireFormat format)
+{
+    char buf[MAX_INPUT_PACKET_SIZE];
+    int size = writeMouseMovePacket(buf, x, y, format);
+    return QByteArray(buf, size);
+}
+
+QByteArray createCommandOutputPacket(const QString& output, bool compressed)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::BigEndian);
+    stream << output;
+    return createPacket(MessageType::CommandOutput, compressed ? qCompress(payload) : payload);
 }
 
 QByteArray createDiscoveryBroadcast(const QString& serverName, int port)
@@ -137,211 +399,354 @@ bool parseDiscoveryBroadcast(const QByteArray& data, QString& serverName, QStrin
     stream >> magic >> version >> serverName >> portValue;
 
     if (magic != DISCOVERY_MAGIC) return false;
-    if (version != PROTOCOL_VERSION) return false;
+    // The broadcast layout is stable; newer peers are reachable and
+    // negotiate features after connecting
+    if (version < PROTOCOL_VERSION) return false;
 
     port = portValue;
     // address is set by the caller from the sender's IP
     return true;
 }
 
+bool parsePacketHeader(const char* data, qsizetype size, PacketHeader& header)
+{
+    if (size < PACKET_HEADER_SIZE) return false;
+
+    header.magic = qFromBigEndian<quint32>(data);
+    header.version = qFromBigEndian<quint16>(data + 4);
+    header.type = static_cast<MessageType>(static_cast<quint8>(data[6]));
+    header.payloadSize = qFromBigEndian<quint32>(data + 7);
+
+    return header.magic == PACKET_MAGIC &&
+           header.version >= PROTOCOL_VERSION && header.version <= PROTOCOL_VERSION_MAX;
+}
+
 bool parsePacketHeader(const QByteArray& data, PacketHeader& header)
 {
-    if (data.size() < 11) return false;
+    return parsePacketHeader(data.constData(), data.size(), header);
+}
 
-    QDataStream stream(data);
-    stream.setByteOrder(QDataStream::BigEndian);
+FrameStatus nextPacket(const char* data, qsizetype size, PacketView& packet, quint32 maxPayloadSize)
+{
+    if (size < PACKET_HEADER_SIZE) return FrameStatus::Incomplete;
+    if (!parsePacketHeader(data, size, packet.header)) return FrameStatus::Invalid;
+    if (packet.header.payloadSize > maxPayloadSize) return FrameStatus::Invalid;
 
-    quint8 type;
-    stream >> header.magic >> header.version >> type >> header.payloadSize;
-    header.type = static_cast<MessageType>(type);
+    qsizetype totalSize = PACKET_HEADER_SIZE + static_cast<qsizetype>(packet.header.payloadSize);
+    if (size < totalSize) return FrameStatus::Incomplete;
 
-    return header.magic == 0x4B435354 && header.version == PROTOCOL_VERSION;
+    packet.payload = data + PACKET_HEADER_SIZE;
+    packet.payloadSize = packet.header.payloadSize;
+    return FrameStatus::Complete;
 }
 
-bool parseAuthPacket(const QByteArray& data, QString& password, QString& clientName)
+bool parseAuthPacket(const PacketView& packet, QString& password, QString& clientName,
+                     PeerCapabilities& caps)
 {
-    QByteArray payload = extractPayload(data);
+    QByteArray payload = packet.payloadBytes();
     QDataStream stream(payload);
     stream.setByteOrder(QDataStream::BigEndian);
     stream >> password >> clientName;
-    return stream.status() == QDataStream::Ok;
+    if (stream.status() != QDataStream::Ok) return false;
+
+    readCapabilities(stream, caps);
+    return true;
 }
 
-bool parseAuthResponsePacket(const QByteArray& data, AuthResult& result, QString& serverName)
+bool parseAuthResponsePacket(const PacketView& packet, AuthResult& result, QString& serverName,
+                             PeerCapabilities& caps, quint32& retryAfterMs)
 {
-    QByteArray payload = extractPayload(data);
+    QByteArray payload = packet.payloadBytes();
     QDataStream stream(payload);
     stream.setByteOrder(QDataStream::BigEndian);
     quint8 r;
     stream >> r >> serverName;
     result = static_cast<AuthResult>(r);
-    return stream.status() == QDataStream::Ok;
-}
+    if (stream.status() != QDataStream::Ok) return false;
 
-bool parseKeyEventPacket(const QByteArray& data, int& vkCode, bool& pressed)
-{
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    qint32 vk;
-    stream >> vk >> pressed;
-    vkCode = vk;
-    return stream.status() == QDataStream::Ok;
+    readCapabilities(stream, caps);
+
+    retryAfterMs = 0;
+    if (!stream.atEnd()) {
+        stream >> retryAfterMs;
+        if (stream.status() != QDataStream::Ok) {
+            retryAfterMs = 0;
+        }
+    }
+    return true;
 }
 
-bool parseMouseEventPacket(const QByteArray& data, int& x, int& y, int& button, bool& pressed)
+bool parseKeyEventPacket(const PacketView& packet, int& vkCode, bool& pressed)
 {
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    qint32 px, py, btn;
-    stream >> px >> py >> btn >> pressed;
-    x = px;
-    y = py;
-    button = btn;
-    return stream.status() == QDataStream::Ok;
+    bool fixed;
+    const char* p = inputPayload(packet, KEY_EVENT_FIXED_PAYLOAD, KEY_EVENT_LEGACY_PAYLOAD, fixed);
+    if (!p) return false;
+
+    vkCode = fixed ? qFromLittleEndian<qint32>(p) : qFromBigEndian<qint32>(p);
+    pressed = p[4] != 0;
+    return true;
 }
 
-bool parseMouseMovePacket(const QByteArray& data, int& x, int& y)
+bool parseMouseEventPacket(const PacketView& packet, int& x, int& y, int& button, bool& pressed)
 {
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    qint32 px, py;
-    stream >> px >> py;
-    x = px;
-    y = py;
-    return stream.status() == QDataStream::Ok;
+    bool fixed;
+    const char* p = inputPayload(packet, MOUSE_EVENT_FIXED_PAYLOAD, MOUSE_EVENT_LEGACY_PAYLOAD, fixed);
+    if (!p) return false;
+
+    if (fixed) {
+        x = qFromLittleEndian<qint32>(p);
+        y = qFromLittleEndian<qint32>(p + 4);
+        button = static_cast<quint8>(p[8]);
+        pressed = p[9] != 0;
+    } else {
+        x = qFromBigEndian<qint32>(p);
+        y = qFromBigEndian<qint32>(p + 4);
+        button = qFromBigEndian<qint32>(p + 8);
+        pressed = p[12] != 0;
+    }
+    return true;
 }
 
-bool parseExecuteCommandPacket(const QByteArray& data, QString& command, QString& type)
+bool parseMouseMovePacket(const PacketView& packet, int& x, int& y)
 {
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream >> command >> type;
-    return stream.status() == QDataStream::Ok;
+    bool fixed;
+    const char* p = inputPayload(packet, MOUSE_MOVE_FIXED_PAYLOAD, MOUSE_MOVE_LEGACY_PAYLOAD, fixed);
+    if (!p) return false;
+
+    if (fixed) {
+        x = qFromLittleEndian<qint32>(p);
+        y = qFromLittleEndian<qint32>(p + 4);
+    } else {
+        x = qFromBigEndian<qint32>(p);
+        y = qFromBigEndian<qint32>(p + 4);
+    }
+    return true;
 }
 
-bool parseCommandOutputPacket(const QByteArray& data, QString& output)
+bool parseCommandOutputPacket(const PacketView& packet, QString& output, bool compressed)
 {
-    QByteArray payload = extractPayload(data);
+    QByteArray payload = compressed ? qUncompress(packet.payloadBytes()) : packet.payloadBytes();
+    if (compressed && payload.isEmpty()) return false;
+
     QDataStream stream(payload);
     stream.setByteOrder(QDataStream::BigEndian);
     stream >> output;
     return stream.status() == QDataStream::Ok;
 }
 
-bool parseClientInfoPacket(const QByteArray& data, QString& clientId, QString& clientName)
+// Screen sharing packets
+QByteArray createScreenShareRequestPacket(bool start)
 {
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream >> clientId >> clientName;
-    return stream.status() == QDataStream::Ok;
+    if (start) {
+        return encode(ScreenShareStartMessage{true});
+    }
+    return encode(ScreenShareStopMessage{false});
 }
 
-// Screen sharing packets
-QByteArray createScreenShareRequestPacket(bool start)
+QByteArray beginScreenFramePacket(int width, int height, quint32 frameId, qsizetype expectedImageSize)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << start;
-    return createPacket(start ? MessageType::ScreenShareStart : MessageType::ScreenShareStop, payload);
+    QByteArray packet(SCREEN_FRAME_HEADER_SIZE, Qt::Uninitialized);
+    if (expectedImageSize > 0) {
+        packet.reserve(SCREEN_FRAME_HEADER_SIZE + expectedImageSize);
+    }
+
+    // Sizes are patched in by finishScreenFramePacket
+    char* p = packet.data() + PACKET_HEADER_SIZE;
+    qToBigEndian<quint32>(frameId, p);
+    qToBigEndian<qint32>(width, p + 4);
+    qToBigEndian<qint32>(height, p + 8);
+    return packet;
 }
 
-QByteArray createScreenFramePacket(const QByteArray& imageData, int width, int height, quint32 frameId)
+void finishScreenFramePacket(QByteArray& packet)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << frameId << static_cast<qint32>(width) << static_cast<qint32>(height);
-    stream << static_cast<quint32>(imageData.size());
-    payload.append(imageData);
-    return createPacket(MessageType::ScreenFrame, payload);
+    if (packet.size() < SCREEN_FRAME_HEADER_SIZE) return;
+
+    quint32 payloadSize = static_cast<quint32>(packet.size() - PACKET_HEADER_SIZE);
+    quint32 imageSize = static_cast<quint32>(packet.size() - SCREEN_FRAME_HEADER_SIZE);
+
+    char* p = packet.data();
+    writePacketHeader(p, MessageType::ScreenFrame, PROTOCOL_VERSION, payloadSize);
+    qToBigEndian<quint32>(imageSize, p + PACKET_HEADER_SIZE + 12);
 }
 
-QByteArray createScreenFrameAckPacket(quint32 frameId)
+QByteArray beginScreenRegionUpdatePacket(int width, int height, quint32 frameId, quint32 baseFrameId,
+                                         qsizetype expectedSize)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << frameId;
-    return createPacket(MessageType::ScreenFrameAck, payload);
+    QByteArray packet(SCREEN_REGION_UPDATE_HEADER_SIZE, Qt::Uninitialized);
+    if (expectedSize > 0) {
+        packet.reserve(SCREEN_REGION_UPDATE_HEADER_SIZE + expectedSize);
+    }
+
+    // Packet size and region count are patched in by finishScreenRegionUpdatePacket
+    char* p = packet.data() + PACKET_HEADER_SIZE;
+    qToBigEndian<quint32>(frameId, p);
+    qToBigEndian<quint32>(baseFrameId, p + 4);
+    qToBigEndian<qint32>(width, p + 8);
+    qToBigEndian<qint32>(height, p + 12);
+    return packet;
 }
 
-QByteArray createClipboardDataPacket(const QString& mimeType, const QByteArray& data)
+void writeScreenRegionHeader(char* out, int x, int y, int width, int height, quint32 dataSize)
 {
-    QByteArray payload;
-    QDataStream stream(&payload, QIODevice::WriteOnly);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream << mimeType << static_cast<quint32>(data.size());
-    payload.append(data);
-    return createPacket(MessageType::ClipboardData, payload);
+    qToBigEndian<quint16>(static_cast<quint16>(x), out);
+    qToBigEndian<quint16>(static_cast<quint16>(y), out + 2);
+    qToBigEndian<quint16>(static_cast<quint16>(width), out + 4);
+    qToBigEndian<quint16>(static_cast<quint16>(height), out + 6);
+    qToBigEndian<quint32>(dataSize, out + 8);
 }
 
-QByteArray createClipboardRequestPacket()
+void finishScreenRegionUpdatePacket(QByteArray& packet, int regionCount)
 {
-    return createPacket(MessageType::ClipboardRequest, QByteArray());
+    if (packet.size() < SCREEN_REGION_UPDATE_HEADER_SIZE) return;
+
+    quint32 payloadSize = static_cast<quint32>(packet.size() - PACKET_HEADER_SIZE);
+    char* p = packet.data();
+    writePacketHeader(p, MessageType::ScreenRegionUpdate, PROTOCOL_VERSION, payloadSize);
+    qToBigEndian<quint32>(static_cast<quint32>(regionCount), p + PACKET_HEADER_SIZE + 16);
 }
 
-bool parseScreenShareRequestPacket(const QByteArray& data, bool& start)
+QByteArray createScreenFramePacket(const QByteArray& imageData, int width, int height, quint32 frameId)
 {
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream >> start;
-    return stream.status() == QDataStream::Ok;
+    QByteArray packet = beginScreenFramePacket(width, height, frameId, imageData.size());
+    packet.append(imageData);
+    finishScreenFramePacket(packet);
+    return packet;
 }
 
-bool parseScreenFramePacket(const QByteArray& data, QByteArray& imageData, int& width, int& height, quint32& frameId)
+QByteArray createClipboardDataPrefix(const QString& mimeType, quint32 dataSize)
 {
-    QByteArray payload = extractPayload(data);
-    if (payload.size() < 16) return false; // Minimum header size
+    // Same layout QDataStream produces: QString as byte length + UTF-16BE
+    const qsizetype mimeBytes = mimeType.size() * 2;
+    const qsizetype prefixSize = PACKET_HEADER_SIZE + 4 + mimeBytes + 4;
 
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
+    QByteArray prefix(prefixSize, Qt::Uninitialized);
+    char* p = prefix.data() + PACKET_HEADER_SIZE;
 
-    qint32 w, h;
-    quint32 dataSize;
-    stream >> frameId >> w >> h >> dataSize;
+    qToBigEndian<quint32>(mimeType.isNull() ? 0xFFFFFFFFu : static_cast<quint32>(mimeBytes), p);
+    p += 4;
+    const QChar* chars = mimeType.constData();
+    for (qsizetype i = 0; i < mimeType.size(); ++i) {
+        qToBigEndian<quint16>(chars[i].unicode(), p);
+        p += 2;
+    }
+    qToBigEndian<quint32>(dataSize, p);
+
+    quint32 payloadSize = static_cast<quint32>(prefixSize - PACKET_HEADER_SIZE) + dataSize;
+    writePacketHeader(prefix.data(), MessageType::ClipboardData, PROTOCOL_VERSION, payloadSize);
+    return prefix;
+}
 
-    width = w;
-    height = h;
+QByteArray createClipboardDataPacket(const QString& mimeType, const QByteArray& data)
+{
+    QByteArray packet = createClipboardDataPrefix(mimeType, static_cast<quint32>(data.size()));
+    packet.reserve(packet.size() + data.size());
+    packet.append(data);
+    return packet;
+}
+
+bool parseScreenFramePacket(const PacketView& packet, QByteArray& imageData, int& width, int& height, quint32& frameId)
+{
+    const int headerSize = 4 + 4 + 4 + 4; // frameId + width + height + dataSize
+    if (packet.payloadSize < headerSize) return false;
+
+    const char* p = packet.payload;
+    frameId = qFromBigEndian<quint32>(p);
+    width = qFromBigEndian<qint32>(p + 4);
+    height = qFromBigEndian<qint32>(p + 8);
+    quint32 dataSize = qFromBigEndian<quint32>(p + 12);
 
-    // Extract image data (rest of payload after header)
-    int headerSize = 4 + 4 + 4 + 4; // frameId + width + height + dataSize
-    if (payload.size() < headerSize + static_cast<int>(dataSize)) return false;
+    if (packet.payloadSize - headerSize < static_cast<qsizetype>(dataSize)) return false;
 
-    imageData = payload.mid(headerSize, dataSize);
+    // View into the receive buffer, no copy
+    imageData = QByteArray::fromRawData(p + headerSize, dataSize);
     return true;
 }
 
-bool parseScreenFrameAckPacket(const QByteArray& data, quint32& frameId)
-{
-    QByteArray payload = extractPayload(data);
-    QDataStream stream(payload);
-    stream.setByteOrder(QDataStream::BigEndian);
-    stream >> frameId;
-    return stream.status() == QDataStream::Ok;
+bool parseScreenRegionUpdatePacket(const PacketView& packet, int& width, int& height, quint32& frameId,
+                                   quint32& baseFrameId, QVector<ScreenRegion>& regions)
+{
+    const int headerSize = SCREEN_REGION_UPDATE_HEADER_SIZE - PACKET_HEADER_SIZE;
+    if (packet.payloadSize < headerSize) return false;
+
+    const char* p = packet.payload;
+    const char* end = packet.payload + packet.payloadSize;
+    frameId = qFromBigEndian<quint32>(p);
+    baseFrameId = qFromBigEndian<quint32>(p + 4);
+    width = qFromBigEndian<qint32>(p + 8);
+    height = qFromBigEndian<qint32>(p + 12);
+    quint32 count = qFromBigEndian<quint32>(p + 16);
+    p += headerSize;
+
+    // Every region takes at least its header, so count can't make us allocate
+    // more than the packet justifies
+    if (count > static_cast<quint32>((end - p) / SCREEN_REGION_HEADER_SIZE)) return false;
+
+    regions.clear();
+    regions.reserve(static_cast<int>(count));
+    for (quint32 i = 0; i < count; ++i) {
+        if (end - p < SCREEN_REGION_HEADER_SIZE) return false;
+
+        ScreenRegion region;
+        region.x = qFromBigEndian<quint16>(p);
+        region.y = qFromBigEndian<quint16>(p + 2);
+        region.width = qFromBigEndian<quint16>(p + 4);
+        region.height = qFromBigEndian<quint16>(p + 6);
+        quint32 dataSize = qFromBigEndian<quint32>(p + 8);
+        p += SCREEN_REGION_HEADER_SIZE;
+
+        if (end - p < static_cast<qsizetype>(dataSize)) return false;
+        if (region.x + region.width > width || region.y + region.height > height) return false;
+
+        region.imageData = QByteArray::fromRawData(p, dataSize);
+        p += dataSize;
+        regions.append(region);
+    }
+    return true;
 }
 
-bool parseClipboardDataPacket(const QByteArray& data, QString& mimeType, QByteArray& clipData)
+bool parseClipboardDataPacket(const PacketView& packet, QString& mimeType, QByteArray& clipData)
 {
-    QByteArray payload = extractPayload(data);
+    QByteArray payload = packet.payloadBytes();
     QDataStream stream(payload);
     stream.setByteOrder(QDataStream::BigEndian);
 
     quint32 dataSize;
     stream >> mimeType >> dataSize;
+    if (stream.status() != QDataStream::Ok) return false;
 
     // Calculate header size (variable due to string)
-    int pos = payload.size() - dataSize;
+    qsizetype pos = payload.size() - static_cast<qsizetype>(dataSize);
     if (pos < 0) return false;
 
-    clipData = payload.right(dataSize);
-    return stream.status() == QDataStream::Ok;
+    // Owning copy, the receive buffer is reused after this returns
+    clipData = QByteArray(payload.constData() + pos, dataSize);
+    return true;
+}
+
+bool parseFragmentPacket(const PacketView& packet, Channel& channel, bool& last,
+                         const char*& chunk, qsizetype& chunkSize)
+{
+    if (packet.payloadSize < 2) return false;
+
+    quint8 rawChannel = static_cast<quint8>(packet.payload[0]);
+    if (rawChannel >= CHANNEL_COUNT) return false;
+
+    channel = static_cast<Channel>(rawChannel);
+    last = (static_cast<quint8>(packet.payload[1]) & FRAGMENT_LAST) != 0;
+    chunk = packet.payload + 2;
+    chunkSize = packet.payloadSize - 2;
+    return true;
+}
+
+bool parseStreamDataPacket(const PacketView& packet, quint32& streamId, const char*& data, qsizetype& dataSize)
+{
+    if (packet.payloadSize < 4) return false;
+
+    streamId = qFromBigEndian<quint32>(packet.payload);
+    data = packet.payload + 4;
+    dataSize = packet.payloadSize - 4;
+    return true;
 }
 
 } // namespace Protocol
@@ -4,6 +4,8 @@
 #include <QByteArray>
 #include <QString>
 #include <QDataStream>
+#include <QtEndian>
+#include <QVector>
 
 namespace Protocol {
 
@@ -14,10 +16,14 @@ enum class MessageType : quint8 {
     KeyEvent = 0x10,
     MouseEvent = 0x11,
     MouseMove = 0x12,
+    InputBatch = 0x13,
+    InputChannelSetup = 0x14,
     ExecuteCommand = 0x20,
     CommandOutput = 0x21,
     Ping = 0x30,
     Pong = 0x31,
+    LatencyProbe = 0x32,
+    LatencyReply = 0x33,
     ClientInfo = 0x40,
     ServerInfo = 0x41,
     // Screen sharing
@@ -26,9 +32,19 @@ enum class MessageType : quint8 {
     ScreenShareStop = 0x52,
     ScreenFrame = 0x53,
     ScreenFrameAck = 0x54,
+    ScreenRegionUpdate = 0x55,
+    CursorPosition = 0x56,
+    CursorShape = 0x57,
+    ScreenShareParams = 0x58,
     // Clipboard
     ClipboardData = 0x60,
     ClipboardRequest = 0x61,
+    // Channel multiplexing
+    Fragment = 0x70,
+    // Streamed bulk payloads
+    StreamBegin = 0x71,
+    StreamData = 0x72,
+    StreamEnd = 0x73,
     Disconnect = 0xFF
 };
 
@@ -43,61 +59,340 @@ enum class AuthResult : quint8 {
 // Protocol version
 constexpr quint16 PROTOCOL_VERSION = 1;
 
+// Version carried by packets that use the fixed-layout input encoding.
+// Everything else is still sent as PROTOCOL_VERSION.
+constexpr quint16 PROTOCOL_VERSION_FIXED_INPUT = 2;
+constexpr quint16 PROTOCOL_VERSION_MAX = PROTOCOL_VERSION_FIXED_INPUT;
+
+// Packet framing
+constexpr quint32 PACKET_MAGIC = 0x4B435354; // "KCST"
+constexpr int PACKET_HEADER_SIZE = 11;       // magic + version + type + payloadSize
+
+// Capability flags negotiated in Auth/AuthResponse. The client advertises
+// what it supports, the server answers with the intersection, and both ends
+// only use features from that set for the lifetime of the connection.
+enum Capability : quint32 {
+    CapFixedInput  = 1u << 0, // fixed-layout input encoding (version 2 headers)
+    CapInputBatch  = 1u << 1, // InputBatch messages
+    CapFrameJpeg   = 1u << 2, // JPEG screen frames
+    CapCompression = 1u << 3, // zlib-compressed CommandOutput payloads
+    CapFragments   = 1u << 4, // Fragment messages (interleaved channels)
+    CapDatagramInput = 1u << 5, // input over a DTLS side channel (InputChannelSetup)
+    CapStreaming   = 1u << 6, // StreamBegin/StreamData/StreamEnd for large payloads
+    CapLatencyProbe = 1u << 7, // LatencyProbe/LatencyReply round-trip timing
+    CapFrameTiles  = 1u << 8, // ScreenRegionUpdate deltas between JPEG frames
+    CapCursor      = 1u << 9, // CursorPosition/CursorShape, pointer left out of frames
+    CapStreamParams = 1u << 10 // ScreenShareParams: the frame rate, quality and scale in use
+};
+
+// Everything this build can decode
+constexpr quint32 SUPPORTED_CAPABILITIES = CapFixedInput | CapInputBatch | CapFrameJpeg | CapCompression |
+                                          CapFragments | CapDatagramInput | CapStreaming | CapLatencyProbe |
+                                          CapFrameTiles | CapCursor | CapStreamParams;
+
+// Assumed for peers that predate negotiation (Auth without capability fields)
+constexpr quint32 LEGACY_CAPABILITIES = CapFrameJpeg;
+
+// Largest message a peer is asked to send us unless configured otherwise.
+// Anything bigger has to be streamed.
+constexpr quint32 DEFAULT_MAX_MESSAGE_SIZE = 16 * 1024 * 1024;
+
+// Limit for everything received before authentication succeeds; the only
+// messages expected by then are Auth and AuthResponse
+constexpr quint32 PRE_AUTH_MAX_MESSAGE_SIZE = 64 * 1024;
+
+struct PeerCapabilities {
+    quint32 flags = LEGACY_CAPABILITIES;
+    quint32 maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE;
+
+    bool has(Capability cap) const { return (flags & cap) != 0; }
+};
+
+// Logical channels multiplexed over one connection, highest priority first.
+// Every message type belongs to exactly one channel; messages on the same
+// channel are delivered in order, channels are independent of each other.
+enum class Channel : quint8 {
+    Control = 0, // auth, ping, screen share control, acks, commands
+    Input = 1,   // key and mouse events, the shared screen's cursor
+    Frames = 2,  // screen frames
+    Bulk = 3     // command output, clipboard
+};
+constexpr int CHANNEL_COUNT = 4;
+
+Channel channelFor(MessageType type);
+
+// Large messages are split into Fragment packets so a queued frame never
+// holds up input or control traffic for longer than one fragment. Payload:
+//   quint8 channel, quint8 flags, then the next slice of the original packet
+// (header included). The receiver appends slices per channel and handles the
+// original packet once the slice flagged FRAGMENT_LAST arrives.
+constexpr int FRAGMENT_HEADER_SIZE = PACKET_HEADER_SIZE + 2;
+constexpr int DEFAULT_FRAGMENT_SIZE = 16 * 1024;
+constexpr quint8 FRAGMENT_LAST = 0x01;
+
+// Writes the Fragment packet header for a slice of chunkSize bytes into out
+// (FRAGMENT_HEADER_SIZE bytes); the slice itself follows on the wire
+void writeFragmentHeader(char* out, Channel channel, bool last, quint32 chunkSize);
+
+// Payloads larger than a single message may be (clipboard blobs, files) are
+// streamed on the bulk channel in chunks of at most STREAM_CHUNK_SIZE bytes:
+//   StreamBegin: quint32 streamId, QString kind, QString mimeType, quint64 totalSize
+//   StreamData:  quint32 streamId, then the raw chunk (rest of the payload)
+//   StreamEnd:   quint32 streamId, bool complete
+// The receiver hands every chunk to its consumer as it arrives and never
+// holds the whole payload.
+constexpr int STREAM_CHUNK_SIZE = 64 * 1024;
+constexpr int STREAM_DATA_HEADER_SIZE = PACKET_HEADER_SIZE + 4;
+constexpr char STREAM_KIND_CLIPBOARD[] = "clipboard";
+
+// Writes the StreamData packet header for a chunk of dataSize bytes into out
+// (STREAM_DATA_HEADER_SIZE bytes); the chunk itself follows
+void writeStreamDataHeader(char* out, quint32 streamId, quint32 dataSize);
+
+// Peers that negotiated CapLatencyProbe probe each other this often
+constexpr int LATENCY_PROBE_INTERVAL_MS = 2000;
+
+// Round-trip estimate smoothed like TCP's SRTT (gain 1/8); a negative
+// estimate means there is none yet
+inline qint64 smoothRoundTrip(qint64 estimateUs, qint64 sampleUs)
+{
+    return estimateUs < 0 ? sampleUs : estimateUs + (sampleUs - estimateUs) / 8;
+}
+
 // Magic header for discovery packets
 constexpr quint32 DISCOVERY_MAGIC = 0x4B455943; // "KEYC"
 
 // Packet structure helper
 struct PacketHeader {
-    quint32 magic = 0x4B435354; // "KCST"
+    quint32 magic = PACKET_MAGIC;
     quint16 version = PROTOCOL_VERSION;
     MessageType type;
     quint32 payloadSize;
 };
 
-// Serialization functions
-QByteArray createAuthPacket(const QString& password, const QString& clientName);
-QByteArray createAuthResponsePacket(AuthResult result, const QString& serverName = QString());
-QByteArray createKeyEventPacket(int vkCode, bool pressed);
-QByteArray createMouseEventPacket(int x, int y, int button, bool pressed);
-QByteArray createMouseMovePacket(int x, int y);
-QByteArray createExecuteCommandPacket(const QString& command, const QString& type);
-QByteArray createCommandOutputPacket(const QString& output);
-QByteArray createPingPacket();
-QByteArray createPongPacket();
-QByteArray createClientInfoPacket(const QString& clientId, const QString& clientName);
-QByteArray createDisconnectPacket();
+// Non-owning view of one complete packet inside a receive buffer.
+// Only valid until the buffer it points into is consumed or refilled.
+struct PacketView {
+    PacketHeader header;
+    const char* payload = nullptr;
+    qsizetype payloadSize = 0;
+
+    // Wraps the payload without copying it
+    QByteArray payloadBytes() const { return QByteArray::fromRawData(payload, payloadSize); }
+};
+
+enum class FrameStatus {
+    Complete,   // packet is filled in
+    Incomplete, // need more bytes (header is filled in once it is available)
+    Invalid     // bad magic, unsupported version or oversized payload
+};
+
+// Frame the next packet at the start of data without copying anything.
+// A header announcing more than maxPayloadSize bytes is Invalid, so a peer
+// cannot make the receive buffer grow past the limit.
+FrameStatus nextPacket(const char* data, qsizetype size, PacketView& packet,
+                       quint32 maxPayloadSize = DEFAULT_MAX_MESSAGE_SIZE);
+
+// Wire encoding for KeyEvent/MouseEvent/MouseMove.
+// Legacy is the original big-endian QDataStream layout (version 1), Fixed is a
+// packed little-endian layout (version 2). Both are fixed-size, so they can be
+// written into a stack buffer and parsed with direct loads.
+enum class InputWireFormat : quint16 {
+    Legacy = PROTOCOL_VERSION,
+    Fixed = PROTOCOL_VERSION_FIXED_INPUT
+};
+
+// Fixed layout payloads (little-endian, no padding):
+//   KeyEvent:   qint32 vkCode, quint8 pressed
+//   MouseEvent: qint32 x, qint32 y, quint8 button, quint8 pressed
+//   MouseMove:  qint32 x, qint32 y
+constexpr int KEY_EVENT_FIXED_PAYLOAD = 5;
+constexpr int MOUSE_EVENT_FIXED_PAYLOAD = 10;
+constexpr int MOUSE_MOVE_FIXED_PAYLOAD = 8;
+
+// Legacy payload sizes (qint32 fields and a one-byte bool)
+constexpr int KEY_EVENT_LEGACY_PAYLOAD = 5;
+constexpr int MOUSE_EVENT_LEGACY_PAYLOAD = 13;
+constexpr int MOUSE_MOVE_LEGACY_PAYLOAD = 8;
+
+// Large enough for any input packet in either encoding
+constexpr int MAX_INPUT_PACKET_SIZE = PACKET_HEADER_SIZE + MOUSE_EVENT_LEGACY_PAYLOAD;
+
+// Batched input (InputBatch). Payload:
+//   quint16 count (LE), then per event:
+//     quint8  kind | 0x80 if pressed
+//     varint  microseconds since the previous event in the batch
+//     Key:         varint vkCode
+//     MouseButton: zigzag varint dx, zigzag varint dy, quint8 button
+//     MouseMove:   zigzag varint dx, zigzag varint dy
+// Mouse coordinates are deltas from the previous mouse event in the batch,
+// starting from (0, 0).
+enum class InputEventKind : quint8 {
+    Key = 0,
+    MouseButton = 1,
+    MouseMove = 2
+};
+
+struct InputEvent {
+    InputEventKind kind = InputEventKind::Key;
+    qint32 x = 0;
+    qint32 y = 0;
+    qint32 code = 0;            // vkCode or mouse button
+    bool pressed = false;
+    quint32 timeOffsetUs = 0;   // time since the previous event in the batch
+};
+
+constexpr int MAX_INPUT_BATCH_EVENTS = 1024;
+constexpr int MAX_INPUT_BATCH_EVENT_SIZE = 17; // worst case encoded size of one event
+
+// Serializes events into packet, reusing its capacity
+void writeInputBatchPacket(QByteArray& packet, const QVector<InputEvent>& events);
+QByteArray createInputBatchPacket(const QVector<InputEvent>& events);
+
+// Single-event packet (KeyEvent/MouseEvent/MouseMove) for peers without batching
+int writeInputEventPacket(char* out, const InputEvent& event, InputWireFormat format);
+
+// Appends the decoded events to events (caller clears it to reuse capacity)
+bool parseInputBatchPacket(const PacketView& packet, QVector<InputEvent>& events);
+
+// Datagram input channel. After authentication the server sends
+// InputChannelSetup over the TLS connection with its UDP port and a fresh
+// pre-shared key; the client then opens a DTLS session to that port using
+// the key. Each datagram inside the session is:
+//   quint32 sequence number of the first event (LE), then an InputBatch payload
+// Every datagram repeats the most recent MAX_INPUT_DATAGRAM_EVENTS events, so
+// a lost datagram is covered by the next one. Sequence numbers start at 1;
+// client keepalives are empty datagrams (sequence 0, no events).
+constexpr int MAX_INPUT_DATAGRAM_EVENTS = 8;
+constexpr int MAX_INPUT_DATAGRAM_SIZE = 4 + 2 + MAX_INPUT_DATAGRAM_EVENTS * MAX_INPUT_BATCH_EVENT_SIZE;
+
+// Writes at most MAX_INPUT_DATAGRAM_EVENTS events (oldest first) into out,
+// which holds MAX_INPUT_DATAGRAM_SIZE bytes. Returns the number of bytes written.
+int writeInputDatagram(char* out, quint32 firstSequence, const InputEvent* events, int count);
+bool parseInputDatagram(const QByteArray& datagram, quint32& firstSequence, QVector<InputEvent>& events);
+
+// Hot-path input serialization into a caller-provided buffer of at least
+// MAX_INPUT_PACKET_SIZE bytes. Returns the number of bytes written. Fixed
+// only goes to peers that negotiated CapFixedInput; peers that predate it
+// drop version 2 headers, so Legacy is the default.
+int writeKeyEventPacket(char* out, int vkCode, bool pressed,
+                        InputWireFormat format = InputWireFormat::Legacy);
+int writeMouseEventPacket(char* out, int x, int y, int button, bool pressed,
+                          InputWireFormat format = InputWireFormat::Legacy);
+int writeMouseMovePacket(char* out, int x, int y,
+                         InputWireFormat format = InputWireFormat::Legacy);
+
+// Writes the PACKET_HEADER_SIZE byte header into out
+void writePacketHeader(char* out, MessageType type, quint16 version, quint32 payloadSize);
+
+// Owning copy of a packet, header included, for passing it on unchanged
+// (relays). The view's buffer may be reused once this returns.
+QByteArray copyPacket(const PacketView& packet);
+
+// Serialization functions. Messages made of plain fields are encoded and
+// decoded through the registry in messages.h; these cover the rest.
+QByteArray createAuthPacket(const QString& password, const QString& clientName,
+                            const PeerCapabilities& caps = PeerCapabilities());
+// A rejected client may be told when to come back; the hint follows the
+// capability trailer, where older clients ignore it
+QByteArray createAuthResponsePacket(AuthResult result, const QString& serverName = QString(),
+                                    const PeerCapabilities& caps = PeerCapabilities(),
+                                    quint32 retryAfterMs = 0);
+QByteArray createKeyEventPacket(int vkCode, bool pressed,
+                                InputWireFormat format = InputWireFormat::Legacy);
+QByteArray createMouseEventPacket(int x, int y, int button, bool pressed,
+                                  InputWireFormat format = InputWireFormat::Legacy);
+QByteArray createMouseMovePacket(int x, int y,
+                                 InputWireFormat format = InputWireFormat::Legacy);
+QByteArray createCommandOutputPacket(const QString& output, bool compressed = false);
 
 // Screen sharing packets
 QByteArray createScreenShareRequestPacket(bool start);
 QByteArray createScreenFramePacket(const QByteArray& imageData, int width, int height, quint32 frameId);
-QByteArray createScreenFrameAckPacket(quint32 frameId);
+
+// In-place screen frame construction. beginScreenFramePacket returns a buffer
+// holding only the reserved packet and frame headers; the encoder appends its
+// output directly after them (e.g. through a QBuffer opened in Append mode) and
+// finishScreenFramePacket patches in the sizes. The result goes to the socket
+// without another copy of the image.
+constexpr int SCREEN_FRAME_HEADER_SIZE = PACKET_HEADER_SIZE + 16; // + frameId, width, height, dataSize
+QByteArray beginScreenFramePacket(int width, int height, quint32 frameId, qsizetype expectedImageSize = 0);
+void finishScreenFramePacket(QByteArray& packet);
+
+// Delta frames (CapFrameTiles). A ScreenRegionUpdate replaces rectangles of
+// the frame baseFrameId with JPEG images of their new content; it only
+// applies on top of exactly that frame. Payload (big-endian):
+//   quint32 frameId, quint32 baseFrameId, qint32 width, qint32 height,
+//   quint32 regionCount, then per region:
+//     quint16 x, quint16 y, quint16 width, quint16 height, quint32 dataSize, JPEG
+// Built in place like ScreenFrame: begin, then for each region the header
+// (writeScreenRegionHeader, size patched once known) and its JPEG, then finish.
+constexpr int SCREEN_REGION_UPDATE_HEADER_SIZE = PACKET_HEADER_SIZE + 20;
+constexpr int SCREEN_REGION_HEADER_SIZE = 12;
+QByteArray beginScreenRegionUpdatePacket(int width, int height, quint32 frameId, quint32 baseFrameId,
+                                         qsizetype expectedSize = 0);
+void writeScreenRegionHeader(char* out, int x, int y, int width, int height, quint32 dataSize);
+void finishScreenRegionUpdatePacket(QByteArray& packet, int regionCount);
+
+struct ScreenRegion {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    QByteArray imageData; // view into the packet
+};
+
+// Remote cursor (CapCursor). Frames never show the pointer; viewers draw
+// it themselves from CursorPosition updates, sent as often as it moves.
+// Shapes are sent once per connection, as CursorShape, and referred to by
+// id; a client keeps the last CURSOR_SHAPE_CACHE_SIZE shapes it received
+// and the server tracks which those are, so a shape is only sent again
+// once it has dropped out. Shape id 0 is the viewer's default pointer.
+// Both go on the input channel: in order, and ahead of queued frames.
+constexpr int CURSOR_SHAPE_CACHE_SIZE = 16;
 
 // Clipboard packets
 QByteArray createClipboardDataPacket(const QString& mimeType, const QByteArray& data);
-QByteArray createClipboardRequestPacket();
+
+// Packet header plus payload prefix for a clipboard transfer of dataSize bytes.
+// Writing the prefix and then the clipboard bytes (gather write) sends the
+// data without copying it into an intermediate packet.
+QByteArray createClipboardDataPrefix(const QString& mimeType, quint32 dataSize);
 
 // Discovery packets
 QByteArray createDiscoveryBroadcast(const QString& serverName, int port);
 bool parseDiscoveryBroadcast(const QByteArray& data, QString& serverName, QString& address, int& port);
 
 // Deserialization functions
+bool parsePacketHeader(const char* data, qsizetype size, PacketHeader& header);
 bool parsePacketHeader(const QByteArray& data, PacketHeader& header);
-bool parseAuthPacket(const QByteArray& data, QString& password, QString& clientName);
-bool parseAuthResponsePacket(const QByteArray& data, AuthResult& result, QString& serverName);
-bool parseKeyEventPacket(const QByteArray& data, int& vkCode, bool& pressed);
-bool parseMouseEventPacket(const QByteArray& data, int& x, int& y, int& button, bool& pressed);
-bool parseMouseMovePacket(const QByteArray& data, int& x, int& y);
-bool parseExecuteCommandPacket(const QByteArray& data, QString& command, QString& type);
-bool parseCommandOutputPacket(const QByteArray& data, QString& output);
-bool parseClientInfoPacket(const QByteArray& data, QString& clientId, QString& clientName);
+// Peers that predate negotiation leave caps at its legacy defaults
+bool parseAuthPacket(const PacketView& packet, QString& password, QString& clientName,
+                     PeerCapabilities& caps);
+// retryAfterMs is 0 unless the server sent a retry hint (ServerFull)
+bool parseAuthResponsePacket(const PacketView& packet, AuthResult& result, QString& serverName,
+                             PeerCapabilities& caps, quint32& retryAfterMs);
+bool parseKeyEventPacket(const PacketView& packet, int& vkCode, bool& pressed);
+bool parseMouseEventPacket(const PacketView& packet, int& x, int& y, int& button, bool& pressed);
+bool parseMouseMovePacket(const PacketView& packet, int& x, int& y);
+bool parseCommandOutputPacket(const PacketView& packet, QString& output, bool compressed = false);
 
 // Screen sharing parsing
-bool parseScreenShareRequestPacket(const QByteArray& data, bool& start);
-bool parseScreenFramePacket(const QByteArray& data, QByteArray& imageData, int& width, int& height, quint32& frameId);
-bool parseScreenFrameAckPacket(const QByteArray& data, quint32& frameId);
+// imageData references the packet's buffer and is only valid while the packet is
+bool parseScreenFramePacket(const PacketView& packet, QByteArray& imageData, int& width, int& height, quint32& frameId);
+// Regions outside the frame make the packet invalid
+bool parseScreenRegionUpdatePacket(const PacketView& packet, int& width, int& height, quint32& frameId,
+                                   quint32& baseFrameId, QVector<ScreenRegion>& regions);
 
 // Clipboard parsing
-bool parseClipboardDataPacket(const QByteArray& data, QString& mimeType, QByteArray& clipData);
+bool parseClipboardDataPacket(const PacketView& packet, QString& mimeType, QByteArray& clipData);
+
+// Fragment parsing; chunk points into the packet's buffer
+bool parseFragmentPacket(const PacketView& packet, Channel& channel, bool& last,
+                         const char*& chunk, qsizetype& chunkSize);
+
+// Stream chunk parsing; data points into the packet's buffer
+bool parseStreamDataPacket(const PacketView& packet, quint32& streamId, const char*& data, qsizetype& dataSize);
 
 } // namespace Protocol
 
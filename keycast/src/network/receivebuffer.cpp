@@ -0,0 +1,72 @@
+#include "receivebuffer.h"
+#include <cstring>
+
+ReceiveBuffer::ReceiveBuffer(qsizetype initialCapacity)
+    : m_initialCapacity(initialCapacity)
+{
+}
+
+void ReceiveBuffer::reserve(qsizetype minFree)
+{
+    if (m_storage.size() - m_writePos >= minFree) return;
+
+    // Move the unread remainder to the front first
+    qsizetype pending = size();
+    if (m_readPos > 0) {
+        if (pending > 0) {
+            memmove(m_storage.data(), m_storage.constData() + m_readPos, pending);
+        }
+        m_readPos = 0;
+        m_writePos = pending;
+    }
+
+    if (m_storage.size() - m_writePos >= minFree) return;
+
+    // Grow geometrically so a stream of large packets settles on one allocation
+    qsizetype newCapacity = qMax(m_initialCapacity, m_storage.size() * 2);
+    newCapacity = qMax(newCapacity, pending + minFree);
+    m_storage.resize(newCapacity);
+}
+
+qint64 ReceiveBuffer::readFrom(QIODevice* device)
+{
+    qint64 total = 0;
+
+    qint64 available = device->bytesAvailable();
+    while (available > 0) {
+        reserve(available);
+
+        qint64 bytesRead = device->read(m_storage.data() + m_writePos, m_storage.size() - m_writePos);
+        if (bytesRead <= 0) break;
+
+        m_writePos += bytesRead;
+        total += bytesRead;
+        available = device->bytesAvailable();
+    }
+
+    return total;
+}
+
+void ReceiveBuffer::consume(qsizetype bytes)
+{
+    m_readPos = qMin(m_readPos + bytes, m_writePos);
+
+    // Rewind for free whenever the buffer drains completely
+    if (m_readPos == m_writePos) {
+        m_readPos = 0;
+        m_writePos = 0;
+
+        // One large message must not pin its buffer for the rest of the
+        // connection
+        if (m_storage.size() > m_retainedCapacity) {
+            m_storage = QByteArray();
+        }
+    }
+}
+
+void ReceiveBuffer::clear()
+{
+    m_readPos = 0;
+    m_writePos = 0;
+    m_storage = QByteArray();
+}
@@ -0,0 +1,48 @@
+#ifndef RECEIVEBUFFER_H
+#define RECEIVEBUFFER_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+// Reusable per-connection receive buffer.
+//
+// Socket data is read straight into the free space at the tail and packets are
+// parsed in place. Consuming a packet only advances the read offset; the unread
+// remainder is moved to the front when the tail runs out of room, so a packet
+// is always contiguous and can be handed out as a non-owning view. Storage is
+// allocated lazily and reused; storage grown past the retained capacity for
+// a large message is released again once it has been consumed.
+class ReceiveBuffer
+{
+public:
+    static constexpr qsizetype DEFAULT_RETAINED_CAPACITY = 1024 * 1024;
+
+    explicit ReceiveBuffer(qsizetype initialCapacity = 64 * 1024);
+
+    const char* data() const { return m_storage.constData() + m_readPos; }
+    qsizetype size() const { return m_writePos - m_readPos; }
+    qsizetype capacity() const { return m_storage.size(); }
+    bool isEmpty() const { return m_writePos == m_readPos; }
+
+    // Largest storage kept around while the buffer is empty
+    qsizetype retainedCapacity() const { return m_retainedCapacity; }
+    void setRetainedCapacity(qsizetype bytes) { m_retainedCapacity = bytes; }
+
+    // Ensure at least minFree bytes can be appended without moving data again
+    void reserve(qsizetype minFree);
+
+    // Read everything the device currently has buffered; returns bytes read
+    qint64 readFrom(QIODevice* device);
+
+    void consume(qsizetype bytes);
+    void clear();
+
+private:
+    QByteArray m_storage;
+    qsizetype m_readPos = 0;
+    qsizetype m_writePos = 0;
+    qsizetype m_initialCapacity;
+    qsizetype m_retainedCapacity = DEFAULT_RETAINED_CAPACITY;
+};
+
+#endif // RECEIVEBUFFER_H
@@ -0,0 +1,85 @@
+#include "relay.h"
+#include "client.h"
+#include "server.h"
+
+Relay::Relay(Client* upstream, Server* downstream, QObject* parent)
+    : QObject(parent)
+    , m_upstream(upstream)
+    , m_downstream(downstream)
+{
+}
+
+Relay::~Relay()
+{
+    stop();
+}
+
+void Relay::start()
+{
+    if (m_active) return;
+
+    m_upstream->setRelaying(true);
+
+    m_connections
+        << connect(m_upstream, &Client::inputEventReceived, m_downstream, &Server::relayInputEvent)
+        << connect(m_upstream, &Client::inputBatchPacketReceived, m_downstream, &Server::relayInputBatch)
+        << connect(m_upstream, &Client::screenFramePacketReceived, m_downstream, &Server::relayScreenFrame)
+        << connect(m_downstream, &Server::keyframeNeeded, m_upstream, &Client::requestKeyframe)
+        << connect(m_upstream, &Client::cursorPacketReceived, m_downstream, &Server::relayCursor)
+        << connect(m_upstream, &Client::screenShareParamsPacketReceived, m_downstream, &Server::relayScreenShareParams)
+        << connect(m_upstream, &Client::executeCommandReceived, m_downstream, &Server::broadcastCommand)
+        << connect(m_upstream, &Client::authenticated, this, &Relay::onUpstreamAuthenticated)
+        << connect(m_upstream, &Client::disconnected, this, [this]() { m_watching = false; })
+        << connect(m_upstream, &Client::latencyChanged, this, &Relay::onUpstreamLatencyChanged)
+        << connect(m_downstream, &Server::viewerCountChanged, this, &Relay::onViewerCountChanged);
+
+    m_active = true;
+    onViewerCountChanged(m_downstream->viewerCount());
+    onUpstreamLatencyChanged();
+    emit activeChanged(true);
+}
+
+void Relay::stop()
+{
+    if (!m_active) return;
+
+    for (const QMetaObject::Connection& connection : m_connections) {
+        disconnect(connection);
+    }
+    m_connections.clear();
+
+    setWatching(false);
+    m_upstream->setRelaying(false);
+    m_downstream->setUpstreamLatency(0, 0);
+
+    m_active = false;
+    emit activeChanged(false);
+}
+
+void Relay::onViewerCountChanged(int viewers)
+{
+    setWatching(viewers > 0);
+}
+
+void Relay::onUpstreamAuthenticated()
+{
+    // A new connection starts without a screen share
+    m_watching = false;
+    setWatching(m_downstream->viewerCount() > 0);
+}
+
+void Relay::onUpstreamLatencyChanged()
+{
+    qint64 pathUs = m_upstream->pathLatencyUs();
+    if (pathUs >= 0) {
+        m_downstream->setUpstreamLatency(m_upstream->hops(), pathUs);
+    }
+}
+
+void Relay::setWatching(bool watching)
+{
+    if (watching == m_watching || !m_upstream->isAuthenticated()) return;
+
+    m_upstream->requestScreenShare(watching);
+    m_watching = watching;
+}
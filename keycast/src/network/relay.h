@@ -0,0 +1,54 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <QObject>
+#include <QList>
+
+class Client;
+class Server;
+
+// Relay role: a Client of an upstream server and a Server to clients of its
+// own, so a source can fan out through a tree of nodes instead of serving
+// every client itself. Input, commands and screen frames from upstream are
+// passed on as they arrive; frames are never decoded or re-encoded, and
+// input batches go out unchanged. Screen frames are asked for upstream only
+// while some client downstream wants them. Deltas go to the clients that
+// can apply them; when one can't, the relay asks upstream for a keyframe,
+// so clients without delta support below keep the link on keyframes.
+// Cursor shapes are cached here and sent to each client below once. Each
+// relay adds its hop to the latency reported to the clients below it.
+// Frame rate, quality and scale are upstream's; as frames are acknowledged
+// on arrival, upstream adapts them to its link to the relay only.
+class Relay : public QObject
+{
+    Q_OBJECT
+
+public:
+    Relay(Client* upstream, Server* downstream, QObject* parent = nullptr);
+    ~Relay();
+
+    bool isActive() const { return m_active; }
+
+public slots:
+    void start();
+    void stop();
+
+signals:
+    void activeChanged(bool active);
+
+private slots:
+    void onViewerCountChanged(int viewers);
+    void onUpstreamAuthenticated();
+    void onUpstreamLatencyChanged();
+
+private:
+    void setWatching(bool watching);
+
+    Client* m_upstream;
+    Server* m_downstream;
+    QList<QMetaObject::Connection> m_connections;
+    bool m_active = false;
+    bool m_watching = false; // screen share requested upstream
+};
+
+#endif // RELAY_H
@@ -1,20 +1,43 @@
 #include "server.h"
+#include "servershard.h"
 #include "protocol.h"
+#include "messages.h"
 #include "settings.h"
 #include "sslconfig.h"
 #include "screencapture.h"
+#include "frameencoder.h"
+#include "datagraminput.h"
+#ifdef KEYCAST_IO_URING
+#include "uringshard.h"
+#endif
 
+#include <QBuffer>
 #include <QUuid>
 #include <QDateTime>
-#include <QBuffer>
+#include <QThread>
 
 Server::Server(QObject* parent)
     : QObject(parent)
-    , m_server(new QTcpServer(this))
-    , m_pingTimer(new QTimer(this))
+    , m_server(new ConnectionListener(this))
+    , m_inputFlushTimer(new QTimer(this))
+    , m_frameWindowTimer(new QTimer(this))
+    , m_streamTimer(new QTimer(this))
+    , m_datagramInput(new InputDatagramServer(this))
+    , m_encoder(new FrameEncoder(this))
 {
-    connect(m_server, &QTcpServer::newConnection, this, &Server::onNewConnection);
-    connect(m_pingTimer, &QTimer::timeout, this, &Server::onPingTimer);
+    m_inputFlushTimer->setSingleShot(true);
+    m_inputFlushTimer->setTimerType(Qt::PreciseTimer);
+    m_pendingInput.reserve(Protocol::MAX_INPUT_BATCH_EVENTS);
+    m_frameWindowTimer->setSingleShot(true);
+    m_frameClock.start();
+    m_inputTarget.all = true;
+    m_frameTarget.all = true;
+
+    connect(m_server, &ConnectionListener::connectionAccepted, this, &Server::onConnectionAccepted);
+    connect(m_inputFlushTimer, &QTimer::timeout, this, &Server::flushInputBatch);
+    connect(m_frameWindowTimer, &QTimer::timeout, this, &Server::updateCaptureDemand);
+    connect(m_streamTimer, &QTimer::timeout, this, &Server::adaptStream);
+    connect(m_encoder, &FrameEncoder::frameEncoded, this, &Server::onFrameEncoded);
 }
 
 Server::~Server()
@@ -28,14 +51,57 @@ void Server::start(int port, const QString& password)
 
     m_port = port;
     m_password = password;
+    setInputBatchInterval(Settings::instance()->inputBatchInterval());
+    m_maxMessageSize = Settings::instance()->maxMessageSize();
+    setFrameQueueBudget(Settings::instance()->frameQueueBudget());
+    setFrameWindow(Settings::instance()->frameWindow());
+
+    StreamSettings limits;
+    limits.frameRate = Settings::instance()->maxFrameRate();
+    limits.quality = Settings::instance()->frameQuality();
+    m_stream.setLimits(limits);
+    m_stream.setLatencyBudgetMs(Settings::instance()->latencyBudget());
+    m_adaptiveStream = Settings::instance()->adaptiveStream();
+
+    const QHash<QString, QStringList> tags = Settings::instance()->clientTags();
+    for (auto it = tags.constBegin(); it != tags.constEnd(); ++it) {
+        m_groups.setTags(it.key(), it.value());
+    }
 
-    if (!m_server->listen(QHostAddress::Any, m_port)) {
+    m_localCapabilities = Protocol::SUPPORTED_CAPABILITIES;
+    if (Settings::instance()->legacyInputEncoding()) {
+        m_localCapabilities &= ~Protocol::CapFixedInput;
+    }
+    if (!Settings::instance()->frameDeltas()) {
+        m_localCapabilities &= ~Protocol::CapFrameTiles;
+    }
+    if (!Settings::instance()->cursorUpdates()) {
+        m_localCapabilities &= ~Protocol::CapCursor;
+    }
+    if (m_inputBatchInterval < 0) {
+        m_localCapabilities &= ~Protocol::CapInputBatch;
+    }
+
+    // Datagram input shares the port number over UDP; clients stay on TCP
+    // if it is disabled or the port is taken
+    if (!Settings::instance()->datagramInput() || !m_datagramInput->listen(m_port)) {
+        m_localCapabilities &= ~Protocol::CapDatagramInput;
+    }
+
+    startShards();
+
+    // Each I/O thread accepts for itself where the kernel can spread
+    // connections over several sockets; otherwise one listener hands them out
+    bool shared = Settings::instance()->reusePort() && listenOnShards();
+    if (!shared && !m_server->listen(QHostAddress::Any, m_port)) {
         emit error(QString("Failed to start server: %1").arg(m_server->errorString()));
+        stopShards();
+        m_clients.clear();
+        m_datagramInput->close();
         return;
     }
 
     m_running = true;
-    m_pingTimer->start(30000); // Ping every 30 seconds
 
     emit started();
 }
@@ -45,26 +111,151 @@ void Server::stop()
     if (!m_running) return;
 
     stopScreenShare();
-    m_pingTimer->stop();
-
-    // Disconnect all clients
-    QByteArray disconnectPacket = Protocol::createDisconnectPacket();
-    for (auto& client : m_clients) {
-        if (client.socket && client.socket->isOpen()) {
-            client.socket->write(disconnectPacket);
-            client.socket->flush();
-            client.socket->disconnectFromHost();
-        }
-    }
-    m_clients.clear();
-    m_socketToId.clear();
+    flushInputBatch();
 
+    // Say goodbye to all clients
     m_server->close();
+    stopShards();
+    m_clients.clear();
+    m_clientIds.clear();
+    updateViewerCount();
+
+    m_datagramInput->close();
     m_running = false;
 
     emit stopped();
 }
 
+void Server::startShards()
+{
+    int threads = m_ioThreads > 0 ? qMin(m_ioThreads, ClientHandles::MAX_SHARDS)
+                                  : qBound(1, QThread::idealThreadCount() / 2, 8);
+
+    // Handshakes are limited per shard, split evenly. The client limit is
+    // one count over all shards: the kernel's hashing of connections is
+    // only even on average, and a full shard must not turn clients away
+    // while others have room.
+    int maxHandshakes = Settings::instance()->maxHandshakes();
+    int maxClients = Settings::instance()->maxClients();
+
+    ShardConfig config;
+    config.password = m_password;
+    config.serverName = Settings::instance()->computerName();
+    config.localCapabilities = m_localCapabilities;
+    config.maxMessageSize = m_maxMessageSize;
+    config.frameQueueBudget = m_frameQueueBudget;
+    if (m_useSsl && SslConfig::instance()->hasCertificate()) {
+        config.useSsl = true;
+        config.sslConfiguration = SslConfig::instance()->serverConfiguration();
+    }
+    config.hops = m_upstreamHops;
+    config.pathLatencyUs = m_upstreamPathUs;
+    config.maxHandshakes = maxHandshakes > 0 ? (maxHandshakes + threads - 1) / threads : 0;
+    config.maxClients = qMax(0, maxClients);
+    config.clientCount = QSharedPointer<QAtomicInt>::create(0);
+
+#ifdef KEYCAST_IO_URING
+    bool useUring = m_backend == "io_uring" && UringShard::isSupported();
+    if (m_backend == "io_uring" && !useUring) {
+        emit error("io_uring is not available on this system, using the qt backend");
+    }
+#else
+    if (m_backend == "io_uring") {
+        emit error("Built without io_uring support, using the qt backend");
+    }
+#endif
+
+    for (int i = 0; i < threads; ++i) {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QString("KeyCast I/O %1").arg(i));
+
+#ifdef KEYCAST_IO_URING
+        ServerShard* shard = useUring ? new UringShard : new ServerShard;
+#else
+        ServerShard* shard = new ServerShard;
+#endif
+        shard->moveToThread(thread);
+        connect(thread, &QThread::finished, shard, &QObject::deleteLater);
+
+        connect(shard, &ServerShard::clientConnected, this, &Server::onClientConnected);
+        connect(shard, &ServerShard::clientAuthenticated, this, &Server::onClientAuthenticated);
+        connect(shard, &ServerShard::clientDisconnected, this, &Server::onClientDisconnected);
+        connect(shard, &ServerShard::commandOutputReceived, this, &Server::onCommandOutputReceived);
+        connect(shard, &ServerShard::screenShareRequested, this, &Server::onScreenShareRequested);
+        connect(shard, &ServerShard::frameAcknowledged, this, &Server::onFrameAcknowledged);
+        connect(shard, &ServerShard::latencyMeasured, this, &Server::onLatencyMeasured);
+
+        thread->start();
+        ShardConfig shardConfig = config;
+        shardConfig.index = i;
+        QMetaObject::invokeMethod(shard, [shard, shardConfig]() {
+            shard->setConfig(shardConfig);
+        }, Qt::QueuedConnection);
+
+        m_threads.append(thread);
+        m_shards.append(shard);
+    }
+    m_clients.resize(threads);
+    m_groups.setShardCount(threads);
+    m_nextShard = 0;
+}
+
+bool Server::listenOnShards()
+{
+    quint16 port = static_cast<quint16>(m_port);
+#ifdef Q_OS_LINUX
+    // A second server would bind next to the first and split its clients;
+    // leave the port to the fallback listener, which reports it as taken
+    if (ServerShard::isPortInUse(port)) return false;
+#endif
+    for (ServerShard* shard : m_shards) {
+        bool listening = false;
+        QMetaObject::invokeMethod(shard, [shard, port, &listening]() {
+            listening = shard->listen(port);
+        }, Qt::BlockingQueuedConnection);
+
+        if (!listening) {
+            // All or nothing, so the fallback listener can bind the port
+            for (ServerShard* other : m_shards) {
+                QMetaObject::invokeMethod(other, [other]() {
+                    other->closeListener();
+                }, Qt::BlockingQueuedConnection);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void Server::stopShards()
+{
+    for (int i = 0; i < m_shards.size(); ++i) {
+        ServerShard* shard = m_shards[i];
+        QMetaObject::invokeMethod(shard, [shard]() {
+            shard->shutdown();
+        }, Qt::BlockingQueuedConnection);
+
+        // The shard is deleted as its thread finishes
+        m_threads[i]->quit();
+        m_threads[i]->wait();
+        delete m_threads[i];
+    }
+    m_threads.clear();
+    m_shards.clear();
+}
+
+ClientState* Server::findClient(ClientHandle handle)
+{
+    int shard = ClientHandles::shard(handle);
+    return shard < m_clients.size() ? m_clients[shard].table.find(handle) : nullptr;
+}
+
+const ClientState* Server::findClient(ClientHandle handle) const
+{
+    int shard = ClientHandles::shard(handle);
+    return shard < m_clients.size() ? m_clients[shard].table.find(handle) : nullptr;
+}
+
 void Server::startScreenShare()
 {
     if (m_screenSharing) return;
@@ -72,10 +263,24 @@ void Server::startScreenShare()
     if (!m_screenCapture) {
         m_screenCapture = new ScreenCapture(this);
         connect(m_screenCapture, &ScreenCapture::frameCaptured, this, &Server::broadcastScreenFrame);
+        connect(m_screenCapture, &ScreenCapture::cursorShapeChanged, this, &Server::broadcastCursorShape);
+        connect(m_screenCapture, &ScreenCapture::cursorMoved, this, &Server::broadcastCursorPosition);
+    }
+    m_screenCapture->setDamageTracking(Settings::instance()->damageTracking());
+    m_screenCapture->setCursorTracking((m_localCapabilities & Protocol::CapCursor) != 0);
+
+    // Each share starts from the configured settings
+    m_stream.setLimits(m_stream.limits());
+    applyStreamSettings(m_stream.settings());
+    m_lastCaptureTicks = m_screenCapture->captureTicks();
+    m_lastCapturedFrames = m_screenCapture->capturedFrames();
+    if (m_adaptiveStream) {
+        m_streamTimer->start(STREAM_INTERVAL_MS);
     }
 
     m_screenCapture->start();
     m_screenSharing = true;
+    updateCaptureDemand();
 }
 
 void Server::stopScreenShare()
@@ -85,330 +290,1011 @@ void Server::stopScreenShare()
     if (m_screenCapture) {
         m_screenCapture->stop();
     }
-
+    m_frameWindowTimer->stop();
+    m_streamTimer->stop();
+    m_encoder->clear();
+
+    for (ShardClients& clients : m_clients) {
+        clients.table.forEach([](ClientHandle, ClientState& client) {
+            client.framesInFlight.clear();
+            client.frameSynced = false;
+            client.frameLatencyMs = -1;
+            client.ackedBytes = 0;
+            client.ackedFrames = 0;
+            client.busyMs = 0;
+            client.backlogged = false;
+        });
+    }
+    m_cursorPosition.clear();
+    m_streamParams.clear();
     m_screenSharing = false;
 }
 
-void Server::setupSslSocket(QSslSocket* socket)
+void Server::onConnectionAccepted(qintptr socketDescriptor)
 {
-    if (!m_useSsl) return;
-
-    SslConfig* ssl = SslConfig::instance();
-    if (ssl->hasCertificate()) {
-        socket->setSslConfiguration(ssl->serverConfiguration());
-    }
+    if (m_shards.isEmpty()) return;
+
+    // Round robin, as the kernel does for shared listeners; the socket is
+    // created on the shard's thread and the shard allocates its handle
+    ServerShard* shard = m_shards[m_nextShard];
+    m_nextShard = (m_nextShard + 1) % m_shards.size();
+    QMetaObject::invokeMethod(shard, [shard, socketDescriptor]() {
+        shard->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
 }
 
-void Server::onNewConnection()
+void Server::onClientConnected(ClientHandle handle, const QString& address)
 {
-    while (m_server->hasPendingConnections()) {
-        QTcpSocket* tcpSocket = m_server->nextPendingConnection();
-
-        // Create SSL socket
-        QSslSocket* socket = new QSslSocket(this);
-        socket->setSocketDescriptor(tcpSocket->socketDescriptor());
-        tcpSocket->setParent(nullptr);
-        delete tcpSocket;
+    int shard = ClientHandles::shard(handle);
+    if (shard >= m_clients.size()) return;
 
-        QString clientId = generateClientId();
+    ClientState state;
+    state.id = generateClientId();
+    state.name = "Unknown";
+    state.address = address;
+    m_clients[shard].table.insert(handle, state);
+    m_clientIds.insert(state.id, handle);
 
-        ClientConnection client;
-        client.id = clientId;
-        client.name = "Unknown";
-        client.address = socket->peerAddress().toString();
-        client.socket = socket;
-        client.authenticated = false;
-        client.sslEstablished = false;
-        client.wantsScreenShare = false;
+    emit clientConnected(state.id);
+}
 
-        m_clients[clientId] = client;
-        m_socketToId[socket] = clientId;
+void Server::onClientAuthenticated(ClientHandle handle, const QString& clientName,
+                                   const Protocol::PeerCapabilities& caps)
+{
+    ClientState* client = findClient(handle);
+    if (!client) return;
+
+    client->name = clientName;
+    client->caps = caps;
+    m_clients[ClientHandles::shard(handle)].authenticated.set(ClientHandles::slot(handle));
+    m_groups.addClient(handle, clientName);
+    updateRoutes();
+
+    if (caps.has(Protocol::CapDatagramInput)) {
+        // Key material only ever travels over the client's connection
+        Protocol::InputChannelSetupMessage setup;
+        setup.port = m_datagramInput->port();
+        m_datagramInput->openSession(handle, setup.identity, setup.key);
+        sendToClient(handle, Protocol::encode(setup));
+    }
 
-        connect(socket, &QSslSocket::readyRead, this, &Server::onClientReadyRead);
-        connect(socket, &QSslSocket::disconnected, this, &Server::onClientDisconnected);
-        connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::errorOccurred),
-                this, &Server::onClientError);
-        connect(socket, QOverload<const QList<QSslError>&>::of(&QSslSocket::sslErrors),
-                this, &Server::onSslErrors);
-        connect(socket, &QSslSocket::encrypted, this, &Server::onClientEncrypted);
+    emit clientAuthenticated(client->id, clientName);
+}
 
-        if (m_useSsl && SslConfig::instance()->hasCertificate()) {
-            setupSslSocket(socket);
-            socket->startServerEncryption();
-        } else {
-            // No SSL, mark as established
-            m_clients[clientId].sslEstablished = true;
-            emit clientConnected(clientId);
-        }
+void Server::onClientDisconnected(ClientHandle handle)
+{
+    // Sends queued before now may name the slot in a ClientSet; the shard
+    // reuses it once this reaches it, behind them. Later ones no longer do.
+    int shardIndex = ClientHandles::shard(handle);
+    if (shardIndex < m_shards.size()) {
+        ServerShard* shard = m_shards[shardIndex];
+        QMetaObject::invokeMethod(shard, [shard, handle]() {
+            shard->releaseClient(handle);
+        }, Qt::QueuedConnection);
     }
+
+    ClientState* client = findClient(handle);
+    if (!client) return;
+
+    QString clientId = client->id;
+    int slot = ClientHandles::slot(handle);
+    ShardClients& clients = m_clients[ClientHandles::shard(handle)];
+    clients.authenticated.reset(slot);
+    clients.screenShare.reset(slot);
+    clients.inputBatched.reset(slot);
+    clients.table.remove(handle);
+    m_clientIds.remove(clientId);
+    m_groups.removeClient(handle);
+    updateRoutes();
+
+    m_datagramInput->closeSession(handle);
+    updateCaptureDemand();
+    updateViewerCount();
+    emit clientDisconnected(clientId);
 }
 
-void Server::onSslErrors(const QList<QSslError>& errors)
+void Server::onCommandOutputReceived(ClientHandle handle, const QString& output)
 {
-    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
-    if (!socket) return;
+    const ClientState* client = findClient(handle);
+    if (client) {
+        emit commandOutputReceived(client->id, output);
+    }
+}
 
-    // Ignore self-signed certificate errors for now
-    socket->ignoreSslErrors();
+void Server::onScreenShareRequested(ClientHandle handle, bool start)
+{
+    ClientState* client = findClient(handle);
+    if (!client) return;
+
+    // Also sent again by viewers that lost track of the frames: either way
+    // the next frame they get is a keyframe
+    client->frameSynced = false;
+
+    // Only clients that can decode frames are offered any
+    ClientSet& screenShare = m_clients[ClientHandles::shard(handle)].screenShare;
+    if (start && client->caps.has(Protocol::CapFrameJpeg)) {
+        screenShare.set(ClientHandles::slot(handle));
+    } else {
+        screenShare.reset(ClientHandles::slot(handle));
+        client->framesInFlight.clear();
+    }
+    updateRoutes();
+    updateCaptureDemand();
+    updateViewerCount();
 }
 
-void Server::onClientEncrypted()
+void Server::onFrameAcknowledged(ClientHandle handle, quint32 frameId)
 {
-    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
-    if (!socket) return;
+    ClientState* client = findClient(handle);
+    if (!client) return;
+
+    // Frames arrive in order, so an ack covers every older frame too; those
+    // were replaced in the send queue or failed to decode
+    int acked = 0;
+    while (acked < client->framesInFlight.size() &&
+           static_cast<qint32>(client->framesInFlight[acked].id - frameId) <= 0) {
+        ++acked;
+    }
+    if (acked == 0) return;
+
+    // Only the newest was delivered; any before it were replaced. The link
+    // had them since the first was sent or the previous ack came, and a
+    // full window means it, rather than the screen, set the pace.
+    qint64 now = m_frameClock.elapsed();
+    const InFlightFrame& delivered = client->framesInFlight[acked - 1];
+    client->frameLatencyMs = Protocol::smoothRoundTrip(client->frameLatencyMs, now - delivered.sentMs);
+    client->ackedBytes += delivered.bytes;
+    client->ackedFrames += 1;
+    client->busyMs += now - qMax(client->lastAckMs, client->framesInFlight.first().sentMs);
+    client->lastAckMs = now;
+    if (client->framesInFlight.size() >= m_frameWindow) {
+        client->backlogged = true;
+    }
 
-    QString clientId = m_socketToId.value(socket);
-    if (clientId.isEmpty() || !m_clients.contains(clientId)) return;
+    client->framesInFlight.remove(0, acked);
+    updateCaptureDemand();
+}
 
-    m_clients[clientId].sslEstablished = true;
-    emit clientConnected(clientId);
+void Server::onLatencyMeasured(ClientHandle handle, qint64 roundTripUs)
+{
+    ClientState* client = findClient(handle);
+    if (!client) return;
+
+    client->roundTripUs = roundTripUs;
+    emit clientLatencyChanged(client->id, roundTripUs);
 }
 
-void Server::onClientReadyRead()
+void Server::updateViewerCount()
 {
-    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
-    if (!socket) return;
+    int viewers = 0;
+    for (const ShardClients& clients : m_clients) {
+        viewers += clients.screenShare.count();
+    }
+
+    if (viewers != m_viewerCount) {
+        m_viewerCount = viewers;
+        emit viewerCountChanged(viewers);
+    }
+}
 
-    QString clientId = m_socketToId.value(socket);
-    if (clientId.isEmpty() || !m_clients.contains(clientId)) return;
+qint64 Server::clientRoundTripUs(const QString& clientId) const
+{
+    const ClientState* client = findClient(handleFor(clientId));
+    return client ? client->roundTripUs : -1;
+}
 
-    ClientConnection& client = m_clients[clientId];
-    client.buffer.append(socket->readAll());
+void Server::setUpstreamLatency(int hops, qint64 pathLatencyUs)
+{
+    m_upstreamHops = static_cast<quint8>(qBound(0, hops, 255));
+    m_upstreamPathUs = static_cast<quint32>(qBound<qint64>(0, pathLatencyUs, 0xFFFFFFFF));
+
+    for (ServerShard* shard : m_shards) {
+        quint8 upstreamHops = m_upstreamHops;
+        quint32 pathUs = m_upstreamPathUs;
+        QMetaObject::invokeMethod(shard, [shard, upstreamHops, pathUs]() {
+            shard->setUpstreamLatency(upstreamHops, pathUs);
+        }, Qt::QueuedConnection);
+    }
+}
 
-    processClientData(client);
+void Server::sendClipboardToClient(const QString& clientId, const QString& mimeType, const QByteArray& data)
+{
+    ClientHandle handle = handleFor(clientId);
+    if (!findClient(handle)) return;
+
+    ClientSet target;
+    target.set(ClientHandles::slot(handle));
+    ServerShard* shard = m_shards[ClientHandles::shard(handle)];
+    QMetaObject::invokeMethod(shard, [shard, target, mimeType, data]() {
+        shard->sendClipboard(target, mimeType, data);
+    }, Qt::QueuedConnection);
 }
 
-void Server::processClientData(ClientConnection& client)
+void Server::broadcastClipboard(const QString& mimeType, const QByteArray& data)
 {
-    while (client.buffer.size() >= 11) { // Minimum header size
-        Protocol::PacketHeader header;
-        if (!Protocol::parsePacketHeader(client.buffer, header)) {
-            // Invalid packet, clear buffer
-            client.buffer.clear();
-            return;
-        }
+    // Every shard streams from the same shared buffer
+    for (int i = 0; i < m_shards.size(); ++i) {
+        if (m_clients[i].authenticated.isEmpty()) continue;
+
+        ServerShard* shard = m_shards[i];
+        ClientSet targets = m_clients[i].authenticated;
+        QMetaObject::invokeMethod(shard, [shard, targets, mimeType, data]() {
+            shard->sendClipboard(targets, mimeType, data);
+        }, Qt::QueuedConnection);
+    }
+}
 
-        int totalSize = 11 + header.payloadSize;
-        if (client.buffer.size() < totalSize) {
-            // Wait for more data
-            return;
-        }
+ConnectionMemory Server::clientMemoryUsage(const QString& clientId) const
+{
+    ConnectionMemory usage;
+    ClientHandle handle = handleFor(clientId);
+    if (!findClient(handle)) return usage;
+
+    // The buffers belong to the shard's thread
+    ServerShard* shard = m_shards[ClientHandles::shard(handle)];
+    QMetaObject::invokeMethod(shard, [shard, handle, &usage]() {
+        usage = shard->memoryUsage(handle);
+    }, Qt::BlockingQueuedConnection);
+    return usage;
+}
 
-        // Extract complete packet
-        QByteArray packet = client.buffer.left(totalSize);
-        client.buffer.remove(0, totalSize);
+ChannelScheduler::ChannelStats Server::clientChannelStats(const QString& clientId, Protocol::Channel channel) const
+{
+    ChannelScheduler::ChannelStats stats;
+    ClientHandle handle = handleFor(clientId);
+    if (!findClient(handle)) return stats;
+
+    ServerShard* shard = m_shards[ClientHandles::shard(handle)];
+    QMetaObject::invokeMethod(shard, [shard, handle, channel, &stats]() {
+        stats = shard->channelStats(handle, channel);
+    }, Qt::BlockingQueuedConnection);
+    return stats;
+}
 
-        handlePacket(client, packet);
+void Server::setFrameQueueBudget(qsizetype bytes)
+{
+    m_frameQueueBudget = qMax<qsizetype>(0, bytes);
+    for (ServerShard* shard : m_shards) {
+        qsizetype budget = m_frameQueueBudget;
+        QMetaObject::invokeMethod(shard, [shard, budget]() {
+            shard->setFrameQueueBudget(budget);
+        }, Qt::QueuedConnection);
     }
 }
 
-void Server::handlePacket(ClientConnection& client, const QByteArray& packet)
+void Server::broadcast(const QByteArray& data)
 {
-    Protocol::PacketHeader header;
-    if (!Protocol::parsePacketHeader(packet, header)) return;
+    // One shared buffer for every shard
+    for (ServerShard* shard : m_shards) {
+        QMetaObject::invokeMethod(shard, [shard, data]() {
+            shard->sendToAll(data);
+        }, Qt::QueuedConnection);
+    }
+}
 
-    switch (header.type) {
-    case Protocol::MessageType::Auth: {
-        QString password, clientName;
-        if (Protocol::parseAuthPacket(packet, password, clientName)) {
-            if (m_password.isEmpty() || password == m_password) {
-                client.authenticated = true;
-                client.name = clientName;
-
-                QByteArray response = Protocol::createAuthResponsePacket(
-                    Protocol::AuthResult::Success,
-                    Settings::instance()->computerName()
-                );
-                client.socket->write(response);
-
-                emit clientAuthenticated(client.id, client.name);
-            } else {
-                QByteArray response = Protocol::createAuthResponsePacket(
-                    Protocol::AuthResult::InvalidPassword
-                );
-                client.socket->write(response);
-                client.socket->flush();
-                client.socket->disconnectFromHost();
+bool Server::broadcastToScreenShareClients(const QByteArray& keyframe, const QByteArray& delta, quint32 frameId)
+{
+    qint64 now = m_frameClock.elapsed();
+    bool allServed = true;
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        ShardClients& clients = m_clients[i];
+
+        ClientSet keyframeTargets;
+        ClientSet deltaTargets;
+        clients.frameTargets.forEach([&](int slot) {
+            ClientState& client = clients.table.at(slot);
+            bool tiles = client.caps.has(Protocol::CapFrameTiles);
+            bool useDelta = tiles && client.frameSynced && !delta.isEmpty();
+            const QByteArray& packet = useDelta ? delta : keyframe;
+
+            if (packet.isEmpty() || !canAcceptFrame(client) || !canSendFrame(client, packet)) {
+                // The next delta builds on this frame. Only a client that
+                // could have taken one is waiting for a keyframe now.
+                client.frameSynced = false;
+                allServed = allServed && !canAcceptFrame(client);
+                client.backlogged = client.backlogged || !canAcceptFrame(client);
+                return;
             }
-        }
-        break;
+            // A frame replaced in the client's queue is never acknowledged;
+            // the next ack covers it. A replaced delta is caught by the
+            // client, which asks for a keyframe.
+            client.framesInFlight.append(InFlightFrame{frameId, now, packet.size()});
+            client.frameSynced = tiles;
+            (useDelta ? deltaTargets : keyframeTargets).set(slot);
+        });
+
+        // Each I/O thread queues the same encoded frames for its own clients
+        sendToShard(i, keyframeTargets, keyframe);
+        sendToShard(i, deltaTargets, delta);
     }
+    return allServed;
+}
 
-    case Protocol::MessageType::Pong:
-        // Client responded to ping, connection is alive
-        break;
+bool Server::canSendFrame(const ClientState& client, const QByteArray& packet) const
+{
+    return packet.size() - Protocol::PACKET_HEADER_SIZE <= client.caps.maxMessageSize;
+}
 
-    case Protocol::MessageType::CommandOutput: {
-        if (!client.authenticated) return;
+bool Server::canAcceptFrame(const ClientState& client) const
+{
+    // Only asked of frameTargets clients. Frames still being encoded are not
+    // counted: a client whose window fills meanwhile skips them.
+    return client.framesInFlight.size() < m_frameWindow;
+}
 
-        QString output;
-        if (Protocol::parseCommandOutputPacket(packet, output)) {
-            emit commandOutputReceived(client.id, output);
-        }
-        break;
+bool Server::canEncodeFrame() const
+{
+    // One may wait for a thread; a newer frame would only replace it
+    return m_encoder->pendingFrames() < m_encoder->maxThreads() + 1;
+}
+
+void Server::expireFrames(ClientState& client)
+{
+    // Frames the client never acknowledges must not close its window forever
+    qint64 now = m_frameClock.elapsed();
+    int expired = 0;
+    while (expired < client.framesInFlight.size() &&
+           now - client.framesInFlight[expired].sentMs >= FRAME_ACK_TIMEOUT_MS) {
+        ++expired;
     }
+    client.framesInFlight.remove(0, expired);
+    if (expired == 0) return;
 
-    case Protocol::MessageType::ScreenShareRequest:
-    case Protocol::MessageType::ScreenShareStart: {
-        if (!client.authenticated) return;
-        client.wantsScreenShare = true;
-        break;
+    // Likely lost, and with it the changes it carried
+    client.frameSynced = false;
+    if (m_screenSharing && m_screenCapture) {
+        m_screenCapture->requestFullFrame();
     }
+}
 
-    case Protocol::MessageType::ScreenShareStop: {
-        if (!client.authenticated) return;
-        client.wantsScreenShare = false;
-        break;
+bool Server::updateFrameWindows()
+{
+    bool demand = false;
+    qint64 nextExpiry = -1;
+    for (ShardClients& clients : m_clients) {
+        clients.frameTargets.forEach([&](int slot) {
+            ClientState& client = clients.table.at(slot);
+            expireFrames(client);
+            if (canAcceptFrame(client)) {
+                demand = true;
+            } else if (!client.framesInFlight.isEmpty()) {
+                qint64 expiry = client.framesInFlight.first().sentMs + FRAME_ACK_TIMEOUT_MS;
+                nextExpiry = nextExpiry < 0 ? expiry : qMin(nextExpiry, expiry);
+            }
+        });
     }
 
-    case Protocol::MessageType::ScreenFrameAck: {
-        // Client acknowledged frame receipt
-        break;
+    // Windows held shut only by lost acks have to be reopened by a timer
+    if (!demand && nextExpiry >= 0) {
+        m_frameWindowTimer->start(qMax<qint64>(0, nextExpiry - m_frameClock.elapsed()));
+    } else {
+        m_frameWindowTimer->stop();
     }
+    return demand;
+}
 
-    case Protocol::MessageType::Disconnect:
-        if (client.socket) {
-            client.socket->disconnectFromHost();
-        }
-        break;
+void Server::updateCaptureDemand()
+{
+    // Windows are kept for relayed frames as well, with nothing to capture
+    bool demand = updateFrameWindows();
+    if (!m_screenSharing || !m_screenCapture) return;
 
-    default:
-        break;
-    }
+    // Nobody can take a frame, or the encoder is behind: don't capture one.
+    // Every delivered frame comes back here, so a busy encoder needs no timer.
+    m_screenCapture->setPaused(!demand || !canEncodeFrame());
 }
 
-void Server::onClientDisconnected()
+void Server::setFrameWindow(int frames)
 {
-    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
-    if (!socket) return;
+    m_frameWindow = qMax(1, frames);
+    updateCaptureDemand();
+}
 
-    QString clientId = m_socketToId.value(socket);
-    if (!clientId.isEmpty()) {
-        m_clients.remove(clientId);
-        m_socketToId.remove(socket);
-        emit clientDisconnected(clientId);
+void Server::adaptStream()
+{
+    if (!m_screenSharing || !m_screenCapture) return;
+
+    StreamController::Measurement measurement;
+    quint64 ticks = m_screenCapture->captureTicks() - m_lastCaptureTicks;
+    quint64 frames = m_screenCapture->capturedFrames() - m_lastCapturedFrames;
+    m_lastCaptureTicks = m_screenCapture->captureTicks();
+    m_lastCapturedFrames = m_screenCapture->capturedFrames();
+    measurement.changeRate = ticks > 0 ? double(frames) / ticks : 0;
+
+    // Every viewer gets the same frames; the controller picks the ones that
+    // set the pace
+    qint64 now = m_frameClock.elapsed();
+    QVector<StreamController::Viewer> viewers;
+    qint64 ackedBytes = 0;
+    int ackedFrames = 0;
+    for (ShardClients& clients : m_clients) {
+        clients.frameTargets.forEach([&](int slot) {
+            ClientState& client = clients.table.at(slot);
+            // Only viewers that had frames this tick; acks that stop
+            // coming count as they age
+            StreamController::Viewer viewer;
+            viewer.latencyMs = client.ackedFrames > 0 ? client.frameLatencyMs : -1;
+            if (!client.framesInFlight.isEmpty()) {
+                viewer.latencyMs = qMax(viewer.latencyMs, now - client.framesInFlight.first().sentMs);
+            }
+            if (client.backlogged && client.busyMs > 0) {
+                viewer.drainBytesPerSec = client.ackedBytes * 1000.0 / client.busyMs;
+            }
+            viewers.append(viewer);
+            ackedBytes += client.ackedBytes;
+            ackedFrames += client.ackedFrames;
+
+            client.ackedBytes = 0;
+            client.ackedFrames = 0;
+            client.busyMs = 0;
+            client.backlogged = false;
+        });
     }
+    m_stream.measureViewers(viewers, measurement);
+    measurement.bytesPerFrame = ackedFrames > 0 ? double(ackedBytes) / ackedFrames : 0;
 
-    socket->deleteLater();
+    applyStreamSettings(m_stream.update(measurement));
 }
 
-void Server::onClientError(QAbstractSocket::SocketError socketError)
+void Server::applyStreamSettings(const StreamSettings& settings)
 {
-    Q_UNUSED(socketError)
-    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
-    if (socket) {
-        socket->disconnectFromHost();
+    if (m_screenCapture) {
+        if (m_screenCapture->frameRate() != settings.frameRate) {
+            m_screenCapture->setFrameRate(settings.frameRate);
+        }
+        m_screenCapture->setQuality(settings.quality);
+        m_screenCapture->setScalePercent(settings.scalePercent);
+    }
+    m_encoder->setQuality(settings.quality);
+
+    Protocol::ScreenShareParamsMessage message;
+    message.frameRate = static_cast<quint8>(settings.frameRate);
+    message.quality = static_cast<quint8>(settings.quality);
+    message.scalePercent = static_cast<quint8>(settings.scalePercent);
+    QByteArray packet = Protocol::encode(message);
+    if (packet == m_streamParams) return;
+
+    m_streamParams = packet;
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendStreamParams(i, m_clients[i].frameTargets);
     }
 }
 
-void Server::onPingTimer()
+void Server::sendStreamParams(int shard, const ClientSet& targets)
 {
-    QByteArray pingPacket = Protocol::createPingPacket();
-    broadcast(pingPacket);
+    if (m_streamParams.isEmpty()) return;
+
+    const ShardClients& clients = m_clients[shard];
+    ClientSet paramsClients;
+    targets.forEach([&](int slot) {
+        if (clients.table.at(slot).caps.has(Protocol::CapStreamParams)) {
+            paramsClients.set(slot);
+        }
+    });
+    sendToShard(shard, paramsClients, m_streamParams);
 }
 
-void Server::broadcast(const QByteArray& data)
+int Server::encoderThreads() const
+{
+    return m_encoder->maxThreads();
+}
+
+void Server::setEncoderThreads(int threads)
+{
+    m_encoder->setMaxThreads(threads);
+}
+
+int Server::framesInFlight(const QString& clientId) const
+{
+    const ClientState* client = findClient(handleFor(clientId));
+    return client ? client->framesInFlight.size() : 0;
+}
+
+bool Server::isAuthenticated(ClientHandle handle) const
 {
-    for (auto& client : m_clients) {
-        if (client.authenticated && client.socket && client.socket->isOpen()) {
-            client.socket->write(data);
+    return findClient(handle) &&
+           m_clients[ClientHandles::shard(handle)].authenticated.test(ClientHandles::slot(handle));
+}
+
+void Server::sendToClient(ClientHandle handle, const QByteArray& data)
+{
+    if (!isAuthenticated(handle)) return;
+
+    ClientSet target;
+    target.set(ClientHandles::slot(handle));
+    sendToShard(ClientHandles::shard(handle), target, data);
+}
+
+void Server::sendToShard(int shard, const ClientSet& clients, const QByteArray& data)
+{
+    if (clients.isEmpty() || shard >= m_shards.size()) return;
+
+    ServerShard* target = m_shards[shard];
+    QMetaObject::invokeMethod(target, [target, clients, data]() {
+        target->send(clients, data);
+    }, Qt::QueuedConnection);
+}
+
+ClientTarget Server::parseTarget(const QString& target)
+{
+    ClientTarget parsed;
+    const QStringList entries = target.split(',', Qt::SkipEmptyParts);
+    for (const QString& entry : entries) {
+        QString name = entry.trimmed();
+        if (name == "all") {
+            parsed.all = true;
+        } else if (name.startsWith('@')) {
+            // Unknown groups are created, so clients tagged later still join
+            int group = m_groups.group(name.mid(1));
+            if (group >= 0) {
+                parsed.groups.append(group);
+            }
+        } else if (ClientHandle handle = handleFor(name)) {
+            parsed.clients.append(handle);
         }
     }
+    return parsed;
 }
 
-void Server::broadcastToScreenShareClients(const QByteArray& data)
+ClientSet Server::recipients(const ClientTarget& target, int shard) const
 {
-    for (auto& client : m_clients) {
-        if (client.authenticated && client.wantsScreenShare && client.socket && client.socket->isOpen()) {
-            client.socket->write(data);
+    const ShardClients& clients = m_clients[shard];
+    if (target.all) {
+        return clients.authenticated;
+    }
+
+    ClientSet result;
+    for (int group : target.groups) {
+        result |= m_groups.members(group, shard);
+    }
+    for (ClientHandle handle : target.clients) {
+        if (ClientHandles::shard(handle) == shard && clients.table.contains(handle)) {
+            result.set(ClientHandles::slot(handle));
         }
     }
+    return result & clients.authenticated;
 }
 
-void Server::sendToClient(const QString& clientId, const QByteArray& data)
+void Server::updateRoutes()
 {
-    if (m_clients.contains(clientId)) {
-        ClientConnection& client = m_clients[clientId];
-        if (client.authenticated && client.socket && client.socket->isOpen()) {
-            client.socket->write(data);
+    for (int i = 0; i < m_clients.size(); ++i) {
+        ShardClients& clients = m_clients[i];
+        clients.inputTargets = recipients(m_inputTarget, i);
+        clients.frameTargets = recipients(m_frameTarget, i) & clients.screenShare;
+    }
+
+    // New viewers have nothing to apply changes to yet
+    if (m_screenCapture) {
+        m_screenCapture->requestFullFrame();
+    }
+
+    // nor seen the pointer, which may not move for a while
+    if (!m_cursorPosition.isEmpty()) {
+        for (int i = 0; i < m_clients.size(); ++i) {
+            sendCursor(i, m_clients[i].frameTargets);
         }
     }
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendStreamParams(i, m_clients[i].frameTargets);
+    }
+}
+
+void Server::setInputTarget(const QString& target)
+{
+    m_inputTargetSpec = target;
+    m_inputTarget = parseTarget(target);
+    updateRoutes();
+}
+
+void Server::setScreenShareTarget(const QString& target)
+{
+    m_frameTargetSpec = target;
+    m_frameTarget = parseTarget(target);
+    updateRoutes();
+    updateCaptureDemand();
+}
+
+void Server::setClientTags(const QString& clientName, const QStringList& tags)
+{
+    m_groups.setTags(clientName, tags);
+    updateRoutes();
+    updateCaptureDemand();
+}
+
+void Server::setInputBatchInterval(int msecs)
+{
+    if (msecs < 0) {
+        flushInputBatch();
+    }
+    m_inputBatchInterval = qMax(-1, msecs);
+}
+
+void Server::broadcastInputEvent(const Protocol::InputEvent& event)
+{
+    bool batching = m_inputBatchInterval >= 0;
+    bool batch = false;
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        ShardClients& clients = m_clients[i];
+
+        // Clients taking the event directly over TCP; the shard encodes it
+        // once per wire format on its own thread
+        ClientSet direct;
+        clients.inputTargets.forEach([&](int slot) {
+            // Events already waiting in a batch for this client go first;
+            // after that an active datagram session takes over
+            if (!clients.inputBatched.test(slot) &&
+                m_datagramInput->sendInputEvent(clients.table.handleAt(slot), event)) {
+                return;
+            }
+
+            if (batching && clients.table.at(slot).caps.has(Protocol::CapInputBatch)) {
+                clients.inputBatched.set(slot);
+                batch = true;
+            } else {
+                direct.set(slot);
+            }
+        });
+
+        if (direct.isEmpty()) continue;
+
+        ServerShard* shard = m_shards[i];
+        QMetaObject::invokeMethod(shard, [shard, direct, event]() {
+            shard->sendInputEvent(direct, event);
+        }, Qt::QueuedConnection);
+    }
+
+    if (batch) {
+        queueInputEvent(event);
+    }
+}
+
+void Server::queueInputEvent(const Protocol::InputEvent& event)
+{
+    if (!m_inputClock.isValid()) {
+        m_inputClock.start();
+    }
+
+    qint64 nowUs = m_inputClock.nsecsElapsed() / 1000;
+
+    Protocol::InputEvent queued = event;
+    if (!m_pendingInput.isEmpty()) {
+        queued.timeOffsetUs = static_cast<quint32>(qMin<qint64>(nowUs - m_lastInputUs, 0xFFFFFFFF));
+    }
+    m_lastInputUs = nowUs;
+    m_pendingInput.append(queued);
+
+    if (m_pendingInput.size() >= Protocol::MAX_INPUT_BATCH_EVENTS) {
+        flushInputBatch();
+    } else if (!m_inputFlushTimer->isActive()) {
+        // A zero interval fires once control returns to the event loop
+        m_inputFlushTimer->start(m_inputBatchInterval);
+    }
+}
+
+void Server::flushInputBatch()
+{
+    m_inputFlushTimer->stop();
+    if (m_pendingInput.isEmpty()) return;
+
+    // A fresh buffer each time: the shards still hold the previous one
+    QByteArray packet;
+    Protocol::writeInputBatchPacket(packet, m_pendingInput);
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendToShard(i, m_clients[i].inputBatched, packet);
+        m_clients[i].inputBatched.clear();
+    }
+    m_pendingInput.clear();
 }
 
 void Server::broadcastKeyEvent(int vkCode, bool pressed)
 {
-    QByteArray packet = Protocol::createKeyEventPacket(vkCode, pressed);
-    broadcast(packet);
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::Key;
+    event.code = vkCode;
+    event.pressed = pressed;
+    broadcastInputEvent(event);
 }
 
 void Server::broadcastMouseEvent(int x, int y, int button, bool pressed)
 {
-    QByteArray packet = Protocol::createMouseEventPacket(x, y, button, pressed);
-    broadcast(packet);
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::MouseButton;
+    event.x = x;
+    event.y = y;
+    event.code = button;
+    event.pressed = pressed;
+    broadcastInputEvent(event);
 }
 
 void Server::broadcastMouseMove(int x, int y)
 {
-    QByteArray packet = Protocol::createMouseMovePacket(x, y);
-    broadcast(packet);
+    Protocol::InputEvent event;
+    event.kind = Protocol::InputEventKind::MouseMove;
+    event.x = x;
+    event.y = y;
+    broadcastInputEvent(event);
 }
 
 void Server::broadcastCommand(const QString& command, const QString& type)
 {
-    QByteArray packet = Protocol::createExecuteCommandPacket(command, type);
+    QByteArray packet = Protocol::encode(Protocol::ExecuteCommandMessage{command, type});
     broadcast(packet);
 }
 
-void Server::broadcastScreenFrame(const QImage& frame)
+void Server::broadcastScreenFrame(const QImage& frame, const QVector<QRect>& dirtyRects)
 {
-    static quint32 frameId = 0;
-    frameId++;
+    // Only what the clients that can take a frame need
+    FrameEncoder::Outputs outputs;
+    for (const ShardClients& clients : m_clients) {
+        clients.frameTargets.forEach([&](int slot) {
+            const ClientState& client = clients.table.at(slot);
+            if (!canAcceptFrame(client)) return;
+            bool synced = client.frameSynced && client.caps.has(Protocol::CapFrameTiles);
+            outputs |= synced ? FrameEncoder::Delta : FrameEncoder::Keyframe;
+        });
+    }
 
-    // Compress as JPEG for smaller size
-    QByteArray imageData;
-    QBuffer buffer(&imageData);
-    buffer.open(QIODevice::WriteOnly);
-    frame.save(&buffer, "JPEG", 70); // 70% quality
+    if (outputs) {
+        // Encoded on a worker thread, sent from onFrameEncoded()
+        qint64 captureUs = m_screenCapture ? m_screenCapture->lastCaptureUs() : 0;
+        m_encoder->encode(frame, ++m_frameId, QString(), captureUs, outputs, dirtyRects);
+    } else if (m_screenCapture) {
+        // Dropped: the changes in it would never reach anyone
+        m_screenCapture->requestFullFrame();
+    }
+    updateCaptureDemand();
+}
+
+void Server::broadcastCursorShape(const QImage& shape, const QPoint& hotspot)
+{
+    Protocol::CursorShapeMessage message;
+    QBuffer buffer(&message.image);
+    if (shape.isNull() || !buffer.open(QIODevice::WriteOnly) || !shape.save(&buffer, "PNG")) {
+        m_cursorShapeId = 0;
+        return;
+    }
     buffer.close();
 
-    QByteArray packet = Protocol::createScreenFramePacket(imageData, frame.width(), frame.height(), frameId);
-    broadcastToScreenShareClients(packet);
+    // Named by content: a shape seen before is already cached by the clients
+    message.hotspotX = static_cast<qint16>(hotspot.x());
+    message.hotspotY = static_cast<qint16>(hotspot.y());
+    quint64 hash = qHashBits(message.image.constData(), message.image.size(), qHash(hotspot));
+    message.shapeId = hash != 0 ? hash : 1;
+
+    m_cursorShapeId = message.shapeId;
+    storeCursorShape(message.shapeId, Protocol::encode(message));
+}
+
+void Server::broadcastCursorPosition(const QPoint& position, bool visible)
+{
+    Protocol::CursorPositionMessage message;
+    message.x = position.x();
+    message.y = position.y();
+    message.shapeId = m_cursorShapeId;
+    message.visible = visible;
+    m_cursorPosition = Protocol::encode(message);
+
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendCursor(i, m_clients[i].frameTargets);
+    }
+}
+
+void Server::storeCursorShape(quint64 shapeId, const QByteArray& packet)
+{
+    for (int i = 0; i < m_cursorShapes.size(); ++i) {
+        if (m_cursorShapes[i].first == shapeId) {
+            m_cursorShapes.remove(i);
+            break;
+        }
+    }
+    m_cursorShapes.append(qMakePair(shapeId, packet));
+    if (m_cursorShapes.size() > Protocol::CURSOR_SHAPE_CACHE_SIZE) {
+        m_cursorShapes.removeFirst();
+    }
+}
+
+void Server::sendCursor(int shard, const ClientSet& targets)
+{
+    const QByteArray* shape = nullptr;
+    for (const auto& cached : m_cursorShapes) {
+        if (cached.first == m_cursorShapeId) {
+            shape = &cached.second;
+        }
+    }
+
+    ShardClients& clients = m_clients[shard];
+    ClientSet cursorClients;
+    ClientSet shapeClients;
+    targets.forEach([&](int slot) {
+        ClientState& client = clients.table.at(slot);
+        if (!client.caps.has(Protocol::CapCursor)) return;
+
+        cursorClients.set(slot);
+        if (shape && !client.cursorShapes.contains(m_cursorShapeId)) {
+            // The client evicts its oldest shape just the same
+            client.cursorShapes.append(m_cursorShapeId);
+            if (client.cursorShapes.size() > Protocol::CURSOR_SHAPE_CACHE_SIZE) {
+                client.cursorShapes.removeFirst();
+            }
+            shapeClients.set(slot);
+        }
+    });
+
+    // Same channel as the position, so the shape arrives first
+    if (shape) {
+        sendToShard(shard, shapeClients, *shape);
+    }
+    sendToShard(shard, cursorClients, m_cursorPosition);
+}
+
+void Server::onFrameEncoded(const EncodedFrame& frame, const QString& clientId, const FrameTiming& timing)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (clientId.isEmpty()) {
+        if (m_screenSharing) {
+            broadcastToScreenShareClients(frame.keyframe, frame.delta, timing.frameId);
+        }
+    } else {
+        ClientHandle handle = handleFor(clientId);
+        ClientState* client = findClient(handle);
+        if (client && isAuthenticated(handle) && canSendFrame(*client, frame.keyframe)) {
+            client->framesInFlight.append(InFlightFrame{timing.frameId, m_frameClock.elapsed(), frame.keyframe.size()});
+            // Not part of the chain the deltas build on
+            client->frameSynced = false;
+            sendToClient(handle, frame.keyframe);
+        }
+    }
+
+    FrameTiming sent = timing;
+    sent.sendUs = timer.nsecsElapsed() / 1000;
+    emit frameSent(sent);
+
+    updateCaptureDemand();
 }
 
 void Server::sendCommandToClient(const QString& clientId, const QString& command, const QString& type)
 {
-    QByteArray packet = Protocol::createExecuteCommandPacket(command, type);
-    sendToClient(clientId, packet);
+    QByteArray packet = Protocol::encode(Protocol::ExecuteCommandMessage{command, type});
+    sendToClient(handleFor(clientId), packet);
 }
 
-void Server::sendScreenFrameToClient(const QString& clientId, const QImage& frame)
+void Server::sendCommand(const QString& target, const QString& command, const QString& type)
 {
-    static quint32 frameId = 0;
-    frameId++;
+    ClientTarget parsed = parseTarget(target);
+    QByteArray packet = Protocol::encode(Protocol::ExecuteCommandMessage{command, type});
+    if (parsed.all) {
+        broadcast(packet);
+        return;
+    }
 
-    QByteArray imageData;
-    QBuffer buffer(&imageData);
-    buffer.open(QIODevice::WriteOnly);
-    frame.save(&buffer, "JPEG", 70);
-    buffer.close();
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendToShard(i, recipients(parsed, i), packet);
+    }
+}
 
-    QByteArray packet = Protocol::createScreenFramePacket(imageData, frame.width(), frame.height(), frameId);
-    sendToClient(clientId, packet);
+void Server::relayScreenFrame(const QByteArray& packet, quint32 frameId)
+{
+    // Encoded upstream; the shards queue the very same buffer
+    Protocol::PacketHeader header;
+    if (!Protocol::parsePacketHeader(packet, header)) return;
+
+    bool keyframe = header.type == Protocol::MessageType::ScreenFrame;
+    if (!broadcastToScreenShareClients(keyframe ? packet : QByteArray(), keyframe ? QByteArray() : packet, frameId)) {
+        emit keyframeNeeded();
+    }
+    updateCaptureDemand();
 }
 
-void Server::disconnectClient(const QString& clientId)
+void Server::relayInputBatch(const QByteArray& packet)
+{
+    // Events batched here go out first
+    flushInputBatch();
+
+    QVector<Protocol::InputEvent> events;
+    bool parsed = false;
+    for (int i = 0; i < m_clients.size(); ++i) {
+        ShardClients& clients = m_clients[i];
+
+        ClientSet batched;
+        ClientSet single;
+        clients.inputTargets.forEach([&](int slot) {
+            if (clients.table.at(slot).caps.has(Protocol::CapInputBatch)) {
+                batched.set(slot);
+            } else {
+                single.set(slot);
+            }
+        });
+
+        sendToShard(i, batched, packet);
+        if (single.isEmpty()) continue;
+
+        // Older clients need the events one by one; unpacked once
+        if (!parsed) {
+            parsed = true;
+            Protocol::PacketView view;
+            if (Protocol::nextPacket(packet.constData(), packet.size(), view) == Protocol::FrameStatus::Complete) {
+                Protocol::parseInputBatchPacket(view, events);
+            }
+        }
+        if (events.isEmpty()) continue;
+
+        ServerShard* shard = m_shards[i];
+        QMetaObject::invokeMethod(shard, [shard, single, events]() {
+            for (const Protocol::InputEvent& event : events) {
+                shard->sendInputEvent(single, event);
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+void Server::relayInputEvent(const Protocol::InputEvent& event)
+{
+    broadcastInputEvent(event);
+}
+
+void Server::relayCursor(const QByteArray& packet)
 {
-    if (m_clients.contains(clientId)) {
-        ClientConnection& client = m_clients[clientId];
-        if (client.socket) {
-            QByteArray packet = Protocol::createDisconnectPacket();
-            client.socket->write(packet);
-            client.socket->flush();
-            client.socket->disconnectFromHost();
+    Protocol::PacketView view;
+    if (Protocol::nextPacket(packet.constData(), packet.size(), view) != Protocol::FrameStatus::Complete) return;
+
+    // Shape ids are the source's; upstream sent each one here only once
+    if (view.header.type == Protocol::MessageType::CursorShape) {
+        Protocol::CursorShapeMessage message;
+        if (Protocol::decode(view, message)) {
+            storeCursorShape(message.shapeId, packet);
         }
+        return;
+    }
+
+    Protocol::CursorPositionMessage message;
+    if (view.header.type != Protocol::MessageType::CursorPosition || !Protocol::decode(view, message)) return;
+
+    m_cursorShapeId = message.shapeId;
+    m_cursorPosition = packet;
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendCursor(i, m_clients[i].frameTargets);
     }
 }
 
+void Server::relayScreenShareParams(const QByteArray& packet)
+{
+    // Upstream's stream, which this server only passes on
+    m_streamParams = packet;
+    for (int i = 0; i < m_clients.size(); ++i) {
+        sendStreamParams(i, m_clients[i].frameTargets);
+    }
+}
+
+void Server::sendScreenFrameToClient(const QString& clientId, const QImage& frame)
+{
+    if (!isAuthenticated(handleFor(clientId))) return;
+
+    // Sent even with a full window, but still counted against it
+    m_encoder->encode(frame, ++m_frameId, clientId);
+}
+
+void Server::disconnectClient(const QString& clientId)
+{
+    ClientHandle handle = handleFor(clientId);
+    if (!findClient(handle)) return;
+
+    ServerShard* shard = m_shards[ClientHandles::shard(handle)];
+    QMetaObject::invokeMethod(shard, [shard, handle]() {
+        shard->disconnectClient(handle);
+    }, Qt::QueuedConnection);
+}
+
+Protocol::PeerCapabilities Server::clientCapabilities(const QString& clientId) const
+{
+    const ClientState* client = findClient(handleFor(clientId));
+    return client ? client->caps : Protocol::PeerCapabilities();
+}
+
 QString Server::generateClientId()
 {
     return QUuid::createUuid().toString(QUuid::WithoutBraces).left(8);
@@ -2,23 +2,68 @@
 #define SERVER_H
 
 #include <QObject>
-#include <QTcpServer>
-#include <QSslSocket>
-#include <QMap>
+#include <QHash>
 #include <QTimer>
 #include <QImage>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "protocol.h"
+#include "channels.h"
+#include "clienttable.h"
+#include "clientgroups.h"
+#include "frameencoder.h"
+#include "streamcontroller.h"
+
+class InputDatagramServer;
+class ConnectionListener;
+class ServerShard;
+class QThread;
 
 class ScreenCapture;
 
-struct ClientConnection {
-    QString id;
+// A screen frame sent to a client and not yet acknowledged
+struct InFlightFrame {
+    quint32 id;
+    qint64 sentMs;
+    qsizetype bytes;
+};
+
+// What the main thread knows about a client; the connection itself lives
+// on the I/O thread of its shard
+struct ClientState {
+    QString id;      // for display; everything else uses the handle
     QString name;
     QString address;
-    QSslSocket* socket;
-    bool authenticated;
-    bool sslEstablished;
-    bool wantsScreenShare;
-    QByteArray buffer;
+    Protocol::PeerCapabilities caps;
+    QVector<InFlightFrame> framesInFlight; // oldest first
+    // Has the last frame of the chain, so the next delta applies. Lost on
+    // any frame it misses.
+    bool frameSynced = false;
+    // Cursor shapes the client has cached, oldest first (CapCursor)
+    QVector<quint64> cursorShapes;
+    qint64 roundTripUs = -1; // smoothed, -1 until measured
+    // Frame delivery, for the stream controller. The counters cover the
+    // current stream tick.
+    qint64 frameLatencyMs = -1; // send to ack, smoothed; -1 until measured
+    qint64 lastAckMs = 0;
+    qint64 ackedBytes = 0;
+    int ackedFrames = 0;
+    qint64 busyMs = 0;          // with acknowledged frames in flight
+    bool backlogged = false;    // a full window held frames back
+};
+
+// The clients of one I/O shard. Per-client flags are bitsets over the
+// table's slots, so fan-out loops scan a few contiguous words.
+struct ShardClients {
+    ClientTable<ClientState> table;
+    ClientSet authenticated;
+    ClientSet screenShare;   // asked for frames and can decode them
+    ClientSet inputBatched;  // have events in the pending InputBatch
+    // Routes: the authenticated clients in the input target, and the
+    // screenShare clients in the screen share target
+    ClientSet inputTargets;
+    ClientSet frameTargets;
 };
 
 class Server : public QObject
@@ -26,14 +71,20 @@ class Server : public QObject
     Q_OBJECT
 
 public:
+    static constexpr int DEFAULT_FRAME_WINDOW = 2;
+    // An unacknowledged frame stops counting against the window after this
+    static constexpr int FRAME_ACK_TIMEOUT_MS = 2000;
+    // How often the adaptive stream is adjusted
+    static constexpr int STREAM_INTERVAL_MS = 1000;
+
     explicit Server(QObject* parent = nullptr);
     ~Server();
 
     bool isRunning() const { return m_running; }
     bool isListening() const { return m_running; }
     bool isScreenSharing() const { return m_screenSharing; }
-    int clientCount() const { return m_clients.size(); }
-    QStringList clientIds() const { return m_clients.keys(); }
+    int clientCount() const { return m_clientIds.size(); }
+    QStringList clientIds() const { return m_clientIds.keys(); }
 
 public slots:
     void start(int port, const QString& password);
@@ -45,15 +96,119 @@ public slots:
     void broadcastMouseEvent(int x, int y, int button, bool pressed);
     void broadcastMouseMove(int x, int y);
     void broadcastCommand(const QString& command, const QString& type);
-    void broadcastScreenFrame(const QImage& frame);
+    // dirtyRects is where frame differs from the one before, empty meaning
+    // anywhere; only used to narrow the tile comparison
+    void broadcastScreenFrame(const QImage& frame, const QVector<QRect>& dirtyRects = QVector<QRect>());
+    // The pointer of the shared screen, to viewers that draw it themselves.
+    // A shape takes effect with the next position; null is the default one.
+    void broadcastCursorShape(const QImage& shape, const QPoint& hotspot);
+    void broadcastCursorPosition(const QPoint& position, bool visible);
 
     void sendCommandToClient(const QString& clientId, const QString& command, const QString& type);
+    void sendCommand(const QString& target, const QString& command, const QString& type);
+
+    // Relaying: traffic from an upstream server, passed on without decoding.
+    // Frames keep their upstream ids and count against each client's window
+    // like local ones; batches go unchanged to clients that take batches.
+    // A relay can't make keyframes: clients that need one wait for the next
+    // from upstream, asked for through keyframeNeeded().
+    void relayScreenFrame(const QByteArray& packet, quint32 frameId);
+    void relayInputBatch(const QByteArray& packet);
+    void relayInputEvent(const Protocol::InputEvent& event);
+    // CursorShape and CursorPosition packets; shapes are cached here and
+    // sent on to each client once, as the server above does
+    void relayCursor(const QByteArray& packet);
+    void relayScreenShareParams(const QByteArray& packet);
     void sendScreenFrameToClient(const QString& clientId, const QImage& frame);
+
+    // Large clipboard data is streamed to clients that support it; others
+    // get it whole if it fits their message size limit
+    void sendClipboardToClient(const QString& clientId, const QString& mimeType, const QByteArray& data);
+    void broadcastClipboard(const QString& mimeType, const QByteArray& data);
     void disconnectClient(const QString& clientId);
 
     bool useSsl() const { return m_useSsl; }
     void setUseSsl(bool use) { m_useSsl = use; }
 
+    // Features offered to connecting clients; each connection uses the
+    // intersection with what the client advertises
+    quint32 localCapabilities() const { return m_localCapabilities; }
+    void setLocalCapabilities(quint32 caps) { m_localCapabilities = caps; }
+    Protocol::PeerCapabilities clientCapabilities(const QString& clientId) const;
+
+    // Largest message an authenticated client may send; connections that
+    // exceed it, or PRE_AUTH_MAX_MESSAGE_SIZE before authenticating, are closed
+    quint32 maxMessageSize() const { return m_maxMessageSize; }
+    void setMaxMessageSize(quint32 bytes) { m_maxMessageSize = bytes; }
+
+    // Buffers currently held for a client
+    ConnectionMemory clientMemoryUsage(const QString& clientId) const;
+
+    // Queue depth and drop counts of one of a client's channels
+    ChannelScheduler::ChannelStats clientChannelStats(const QString& clientId, Protocol::Channel channel) const;
+
+    // Bytes of frames that may wait for each client; past that, waiting
+    // frames are replaced by the newest one
+    qsizetype frameQueueBudget() const { return m_frameQueueBudget; }
+    void setFrameQueueBudget(qsizetype bytes);
+
+    // Frames a client may have unacknowledged. Clients with a full window
+    // get no new frames, and capture pauses while no client can take one.
+    int frameWindow() const { return m_frameWindow; }
+    void setFrameWindow(int frames);
+    int framesInFlight(const QString& clientId) const;
+
+    // Frame rate, quality and scale of the screen share. Start at the
+    // configured ones; when adaptive, lowered while the slowest viewer gets
+    // frames later than the latency budget allows (StreamController).
+    StreamSettings streamSettings() const { return m_stream.settings(); }
+    bool adaptiveStream() const { return m_adaptiveStream; }
+
+    // Clients currently asking for screen frames
+    int viewerCount() const { return m_viewerCount; }
+
+    // Smoothed round trip to a client, -1 until measured
+    qint64 clientRoundTripUs(const QString& clientId) const;
+
+    // When relaying: hops between the source and this server and the
+    // one-way latency over them, passed on to clients in latency probes
+    void setUpstreamLatency(int hops, qint64 pathLatencyUs);
+
+    // JPEG encoding runs on this many worker threads
+    int encoderThreads() const;
+    void setEncoderThreads(int threads);
+
+    // Client sockets are spread over this many I/O threads, each running
+    // its own event loop; 0 picks a count from the number of cores. Takes
+    // effect on the next start().
+    int ioThreads() const { return m_ioThreads; }
+    void setIoThreads(int threads) { m_ioThreads = qMax(0, threads); }
+
+    // How the I/O threads talk to sockets: "qt" (QSslSocket) or
+    // "io_uring", which needs a build with KEYCAST_IO_URING and falls back
+    // to "qt" where the kernel lacks it. Takes effect on the next start().
+    QString backend() const { return m_backend; }
+    void setBackend(const QString& backend) { m_backend = backend; }
+
+    // Targets are "all", or a comma-separated list of client ids and @group
+    // names. They are resolved once: client ids name current connections,
+    // while groups follow their members as they connect and disconnect.
+    QString inputTarget() const { return m_inputTargetSpec; }
+    void setInputTarget(const QString& target);
+    QString screenShareTarget() const { return m_frameTargetSpec; }
+    void setScreenShareTarget(const QString& target);
+
+    // Groups are named by client tags, which are kept by client name
+    QStringList groups() const { return m_groups.groups(); }
+    QStringList clientTags(const QString& clientName) const { return m_groups.tags(clientName); }
+    void setClientTags(const QString& clientName, const QStringList& tags);
+
+    // Input batching for clients that negotiated it: -1 disables batching,
+    // 0 flushes once per event-loop turn, > 0 flushes at most this many
+    // milliseconds after the first queued event
+    int inputBatchInterval() const { return m_inputBatchInterval; }
+    void setInputBatchInterval(int msecs);
+
 signals:
     void started();
     void stopped();
@@ -61,35 +216,116 @@ signals:
     void clientDisconnected(const QString& clientId);
     void clientAuthenticated(const QString& clientId, const QString& clientName);
     void commandOutputReceived(const QString& clientId, const QString& output);
+    // Per-stage timing of every frame handed to clients
+    void frameSent(const FrameTiming& timing);
+    void viewerCountChanged(int viewers);
+    // Relaying: a client got a delta it can't apply or missed a frame
+    void keyframeNeeded();
+    void clientLatencyChanged(const QString& clientId, qint64 roundTripUs);
     void error(const QString& message);
 
 private slots:
-    void onNewConnection();
-    void onClientReadyRead();
-    void onClientDisconnected();
-    void onClientError(QAbstractSocket::SocketError socketError);
-    void onSslErrors(const QList<QSslError>& errors);
-    void onClientEncrypted();
-    void onPingTimer();
+    void onConnectionAccepted(qintptr socketDescriptor);
+    void onClientConnected(ClientHandle handle, const QString& address);
+    void onClientAuthenticated(ClientHandle handle, const QString& clientName,
+                               const Protocol::PeerCapabilities& caps);
+    void onClientDisconnected(ClientHandle handle);
+    void onCommandOutputReceived(ClientHandle handle, const QString& output);
+    void onScreenShareRequested(ClientHandle handle, bool start);
+    void onFrameAcknowledged(ClientHandle handle, quint32 frameId);
+    void onLatencyMeasured(ClientHandle handle, qint64 roundTripUs);
+    void flushInputBatch();
+    void updateCaptureDemand();
+    void onFrameEncoded(const EncodedFrame& frame, const QString& clientId, const FrameTiming& timing);
+    void adaptStream();
 
 private:
-    void processClientData(ClientConnection& client);
-    void handlePacket(ClientConnection& client, const QByteArray& packet);
+    void startShards();
+    void stopShards();
+    // SO_REUSEPORT listeners on every shard; false if the port is already
+    // in use or any could not bind
+    bool listenOnShards();
+    ClientHandle handleFor(const QString& clientId) const { return m_clientIds.value(clientId); }
+    ClientState* findClient(ClientHandle handle);
+    const ClientState* findClient(ClientHandle handle) const;
+    bool isAuthenticated(ClientHandle handle) const;
+    void broadcastInputEvent(const Protocol::InputEvent& event);
+    void queueInputEvent(const Protocol::InputEvent& event);
     void broadcast(const QByteArray& data);
-    void broadcastToScreenShareClients(const QByteArray& data);
-    void sendToClient(const QString& clientId, const QByteArray& data);
+    // Clients that have the frame before get the delta, others the
+    // keyframe. Returns false if a client ready for a frame got neither.
+    bool broadcastToScreenShareClients(const QByteArray& keyframe, const QByteArray& delta, quint32 frameId);
+    void sendToClient(ClientHandle handle, const QByteArray& data);
+    void storeCursorShape(quint64 shapeId, const QByteArray& packet);
+    // The current position to those of clients that take cursor updates,
+    // preceded by its shape where they don't have it yet
+    void sendCursor(int shard, const ClientSet& clients);
+    void applyStreamSettings(const StreamSettings& settings);
+    // The current ScreenShareParams to those of clients that take them
+    void sendStreamParams(int shard, const ClientSet& clients);
+    // Queue data on one I/O thread for clients of that shard
+    void sendToShard(int shard, const ClientSet& clients, const QByteArray& data);
+    ClientTarget parseTarget(const QString& target);
+    // Authenticated clients of one shard named by a target
+    ClientSet recipients(const ClientTarget& target, int shard) const;
+    // Recomputes the input and frame routes after membership changes
+    void updateRoutes();
+    void updateViewerCount();
+    bool canSendFrame(const ClientState& client, const QByteArray& packet) const;
+    bool canAcceptFrame(const ClientState& client) const;
+    // A thread is free, or would be by the time a new frame is captured
+    bool canEncodeFrame() const;
+    void expireFrames(ClientState& client);
+    // Expires lost frames and arms the timer that reopens windows they hold
+    // shut; true if some client can take a frame
+    bool updateFrameWindows();
     QString generateClientId();
-    void setupSslSocket(QSslSocket* socket);
 
-    QTcpServer* m_server;
-    QTimer* m_pingTimer;
+    ConnectionListener* m_server;
+    QTimer* m_inputFlushTimer;
+    QTimer* m_frameWindowTimer;
+    QTimer* m_streamTimer;
+    InputDatagramServer* m_datagramInput;
     ScreenCapture* m_screenCapture = nullptr;
-    QMap<QString, ClientConnection> m_clients;
-    QMap<QSslSocket*, QString> m_socketToId;
+    FrameEncoder* m_encoder;
+    QVector<QThread*> m_threads;
+    QVector<ServerShard*> m_shards; // m_shards[i] runs on m_threads[i]
+    QVector<ShardClients> m_clients; // m_clients[i] are served by m_shards[i]
+    QHash<QString, ClientHandle> m_clientIds; // display ids, for the public API
+    ClientGroups m_groups;
+    ClientTarget m_inputTarget;
+    ClientTarget m_frameTarget;
+    QString m_inputTargetSpec = "all";
+    QString m_frameTargetSpec = "all";
 
     bool m_running = false;
     bool m_useSsl = true;
     bool m_screenSharing = false;
+    quint32 m_localCapabilities = Protocol::SUPPORTED_CAPABILITIES;
+    quint32 m_maxMessageSize = Protocol::DEFAULT_MAX_MESSAGE_SIZE;
+    qsizetype m_frameQueueBudget = ChannelScheduler::DEFAULT_FRAME_QUEUE_LIMIT;
+    int m_inputBatchInterval = 0;
+    QElapsedTimer m_inputClock;
+    qint64 m_lastInputUs = 0;
+    QVector<Protocol::InputEvent> m_pendingInput;
+    quint32 m_frameId = 0;
+    // Pointer as last captured or relayed, for viewers that join later
+    QVector<QPair<quint64, QByteArray>> m_cursorShapes; // CursorShape packets, oldest first
+    quint64 m_cursorShapeId = 0;  // shape of m_cursorPosition
+    QByteArray m_cursorPosition;  // CursorPosition packet, empty until known
+    int m_frameWindow = DEFAULT_FRAME_WINDOW;
+    StreamController m_stream;
+    bool m_adaptiveStream = true;
+    QByteArray m_streamParams; // ScreenShareParams packet, empty while not sharing
+    quint64 m_lastCaptureTicks = 0;
+    quint64 m_lastCapturedFrames = 0;
+    int m_ioThreads = 0;
+    QString m_backend = "qt";
+    int m_viewerCount = 0;
+    int m_nextShard = 0; // for connections from m_server
+    quint8 m_upstreamHops = 0;
+    quint32 m_upstreamPathUs = 0;
+    QElapsedTimer m_frameClock;
     QString m_password;
     int m_port = 45679;
 };
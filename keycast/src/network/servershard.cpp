@@ -0,0 +1,719 @@
+#include "servershard.h"
+
+#include <QBuffer>
+#include <QSharedPointer>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+ServerShard::ServerShard(QObject* parent)
+    : QObject(parent)
+    , m_pingTimer(new QTimer(this))
+    , m_probeTimer(new QTimer(this))
+{
+    m_clock.start();
+    connect(m_pingTimer, &QTimer::timeout, this, &ServerShard::onPingTimer);
+    connect(m_probeTimer, &QTimer::timeout, this, &ServerShard::onProbeTimer);
+}
+
+ServerShard::~ServerShard()
+{
+    shutdown();
+}
+
+void ServerShard::setConfig(const ShardConfig& config)
+{
+    m_config = config;
+    setFrameQueueBudget(config.frameQueueBudget);
+
+    if (!m_pingTimer->isActive()) {
+        m_pingTimer->start(PING_INTERVAL_MS);
+        m_probeTimer->start(Protocol::LATENCY_PROBE_INTERVAL_MS);
+    }
+}
+
+void ServerShard::setFrameQueueBudget(qsizetype bytes)
+{
+    m_config.frameQueueBudget = bytes;
+    m_clients.forEach([bytes](ClientHandle, ClientConnection& client) {
+        client.scheduler.setChannelLimit(Protocol::Channel::Frames, bytes);
+    });
+}
+
+void ServerShard::setUpstreamLatency(quint8 hops, quint32 pathLatencyUs)
+{
+    // Goes out with the next probes
+    m_config.hops = hops;
+    m_config.pathLatencyUs = pathLatencyUs;
+}
+
+#ifdef Q_OS_LINUX
+// Dual-stack where IPv6 is available, like QHostAddress::Any
+int ServerShard::openSharedListenSocket(quint16 port)
+{
+    int one = 1;
+    int zero = 0;
+
+    int fd = ::socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        sockaddr_in6 addr = {};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(port);
+        addr.sin6_addr = in6addr_any;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0 &&
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0 &&
+            ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            ::listen(fd, SOMAXCONN) == 0) {
+            return fd;
+        }
+        ::close(fd);
+    }
+
+    fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0 &&
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0 &&
+        ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        ::listen(fd, SOMAXCONN) == 0) {
+        return fd;
+    }
+    ::close(fd);
+    return -1;
+}
+
+bool ServerShard::isPortInUse(quint16 port)
+{
+    if (port == 0) return false;
+
+    // A bind without SO_REUSEPORT fails on any listening socket, shared or
+    // not; SO_REUSEADDR lets it past our own connections in TIME_WAIT
+    int one = 1;
+    int zero = 0;
+    bool inUse = false;
+
+    int fd = ::socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        sockaddr_in6 addr = {};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_port = htons(port);
+        addr.sin6_addr = in6addr_any;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        inUse = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 && errno == EADDRINUSE;
+        ::close(fd);
+        return inUse;
+    }
+
+    fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    inUse = ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 && errno == EADDRINUSE;
+    ::close(fd);
+    return inUse;
+}
+#endif
+
+bool ServerShard::listen(quint16 port)
+{
+#ifdef Q_OS_LINUX
+    closeListener();
+
+    int fd = openSharedListenSocket(port);
+    if (fd < 0) return false;
+
+    m_listener = new ConnectionListener(this);
+    if (!m_listener->setSocketDescriptor(fd)) {
+        ::close(fd);
+        delete m_listener;
+        m_listener = nullptr;
+        return false;
+    }
+    connect(m_listener, &ConnectionListener::connectionAccepted, this, &ServerShard::addConnection);
+    return true;
+#else
+    // Other systems either lack SO_REUSEPORT or don't balance across it
+    Q_UNUSED(port)
+    return false;
+#endif
+}
+
+void ServerShard::closeListener()
+{
+    if (m_listener) {
+        m_listener->close();
+        delete m_listener;
+        m_listener = nullptr;
+    }
+}
+
+void ServerShard::refuseConnection(qintptr socketDescriptor)
+{
+    QTcpSocket refused;
+    refused.setSocketDescriptor(socketDescriptor);
+    refused.abort();
+}
+
+void ServerShard::setAccepting(bool accepting)
+{
+    if (!m_listener) return;
+
+    if (accepting) {
+        m_listener->resumeAccepting();
+    } else {
+        m_listener->pauseAccepting();
+    }
+}
+
+void ServerShard::addConnection(qintptr socketDescriptor)
+{
+    // Behind any that wait, even while their turn is still being queued
+    if (m_waiting.isEmpty() &&
+        (m_config.maxHandshakes <= 0 || m_handshaking.count() < m_config.maxHandshakes)) {
+        startConnection(socketDescriptor);
+        return;
+    }
+
+    if (m_waiting.size() < MAX_WAITING_CONNECTIONS) {
+        m_waiting.enqueue(socketDescriptor);
+        if (m_waiting.size() == MAX_WAITING_CONNECTIONS) {
+            // The kernel's backlog holds the rest until the queue drains
+            setAccepting(false);
+        }
+        return;
+    }
+
+    // Handed over by Server's listener with the queue full: the client
+    // sees the connection close and retries later
+    refuseConnection(socketDescriptor);
+}
+
+void ServerShard::startConnection(qintptr socketDescriptor)
+{
+    ClientHandle handle = m_clients.allocate(m_config.index);
+    if (!handle) {
+        // Every slot taken
+        refuseConnection(socketDescriptor);
+        return;
+    }
+
+    QString address;
+    QIODevice* socket = createSocket(handle, socketDescriptor, address);
+    if (!socket) {
+        // The connection died while waiting
+        m_clients.remove(handle);
+        return;
+    }
+
+    ClientConnection& client = *m_clients.find(handle);
+    client.handle = handle;
+    client.address = address;
+    client.socket = socket;
+    client.scheduler.setDevice(socket);
+    client.scheduler.setChannelLimit(Protocol::Channel::Frames, m_config.frameQueueBudget);
+
+    // Slow or silent peers must not hold a handshake slot for long
+    m_handshaking.set(ClientHandles::slot(handle));
+    QTimer::singleShot(HANDSHAKE_TIMEOUT_MS, this, [this, handle]() {
+        ClientConnection* pending = m_clients.find(handle);
+        if (pending && !pending->authenticated) {
+            abortSocket(pending->socket);
+        }
+    });
+
+    if (m_config.useSsl) {
+        startServerEncryption(client);
+    } else {
+        // No SSL, mark as established
+        client.sslEstablished = true;
+        emit clientConnected(handle, client.address);
+    }
+}
+
+QIODevice* ServerShard::createSocket(ClientHandle handle, qintptr socketDescriptor, QString& address)
+{
+    QSslSocket* socket = new QSslSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor)) {
+        delete socket;
+        return nullptr;
+    }
+    address = socket->peerAddress().toString();
+
+    // The handle travels with each signal; no lookup by socket needed
+    connect(socket, &QSslSocket::readyRead, this, [this, handle]() { onReadyRead(handle); });
+    connect(socket, &QSslSocket::bytesWritten, this, [this, handle]() { onBytesWritten(handle); });
+    connect(socket, &QSslSocket::disconnected, this, [this, handle]() { onDisconnected(handle); });
+    connect(socket, &QSslSocket::encrypted, this, [this, handle]() { onEncrypted(handle); });
+    connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QAbstractSocket::errorOccurred),
+            socket, [socket]() { socket->disconnectFromHost(); });
+    connect(socket, QOverload<const QList<QSslError>&>::of(&QSslSocket::sslErrors),
+            this, &ServerShard::onSslErrors);
+    return socket;
+}
+
+void ServerShard::startServerEncryption(ClientConnection& client)
+{
+    QSslSocket* socket = static_cast<QSslSocket*>(client.socket);
+    socket->setSslConfiguration(m_config.sslConfiguration);
+    socket->startServerEncryption();
+}
+
+void ServerShard::closeSocket(QIODevice* socket)
+{
+    QSslSocket* sslSocket = static_cast<QSslSocket*>(socket);
+    sslSocket->flush();
+    sslSocket->disconnectFromHost();
+}
+
+void ServerShard::abortSocket(QIODevice* socket)
+{
+    static_cast<QSslSocket*>(socket)->abort();
+}
+
+void ServerShard::finishHandshake(ClientHandle handle)
+{
+    int slot = ClientHandles::slot(handle);
+    if (!m_handshaking.test(slot)) return;
+    m_handshaking.reset(slot);
+
+    // Not from here: a new connection may grow the client table, and the
+    // callers (Auth handling, disconnects) still hold references into it
+    if (!m_waiting.isEmpty() && !m_admitQueued) {
+        m_admitQueued = true;
+        QMetaObject::invokeMethod(this, [this]() { admitWaiting(); }, Qt::QueuedConnection);
+    }
+}
+
+void ServerShard::admitWaiting()
+{
+    m_admitQueued = false;
+    while (!m_waiting.isEmpty() &&
+           (m_config.maxHandshakes <= 0 || m_handshaking.count() < m_config.maxHandshakes)) {
+        startConnection(m_waiting.dequeue());
+    }
+
+    if (m_waiting.size() < MAX_WAITING_CONNECTIONS / 2) {
+        setAccepting(true);
+    }
+}
+
+void ServerShard::disconnectClient(ClientHandle handle)
+{
+    ClientConnection* client = m_clients.find(handle);
+    if (!client || !client->socket) return;
+
+    // Straight to the socket, queued data is abandoned anyway
+    client->socket->write(Protocol::encode(Protocol::DisconnectMessage()));
+    closeSocket(client->socket);
+}
+
+void ServerShard::shutdown()
+{
+    m_pingTimer->stop();
+    m_probeTimer->stop();
+    closeListener();
+
+    while (!m_waiting.isEmpty()) {
+        refuseConnection(m_waiting.dequeue());
+    }
+
+    QByteArray disconnectPacket = Protocol::encode(Protocol::DisconnectMessage());
+    m_clients.forEach([this, &disconnectPacket](ClientHandle, ClientConnection& client) {
+        if (!client.socket) return;
+
+        // Server is going away; it doesn't want to hear about these
+        client.socket->disconnect(this);
+        if (client.socket->isOpen()) {
+            client.socket->write(disconnectPacket);
+            closeSocket(client.socket);
+        }
+        client.socket->deleteLater();
+    });
+    m_clients.clear();
+    releaseClientCount(m_authenticated.count());
+    m_authenticated.clear();
+    m_handshaking.clear();
+}
+
+bool ServerShard::isWritable(const ClientConnection& client) const
+{
+    return client.authenticated && client.socket && client.socket->isOpen();
+}
+
+bool ServerShard::admitClient()
+{
+    if (!m_config.clientCount) {
+        return m_config.maxClients <= 0 || m_authenticated.count() < m_config.maxClients;
+    }
+
+    // Take a place first, so shards admitting at once can't overshoot
+    int before = m_config.clientCount->fetchAndAddRelaxed(1);
+    if (m_config.maxClients <= 0 || before < m_config.maxClients) return true;
+    m_config.clientCount->fetchAndAddRelaxed(-1);
+    return false;
+}
+
+void ServerShard::releaseClientCount(int clients)
+{
+    if (m_config.clientCount && clients > 0) {
+        m_config.clientCount->fetchAndAddRelaxed(-clients);
+    }
+}
+
+void ServerShard::onSslErrors(const QList<QSslError>& errors)
+{
+    Q_UNUSED(errors)
+    QSslSocket* socket = qobject_cast<QSslSocket*>(sender());
+    if (!socket) return;
+
+    // Ignore self-signed certificate errors for now
+    socket->ignoreSslErrors();
+}
+
+void ServerShard::onEncrypted(ClientHandle handle)
+{
+    ClientConnection* client = m_clients.find(handle);
+    if (!client) return;
+
+    client->sslEstablished = true;
+    emit clientConnected(handle, client->address);
+}
+
+void ServerShard::onReadyRead(ClientHandle handle)
+{
+    ClientConnection* client = m_clients.find(handle);
+    if (!client) return;
+
+    client->buffer.readFrom(client->socket);
+    processClientData(*client);
+}
+
+void ServerShard::onBytesWritten(ClientHandle handle)
+{
+    ClientConnection* client = m_clients.find(handle);
+    if (!client) return;
+
+    // Socket buffer drained below the high-water mark, send what is queued
+    // and read the next chunks of any streams
+    client->scheduler.flush();
+    client->streams.pump(client->scheduler);
+}
+
+void ServerShard::onDisconnected(ClientHandle handle)
+{
+    ClientConnection* client = m_clients.find(handle);
+    if (!client) return;
+
+    client->socket->deleteLater();
+    if (m_authenticated.test(ClientHandles::slot(handle))) {
+        releaseClientCount(1);
+    }
+    m_authenticated.reset(ClientHandles::slot(handle));
+    m_clients.retire(handle);
+    finishHandshake(handle);
+    emit clientDisconnected(handle);
+}
+
+void ServerShard::releaseClient(ClientHandle handle)
+{
+    m_clients.release(handle);
+}
+
+void ServerShard::onPingTimer()
+{
+    sendToAll(Protocol::encode(Protocol::PingMessage()));
+}
+
+void ServerShard::onProbeTimer()
+{
+    Protocol::LatencyProbeMessage probe;
+    probe.sentUs = static_cast<quint64>(m_clock.nsecsElapsed() / 1000);
+    probe.hops = m_config.hops;
+    probe.pathLatencyUs = m_config.pathLatencyUs;
+    QByteArray packet = Protocol::encode(probe);
+
+    m_authenticated.forEach([this, &packet](int slot) {
+        ClientConnection& client = m_clients.at(slot);
+        if (isWritable(client) && client.caps.has(Protocol::CapLatencyProbe)) {
+            client.scheduler.send(packet);
+        }
+    });
+}
+
+void ServerShard::processClientData(ClientConnection& client)
+{
+    Protocol::PacketView packet;
+    for (;;) {
+        Protocol::FrameStatus status = Protocol::nextPacket(client.buffer.data(), client.buffer.size(), packet,
+                                                            client.maxMessageSize);
+
+        if (status == Protocol::FrameStatus::Invalid) {
+            // Garbage or an oversized message; there is no resynchronizing
+            // the stream. May remove the client, so return right away.
+            client.buffer.clear();
+            closeSocket(client.socket);
+            return;
+        }
+
+        if (status == Protocol::FrameStatus::Incomplete) {
+            // Make room for the whole packet so the rest arrives contiguously
+            if (client.buffer.size() >= Protocol::PACKET_HEADER_SIZE) {
+                qsizetype totalSize = Protocol::PACKET_HEADER_SIZE + static_cast<qsizetype>(packet.header.payloadSize);
+                client.buffer.reserve(totalSize - client.buffer.size());
+            }
+            return;
+        }
+
+        ClientHandle handle = client.handle;
+        handlePacket(client, packet);
+
+        // A handler may have closed the connection and freed its slot
+        if (!m_clients.contains(handle)) return;
+        client.buffer.consume(Protocol::PACKET_HEADER_SIZE + packet.payloadSize);
+    }
+}
+
+void ServerShard::handlePacket(ClientConnection& client, const Protocol::PacketView& packet)
+{
+    Protocol::Dispatcher<ServerShard, HandledMessages, ClientConnection>::dispatch(*this, packet, client);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::AuthMessage& message)
+{
+    bool accepted = m_config.password.isEmpty() || message.password == m_config.password;
+    // Counted once, however often a client sends Auth
+    if (accepted && !client.authenticated && !admitClient()) {
+        // Come back later; the client spreads its retries around the hint
+        QByteArray response = Protocol::createAuthResponsePacket(
+            Protocol::AuthResult::ServerFull, m_config.serverName, Protocol::PeerCapabilities(),
+            SERVER_FULL_RETRY_MS);
+        client.scheduler.send(response);
+        closeSocket(client.socket);
+        return;
+    }
+
+    if (accepted) {
+        client.authenticated = true;
+        m_authenticated.set(ClientHandles::slot(client.handle));
+
+        // Use only what both ends support; remember the client's
+        // receive limit for everything we send it
+        client.caps.flags = message.caps.flags & m_config.localCapabilities;
+        client.caps.maxMessageSize = message.caps.maxMessageSize;
+        client.maxMessageSize = m_config.maxMessageSize;
+        client.fragments.setMaxMessageSize(m_config.maxMessageSize);
+
+        Protocol::PeerCapabilities offered;
+        offered.flags = client.caps.flags;
+        offered.maxMessageSize = m_config.maxMessageSize;
+
+        QByteArray response = Protocol::createAuthResponsePacket(
+            Protocol::AuthResult::Success,
+            m_config.serverName,
+            offered
+        );
+        client.scheduler.send(response);
+
+        if (client.caps.has(Protocol::CapFragments)) {
+            client.scheduler.setFragmentSize(Protocol::DEFAULT_FRAGMENT_SIZE);
+        }
+
+        // Server sets up the datagram channel, if negotiated, from here
+        emit clientAuthenticated(client.handle, message.clientName, client.caps);
+        finishHandshake(client.handle);
+    } else {
+        QByteArray response = Protocol::createAuthResponsePacket(
+            Protocol::AuthResult::InvalidPassword
+        );
+        client.scheduler.send(response);
+        closeSocket(client.socket);
+    }
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::PongMessage& message)
+{
+    Q_UNUSED(client)
+    Q_UNUSED(message)
+    // Client responded to ping, connection is alive
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::CommandOutputMessage& message)
+{
+    if (!client.authenticated) return;
+
+    QString output;
+    if (Protocol::parseCommandOutputPacket(message.packet, output, client.caps.has(Protocol::CapCompression))) {
+        emit commandOutputReceived(client.handle, output);
+    }
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::ScreenShareRequestMessage& message)
+{
+    if (!client.authenticated) return;
+    emit screenShareRequested(client.handle, message.start);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::ScreenShareStartMessage& message)
+{
+    Q_UNUSED(message)
+    if (!client.authenticated) return;
+    emit screenShareRequested(client.handle, true);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::ScreenShareStopMessage& message)
+{
+    Q_UNUSED(message)
+    if (!client.authenticated) return;
+    emit screenShareRequested(client.handle, false);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::ScreenFrameAckMessage& message)
+{
+    if (!client.authenticated) return;
+    emit frameAcknowledged(client.handle, message.frameId);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::FragmentMessage& message)
+{
+    if (!client.authenticated) return;
+
+    Protocol::PacketView reassembled;
+    if (client.fragments.append(message.packet, reassembled)) {
+        handlePacket(client, reassembled);
+    }
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::LatencyProbeMessage& message)
+{
+    if (!client.authenticated) return;
+    client.scheduler.send(Protocol::encode(Protocol::LatencyReplyMessage{message.sentUs}));
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::LatencyReplyMessage& message)
+{
+    if (!client.authenticated) return;
+
+    qint64 sample = m_clock.nsecsElapsed() / 1000 - static_cast<qint64>(message.sentUs);
+    if (sample < 0) return; // not one of ours
+
+    client.roundTripUs = Protocol::smoothRoundTrip(client.roundTripUs, sample);
+    emit latencyMeasured(client.handle, client.roundTripUs);
+}
+
+void ServerShard::handleMessage(ClientConnection& client, const Protocol::DisconnectMessage& message)
+{
+    Q_UNUSED(message)
+    if (client.socket) {
+        closeSocket(client.socket);
+    }
+}
+
+void ServerShard::send(const ClientSet& clients, const QByteArray& packet)
+{
+    (clients & m_authenticated).forEach([this, &packet](int slot) {
+        ClientConnection& client = m_clients.at(slot);
+        if (isWritable(client)) {
+            client.scheduler.send(packet);
+        }
+    });
+}
+
+void ServerShard::sendToAll(const QByteArray& packet)
+{
+    m_authenticated.forEach([this, &packet](int slot) {
+        ClientConnection& client = m_clients.at(slot);
+        if (isWritable(client)) {
+            client.scheduler.send(packet);
+        }
+    });
+}
+
+void ServerShard::sendInputEvent(const ClientSet& clients, const Protocol::InputEvent& event)
+{
+    // Each encoding is produced at most once per event, on the stack
+    char fixedPacket[Protocol::MAX_INPUT_PACKET_SIZE];
+    char legacyPacket[Protocol::MAX_INPUT_PACKET_SIZE];
+    int fixedSize = 0;
+    int legacySize = 0;
+
+    (clients & m_authenticated).forEach([&](int slot) {
+        ClientConnection& client = m_clients.at(slot);
+        if (!isWritable(client)) return;
+
+        if (client.caps.has(Protocol::CapFixedInput)) {
+            if (!fixedSize) {
+                fixedSize = Protocol::writeInputEventPacket(fixedPacket, event, Protocol::InputWireFormat::Fixed);
+            }
+            client.scheduler.send(fixedPacket, fixedSize);
+        } else {
+            if (!legacySize) {
+                legacySize = Protocol::writeInputEventPacket(legacyPacket, event, Protocol::InputWireFormat::Legacy);
+            }
+            client.scheduler.send(legacyPacket, legacySize);
+        }
+    });
+}
+
+void ServerShard::sendClipboard(const ClientSet& clients, const QString& mimeType, const QByteArray& data)
+{
+    (clients & m_authenticated).forEach([&](int slot) {
+        sendClipboard(m_clients.at(slot), mimeType, data);
+    });
+}
+
+bool ServerShard::sendClipboard(ClientConnection& client, const QString& mimeType, const QByteArray& data)
+{
+    if (!isWritable(client)) return false;
+
+    if (data.size() > Protocol::STREAM_CHUNK_SIZE && client.caps.has(Protocol::CapStreaming)) {
+        // The buffer shares data, so each client reads the same copy
+        QSharedPointer<QBuffer> source(new QBuffer);
+        source->setData(data);
+        source->open(QIODevice::ReadOnly);
+        client.streams.start(Protocol::STREAM_KIND_CLIPBOARD, mimeType, source, data.size());
+        client.streams.pump(client.scheduler);
+        return true;
+    }
+
+    // Older clients take it whole or not at all
+    qint64 payloadSize = 4 + mimeType.size() * 2 + 4 + data.size(); // see createClipboardDataPrefix
+    if (payloadSize > client.caps.maxMessageSize) return false;
+
+    return client.scheduler.send(Protocol::createClipboardDataPacket(mimeType, data));
+}
+
+ConnectionMemory ServerShard::memoryUsage(ClientHandle handle) const
+{
+    ConnectionMemory usage;
+    const ClientConnection* client = m_clients.find(handle);
+    if (!client) return usage;
+
+    if (client->socket) {
+        usage.socketBuffers = client->socket->bytesAvailable() + client->socket->bytesToWrite();
+    }
+    usage.receiveBuffer = client->buffer.capacity();
+    usage.sendQueue = client->scheduler.queuedBytes();
+    usage.reassembly = client->fragments.memoryUsage();
+    return usage;
+}
+
+ChannelScheduler::ChannelStats ServerShard::channelStats(ClientHandle handle, Protocol::Channel channel) const
+{
+    const ClientConnection* client = m_clients.find(handle);
+    if (!client) return ChannelScheduler::ChannelStats();
+    return client->scheduler.stats(channel);
+}
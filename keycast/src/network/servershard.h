@@ -0,0 +1,244 @@
+#ifndef SERVERSHARD_H
+#define SERVERSHARD_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QTcpServer>
+#include <QSslSocket>
+#include <QSslConfiguration>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QQueue>
+
+#include "protocol.h"
+#include "messages.h"
+#include "receivebuffer.h"
+#include "channels.h"
+#include "streams.h"
+#include "clienttable.h"
+
+Q_DECLARE_METATYPE(Protocol::PeerCapabilities)
+
+// One client socket and its buffers. Owned by the shard whose thread the
+// socket lives on.
+struct ClientConnection {
+    ClientHandle handle = 0;
+    QString address;
+    QIODevice* socket = nullptr; // a QSslSocket unless a subclass says otherwise
+    bool authenticated = false;
+    bool sslEstablished = false;
+    Protocol::PeerCapabilities caps; // negotiated during Auth
+    quint32 maxMessageSize = Protocol::PRE_AUTH_MAX_MESSAGE_SIZE; // largest payload accepted
+    ReceiveBuffer buffer;
+    ChannelScheduler scheduler;  // all writes go through here
+    FragmentAssembler fragments;
+    StreamSender streams;        // large payloads, fed into the scheduler
+    qint64 roundTripUs = -1;     // smoothed, -1 until measured
+};
+
+// What a shard needs to accept and authenticate clients on its own
+struct ShardConfig {
+    QString password;
+    QString serverName;
+    quint32 localCapabilities = Protocol::SUPPORTED_CAPABILITIES;
+    quint32 maxMessageSize = Protocol::DEFAULT_MAX_MESSAGE_SIZE;
+    qsizetype frameQueueBudget = ChannelScheduler::DEFAULT_FRAME_QUEUE_LIMIT;
+    bool useSsl = false; // TLS with sslConfiguration
+    QSslConfiguration sslConfiguration;
+    // Distance from the source when this server relays another one
+    quint8 hops = 0;
+    quint32 pathLatencyUs = 0;
+    int index = 0;         // shard number, part of every handle
+    int maxHandshakes = 0; // connections between accept and Auth, 0 = unlimited
+    int maxClients = 0;    // authenticated clients over all shards, 0 = unlimited
+    // Authenticated clients over all shards, shared by them: the kernel
+    // doesn't spread connections evenly enough to split maxClients
+    QSharedPointer<QAtomicInt> clientCount;
+};
+
+// Hands accepted sockets out as descriptors, so the socket object can be
+// created on the thread that will own it
+class ConnectionListener : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit ConnectionListener(QObject* parent = nullptr) : QTcpServer(parent) {}
+
+signals:
+    void connectionAccepted(qintptr socketDescriptor);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override { emit connectionAccepted(socketDescriptor); }
+};
+
+// A group of client connections served by one I/O thread.
+//
+// The shard owns the sockets: TLS, framing, authentication, reassembly and
+// the per-client send scheduling all run on its thread. Server keeps the
+// cross-client state (screen share windows, input routing) on the main
+// thread and calls the public functions below through queued invocations;
+// packets it passes in are implicitly shared and never modified, so one
+// buffer serves every shard. Clients are named by the handles Server
+// allocates, and sets of them by their slots. Everything a shard learns is
+// reported back through its signals.
+//
+// Admission: only maxHandshakes connections at a time go through TLS and
+// Auth; later ones wait their turn in accept order, so a reconnect storm
+// costs each I/O thread a bounded amount of work at once. Past the waiting
+// queue the shard's own listener stops accepting and the kernel backlog
+// holds the rest. Clients beyond maxClients, counted over all shards, are
+// turned away with ServerFull and a retry hint.
+class ServerShard : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int PING_INTERVAL_MS = 30000;
+    // A connection still not authenticated after this is dropped
+    static constexpr int HANDSHAKE_TIMEOUT_MS = 10000;
+    static constexpr int MAX_WAITING_CONNECTIONS = 512;
+    // Sent with ServerFull; clients add jitter of their own
+    static constexpr quint32 SERVER_FULL_RETRY_MS = 10000;
+
+    explicit ServerShard(QObject* parent = nullptr);
+    ~ServerShard();
+
+    // Shard thread only
+
+    void setConfig(const ShardConfig& config);
+    void setFrameQueueBudget(qsizetype bytes);
+    void setUpstreamLatency(quint8 hops, quint32 pathLatencyUs);
+
+    // Accept on a socket of this shard's own that shares the port with the
+    // other shards (SO_REUSEPORT), so the kernel spreads connections over
+    // the I/O threads. Linux only; false elsewhere or if the bind fails.
+    virtual bool listen(quint16 port);
+    virtual void closeListener();
+#ifdef Q_OS_LINUX
+    // Something already listens on the port. Another server's SO_REUSEPORT
+    // sockets would take a share of our connections without any error.
+    static bool isPortInUse(quint16 port);
+#endif
+
+    // Takes a connection accepted elsewhere
+    void addConnection(qintptr socketDescriptor);
+    void disconnectClient(ClientHandle client);
+    // A disconnected client's slot is only reused after this: called by
+    // Server once it has dropped the slot from its sets, behind any sends
+    // that still name it
+    void releaseClient(ClientHandle client);
+    // Say goodbye to every client and close all sockets
+    void shutdown();
+
+    // Queue packet for each client in the set that is authenticated
+    void send(const ClientSet& clients, const QByteArray& packet);
+    void sendToAll(const QByteArray& packet);
+    // KeyEvent/MouseEvent/MouseMove in each client's negotiated encoding
+    void sendInputEvent(const ClientSet& clients, const Protocol::InputEvent& event);
+    void sendClipboard(const ClientSet& clients, const QString& mimeType, const QByteArray& data);
+
+    ConnectionMemory memoryUsage(ClientHandle client) const;
+    ChannelScheduler::ChannelStats channelStats(ClientHandle client, Protocol::Channel channel) const;
+
+signals:
+    void clientConnected(ClientHandle client, const QString& address);
+    void clientAuthenticated(ClientHandle client, const QString& clientName,
+                             const Protocol::PeerCapabilities& caps);
+    void clientDisconnected(ClientHandle client);
+    void commandOutputReceived(ClientHandle client, const QString& output);
+    void screenShareRequested(ClientHandle client, bool start);
+    void frameAcknowledged(ClientHandle client, quint32 frameId);
+    void latencyMeasured(ClientHandle client, qint64 roundTripUs);
+
+protected:
+    // Transport. The defaults serve each client through a QSslSocket; a
+    // backend of another kind overrides all of them and reports socket
+    // events through the on*() functions below.
+
+    // Socket for an accepted descriptor, its signals already connected for
+    // the given handle; nullptr if the connection is gone
+    virtual QIODevice* createSocket(ClientHandle client, qintptr socketDescriptor, QString& address);
+    virtual void startServerEncryption(ClientConnection& client);
+    // Send what is buffered, then close
+    virtual void closeSocket(QIODevice* socket);
+    virtual void abortSocket(QIODevice* socket);
+    // Stop or restart taking connections from this shard's own listener
+    virtual void setAccepting(bool accepting);
+
+#ifdef Q_OS_LINUX
+    // Listening socket bound with SO_REUSEPORT; -1 on failure
+    static int openSharedListenSocket(quint16 port);
+#endif
+    // Close a descriptor that never became a client
+    static void refuseConnection(qintptr socketDescriptor);
+
+    const ShardConfig& config() const { return m_config; }
+
+    // Socket events, connected per client with its handle bound
+    void onReadyRead(ClientHandle client);
+    void onBytesWritten(ClientHandle client);
+    void onDisconnected(ClientHandle client);
+    void onEncrypted(ClientHandle client);
+
+private slots:
+    void onSslErrors(const QList<QSslError>& errors);
+    void onPingTimer();
+    void onProbeTimer();
+
+private:
+    void startConnection(qintptr socketDescriptor);
+    // A connection left the handshake stage; let the next one in
+    void finishHandshake(ClientHandle client);
+    // Start waiting connections while handshake slots are free. Queued, as
+    // it allocates client slots.
+    void admitWaiting();
+    bool isWritable(const ClientConnection& client) const;
+    // Counts a client against maxClients; false if the server is full
+    bool admitClient();
+    void releaseClientCount(int clients);
+    void processClientData(ClientConnection& client);
+    void handlePacket(ClientConnection& client, const Protocol::PacketView& packet);
+    bool sendClipboard(ClientConnection& client, const QString& mimeType, const QByteArray& data);
+
+    // Messages a client may send; anything else is ignored
+    using HandledMessages = Protocol::MessageList<
+        Protocol::AuthMessage,
+        Protocol::PongMessage,
+        Protocol::CommandOutputMessage,
+        Protocol::ScreenShareRequestMessage,
+        Protocol::ScreenShareStartMessage,
+        Protocol::ScreenShareStopMessage,
+        Protocol::ScreenFrameAckMessage,
+        Protocol::FragmentMessage,
+        Protocol::LatencyProbeMessage,
+        Protocol::LatencyReplyMessage,
+        Protocol::DisconnectMessage>;
+    friend class Protocol::Dispatcher<ServerShard, HandledMessages, ClientConnection>;
+
+    void handleMessage(ClientConnection& client, const Protocol::AuthMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::PongMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::CommandOutputMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::ScreenShareRequestMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::ScreenShareStartMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::ScreenShareStopMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::ScreenFrameAckMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::FragmentMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::LatencyProbeMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::LatencyReplyMessage& message);
+    void handleMessage(ClientConnection& client, const Protocol::DisconnectMessage& message);
+
+    QTimer* m_pingTimer;
+    QTimer* m_probeTimer;
+    QElapsedTimer m_clock; // probe timestamps
+    ShardConfig m_config;
+    ClientTable<ClientConnection> m_clients;
+    ClientSet m_authenticated;
+    ClientSet m_handshaking;       // accepted, not yet authenticated
+    QQueue<qintptr> m_waiting;     // accepted, handshake not started
+    bool m_admitQueued = false;    // an admitWaiting() call is pending
+    ConnectionListener* m_listener = nullptr;
+};
+
+#endif // SERVERSHARD_H
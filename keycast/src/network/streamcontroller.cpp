@@ -0,0 +1,114 @@
+#include "streamcontroller.h"
+
+namespace {
+
+constexpr double DRAIN_HEADROOM = 0.9; // so queues empty rather than hold steady
+constexpr int QUALITY_STEP = 10;
+constexpr int SCALE_STEP = 25;
+constexpr int SCALE_HOLD_TICKS = 5; // every scale change costs a keyframe
+
+} // namespace
+
+StreamController::StreamController()
+{
+}
+
+void StreamController::setLimits(const StreamSettings& limits)
+{
+    m_limits.frameRate = qBound(MIN_FRAME_RATE, limits.frameRate, 60);
+    m_limits.quality = qBound(10, limits.quality, 100);
+    m_limits.scalePercent = qBound(MIN_SCALE_PERCENT, limits.scalePercent, 100);
+    m_settings = m_limits;
+    m_scaleHold = 0;
+}
+
+void StreamController::measureViewers(const QVector<Viewer>& viewers, Measurement& measurement) const
+{
+    // Viewers far over budget count only if all the others with frames are too
+    qint64 farOver = qint64(m_latencyBudgetMs) * FAR_OVER_BUDGET;
+    bool anyWithin = false;
+    for (const Viewer& viewer : viewers) {
+        anyWithin = anyWithin || (viewer.latencyMs >= 0 && viewer.latencyMs <= farOver);
+    }
+
+    for (const Viewer& viewer : viewers) {
+        if (anyWithin && viewer.latencyMs > farOver) continue;
+        measurement.latencyMs = qMax(measurement.latencyMs, viewer.latencyMs);
+        if (viewer.drainBytesPerSec >= 0 &&
+            (measurement.drainBytesPerSec < 0 || viewer.drainBytesPerSec < measurement.drainBytesPerSec)) {
+            measurement.drainBytesPerSec = viewer.drainBytesPerSec;
+        }
+    }
+}
+
+StreamSettings StreamController::update(const Measurement& measurement)
+{
+    if (m_scaleHold > 0) --m_scaleHold;
+
+    // No frames went out, nothing learned
+    if (measurement.latencyMs < 0) return m_settings;
+
+    bool overBudget = measurement.latencyMs > m_latencyBudgetMs;
+    bool backlogged = measurement.drainBytesPerSec >= 0;
+    bool delivered = measurement.bytesPerFrame > 0;
+    int sustainable = m_settings.frameRate;
+    bool framesTooLarge = false;
+    if (backlogged && delivered) {
+        sustainable = int(measurement.drainBytesPerSec * DRAIN_HEADROOM / measurement.bytesPerFrame);
+        framesTooLarge = measurement.bytesPerFrame * 1000 > measurement.drainBytesPerSec * m_latencyBudgetMs;
+    }
+
+    if (overBudget || framesTooLarge || sustainable < m_settings.frameRate) {
+        int frameRate = qMin(sustainable, overBudget ? m_settings.frameRate * 3 / 4 : m_settings.frameRate);
+        decrease(measurement, frameRate, framesTooLarge);
+    } else if (!backlogged && delivered && measurement.latencyMs * 2 < m_latencyBudgetMs) {
+        increase();
+    }
+    return m_settings;
+}
+
+void StreamController::decrease(const Measurement& measurement, int frameRate, bool framesTooLarge)
+{
+    // Lowered, never raised, to what the content needs
+    int floor = measurement.changeRate > MOTION_CHANGE_RATE ? MOTION_FRAME_RATE : MIN_FRAME_RATE;
+    floor = qMin(floor, m_settings.frameRate);
+    m_settings.frameRate = qMax(frameRate, floor);
+    if (!framesTooLarge && frameRate >= floor) return;
+
+    if (lowerDetail()) return;
+
+    // Nothing left to trade: only as many frames as get through
+    m_settings.frameRate = qMax(MIN_FRAME_RATE, qMin(frameRate, m_settings.frameRate));
+}
+
+bool StreamController::lowerDetail()
+{
+    int minQuality = qMin(MIN_QUALITY, m_limits.quality);
+    if (m_settings.quality > minQuality) {
+        m_settings.quality = qMax(minQuality, m_settings.quality - QUALITY_STEP);
+        return true;
+    }
+    if (m_settings.scalePercent > MIN_SCALE_PERCENT) {
+        if (m_scaleHold == 0) {
+            m_settings.scalePercent = qMax(MIN_SCALE_PERCENT, m_settings.scalePercent - SCALE_STEP);
+            m_scaleHold = SCALE_HOLD_TICKS;
+        }
+        return true;
+    }
+    return false;
+}
+
+void StreamController::increase()
+{
+    // In the reverse order of decrease(), one step a tick
+    if (m_settings.scalePercent < m_limits.scalePercent) {
+        if (m_scaleHold == 0) {
+            m_settings.scalePercent = qMin(m_limits.scalePercent, m_settings.scalePercent + SCALE_STEP);
+            m_scaleHold = SCALE_HOLD_TICKS;
+        }
+    } else if (m_settings.quality < m_limits.quality) {
+        m_settings.quality = qMin(m_limits.quality, m_settings.quality + QUALITY_STEP);
+    } else if (m_settings.frameRate < m_limits.frameRate) {
+        m_settings.frameRate = qMin(m_limits.frameRate, m_settings.frameRate + qMax(1, m_settings.frameRate / 4));
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef STREAMCONTROLLER_H
+#define STREAMCONTROLLER_H
+
+#include <QtGlobal>
+#include <QVector>
+
+// How the shared screen is captured and encoded
+struct StreamSettings {
+    int frameRate = 15;
+    int quality = 70;        // JPEG quality
+    int scalePercent = 100;  // of the capture size
+
+    bool operator==(const StreamSettings& other) const {
+        return frameRate == other.frameRate && quality == other.quality && scalePercent == other.scalePercent;
+    }
+    bool operator!=(const StreamSettings& other) const { return !(*this == other); }
+};
+
+// Picks the frame rate, quality and scale of the screen share from what
+// the viewers' connections carry, so frames reach them within a latency
+// budget. Every viewer gets the same encoded frames, so the slowest one
+// sets the pace. One far over the budget while others are within it is
+// left out instead: its frame window alone limits what it gets, rather
+// than every viewer dropping to what its link carries.
+//
+// Once a tick, frames acknowledged later than the budget, or a full window
+// draining slower than frames are sent, lower the frame rate to what the
+// drain carries. Below the rate the content needs, detail goes instead:
+// quality first, then scale. Frames larger than the budget carries lower
+// detail straight away. Well within budget, everything comes back a step
+// at a time, scale first. Busy screens keep MOTION_FRAME_RATE and lose
+// detail; mostly idle ones, text say, keep detail and lose frames.
+class StreamController
+{
+public:
+    static constexpr int MIN_FRAME_RATE = 2;
+    static constexpr int MOTION_FRAME_RATE = 10;
+    static constexpr int MIN_QUALITY = 30;
+    static constexpr int MIN_SCALE_PERCENT = 50;
+    static constexpr int DEFAULT_LATENCY_BUDGET_MS = 150;
+    // Share of capture ticks with changes above which the screen is busy
+    static constexpr double MOTION_CHANGE_RATE = 0.5;
+    // Latency, in budgets, past which a viewer no longer sets the pace
+    static constexpr int FAR_OVER_BUDGET = 4;
+
+    // What the viewers saw since the previous tick
+    struct Measurement {
+        qint64 latencyMs = -1;         // slowest pacing viewer's send-to-ack time, -1 if no frames went out
+        double drainBytesPerSec = -1;  // slowest ack rate of a pacing viewer with a full window, -1 if none was full
+        double bytesPerFrame = 0;      // mean size of the frames acknowledged, 0 if none were
+        double changeRate = 0;         // share of capture ticks on which the screen changed
+    };
+
+    // One viewer's delivery since the previous tick
+    struct Viewer {
+        qint64 latencyMs = -1;         // send-to-ack time, -1 if it had no frames
+        double drainBytesPerSec = -1;  // ack rate, -1 unless its window was full
+    };
+
+    StreamController();
+
+    int latencyBudgetMs() const { return m_latencyBudgetMs; }
+    void setLatencyBudgetMs(int msecs) { m_latencyBudgetMs = qMax(1, msecs); }
+
+    // Upper bounds, which the stream starts from again when they are set
+    StreamSettings limits() const { return m_limits; }
+    void setLimits(const StreamSettings& limits);
+
+    StreamSettings settings() const { return m_settings; }
+    // Fills in latencyMs and drainBytesPerSec from the viewers that set the pace
+    void measureViewers(const QVector<Viewer>& viewers, Measurement& measurement) const;
+    // Settings for the next tick
+    StreamSettings update(const Measurement& measurement);
+
+private:
+    void decrease(const Measurement& measurement, int frameRate, bool framesTooLarge);
+    void increase();
+    // Quality, then scale; false if both are at their minimum
+    bool lowerDetail();
+
+    StreamSettings m_limits;
+    StreamSettings m_settings;
+    int m_latencyBudgetMs = DEFAULT_LATENCY_BUDGET_MS;
+    int m_scaleHold = 0; // ticks before the scale may change again
+};
+
+#endif // STREAMCONTROLLER_H
@@ -0,0 +1,88 @@
+#include "streams.h"
+#include "channels.h"
+#include "messages.h"
+
+quint32 StreamSender::start(const QString& kind, const QString& mimeType, const QSharedPointer<QIODevice>& source,
+                            qint64 size)
+{
+    Stream stream;
+    stream.id = m_nextId++;
+    stream.kind = kind;
+    stream.mimeType = mimeType;
+    stream.source = source;
+    stream.size = qMax<qint64>(0, size);
+    m_streams.enqueue(stream);
+    return stream.id;
+}
+
+void StreamSender::pump(ChannelScheduler& scheduler)
+{
+    while (!m_streams.isEmpty() && scheduler.queuedBytes(Protocol::Channel::Bulk) < m_window) {
+        Stream& stream = m_streams.head();
+
+        if (!stream.begun) {
+            Protocol::StreamBeginMessage begin;
+            begin.streamId = stream.id;
+            begin.kind = stream.kind;
+            begin.mimeType = stream.mimeType;
+            begin.totalSize = static_cast<quint64>(stream.size);
+            scheduler.send(Protocol::encode(begin));
+            stream.begun = true;
+        }
+
+        qint64 chunkSize = qMin<qint64>(stream.size - stream.sent, Protocol::STREAM_CHUNK_SIZE);
+        if (chunkSize > 0) {
+            // Read straight into the packet, behind its header
+            QByteArray packet(Protocol::STREAM_DATA_HEADER_SIZE + chunkSize, Qt::Uninitialized);
+            qint64 bytesRead = stream.source->read(packet.data() + Protocol::STREAM_DATA_HEADER_SIZE, chunkSize);
+            if (bytesRead > 0) {
+                packet.resize(Protocol::STREAM_DATA_HEADER_SIZE + bytesRead);
+                Protocol::writeStreamDataHeader(packet.data(), stream.id, static_cast<quint32>(bytesRead));
+                scheduler.send(packet);
+                stream.sent += bytesRead;
+                continue;
+            }
+        }
+
+        // Done, or the source ended early
+        scheduler.send(Protocol::encode(Protocol::StreamEndMessage{stream.id, stream.sent == stream.size}));
+        m_streams.dequeue();
+    }
+}
+
+void StreamSender::clear()
+{
+    m_streams.clear();
+}
+
+bool StreamReceiver::begin(quint32 streamId, const QString& kind, const QString& mimeType, quint64 totalSize)
+{
+    if (m_streams.contains(streamId) || m_streams.size() >= MAX_STREAMS) return false;
+
+    Stream stream;
+    stream.kind = kind;
+    stream.mimeType = mimeType;
+    stream.totalSize = totalSize;
+    m_streams.insert(streamId, stream);
+    return true;
+}
+
+bool StreamReceiver::accept(quint32 streamId, qsizetype bytes)
+{
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end()) return false;
+    if (bytes < 0 || static_cast<quint64>(bytes) > it->totalSize - it->received) return false;
+
+    it->received += static_cast<quint64>(bytes);
+    return true;
+}
+
+bool StreamReceiver::finish(quint32 streamId, Stream& stream)
+{
+    auto it = m_streams.find(streamId);
+    if (it == m_streams.end()) return false;
+
+    stream = *it;
+    m_streams.erase(it);
+    return true;
+}
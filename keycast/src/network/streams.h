@@ -0,0 +1,86 @@
+#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QString>
+
+#include "protocol.h"
+
+class ChannelScheduler;
+
+// Outgoing streams of one connection.
+//
+// Payloads are read from their source one chunk at a time, and only while the
+// bulk channel has less than a window's worth queued, so a large payload
+// costs the sender about one window per connection no matter its size.
+// Streams are sent one after another; call pump() whenever the socket has
+// drained.
+class StreamSender
+{
+public:
+    static constexpr qsizetype DEFAULT_WINDOW = 4 * Protocol::STREAM_CHUNK_SIZE;
+
+    // Queue size bytes from source; the source must be open for reading.
+    // Returns the stream id.
+    quint32 start(const QString& kind, const QString& mimeType, const QSharedPointer<QIODevice>& source,
+                  qint64 size);
+
+    // Move chunks into the scheduler until the window is full
+    void pump(ChannelScheduler& scheduler);
+
+    bool isEmpty() const { return m_streams.isEmpty(); }
+    int count() const { return m_streams.size(); }
+    void clear();
+
+private:
+    struct Stream {
+        quint32 id = 0;
+        QString kind;
+        QString mimeType;
+        QSharedPointer<QIODevice> source;
+        qint64 size = 0;
+        qint64 sent = 0;
+        bool begun = false;
+    };
+
+    QQueue<Stream> m_streams;
+    quint32 m_nextId = 1;
+    qsizetype m_window = DEFAULT_WINDOW;
+};
+
+// Bookkeeping for incoming streams. Chunks are not stored here; the caller
+// passes each one on to its consumer as it arrives.
+class StreamReceiver
+{
+public:
+    static constexpr int MAX_STREAMS = 8;
+
+    struct Stream {
+        QString kind;
+        QString mimeType;
+        quint64 totalSize = 0;
+        quint64 received = 0;
+    };
+
+    // Returns false if the id is in use or too many streams are open
+    bool begin(quint32 streamId, const QString& kind, const QString& mimeType, quint64 totalSize);
+
+    // Account for a chunk; returns false for unknown streams and for chunks
+    // that would run past the announced size
+    bool accept(quint32 streamId, qsizetype bytes);
+
+    // Remove the stream; returns false if it was not open
+    bool finish(quint32 streamId, Stream& stream);
+
+    bool contains(quint32 streamId) const { return m_streams.contains(streamId); }
+    void clear() { m_streams.clear(); }
+
+private:
+    QHash<quint32, Stream> m_streams;
+};
+
+#endif // STREAMS_H
@@ -0,0 +1,675 @@
+#include "uringshard.h"
+
+#include <QHostAddress>
+#include <QSslCertificate>
+#include <QSslKey>
+#include <QTimer>
+
+#include <liburing.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace {
+
+constexpr int BUFFER_GROUP = 0;
+constexpr int TLS_READ_CHUNK = 16384; // one TLS record
+
+quint64 userData(quint8 operation, quint32 id)
+{
+    return (static_cast<quint64>(operation) << 56) | id;
+}
+
+quint8 operationOf(quint64 data) { return static_cast<quint8>(data >> 56); }
+quint32 idOf(quint64 data) { return static_cast<quint32>(data); }
+
+// Certificate and key as QSslSocket would use them; nullptr if OpenSSL
+// doesn't take them
+SSL_CTX* createServerContext(const QSslConfiguration& configuration)
+{
+    SSL_CTX* context = SSL_CTX_new(TLS_server_method());
+    if (!context) return nullptr;
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+
+    bool loaded = false;
+    QByteArray certificatePem = configuration.localCertificate().toPem();
+    QByteArray keyPem = configuration.privateKey().toPem();
+    BIO* certificateBio = BIO_new_mem_buf(certificatePem.constData(), certificatePem.size());
+    BIO* keyBio = BIO_new_mem_buf(keyPem.constData(), keyPem.size());
+    X509* certificate = PEM_read_bio_X509(certificateBio, nullptr, nullptr, nullptr);
+    EVP_PKEY* key = PEM_read_bio_PrivateKey(keyBio, nullptr, nullptr, nullptr);
+    if (certificate && key) {
+        loaded = SSL_CTX_use_certificate(context, certificate) == 1 &&
+                 SSL_CTX_use_PrivateKey(context, key) == 1 &&
+                 SSL_CTX_check_private_key(context) == 1;
+    }
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    BIO_free(certificateBio);
+    BIO_free(keyBio);
+
+    if (!loaded) {
+        SSL_CTX_free(context);
+        return nullptr;
+    }
+    return context;
+}
+
+} // namespace
+
+UringSocket::UringSocket(UringShard* shard, quint32 id, int fd)
+    : QIODevice(shard)
+    , m_shard(shard)
+    , m_id(id)
+    , m_fd(fd)
+{
+    // Reads and writes go straight to readData/writeData
+    open(QIODevice::ReadWrite | QIODevice::Unbuffered);
+}
+
+UringSocket::~UringSocket()
+{
+    m_shard->forget(this);
+    if (m_fd >= 0) {
+        // Ends the armed receive; its completion finds no socket
+        ::shutdown(m_fd, SHUT_RDWR);
+        ::close(m_fd);
+    }
+    SSL_free(m_ssl);
+}
+
+bool UringSocket::startServerEncryption(SSL_CTX* context)
+{
+    m_ssl = SSL_new(context);
+    if (!m_ssl) return false;
+
+    m_tlsIn = BIO_new(BIO_s_mem());
+    m_tlsOut = BIO_new(BIO_s_mem());
+    SSL_set_bio(m_ssl, m_tlsIn, m_tlsOut);
+    SSL_set_accept_state(m_ssl);
+    return true;
+}
+
+void UringSocket::disconnectFromHost()
+{
+    if (m_closing || m_finished) return;
+    m_closing = true;
+
+    if (m_ssl && m_handshakeDone) {
+        SSL_shutdown(m_ssl); // close_notify
+        drainTls();
+    }
+
+    if (m_outgoing.isEmpty() && !m_sendInFlight) {
+        // The armed receive ends and finishes the close
+        ::shutdown(m_fd, SHUT_RDWR);
+    }
+}
+
+void UringSocket::abort()
+{
+    if (m_finished) return;
+    m_closing = true;
+    m_outgoing.clear();
+    m_pendingPlaintext.clear();
+    ::shutdown(m_fd, SHUT_RDWR);
+}
+
+qint64 UringSocket::bytesAvailable() const
+{
+    return m_incoming.size() - m_incomingOffset + QIODevice::bytesAvailable();
+}
+
+qint64 UringSocket::bytesToWrite() const
+{
+    return m_pendingPlaintext.size() + m_outgoing.size() + (m_sending.size() - m_sendOffset);
+}
+
+qint64 UringSocket::readData(char* data, qint64 maxSize)
+{
+    qint64 size = qMin<qint64>(maxSize, m_incoming.size() - m_incomingOffset);
+    memcpy(data, m_incoming.constData() + m_incomingOffset, size);
+    m_incomingOffset += size;
+
+    if (m_incomingOffset == m_incoming.size()) {
+        m_incoming.clear();
+        m_incomingOffset = 0;
+    }
+    return size;
+}
+
+qint64 UringSocket::writeData(const char* data, qint64 size)
+{
+    if (m_closing || m_finished) return -1;
+
+    if (!m_ssl) {
+        queueOutgoing(data, size);
+        return size;
+    }
+
+    if (!m_handshakeDone) {
+        // Sent once encrypted, as QSslSocket does
+        m_pendingPlaintext.append(data, size);
+        return size;
+    }
+
+    // Memory BIOs never push back, so each write is taken whole
+    if (SSL_write(m_ssl, data, static_cast<int>(size)) <= 0) {
+        abort();
+        return -1;
+    }
+    drainTls();
+    return size;
+}
+
+void UringSocket::onReceived(const char* data, int size)
+{
+    if (m_closing) return;
+
+    if (!m_ssl) {
+        m_incoming.append(data, size);
+        emit readyRead();
+        return;
+    }
+
+    BIO_write(m_tlsIn, data, size);
+
+    if (!m_handshakeDone) {
+        int result = SSL_do_handshake(m_ssl);
+        drainTls();
+        if (result != 1) {
+            int error = SSL_get_error(m_ssl, result);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                abort();
+            }
+            return;
+        }
+
+        m_handshakeDone = true;
+        if (!m_pendingPlaintext.isEmpty()) {
+            QByteArray pending;
+            pending.swap(m_pendingPlaintext);
+            writeData(pending.constData(), pending.size());
+        }
+        emit encrypted();
+        if (m_closing) return;
+    }
+
+    decrypt();
+}
+
+void UringSocket::decrypt()
+{
+    qsizetype before = m_incoming.size();
+    bool peerClosed = false;
+
+    for (;;) {
+        qsizetype offset = m_incoming.size();
+        m_incoming.resize(offset + TLS_READ_CHUNK);
+        int result = SSL_read(m_ssl, m_incoming.data() + offset, TLS_READ_CHUNK);
+        m_incoming.resize(offset + qMax(result, 0));
+        if (result > 0) continue;
+
+        int error = SSL_get_error(m_ssl, result);
+        if (error == SSL_ERROR_ZERO_RETURN) {
+            peerClosed = true;
+        } else if (error != SSL_ERROR_WANT_READ) {
+            abort();
+            return;
+        }
+        break;
+    }
+
+    // Session tickets and key updates write too
+    drainTls();
+
+    if (m_incoming.size() > before) {
+        emit readyRead();
+    }
+    if (peerClosed) {
+        disconnectFromHost();
+    }
+}
+
+void UringSocket::drainTls()
+{
+    size_t pending = BIO_ctrl_pending(m_tlsOut);
+    if (!pending) return;
+
+    qsizetype offset = m_outgoing.size();
+    m_outgoing.resize(offset + static_cast<qsizetype>(pending));
+    int read = BIO_read(m_tlsOut, m_outgoing.data() + offset, static_cast<int>(pending));
+    m_outgoing.resize(offset + qMax(read, 0));
+    m_shard->queueSend(this);
+}
+
+void UringSocket::queueOutgoing(const char* data, qsizetype size)
+{
+    m_outgoing.append(data, size);
+    m_shard->queueSend(this);
+}
+
+void UringSocket::onReceiveEnded()
+{
+    m_receiving = false;
+
+    // Peer gone or the socket shut down; nothing more goes out either
+    m_closing = true;
+    m_outgoing.clear();
+    m_pendingPlaintext.clear();
+    finishIfDone();
+}
+
+void UringSocket::onSent(int result)
+{
+    m_sendInFlight = false;
+
+    if (result < 0) {
+        m_sending.clear();
+        m_sendOffset = 0;
+        abort();
+        finishIfDone();
+        return;
+    }
+
+    m_sendOffset += result;
+    if (m_sendOffset == m_sending.size()) {
+        m_sending.clear();
+        m_sendOffset = 0;
+    }
+
+    if (m_sendOffset > 0 || !m_outgoing.isEmpty()) {
+        // The rest of a short send, or what was written meanwhile
+        m_shard->queueSend(this);
+    } else if (m_closing && !m_finished) {
+        ::shutdown(m_fd, SHUT_RDWR);
+    }
+
+    emit bytesWritten(result);
+    finishIfDone();
+}
+
+void UringSocket::finishIfDone()
+{
+    if (m_finished || m_receiving || m_sendInFlight) return;
+
+    m_finished = true;
+    ::close(m_fd);
+    m_fd = -1;
+    close();
+    emit disconnected();
+}
+
+UringShard::UringShard(QObject* parent)
+    : ServerShard(parent)
+{
+}
+
+UringShard::~UringShard()
+{
+    // While the overrides still exist: ServerShard's destructor would
+    // treat the sockets as QSslSockets. The goodbyes go out before the
+    // sockets close.
+    shutdown();
+    submit();
+
+    // Sockets are children; they unregister themselves on the way out
+    const QList<UringSocket*> sockets = m_sockets.values();
+    qDeleteAll(sockets);
+
+    delete m_notifier;
+    if (m_ring) {
+        if (m_bufferRing) {
+            io_uring_free_buf_ring(m_ring, m_bufferRing, RECV_BUFFER_COUNT, BUFFER_GROUP);
+        }
+        io_uring_queue_exit(m_ring);
+        delete m_ring;
+    }
+    // Only now is nothing in flight reading them
+    m_orphanedSends.clear();
+
+    SSL_CTX_free(m_sslContext);
+}
+
+bool UringShard::isSupported()
+{
+    io_uring ring;
+    if (io_uring_queue_init(8, &ring, 0) < 0) return false;
+
+    int result = 0;
+    io_uring_buf_ring* buffers = io_uring_setup_buf_ring(&ring, 8, BUFFER_GROUP, 0, &result);
+    if (buffers) {
+        io_uring_free_buf_ring(&ring, buffers, 8, BUFFER_GROUP);
+    }
+    io_uring_queue_exit(&ring);
+    return buffers != nullptr;
+}
+
+bool UringShard::ensureRing()
+{
+    if (m_ring) return true;
+
+    m_ring = new io_uring;
+    if (io_uring_queue_init(RING_ENTRIES, m_ring, 0) < 0) {
+        delete m_ring;
+        m_ring = nullptr;
+        return false;
+    }
+
+    int result = 0;
+    m_bufferRing = io_uring_setup_buf_ring(m_ring, RECV_BUFFER_COUNT, BUFFER_GROUP, 0, &result);
+    if (!m_bufferRing) {
+        io_uring_queue_exit(m_ring);
+        delete m_ring;
+        m_ring = nullptr;
+        return false;
+    }
+
+    m_bufferArena.resize(RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+    for (unsigned i = 0; i < RECV_BUFFER_COUNT; ++i) {
+        io_uring_buf_ring_add(m_bufferRing, m_bufferArena.data() + i * RECV_BUFFER_SIZE, RECV_BUFFER_SIZE,
+                              i, io_uring_buf_ring_mask(RECV_BUFFER_COUNT), i);
+    }
+    io_uring_buf_ring_advance(m_bufferRing, RECV_BUFFER_COUNT);
+
+    // The ring's descriptor polls readable while completions are waiting
+    m_notifier = new QSocketNotifier(m_ring->ring_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &UringShard::onCompletions);
+    return true;
+}
+
+io_uring_sqe* UringShard::nextSqe()
+{
+    io_uring_sqe* sqe = io_uring_get_sqe(m_ring);
+    if (!sqe) {
+        // Submission queue full: hand the batch over early
+        io_uring_submit(m_ring);
+        sqe = io_uring_get_sqe(m_ring);
+    }
+    return sqe;
+}
+
+bool UringShard::listen(quint16 port)
+{
+    closeListener();
+    if (!ensureRing()) return false;
+
+    m_listenFd = openSharedListenSocket(port);
+    if (m_listenFd < 0) return false;
+
+    m_accepting = true;
+    armAccept();
+    submit();
+    return true;
+}
+
+void UringShard::closeListener()
+{
+    if (m_listenFd < 0) return;
+
+    if (m_acceptArmed) {
+        if (io_uring_sqe* sqe = nextSqe()) {
+            io_uring_prep_cancel64(sqe, userData(OpAccept, 0), 0);
+            io_uring_sqe_set_data64(sqe, userData(OpCancel, 0));
+        }
+        io_uring_submit(m_ring);
+    }
+
+    // Stops listening right away, so another socket can take the port
+    ::shutdown(m_listenFd, SHUT_RDWR);
+    ::close(m_listenFd);
+    m_listenFd = -1;
+}
+
+void UringShard::setAccepting(bool accepting)
+{
+    m_accepting = accepting;
+    if (m_listenFd < 0) return;
+
+    if (accepting && !m_acceptArmed) {
+        armAccept();
+        scheduleSubmit();
+    } else if (!accepting && m_acceptArmed) {
+        if (io_uring_sqe* sqe = nextSqe()) {
+            io_uring_prep_cancel64(sqe, userData(OpAccept, 0), 0);
+            io_uring_sqe_set_data64(sqe, userData(OpCancel, 0));
+            scheduleSubmit();
+        }
+    }
+}
+
+void UringShard::armAccept()
+{
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) return;
+
+    io_uring_prep_multishot_accept(sqe, m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    io_uring_sqe_set_data64(sqe, userData(OpAccept, 0));
+    m_acceptArmed = true;
+}
+
+QIODevice* UringShard::createSocket(ClientHandle handle, qintptr socketDescriptor, QString& address)
+{
+    int fd = static_cast<int>(socketDescriptor);
+    sockaddr_storage peer = {};
+    socklen_t peerSize = sizeof(peer);
+    if (!ensureRing() || ::getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &peerSize) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    address = QHostAddress(reinterpret_cast<sockaddr*>(&peer)).toString();
+
+    // Ids tell completions for a deleted socket from those of a new one
+    if (++m_nextId == 0) ++m_nextId;
+    UringSocket* socket = new UringSocket(this, m_nextId, fd);
+    m_sockets.insert(m_nextId, socket);
+
+    connect(socket, &UringSocket::readyRead, this, [this, handle]() { onReadyRead(handle); });
+    connect(socket, &UringSocket::bytesWritten, this, [this, handle]() { onBytesWritten(handle); });
+    connect(socket, &UringSocket::disconnected, this, [this, handle]() { onDisconnected(handle); });
+    connect(socket, &UringSocket::encrypted, this, [this, handle]() { onEncrypted(handle); });
+
+    armReceive(socket);
+    scheduleSubmit();
+    return socket;
+}
+
+void UringShard::startServerEncryption(ClientConnection& client)
+{
+    if (!m_sslContext) {
+        m_sslContext = createServerContext(config().sslConfiguration);
+    }
+
+    UringSocket* socket = static_cast<UringSocket*>(client.socket);
+    if (!m_sslContext || !socket->startServerEncryption(m_sslContext)) {
+        socket->abort();
+    }
+}
+
+void UringShard::closeSocket(QIODevice* socket)
+{
+    static_cast<UringSocket*>(socket)->disconnectFromHost();
+}
+
+void UringShard::abortSocket(QIODevice* socket)
+{
+    static_cast<UringSocket*>(socket)->abort();
+}
+
+void UringShard::armReceive(UringSocket* socket)
+{
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) {
+        socket->abort();
+        return;
+    }
+
+    // The kernel picks a buffer from the group when data arrives
+    if (m_multishotReceive) {
+        io_uring_prep_recv_multishot(sqe, socket->m_fd, nullptr, 0, 0);
+    } else {
+        io_uring_prep_recv(sqe, socket->m_fd, nullptr, RECV_BUFFER_SIZE, 0);
+    }
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    io_uring_sqe_set_data64(sqe, userData(OpReceive, socket->m_id));
+    socket->m_receiving = true;
+}
+
+void UringShard::queueSend(UringSocket* socket)
+{
+    if (socket->m_sendQueued) return;
+
+    socket->m_sendQueued = true;
+    m_sendQueue.append(socket->m_id);
+    scheduleSubmit();
+}
+
+void UringShard::startSend(UringSocket* socket)
+{
+    if (socket->m_sendInFlight || socket->m_finished) return;
+
+    if (socket->m_sending.isEmpty()) {
+        if (socket->m_outgoing.isEmpty()) return;
+        socket->m_sending.swap(socket->m_outgoing);
+        socket->m_sendOffset = 0;
+    }
+
+    io_uring_sqe* sqe = nextSqe();
+    if (!sqe) {
+        // Try again with the next batch
+        queueSend(socket);
+        return;
+    }
+
+    io_uring_prep_send(sqe, socket->m_fd, socket->m_sending.constData() + socket->m_sendOffset,
+                       static_cast<size_t>(socket->m_sending.size() - socket->m_sendOffset), MSG_NOSIGNAL);
+    io_uring_sqe_set_data64(sqe, userData(OpSend, socket->m_id));
+    socket->m_sendInFlight = true;
+}
+
+void UringShard::scheduleSubmit()
+{
+    if (m_submitScheduled) return;
+
+    // After the event being handled, so all of its sends share one syscall
+    m_submitScheduled = true;
+    QMetaObject::invokeMethod(this, [this]() { submit(); }, Qt::QueuedConnection);
+}
+
+void UringShard::submit()
+{
+    m_submitScheduled = false;
+    if (!m_ring) return;
+
+    QVector<quint32> queue;
+    queue.swap(m_sendQueue);
+    for (quint32 id : queue) {
+        UringSocket* socket = m_sockets.value(id);
+        if (!socket) continue;
+        socket->m_sendQueued = false;
+        startSend(socket);
+    }
+
+    if (io_uring_sq_ready(m_ring) > 0) {
+        io_uring_submit(m_ring);
+    }
+}
+
+void UringShard::forget(UringSocket* socket)
+{
+    m_sockets.remove(socket->m_id);
+    if (socket->m_sendInFlight) {
+        m_orphanedSends.insert(socket->m_id, socket->m_sending);
+    }
+}
+
+void UringShard::recycleBuffer(int bufferId)
+{
+    io_uring_buf_ring_add(m_bufferRing, m_bufferArena.data() + bufferId * RECV_BUFFER_SIZE, RECV_BUFFER_SIZE,
+                          bufferId, io_uring_buf_ring_mask(RECV_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(m_bufferRing, 1);
+}
+
+void UringShard::onCompletions()
+{
+    io_uring_cqe* cqes[COMPLETION_BATCH];
+    for (;;) {
+        unsigned count = io_uring_peek_batch_cqe(m_ring, cqes, COMPLETION_BATCH);
+        if (count == 0) break;
+
+        for (unsigned i = 0; i < count; ++i) {
+            handleCompletion(cqes[i]);
+        }
+        io_uring_cq_advance(m_ring, count);
+    }
+
+    // Re-armed receives and the sends the completions caused
+    submit();
+}
+
+void UringShard::handleCompletion(const io_uring_cqe* cqe)
+{
+    quint64 data = io_uring_cqe_get_data64(cqe);
+    quint32 id = idOf(data);
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+
+    switch (operationOf(data)) {
+    case OpAccept:
+        if (cqe->res >= 0) {
+            addConnection(cqe->res);
+        }
+        if (!more) {
+            m_acceptArmed = false;
+            if (m_accepting && m_listenFd >= 0) {
+                if (cqe->res < 0 && cqe->res != -ECANCELED) {
+                    QTimer::singleShot(ACCEPT_RETRY_MS, this, [this]() { setAccepting(m_accepting); });
+                } else {
+                    armAccept();
+                }
+            }
+        }
+        break;
+
+    case OpReceive: {
+        UringSocket* socket = m_sockets.value(id);
+        bool hasBuffer = cqe->flags & IORING_CQE_F_BUFFER;
+        int bufferId = static_cast<int>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if (socket && cqe->res > 0 && hasBuffer) {
+            socket->onReceived(m_bufferArena.constData() + bufferId * RECV_BUFFER_SIZE, cqe->res);
+        }
+        if (hasBuffer) {
+            recycleBuffer(bufferId);
+        }
+
+        if (!more && socket) {
+            if (cqe->res == -EINVAL && m_multishotReceive) {
+                // Kernel without multishot receive: one receive at a time
+                m_multishotReceive = false;
+                armReceive(socket);
+            } else if ((cqe->res > 0 || cqe->res == -ENOBUFS) && !socket->m_finished) {
+                // Buffers are back in the ring by now
+                armReceive(socket);
+            } else {
+                socket->onReceiveEnded();
+            }
+        }
+        break;
+    }
+
+    case OpSend:
+        if (UringSocket* socket = m_sockets.value(id)) {
+            socket->onSent(cqe->res);
+        } else {
+            m_orphanedSends.remove(id);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
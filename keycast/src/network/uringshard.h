@@ -0,0 +1,172 @@
+#ifndef URINGSHARD_H
+#define URINGSHARD_H
+
+#include "servershard.h"
+
+#include <QHash>
+#include <QVector>
+#include <QSocketNotifier>
+
+struct io_uring;
+struct io_uring_cqe;
+struct io_uring_sqe;
+struct io_uring_buf_ring;
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct bio_st BIO;
+
+class UringShard;
+
+// One client connection of a UringShard. The device side is plaintext;
+// the shard moves bytes between the kernel and this object. With TLS,
+// OpenSSL works on memory BIOs in between, so it never touches the socket.
+class UringSocket : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    UringSocket(UringShard* shard, quint32 id, int fd);
+    ~UringSocket() override;
+
+    bool startServerEncryption(SSL_CTX* context);
+
+    // Close once everything written so far has been sent
+    void disconnectFromHost();
+    // Close now, dropping unsent data
+    void abort();
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    qint64 bytesToWrite() const override;
+
+signals:
+    void encrypted();
+    void disconnected();
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 size) override;
+
+private:
+    friend class UringShard;
+
+    // Completions, delivered by the shard
+    void onReceived(const char* data, int size);
+    void onReceiveEnded();
+    void onSent(int result);
+
+    void decrypt();
+    // Move ciphertext OpenSSL produced into the outgoing buffer
+    void drainTls();
+    void queueOutgoing(const char* data, qsizetype size);
+    void finishIfDone();
+
+    UringShard* m_shard;
+    quint32 m_id;
+    int m_fd;
+
+    SSL* m_ssl = nullptr;
+    BIO* m_tlsIn = nullptr;  // ciphertext from the peer, owned by m_ssl
+    BIO* m_tlsOut = nullptr; // ciphertext for the peer, owned by m_ssl
+    bool m_handshakeDone = false;
+    QByteArray m_pendingPlaintext; // written before the handshake finished
+
+    QByteArray m_incoming; // plaintext not read yet
+    qsizetype m_incomingOffset = 0;
+    QByteArray m_outgoing; // not handed to the kernel yet
+    QByteArray m_sending;  // the send in flight; stays put until it completes
+    qsizetype m_sendOffset = 0;
+    bool m_sendInFlight = false;
+    bool m_sendQueued = false; // in the shard's list for the next submission
+    bool m_receiving = false;  // a receive is armed
+    bool m_closing = false;
+    bool m_finished = false;
+};
+
+// ServerShard on io_uring, Linux only. Instead of a notifier and a set of
+// signals per QSslSocket, one ring per I/O thread carries every accept,
+// receive and send, and one notifier on the ring wakes the thread when
+// completions are waiting. Receives are multishot and take their memory
+// from a ring of provided buffers registered with the kernel, so idle
+// clients hold no receive buffer at all. Sends queued while handling one
+// event (a broadcast to every client, say) go to the kernel in a single
+// submission at the end of it.
+//
+// Authentication, scheduling and everything above the transport is
+// ServerShard's; Server picks this class per the network backend setting.
+// keycast_loadbench compares the two backends under a connection storm.
+class UringShard : public ServerShard
+{
+    Q_OBJECT
+
+public:
+    static constexpr unsigned RING_ENTRIES = 4096;
+    static constexpr unsigned RECV_BUFFER_COUNT = 512; // power of two
+    static constexpr unsigned RECV_BUFFER_SIZE = 8192;
+    static constexpr int COMPLETION_BATCH = 256;
+    static constexpr int ACCEPT_RETRY_MS = 100; // after an accept error, e.g. out of descriptors
+
+    explicit UringShard(QObject* parent = nullptr);
+    ~UringShard() override;
+
+    // Whether the kernel allows rings and provided buffer rings (5.19+)
+    static bool isSupported();
+
+    bool listen(quint16 port) override;
+    void closeListener() override;
+
+protected:
+    QIODevice* createSocket(ClientHandle client, qintptr socketDescriptor, QString& address) override;
+    void startServerEncryption(ClientConnection& client) override;
+    void closeSocket(QIODevice* socket) override;
+    void abortSocket(QIODevice* socket) override;
+    void setAccepting(bool accepting) override;
+
+private slots:
+    void onCompletions();
+
+private:
+    friend class UringSocket;
+
+    enum Operation : quint8 {
+        OpAccept = 1,
+        OpReceive,
+        OpSend,
+        OpCancel,
+    };
+
+    bool ensureRing();
+    io_uring_sqe* nextSqe();
+    void handleCompletion(const io_uring_cqe* cqe);
+    void recycleBuffer(int bufferId);
+
+    void armAccept();
+    void armReceive(UringSocket* socket);
+    void startSend(UringSocket* socket);
+    // Sends go out with the next submission
+    void queueSend(UringSocket* socket);
+    void scheduleSubmit();
+    void submit();
+    // A socket is being deleted, possibly with operations in flight
+    void forget(UringSocket* socket);
+
+    io_uring* m_ring = nullptr;
+    io_uring_buf_ring* m_bufferRing = nullptr;
+    QByteArray m_bufferArena; // RECV_BUFFER_COUNT buffers of RECV_BUFFER_SIZE
+    QSocketNotifier* m_notifier = nullptr;
+    bool m_multishotReceive = true; // cleared on kernels without it (before 6.0)
+
+    SSL_CTX* m_sslContext = nullptr;
+
+    QHash<quint32, UringSocket*> m_sockets;
+    quint32 m_nextId = 0;
+    QVector<quint32> m_sendQueue;               // sockets with data for the next submission
+    QHash<quint32, QByteArray> m_orphanedSends; // in flight for sockets already deleted
+    bool m_submitScheduled = false;
+
+    int m_listenFd = -1;
+    bool m_acceptArmed = false;
+    bool m_accepting = true;
+};
+
+#endif // URINGSHARD_H
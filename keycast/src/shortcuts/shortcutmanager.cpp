@@ -116,7 +116,12 @@ void ShortcutManager::executeShortcut(int id)
     const RegisteredShortcut& shortcut = m_shortcuts[id];
     emit shortcutTriggered(id, shortcut.action.name);
 
-    executeCommand(shortcut.action.command, shortcut.action.actionType);
+    const QString& target = shortcut.action.targetClients;
+    if (target.isEmpty() || target == "local") {
+        executeCommand(shortcut.action.command, shortcut.action.actionType);
+    } else {
+        emit remoteCommandRequested(target, shortcut.action.command, shortcut.action.actionType);
+    }
 }
 
 QPair<int, int> ShortcutManager::parseKeySequence(const QString& seq)
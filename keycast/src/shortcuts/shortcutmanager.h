@@ -35,6 +35,8 @@ signals:
     void shortcutTriggered(int id, const QString& name);
     void commandExecuted(const QString& command, const QString& output);
     void commandError(const QString& command, const QString& error);
+    // A shortcut aimed at connected clients rather than this machine
+    void remoteCommandRequested(const QString& target, const QString& command, const QString& type);
 
 private:
 #ifdef Q_OS_WIN
@@ -44,6 +44,11 @@ MainWindow::MainWindow(QWidget* parent)
     });
     connect(keycastApp, &Application::broadcastStateChanged, this, &MainWindow::updateBroadcastStatus);
     connect(keycastApp, &Application::serverDiscovered, this, &MainWindow::addDiscoveredServer);
+
+    connect(keycastApp->server(), &Server::clientAuthenticated, this, &MainWindow::addConnectedClient);
+    connect(keycastApp->server(), &Server::clientDisconnected, this, &MainWindow::removeConnectedClient);
+    connect(keycastApp->server(), &Server::clientLatencyChanged, this, &MainWindow::updateClientLatency);
+    connect(keycastApp->client(), &Client::latencyChanged, this, &MainWindow::onUpstreamLatencyChanged);
 }
 
 MainWindow::~MainWindow()
@@ -236,6 +241,16 @@ void MainWindow::setupTerminalTab()
     m_targetClientCombo = new QComboBox();
     m_targetClientCombo->addItem("All Clients", "all");
     m_targetClientCombo->addItem("Local", "local");
+    QStringList groups;
+    const QHash<QString, QStringList> clientTags = Settings::instance()->clientTags();
+    for (const QStringList& tags : clientTags) {
+        groups += tags;
+    }
+    groups.removeDuplicates();
+    groups.sort();
+    for (const QString& group : groups) {
+        m_targetClientCombo->addItem("Group: " + group, "@" + group);
+    }
     targetLayout->addWidget(m_targetClientCombo);
     targetLayout->addStretch();
 
@@ -374,6 +389,18 @@ void MainWindow::updateClientStatus(bool connected)
     }
 }
 
+void MainWindow::onUpstreamLatencyChanged()
+{
+    Client* client = keycastApp->client();
+    if (!client->isConnected()) return;
+
+    // Latency from the source, over every relay in between
+    m_clientStatusLabel->setText(QString("Connected to server (%1 %2, %3 ms)")
+        .arg(client->hops())
+        .arg(client->hops() == 1 ? "hop" : "hops")
+        .arg(client->pathLatencyUs() / 1000.0, 0, 'f', 1));
+}
+
 void MainWindow::updateBroadcastStatus(bool active)
 {
     if (active) {
@@ -411,12 +438,26 @@ void MainWindow::addConnectedClient(const QString& clientId, const QString& clie
 {
     QListWidgetItem* item = new QListWidgetItem(QString("%1 (%2)").arg(clientName, clientId));
     item->setData(Qt::UserRole, clientId);
+    item->setData(Qt::UserRole + 1, clientName);
     m_connectedClientsList->addItem(item);
 
     // Update target combo
     m_targetClientCombo->addItem(clientName, clientId);
 }
 
+void MainWindow::updateClientLatency(const QString& clientId, qint64 roundTripUs)
+{
+    for (int i = 0; i < m_connectedClientsList->count(); ++i) {
+        QListWidgetItem* item = m_connectedClientsList->item(i);
+        if (item->data(Qt::UserRole).toString() == clientId) {
+            item->setText(QString("%1 (%2) - %3 ms")
+                .arg(item->data(Qt::UserRole + 1).toString(), clientId)
+                .arg(roundTripUs / 2000.0, 0, 'f', 1));
+            break;
+        }
+    }
+}
+
 void MainWindow::removeConnectedClient(const QString& clientId)
 {
     for (int i = 0; i < m_connectedClientsList->count(); ++i) {
@@ -561,10 +602,8 @@ void MainWindow::onSendTerminalCommand()
 
     if (target == "local") {
         keycastApp->shortcutManager()->executeCommand(command, "terminal");
-    } else if (target == "all") {
-        keycastApp->server()->broadcastCommand(command, "terminal");
     } else {
-        keycastApp->server()->sendCommandToClient(target, command, "terminal");
+        keycastApp->server()->sendCommand(target, command, "terminal");
     }
 }
 
@@ -30,6 +30,7 @@ public slots:
     void addDiscoveredServer(const QString& name, const QString& address, int port);
     void addConnectedClient(const QString& clientId, const QString& clientName);
     void removeConnectedClient(const QString& clientId);
+    void updateClientLatency(const QString& clientId, qint64 roundTripUs);
     void appendTerminalOutput(const QString& text);
 
 protected:
@@ -50,6 +51,7 @@ private slots:
     void onServerSelectionChanged();
     void onOpenRemoteDesktopClicked();
     void onToggleScreenShareClicked();
+    void onUpstreamLatencyChanged();
 
 private:
     void setupUi();
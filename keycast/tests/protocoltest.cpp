@@ -0,0 +1,84 @@
+// keycast_protocoltest: wire codec round trips, run by ctest.
+
+#include <QtTest>
+
+#include <limits>
+
+#include "protocol.h"
+
+namespace {
+
+Protocol::InputEvent mouseEvent(Protocol::InputEventKind kind, qint32 x, qint32 y)
+{
+    Protocol::InputEvent event;
+    event.kind = kind;
+    event.x = x;
+    event.y = y;
+    return event;
+}
+
+// Coordinates whose deltas overflow qint32 both ways
+QVector<Protocol::InputEvent> extremeEvents()
+{
+    constexpr qint32 MIN = std::numeric_limits<qint32>::min();
+    constexpr qint32 MAX = std::numeric_limits<qint32>::max();
+    QVector<Protocol::InputEvent> events = {
+        mouseEvent(Protocol::InputEventKind::MouseMove, MIN, MAX),
+        mouseEvent(Protocol::InputEventKind::MouseMove, MAX, MIN),
+        mouseEvent(Protocol::InputEventKind::MouseMove, MIN, MIN),
+        mouseEvent(Protocol::InputEventKind::MouseMove, 0, 0),
+        mouseEvent(Protocol::InputEventKind::MouseButton, MAX, MAX),
+        mouseEvent(Protocol::InputEventKind::MouseMove, -1, 1),
+    };
+    events[4].code = 1;
+    events[4].pressed = true;
+    return events;
+}
+
+void compareEvents(const QVector<Protocol::InputEvent>& actual, const QVector<Protocol::InputEvent>& expected)
+{
+    QCOMPARE(actual.size(), expected.size());
+    for (int i = 0; i < expected.size(); ++i) {
+        QCOMPARE(int(actual[i].kind), int(expected[i].kind));
+        QCOMPARE(actual[i].x, expected[i].x);
+        QCOMPARE(actual[i].y, expected[i].y);
+        QCOMPARE(actual[i].code, expected[i].code);
+        QCOMPARE(actual[i].pressed, expected[i].pressed);
+    }
+}
+
+} // namespace
+
+class ProtocolTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void inputBatchExtremeCoordinates()
+    {
+        const QVector<Protocol::InputEvent> events = extremeEvents();
+        QByteArray packet = Protocol::createInputBatchPacket(events);
+
+        Protocol::PacketView view;
+        QVERIFY(Protocol::nextPacket(packet.constData(), packet.size(), view) == Protocol::FrameStatus::Complete);
+        QVector<Protocol::InputEvent> parsed;
+        QVERIFY(Protocol::parseInputBatchPacket(view, parsed));
+        compareEvents(parsed, events);
+    }
+
+    void inputDatagramExtremeCoordinates()
+    {
+        const QVector<Protocol::InputEvent> events = extremeEvents();
+        char datagram[Protocol::MAX_INPUT_DATAGRAM_SIZE];
+        int size = Protocol::writeInputDatagram(datagram, 7, events.constData(), events.size());
+
+        quint32 firstSequence = 0;
+        QVector<Protocol::InputEvent> parsed;
+        QVERIFY(Protocol::parseInputDatagram(QByteArray(datagram, size), firstSequence, parsed));
+        QCOMPARE(firstSequence, 7u);
+        compareEvents(parsed, events);
+    }
+};
+
+QTEST_APPLESS_MAIN(ProtocolTest)
+#include "protocoltest.moc"
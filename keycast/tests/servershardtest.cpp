@@ -0,0 +1,126 @@
+// keycast_servershardtest: ServerShard admission over loopback, run by ctest.
+
+#include <QtTest>
+#include <QTcpSocket>
+
+#include <memory>
+#include <vector>
+
+#include "servershard.h"
+
+namespace {
+
+constexpr int TIMEOUT_MS = 5000;
+
+// A client on a plain TCP connection, reading whole packets
+class TestClient
+{
+public:
+    explicit TestClient(quint16 port) { m_socket.connectToHost(QHostAddress::LocalHost, port); }
+
+    void send(const QByteArray& data) { m_socket.write(data); }
+
+    // Waits until a packet of the type arrived, keeping any before it
+    bool waitForPacket(Protocol::MessageType type)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (!m_received.contains(type)) {
+            if (timer.elapsed() > TIMEOUT_MS) return false;
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+            m_buffer += m_socket.readAll();
+
+            Protocol::PacketView packet;
+            while (Protocol::nextPacket(m_buffer.constData(), m_buffer.size(), packet) ==
+                   Protocol::FrameStatus::Complete) {
+                m_received.append(packet.header.type);
+                m_buffer.remove(0, Protocol::PACKET_HEADER_SIZE + packet.payloadSize);
+            }
+        }
+        return true;
+    }
+
+private:
+    QTcpSocket m_socket;
+    QByteArray m_buffer;
+    QVector<Protocol::MessageType> m_received;
+};
+
+QByteArray authPacket(const QString& name)
+{
+    return Protocol::createAuthPacket(QString(), name);
+}
+
+} // namespace
+
+class ServerShardTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void admitWaitingOnAuthWithFullTable_data()
+    {
+        // Clients already in the table, so the waiter's slot has to grow it
+        // at different points of its capacity
+        QTest::addColumn<int>("filled");
+        for (int filled = 0; filled <= 8; ++filled) {
+            QTest::addRow("%d filled", filled) << filled;
+        }
+    }
+
+    // The Auth that finishes one handshake lets a waiting connection in;
+    // the packets after it, in the same read, must still be handled
+    void admitWaitingOnAuthWithFullTable()
+    {
+        QFETCH(int, filled);
+
+        ServerShard shard;
+        ShardConfig config;
+        config.maxHandshakes = 1;
+        shard.setConfig(config);
+
+        int connected = 0;
+        int authenticated = 0;
+        QObject::connect(&shard, &ServerShard::clientConnected, [&connected]() { ++connected; });
+        QObject::connect(&shard, &ServerShard::clientAuthenticated, [&authenticated]() { ++authenticated; });
+
+        ConnectionListener listener;
+        int accepted = 0;
+        QObject::connect(&listener, &ConnectionListener::connectionAccepted, &shard, [&](qintptr descriptor) {
+            ++accepted;
+            shard.addConnection(descriptor);
+        });
+        QVERIFY(listener.listen(QHostAddress::LocalHost, 0));
+        quint16 port = listener.serverPort();
+
+        // Every slot in use, none free
+        std::vector<std::unique_ptr<TestClient>> clients;
+        for (int i = 0; i < filled; ++i) {
+            clients.push_back(std::make_unique<TestClient>(port));
+            TestClient* client = clients.back().get();
+            client->send(authPacket(QString("filled %1").arg(i)));
+            QVERIFY(client->waitForPacket(Protocol::MessageType::AuthResponse));
+        }
+
+        // One in the handshake, one waiting behind it
+        TestClient first(port);
+        QTRY_COMPARE_WITH_TIMEOUT(connected, filled + 1, TIMEOUT_MS);
+        TestClient waiting(port);
+        QTRY_COMPARE_WITH_TIMEOUT(accepted, filled + 2, TIMEOUT_MS);
+        QCOMPARE(connected, filled + 1);
+
+        Protocol::LatencyProbeMessage probe;
+        probe.sentUs = 1;
+        first.send(authPacket("first") + Protocol::encode(probe));
+        QVERIFY(first.waitForPacket(Protocol::MessageType::AuthResponse));
+        QVERIFY(first.waitForPacket(Protocol::MessageType::LatencyReply));
+
+        QTRY_COMPARE_WITH_TIMEOUT(connected, filled + 2, TIMEOUT_MS);
+        waiting.send(authPacket("waiting"));
+        QVERIFY(waiting.waitForPacket(Protocol::MessageType::AuthResponse));
+        QCOMPARE(authenticated, filled + 2);
+    }
+};
+
+QTEST_MAIN(ServerShardTest)
+#include "servershardtest.moc"